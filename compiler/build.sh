@@ -9,4 +9,4 @@ echo "Building $asm"
 
 set -xue
 
-$cc $files -o ../build/$asm -Isrc -g -Wall -Wextra -Werror -Wno-missing-braces -Wno-sizeof-array-div -Wno-sizeof-pointer-div -pedantic -std=c11
+$cc $files -o ../build/$asm -Isrc -g -Wall -Wextra -Werror -Wno-missing-braces -Wno-sizeof-array-div -Wno-sizeof-pointer-div -pedantic -std=c11 -pthread
@@ -18,66 +18,354 @@ void *ast_dup(const void *src, size_t size) {
     return ptr;
 }
 
-Typespec *typespec_new(TypespecKind kind) {
-    Typespec *t = ast_alloc(sizeof(Typespec));
+// Copies size bytes of src to *cursor and advances it, for laying child
+// arrays out in the trailing space of a node allocated with room for them.
+void *ast_place(char **cursor, const void *src, size_t size) {
+    if (size == 0) {
+        return NULL;
+    }
+    void *ptr = *cursor;
+    memcpy(ptr, src, size);
+    *cursor += ALIGN_UP(size, ARENA_ALIGNMENT);
+    return ptr;
+}
+
+#define NODE_SIZE(type, field) (offsetof(type, field) + sizeof(((type *)0)->field))
+#define BLOCK_SIZE(block) ALIGN_UP((block).num_stmts * sizeof(Stmt *), ARENA_ALIGNMENT)
+
+size_t typespec_size(TypespecKind kind) {
+    switch (kind) {
+    case TYPESPEC_IDENT:
+        return NODE_SIZE(Typespec, name);
+    case TYPESPEC_FN:
+        return NODE_SIZE(Typespec, fn);
+    case TYPESPEC_ARRAY:
+        return NODE_SIZE(Typespec, array);
+    case TYPESPEC_PTR:
+        return NODE_SIZE(Typespec, ptr);
+    default:
+        return offsetof(Typespec, name);
+    }
+}
+
+size_t decl_size(DeclKind kind) {
+    switch (kind) {
+    case DECL_ENUM:
+        return NODE_SIZE(Decl, enum_decl);
+    case DECL_STRUCT:
+    case DECL_UNION:
+        return NODE_SIZE(Decl, aggregate);
+    case DECL_LET:
+        return NODE_SIZE(Decl, let);
+    case DECL_CONST:
+        return NODE_SIZE(Decl, const_decl);
+    case DECL_TYPEDEF:
+        return NODE_SIZE(Decl, typedef_decl);
+    case DECL_FN:
+        return NODE_SIZE(Decl, fn);
+    default:
+        return offsetof(Decl, enum_decl);
+    }
+}
+
+size_t expr_size(ExprKind kind) {
+    switch (kind) {
+    case EXPR_INT:
+        return NODE_SIZE(Expr, int_mod);
+    case EXPR_FLOAT:
+        return NODE_SIZE(Expr, float_val);
+    case EXPR_STR:
+        return NODE_SIZE(Expr, str_val);
+    case EXPR_IDENT:
+        return NODE_SIZE(Expr, sym);
+    case EXPR_CAST:
+        return NODE_SIZE(Expr, cast);
+    case EXPR_CALL:
+        return NODE_SIZE(Expr, call);
+    case EXPR_INDEX:
+        return NODE_SIZE(Expr, index);
+    case EXPR_FIELD:
+        return NODE_SIZE(Expr, field);
+    case EXPR_COMPOUND:
+        return NODE_SIZE(Expr, compound);
+    case EXPR_UNARY:
+        return NODE_SIZE(Expr, unary);
+    case EXPR_BINARY:
+        return NODE_SIZE(Expr, binary);
+    case EXPR_TERNARY:
+        return NODE_SIZE(Expr, ternary);
+    default:
+        return offsetof(Expr, int_val);
+    }
+}
+
+size_t stmt_size(StmtKind kind) {
+    switch (kind) {
+    case STMT_RETURN:
+        return NODE_SIZE(Stmt, return_stmt);
+    case STMT_BLOCK:
+        return NODE_SIZE(Stmt, block);
+    case STMT_IF:
+        return NODE_SIZE(Stmt, if_stmt);
+    case STMT_WHILE:
+    case STMT_DO_WHILE:
+        return NODE_SIZE(Stmt, while_stmt);
+    case STMT_FOR:
+        return NODE_SIZE(Stmt, for_stmt);
+    case STMT_SWITCH:
+        return NODE_SIZE(Stmt, switch_stmt);
+    case STMT_ASSIGN:
+        return NODE_SIZE(Stmt, assign);
+    case STMT_INIT:
+        return NODE_SIZE(Stmt, init);
+    case STMT_EXPR:
+        return NODE_SIZE(Stmt, expr);
+    default:
+        return offsetof(Stmt, expr);
+    }
+}
+
+Typespec *typespec_alloc(TypespecKind kind, size_t extra) {
+    Typespec *t = ast_alloc(typespec_size(kind) + extra);
     t->kind = kind;
     return t;
 }
 
-Typespec *typespec_ident(const char *name) {
-    Typespec *t = typespec_new(TYPESPEC_IDENT);
-    t->name = name;
+Typespec *typespec_new(TypespecKind kind) {
+    return typespec_alloc(kind, 0);
+}
+
+/*
+ * Typespecs are hash-consed: the builders return the one canonical node for
+ * each structure, so equal types compare equal by pointer. Children are
+ * canonical by construction, which keeps hashing and comparison shallow.
+ * Array sizes only match when they are the same expression or the same
+ * integer literal. Other expressions can't be compared before constant
+ * evaluation, and a name can mean a different binding in every scope, so
+ * sizes that use one get nodes of their own for the resolver to annotate.
+ */
+
+TypespecTable typespec_table;
+
+bool typespec_size_equal(Expr *a, Expr *b) {
+    if (a == b) {
+        return true;
+    }
+    if (!a || !b || a->kind != b->kind) {
+        return false;
+    }
+    switch (a->kind) {
+    case EXPR_INT:
+        return a->int_val == b->int_val && a->int_mod == b->int_mod;
+    default:
+        return false;
+    }
+}
+
+uint64_t typespec_size_hash(Expr *size) {
+    if (!size) {
+        return 0;
+    }
+    switch (size->kind) {
+    case EXPR_INT:
+        return hash_mix(hash_uint64(size->int_val), size->int_mod);
+    default:
+        return hash_ptr(size);
+    }
+}
+
+uint64_t typespec_hash(Typespec *type) {
+    uint64_t hash = hash_uint64(type->kind);
+    switch (type->kind) {
+    case TYPESPEC_IDENT:
+        return hash_mix(hash, hash_ptr(type->name));
+    case TYPESPEC_FN:
+        for (size_t i = 0; i < type->fn.num_args; i++) {
+            hash = hash_mix(hash, hash_ptr(type->fn.args[i]));
+        }
+        return hash_mix(hash_mix(hash, type->fn.num_args), hash_ptr(type->fn.ret));
+    case TYPESPEC_ARRAY:
+        return hash_mix(hash_mix(hash, hash_ptr(type->array.elem)), typespec_size_hash(type->array.size));
+    case TYPESPEC_PTR:
+        return hash_mix(hash, hash_ptr(type->ptr.elem));
+    default:
+        assert(0);
+        return 0;
+    }
+}
+
+bool typespec_equal(Typespec *a, Typespec *b) {
+    if (a->kind != b->kind) {
+        return false;
+    }
+    switch (a->kind) {
+    case TYPESPEC_IDENT:
+        return a->name == b->name;
+    case TYPESPEC_FN:
+        return a->fn.num_args == b->fn.num_args && a->fn.ret == b->fn.ret &&
+               (a->fn.num_args == 0 || memcmp(a->fn.args, b->fn.args, a->fn.num_args * sizeof(*a->fn.args)) == 0);
+    case TYPESPEC_ARRAY:
+        return a->array.elem == b->array.elem && typespec_size_equal(a->array.size, b->array.size);
+    case TYPESPEC_PTR:
+        return a->ptr.elem == b->ptr.elem;
+    default:
+        assert(0);
+        return false;
+    }
+}
+
+// Allocates the canonical node for key, whose fn args may live anywhere.
+Typespec *typespec_build(Typespec *key) {
+    size_t args_size = key->kind == TYPESPEC_FN ? key->fn.num_args * sizeof(*key->fn.args) : 0;
+    Typespec *t = typespec_alloc(key->kind, args_size);
+    switch (key->kind) {
+    case TYPESPEC_IDENT:
+        t->name = key->name;
+        break;
+    case TYPESPEC_FN: {
+        char *trailing = (char *)t + typespec_size(TYPESPEC_FN);
+        t->fn.args = ast_place(&trailing, key->fn.args, args_size);
+        t->fn.num_args = key->fn.num_args;
+        t->fn.ret = key->fn.ret;
+        break;
+    }
+    case TYPESPEC_ARRAY:
+        t->array = key->array;
+        break;
+    case TYPESPEC_PTR:
+        t->ptr = key->ptr;
+        break;
+    default:
+        assert(0);
+        break;
+    }
+    typespec_table.bytes += ALIGN_UP(typespec_size(key->kind) + args_size, ARENA_ALIGNMENT);
     return t;
 }
 
+void typespec_table_grow(void) {
+    size_t new_cap = typespec_table.cap ? 2 * typespec_table.cap : 64;
+    Typespec **new_slots = xcalloc(new_cap, sizeof(Typespec *));
+    for (size_t i = 0; i < typespec_table.cap; i++) {
+        Typespec *t = typespec_table.slots[i];
+        if (t) {
+            size_t j = typespec_hash(t) & (new_cap - 1);
+            while (new_slots[j]) {
+                j = (j + 1) & (new_cap - 1);
+            }
+            new_slots[j] = t;
+        }
+    }
+    free(typespec_table.slots);
+    typespec_table.slots = new_slots;
+    typespec_table.cap = new_cap;
+}
+
+// Returns the table slot holding the node equal to key, or the empty slot
+// it belongs in.
+Typespec **typespec_slot(Typespec *key) {
+    if (2 * typespec_table.len >= typespec_table.cap) {
+        typespec_table_grow();
+    }
+    size_t mask = typespec_table.cap - 1;
+    for (size_t i = typespec_hash(key) & mask;; i = (i + 1) & mask) {
+        Typespec *t = typespec_table.slots[i];
+        if (!t || typespec_equal(t, key)) {
+            return &typespec_table.slots[i];
+        }
+    }
+}
+
+Typespec *typespec_intern(Typespec *key) {
+    typespec_table.uses++;
+    Typespec **slot = typespec_slot(key);
+    if (!*slot) {
+        *slot = typespec_build(key);
+        typespec_table.len++;
+    }
+    return *slot;
+}
+
+// Makes an existing node with canonical children canonical itself, unless
+// an equal node already is.
+Typespec *typespec_canonical(Typespec *type) {
+    Typespec **slot = typespec_slot(type);
+    if (!*slot) {
+        *slot = type;
+        typespec_table.len++;
+    }
+    return *slot;
+}
+
+void typespec_table_free(void) {
+    free(typespec_table.slots);
+    typespec_table = (TypespecTable){0};
+}
+
+Typespec *typespec_ident(const char *name) {
+    Typespec key = {TYPESPEC_IDENT, .name = name};
+    return typespec_intern(&key);
+}
+
 Typespec *typespec_ptr(Typespec *elem) {
-    Typespec *t = typespec_new(TYPESPEC_PTR);
-    t->ptr.elem = elem;
-    return t;
+    Typespec key = {TYPESPEC_PTR, .ptr = {elem}};
+    return typespec_intern(&key);
 }
 
 Typespec *typespec_array(Typespec *elem, Expr *size) {
-    Typespec *t = typespec_new(TYPESPEC_ARRAY);
-    t->array.elem = elem;
-    t->array.size = size;
-    return t;
+    Typespec key = {TYPESPEC_ARRAY, .array = {elem, size}};
+    return typespec_intern(&key);
 }
 
 Typespec *typespec_fn(Typespec **args, size_t num_args, Typespec *ret) {
-    Typespec *t = typespec_new(TYPESPEC_FN);
-    t->fn.args = args;
-    t->fn.num_args = num_args;
-    t->fn.ret = ret;
-    return t;
+    Typespec key = {TYPESPEC_FN, .fn = {num_args, args, ret}};
+    return typespec_intern(&key);
 }
 
-Decl *decl_new(DeclKind kind, const char *name) {
-    Decl *d = ast_alloc(sizeof(Decl));
+Typespec *typespec_error(void) {
+    return typespec_new(TYPESPEC_ERROR);
+}
+
+Decl *decl_alloc(DeclKind kind, const char *name, size_t extra) {
+    Decl *d = ast_alloc(decl_size(kind) + extra);
     d->kind = kind;
     d->name = name;
     return d;
 }
 
+Decl *decl_new(DeclKind kind, const char *name) {
+    return decl_alloc(kind, name, 0);
+}
+
 Decl *decl_enum(const char *name, EnumItem *items, size_t num_items) {
-    Decl *d = decl_new(DECL_ENUM, name);
-    d->enum_decl.items = items;
+    size_t items_size = num_items * sizeof(*items);
+    Decl *d = decl_alloc(DECL_ENUM, name, items_size);
+    char *trailing = (char *)d + decl_size(DECL_ENUM);
+    d->enum_decl.items = ast_place(&trailing, items, items_size);
     d->enum_decl.num_items = num_items;
     return d;
 }
 
 Decl *decl_aggregate(DeclKind kind, const char *name, AggregateItem *items, size_t num_items) {
     assert(kind == DECL_STRUCT || kind == DECL_UNION);
-    Decl *d = decl_new(kind, name);
-    d->aggregate.items = items;
+    size_t items_size = num_items * sizeof(*items);
+    size_t extra = items_size;
+    for (size_t i = 0; i < num_items; i++) {
+        extra += ALIGN_UP(items[i].num_names * sizeof(*items[i].names), ARENA_ALIGNMENT);
+    }
+    Decl *d = decl_alloc(kind, name, extra);
+    char *trailing = (char *)d + decl_size(kind);
+    d->aggregate.items = ast_place(&trailing, items, items_size);
     d->aggregate.num_items = num_items;
+    for (size_t i = 0; i < num_items; i++) {
+        AggregateItem *item = &d->aggregate.items[i];
+        item->names = ast_place(&trailing, item->names, item->num_names * sizeof(*item->names));
+    }
     return d;
 }
 
 Decl *decl_union(const char *name, AggregateItem *items, size_t num_items) {
-    Decl *d = decl_new(DECL_UNION, name);
-    d->aggregate.items = items;
-    d->aggregate.num_items = num_items;
-    return d;
+    return decl_aggregate(DECL_UNION, name, items, num_items);
 }
 
 Decl *decl_let(const char *name, Typespec *type, Expr *expr) {
@@ -88,11 +376,13 @@ Decl *decl_let(const char *name, Typespec *type, Expr *expr) {
 }
 
 Decl *decl_fn(const char *name, FnParam *params, size_t num_params, Typespec *ret_type, StmtBlock block) {
-    Decl *d = decl_new(DECL_FN, name);
-    d->fn.params = params;
+    size_t params_size = num_params * sizeof(*params);
+    Decl *d = decl_alloc(DECL_FN, name, ALIGN_UP(params_size, ARENA_ALIGNMENT) + BLOCK_SIZE(block));
+    char *trailing = (char *)d + decl_size(DECL_FN);
+    d->fn.params = ast_place(&trailing, params, params_size);
     d->fn.num_params = num_params;
     d->fn.ret_type = ret_type;
-    d->fn.block = block;
+    d->fn.block = (StmtBlock){ast_place(&trailing, block.stmts, block.num_stmts * sizeof(Stmt *)), block.num_stmts};
     return d;
 }
 
@@ -108,12 +398,20 @@ Decl *decl_typedef(const char *name, Typespec *type) {
     return d;
 }
 
-Expr *expr_new(ExprKind kind) {
-    Expr *e = ast_alloc(sizeof(Expr));
+Decl *decl_error(void) {
+    return decl_new(DECL_ERROR, NULL);
+}
+
+Expr *expr_alloc(ExprKind kind, size_t extra) {
+    Expr *e = ast_alloc(expr_size(kind) + extra);
     e->kind = kind;
     return e;
 }
 
+Expr *expr_new(ExprKind kind) {
+    return expr_alloc(kind, 0);
+}
+
 Expr *expr_int(uint64_t value) {
     Expr *e = expr_new(EXPR_INT);
     e->int_val = value;
@@ -139,9 +437,11 @@ Expr *expr_ident(const char *name) {
 }
 
 Expr *expr_compound(Typespec *type, Expr **args, size_t num_args) {
-    Expr *e = expr_new(EXPR_COMPOUND);
+    size_t args_size = num_args * sizeof(*args);
+    Expr *e = expr_alloc(EXPR_COMPOUND, args_size);
+    char *trailing = (char *)e + expr_size(EXPR_COMPOUND);
     e->compound.type = type;
-    e->compound.args = args;
+    e->compound.args = ast_place(&trailing, args, args_size);
     e->compound.num_args = num_args;
     return e;
 }
@@ -154,9 +454,11 @@ Expr *expr_cast(Typespec *type, Expr *expr) {
 }
 
 Expr *expr_call(Expr *expr, Expr **args, size_t num_args) {
-    Expr *e = expr_new(EXPR_CALL);
+    size_t args_size = num_args * sizeof(*args);
+    Expr *e = expr_alloc(EXPR_CALL, args_size);
+    char *trailing = (char *)e + expr_size(EXPR_CALL);
     e->call.expr = expr;
-    e->call.args = args;
+    e->call.args = ast_place(&trailing, args, args_size);
     e->call.num_args = num_args;
     return e;
 }
@@ -198,12 +500,24 @@ Expr *expr_ternary(Expr *cond, Expr *then_expr, Expr *else_expr) {
     return e;
 }
 
-Stmt *stmt_new(StmtKind kind) {
-    Stmt *s = ast_alloc(sizeof(Stmt));
+Expr *expr_error(void) {
+    return expr_new(EXPR_ERROR);
+}
+
+Stmt *stmt_alloc(StmtKind kind, size_t extra) {
+    Stmt *s = ast_alloc(stmt_size(kind) + extra);
     s->kind = kind;
     return s;
 }
 
+Stmt *stmt_new(StmtKind kind) {
+    return stmt_alloc(kind, 0);
+}
+
+StmtBlock stmt_place_block(char **cursor, StmtBlock block) {
+    return (StmtBlock){ast_place(cursor, block.stmts, block.num_stmts * sizeof(Stmt *)), block.num_stmts};
+}
+
 Stmt *stmt_return(Expr *expr) {
     Stmt *s = stmt_new(STMT_RETURN);
     s->return_stmt.expr = expr;
@@ -219,49 +533,73 @@ Stmt *stmt_continue(void) {
 }
 
 Stmt *stmt_block(StmtBlock block) {
-    Stmt *s = stmt_new(STMT_BLOCK);
-    s->block = block;
+    Stmt *s = stmt_alloc(STMT_BLOCK, BLOCK_SIZE(block));
+    char *trailing = (char *)s + stmt_size(STMT_BLOCK);
+    s->block = stmt_place_block(&trailing, block);
     return s;
 }
 
 Stmt *stmt_if(Expr *cond, StmtBlock then_block, ElseIf *elseifs, size_t num_elseifs, StmtBlock else_block) {
-    Stmt *s = stmt_new(STMT_IF);
+    size_t elseifs_size = num_elseifs * sizeof(*elseifs);
+    size_t extra = BLOCK_SIZE(then_block) + elseifs_size + BLOCK_SIZE(else_block);
+    for (size_t i = 0; i < num_elseifs; i++) {
+        extra += BLOCK_SIZE(elseifs[i].block);
+    }
+    Stmt *s = stmt_alloc(STMT_IF, extra);
+    char *trailing = (char *)s + stmt_size(STMT_IF);
     s->if_stmt.cond = cond;
-    s->if_stmt.then_block = then_block;
-    s->if_stmt.elseifs = elseifs;
+    s->if_stmt.then_block = stmt_place_block(&trailing, then_block);
+    s->if_stmt.elseifs = ast_place(&trailing, elseifs, elseifs_size);
     s->if_stmt.num_elseifs = num_elseifs;
-    s->if_stmt.else_block = else_block;
+    for (size_t i = 0; i < num_elseifs; i++) {
+        s->if_stmt.elseifs[i].block = stmt_place_block(&trailing, s->if_stmt.elseifs[i].block);
+    }
+    s->if_stmt.else_block = stmt_place_block(&trailing, else_block);
     return s;
 }
 
-Stmt *stmt_while(Expr *cond, StmtBlock block) {
-    Stmt *s = stmt_new(STMT_WHILE);
+Stmt *stmt_while_kind(StmtKind kind, Expr *cond, StmtBlock block) {
+    Stmt *s = stmt_alloc(kind, BLOCK_SIZE(block));
+    char *trailing = (char *)s + stmt_size(kind);
     s->while_stmt.cond = cond;
-    s->while_stmt.block = block;
+    s->while_stmt.block = stmt_place_block(&trailing, block);
     return s;
 }
 
+Stmt *stmt_while(Expr *cond, StmtBlock block) {
+    return stmt_while_kind(STMT_WHILE, cond, block);
+}
+
 Stmt *stmt_do_while(Expr *cond, StmtBlock block) {
-    Stmt *s = stmt_new(STMT_DO_WHILE);
-    s->while_stmt.cond = cond;
-    s->while_stmt.block = block;
-    return s;
+    return stmt_while_kind(STMT_DO_WHILE, cond, block);
 }
 
 Stmt *stmt_for(Stmt *init, Expr *cond, Stmt *next, StmtBlock block) {
-    Stmt *s = stmt_new(STMT_FOR);
+    Stmt *s = stmt_alloc(STMT_FOR, BLOCK_SIZE(block));
+    char *trailing = (char *)s + stmt_size(STMT_FOR);
     s->for_stmt.init = init;
     s->for_stmt.cond = cond;
     s->for_stmt.next = next;
-    s->for_stmt.block = block;
+    s->for_stmt.block = stmt_place_block(&trailing, block);
     return s;
 }
 
 Stmt *stmt_switch(Expr *expr, SwitchCase *cases, size_t num_cases) {
-    Stmt *s = stmt_new(STMT_SWITCH);
+    size_t cases_size = num_cases * sizeof(*cases);
+    size_t extra = cases_size;
+    for (size_t i = 0; i < num_cases; i++) {
+        extra += ALIGN_UP(cases[i].num_exprs * sizeof(Expr *), ARENA_ALIGNMENT) + BLOCK_SIZE(cases[i].block);
+    }
+    Stmt *s = stmt_alloc(STMT_SWITCH, extra);
+    char *trailing = (char *)s + stmt_size(STMT_SWITCH);
     s->switch_stmt.expr = expr;
-    s->switch_stmt.cases = cases;
+    s->switch_stmt.cases = ast_place(&trailing, cases, cases_size);
     s->switch_stmt.num_cases = num_cases;
+    for (size_t i = 0; i < num_cases; i++) {
+        SwitchCase *c = &s->switch_stmt.cases[i];
+        c->exprs = ast_place(&trailing, c->exprs, c->num_exprs * sizeof(Expr *));
+        c->block = stmt_place_block(&trailing, c->block);
+    }
     return s;
 }
 
@@ -285,3 +623,750 @@ Stmt *stmt_expr(Expr *expr) {
     s->expr = expr;
     return s;
 }
+
+Stmt *stmt_error(void) {
+    return stmt_new(STMT_ERROR);
+}
+
+/*
+ * Each copy first rebuilds the node through its builder, which copies the
+ * node's child arrays while they still point at the old children, and then
+ * replaces those children with copies. That puts every parent ahead of its
+ * subtree in the arena.
+ */
+
+// Canonical typespecs are rebuilt bottom-up: a parent can only be looked up
+// once its children are canonical in the new arena.
+Typespec *typespec_copy(Typespec *type) {
+    if (!type) {
+        return NULL;
+    }
+    switch (type->kind) {
+    case TYPESPEC_IDENT:
+        return typespec_ident(type->name);
+    case TYPESPEC_FN: {
+        Typespec **args = NULL;
+        for (size_t i = 0; i < type->fn.num_args; i++) {
+            buf_push(args, typespec_copy(type->fn.args[i]));
+        }
+        Typespec *t = typespec_fn(args, buf_len(args), typespec_copy(type->fn.ret));
+        buf_free(args);
+        return t;
+    }
+    case TYPESPEC_ARRAY:
+        return typespec_array(typespec_copy(type->array.elem), expr_copy(type->array.size));
+    case TYPESPEC_PTR:
+        return typespec_ptr(typespec_copy(type->ptr.elem));
+    default:
+        return typespec_new(type->kind);
+    }
+}
+
+void expr_copy_args(Expr **args, size_t num_args) {
+    for (size_t i = 0; i < num_args; i++) {
+        args[i] = expr_copy(args[i]);
+    }
+}
+
+Expr *expr_copy_kind(Expr *expr) {
+    Expr *e;
+    switch (expr->kind) {
+    case EXPR_INT:
+        e = expr_int(expr->int_val);
+        e->int_mod = expr->int_mod;
+        return e;
+    case EXPR_FLOAT:
+        return expr_float(expr->float_val);
+    case EXPR_STR:
+        return expr_str(expr->str_val);
+    case EXPR_IDENT:
+        e = expr_ident(expr->name);
+        e->sym = expr->sym;
+        return e;
+    case EXPR_CAST:
+        e = expr_cast(expr->cast.type, expr->cast.expr);
+        e->cast.type = typespec_copy(e->cast.type);
+        e->cast.expr = expr_copy(e->cast.expr);
+        return e;
+    case EXPR_CALL:
+        e = expr_call(expr->call.expr, expr->call.args, expr->call.num_args);
+        e->call.expr = expr_copy(e->call.expr);
+        expr_copy_args(e->call.args, e->call.num_args);
+        return e;
+    case EXPR_INDEX:
+        e = expr_index(expr->index.expr, expr->index.index);
+        e->index.expr = expr_copy(e->index.expr);
+        e->index.index = expr_copy(e->index.index);
+        return e;
+    case EXPR_FIELD:
+        e = expr_field(expr->field.expr, expr->field.name);
+        e->field.expr = expr_copy(e->field.expr);
+        return e;
+    case EXPR_COMPOUND:
+        e = expr_compound(expr->compound.type, expr->compound.args, expr->compound.num_args);
+        e->compound.type = typespec_copy(e->compound.type);
+        expr_copy_args(e->compound.args, e->compound.num_args);
+        return e;
+    case EXPR_UNARY:
+        e = expr_unary(expr->unary.op, expr->unary.expr);
+        e->unary.expr = expr_copy(e->unary.expr);
+        return e;
+    case EXPR_BINARY:
+        e = expr_binary(expr->binary.op, expr->binary.left, expr->binary.right);
+        e->binary.left = expr_copy(e->binary.left);
+        e->binary.right = expr_copy(e->binary.right);
+        return e;
+    case EXPR_TERNARY:
+        e = expr_ternary(expr->ternary.cond, expr->ternary.then_expr, expr->ternary.else_expr);
+        e->ternary.cond = expr_copy(e->ternary.cond);
+        e->ternary.then_expr = expr_copy(e->ternary.then_expr);
+        e->ternary.else_expr = expr_copy(e->ternary.else_expr);
+        return e;
+    default:
+        return expr_new(expr->kind);
+    }
+}
+
+// Checker types carry over, so a copy of a checked tree is still checked.
+Expr *expr_copy(Expr *expr) {
+    if (!expr) {
+        return NULL;
+    }
+    Expr *e = expr_copy_kind(expr);
+    e->type = expr->type;
+    return e;
+}
+
+uint64_t expr_hash(Expr *expr) {
+    uint64_t hash = hash_uint64(expr->kind);
+    switch (expr->kind) {
+    case EXPR_INT:
+        return hash_mix(hash, hash_uint64(expr->int_val));
+    case EXPR_FLOAT:
+        return hash_mix(hash, hash_bytes(&expr->float_val, sizeof(expr->float_val)));
+    case EXPR_STR:
+        return hash_mix(hash, hash_bytes(expr->str_val, strlen(expr->str_val)));
+    case EXPR_IDENT:
+        return hash_mix(hash, expr->sym ? hash_ptr(expr->sym) : hash_ptr(expr->name));
+    case EXPR_CAST:
+        return hash_mix(hash_mix(hash, hash_ptr(expr->cast.type)), expr_hash(expr->cast.expr));
+    case EXPR_CALL:
+        hash = hash_mix(hash, expr_hash(expr->call.expr));
+        for (size_t i = 0; i < expr->call.num_args; i++) {
+            hash = hash_mix(hash, expr_hash(expr->call.args[i]));
+        }
+        return hash_mix(hash, expr->call.num_args);
+    case EXPR_INDEX:
+        return hash_mix(hash_mix(hash, expr_hash(expr->index.expr)), expr_hash(expr->index.index));
+    case EXPR_FIELD:
+        return hash_mix(hash_mix(hash, hash_ptr(expr->field.name)), expr_hash(expr->field.expr));
+    case EXPR_COMPOUND:
+        hash = hash_mix(hash, hash_ptr(expr->compound.type));
+        for (size_t i = 0; i < expr->compound.num_args; i++) {
+            hash = hash_mix(hash, expr_hash(expr->compound.args[i]));
+        }
+        return hash_mix(hash, expr->compound.num_args);
+    case EXPR_UNARY:
+        return hash_mix(hash_mix(hash, expr->unary.op), expr_hash(expr->unary.expr));
+    case EXPR_BINARY:
+        hash = hash_mix(hash_mix(hash, expr->binary.op), expr_hash(expr->binary.left));
+        return hash_mix(hash, expr_hash(expr->binary.right));
+    case EXPR_TERNARY:
+        hash = hash_mix(hash, expr_hash(expr->ternary.cond));
+        hash = hash_mix(hash, expr_hash(expr->ternary.then_expr));
+        return hash_mix(hash, expr_hash(expr->ternary.else_expr));
+    default:
+        return hash;
+    }
+}
+
+bool expr_equal_args(Expr **a, Expr **b, size_t num_args) {
+    for (size_t i = 0; i < num_args; i++) {
+        if (!expr_equal(a[i], b[i])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool expr_equal(Expr *a, Expr *b) {
+    if (a == b) {
+        return true;
+    }
+    if (a->kind != b->kind) {
+        return false;
+    }
+    switch (a->kind) {
+    case EXPR_INT:
+        return a->int_val == b->int_val;
+    case EXPR_FLOAT:
+        return memcmp(&a->float_val, &b->float_val, sizeof(a->float_val)) == 0;
+    case EXPR_STR:
+        return strcmp(a->str_val, b->str_val) == 0;
+    case EXPR_IDENT:
+        return a->sym || b->sym ? a->sym == b->sym : a->name == b->name;
+    case EXPR_CAST:
+        return a->cast.type == b->cast.type && expr_equal(a->cast.expr, b->cast.expr);
+    case EXPR_CALL:
+        return a->call.num_args == b->call.num_args && expr_equal(a->call.expr, b->call.expr) &&
+               expr_equal_args(a->call.args, b->call.args, a->call.num_args);
+    case EXPR_INDEX:
+        return expr_equal(a->index.expr, b->index.expr) && expr_equal(a->index.index, b->index.index);
+    case EXPR_FIELD:
+        return a->field.name == b->field.name && expr_equal(a->field.expr, b->field.expr);
+    case EXPR_COMPOUND:
+        return a->compound.type == b->compound.type && a->compound.num_args == b->compound.num_args &&
+               expr_equal_args(a->compound.args, b->compound.args, a->compound.num_args);
+    case EXPR_UNARY:
+        return a->unary.op == b->unary.op && expr_equal(a->unary.expr, b->unary.expr);
+    case EXPR_BINARY:
+        return a->binary.op == b->binary.op && expr_equal(a->binary.left, b->binary.left) &&
+               expr_equal(a->binary.right, b->binary.right);
+    case EXPR_TERNARY:
+        return expr_equal(a->ternary.cond, b->ternary.cond) && expr_equal(a->ternary.then_expr, b->ternary.then_expr) &&
+               expr_equal(a->ternary.else_expr, b->ternary.else_expr);
+    default:
+        return true;
+    }
+}
+
+void stmt_copy_block(StmtBlock block) {
+    for (size_t i = 0; i < block.num_stmts; i++) {
+        block.stmts[i] = stmt_copy(block.stmts[i]);
+    }
+}
+
+StmtBlock stmt_block_copy(StmtBlock block) {
+    StmtBlock copy = {ast_dup(block.stmts, block.num_stmts * sizeof(Stmt *)), block.num_stmts};
+    stmt_copy_block(copy);
+    return copy;
+}
+
+Stmt *stmt_copy(Stmt *stmt) {
+    if (!stmt) {
+        return NULL;
+    }
+    Stmt *s;
+    switch (stmt->kind) {
+    case STMT_RETURN:
+        s = stmt_return(stmt->return_stmt.expr);
+        s->return_stmt.expr = expr_copy(s->return_stmt.expr);
+        return s;
+    case STMT_BLOCK:
+        s = stmt_block(stmt->block);
+        stmt_copy_block(s->block);
+        return s;
+    case STMT_IF:
+        s = stmt_if(stmt->if_stmt.cond, stmt->if_stmt.then_block, stmt->if_stmt.elseifs, stmt->if_stmt.num_elseifs, stmt->if_stmt.else_block);
+        s->if_stmt.cond = expr_copy(s->if_stmt.cond);
+        stmt_copy_block(s->if_stmt.then_block);
+        for (size_t i = 0; i < s->if_stmt.num_elseifs; i++) {
+            s->if_stmt.elseifs[i].cond = expr_copy(s->if_stmt.elseifs[i].cond);
+            stmt_copy_block(s->if_stmt.elseifs[i].block);
+        }
+        stmt_copy_block(s->if_stmt.else_block);
+        return s;
+    case STMT_WHILE:
+    case STMT_DO_WHILE:
+        s = stmt->kind == STMT_WHILE ? stmt_while(stmt->while_stmt.cond, stmt->while_stmt.block) : stmt_do_while(stmt->while_stmt.cond, stmt->while_stmt.block);
+        s->while_stmt.cond = expr_copy(s->while_stmt.cond);
+        stmt_copy_block(s->while_stmt.block);
+        return s;
+    case STMT_FOR:
+        s = stmt_for(stmt->for_stmt.init, stmt->for_stmt.cond, stmt->for_stmt.next, stmt->for_stmt.block);
+        s->for_stmt.init = stmt_copy(s->for_stmt.init);
+        s->for_stmt.cond = expr_copy(s->for_stmt.cond);
+        s->for_stmt.next = stmt_copy(s->for_stmt.next);
+        stmt_copy_block(s->for_stmt.block);
+        return s;
+    case STMT_SWITCH:
+        s = stmt_switch(stmt->switch_stmt.expr, stmt->switch_stmt.cases, stmt->switch_stmt.num_cases);
+        s->switch_stmt.expr = expr_copy(s->switch_stmt.expr);
+        s->switch_stmt.plan = switch_plan_copy(stmt->switch_stmt.plan);
+        for (size_t i = 0; i < s->switch_stmt.num_cases; i++) {
+            SwitchCase *c = &s->switch_stmt.cases[i];
+            expr_copy_args(c->exprs, c->num_exprs);
+            stmt_copy_block(c->block);
+        }
+        return s;
+    case STMT_ASSIGN:
+        s = stmt_assign(stmt->assign.op, stmt->assign.left, stmt->assign.right);
+        s->assign.left = expr_copy(s->assign.left);
+        s->assign.right = expr_copy(s->assign.right);
+        return s;
+    case STMT_INIT:
+        s = stmt_init(stmt->init.name, stmt->init.expr);
+        s->init.expr = expr_copy(s->init.expr);
+        return s;
+    case STMT_EXPR:
+        s = stmt_expr(stmt->expr);
+        s->expr = expr_copy(s->expr);
+        return s;
+    default:
+        return stmt_new(stmt->kind);
+    }
+}
+
+Decl *decl_copy(Decl *decl) {
+    Decl *d;
+    switch (decl->kind) {
+    case DECL_ENUM:
+        d = decl_enum(decl->name, decl->enum_decl.items, decl->enum_decl.num_items);
+        for (size_t i = 0; i < d->enum_decl.num_items; i++) {
+            d->enum_decl.items[i].expr = expr_copy(d->enum_decl.items[i].expr);
+        }
+        return d;
+    case DECL_STRUCT:
+    case DECL_UNION:
+        d = decl_aggregate(decl->kind, decl->name, decl->aggregate.items, decl->aggregate.num_items);
+        for (size_t i = 0; i < d->aggregate.num_items; i++) {
+            d->aggregate.items[i].types = typespec_copy(d->aggregate.items[i].types);
+        }
+        return d;
+    case DECL_LET:
+        d = decl_let(decl->name, decl->let.type, decl->let.expr);
+        d->let.type = typespec_copy(d->let.type);
+        d->let.expr = expr_copy(d->let.expr);
+        return d;
+    case DECL_CONST:
+        d = decl_const(decl->name, decl->const_decl.expr);
+        d->const_decl.expr = expr_copy(d->const_decl.expr);
+        return d;
+    case DECL_TYPEDEF:
+        d = decl_typedef(decl->name, decl->typedef_decl.type);
+        d->typedef_decl.type = typespec_copy(d->typedef_decl.type);
+        return d;
+    case DECL_FN:
+        d = decl_fn(decl->name, decl->fn.params, decl->fn.num_params, decl->fn.ret_type, decl->fn.block);
+        for (size_t i = 0; i < d->fn.num_params; i++) {
+            d->fn.params[i].type = typespec_copy(d->fn.params[i].type);
+        }
+        d->fn.ret_type = typespec_copy(d->fn.ret_type);
+        d->fn.never_returns = decl->fn.never_returns;
+        stmt_copy_block(d->fn.block);
+        return d;
+    default:
+        return decl_new(decl->kind, decl->name);
+    }
+}
+
+// Moves finished declarations into a fresh arena in depth-first order and
+// frees the old one, so later passes stream through memory linearly. Every
+// other pointer into the old arena is invalidated.
+void ast_compact(Decl **decls, size_t num_decls) {
+    Arena old_arena = ast_arena;
+    TypespecTable old_table = typespec_table;
+    ast_arena = (Arena){0};
+    typespec_table = (TypespecTable){0};
+    for (size_t i = 0; i < num_decls; i++) {
+        decls[i] = decl_copy(decls[i]);
+    }
+    arena_free(&old_arena);
+    free(old_table.slots);
+}
+
+AstNode ast_typespec(Typespec *typespec) {
+    return (AstNode){AST_TYPESPEC, .typespec = typespec};
+}
+
+AstNode ast_decl(Decl *decl) {
+    return (AstNode){AST_DECL, .decl = decl};
+}
+
+AstNode ast_expr(Expr *expr) {
+    return (AstNode){AST_EXPR, .expr = expr};
+}
+
+AstNode ast_stmt(Stmt *stmt) {
+    return (AstNode){AST_STMT, .stmt = stmt};
+}
+
+void visit_push(AstVisitor *visitor, AstNode node) {
+    if (node.ptr) {
+        buf_push(visitor->stack, (VisitFrame){node, false});
+    }
+}
+
+/*
+ * The stack pops last-in first-out, so children are pushed last to first
+ * to come back off in source order.
+ */
+
+void visit_push_exprs(AstVisitor *visitor, Expr **exprs, size_t num_exprs) {
+    for (size_t i = num_exprs; i > 0; i--) {
+        visit_push(visitor, ast_expr(exprs[i - 1]));
+    }
+}
+
+void visit_push_stmt_block(AstVisitor *visitor, StmtBlock block) {
+    for (size_t i = block.num_stmts; i > 0; i--) {
+        visit_push(visitor, ast_stmt(block.stmts[i - 1]));
+    }
+}
+
+void visit_push_typespec_children(AstVisitor *visitor, Typespec *type) {
+    switch (type->kind) {
+    case TYPESPEC_FN:
+        visit_push(visitor, ast_typespec(type->fn.ret));
+        for (size_t i = type->fn.num_args; i > 0; i--) {
+            visit_push(visitor, ast_typespec(type->fn.args[i - 1]));
+        }
+        break;
+    case TYPESPEC_ARRAY:
+        visit_push(visitor, ast_expr(type->array.size));
+        visit_push(visitor, ast_typespec(type->array.elem));
+        break;
+    case TYPESPEC_PTR:
+        visit_push(visitor, ast_typespec(type->ptr.elem));
+        break;
+    default:
+        break;
+    }
+}
+
+void visit_push_decl_children(AstVisitor *visitor, Decl *decl) {
+    switch (decl->kind) {
+    case DECL_ENUM:
+        for (size_t i = decl->enum_decl.num_items; i > 0; i--) {
+            visit_push(visitor, ast_expr(decl->enum_decl.items[i - 1].expr));
+        }
+        break;
+    case DECL_STRUCT:
+    case DECL_UNION:
+        for (size_t i = decl->aggregate.num_items; i > 0; i--) {
+            visit_push(visitor, ast_typespec(decl->aggregate.items[i - 1].types));
+        }
+        break;
+    case DECL_LET:
+        visit_push(visitor, ast_expr(decl->let.expr));
+        visit_push(visitor, ast_typespec(decl->let.type));
+        break;
+    case DECL_CONST:
+        visit_push(visitor, ast_expr(decl->const_decl.expr));
+        break;
+    case DECL_TYPEDEF:
+        visit_push(visitor, ast_typespec(decl->typedef_decl.type));
+        break;
+    case DECL_FN:
+        visit_push_stmt_block(visitor, decl->fn.block);
+        visit_push(visitor, ast_typespec(decl->fn.ret_type));
+        for (size_t i = decl->fn.num_params; i > 0; i--) {
+            visit_push(visitor, ast_typespec(decl->fn.params[i - 1].type));
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+void visit_push_expr_children(AstVisitor *visitor, Expr *expr) {
+    switch (expr->kind) {
+    case EXPR_CAST:
+        visit_push(visitor, ast_expr(expr->cast.expr));
+        visit_push(visitor, ast_typespec(expr->cast.type));
+        break;
+    case EXPR_CALL:
+        visit_push_exprs(visitor, expr->call.args, expr->call.num_args);
+        visit_push(visitor, ast_expr(expr->call.expr));
+        break;
+    case EXPR_INDEX:
+        visit_push(visitor, ast_expr(expr->index.index));
+        visit_push(visitor, ast_expr(expr->index.expr));
+        break;
+    case EXPR_FIELD:
+        visit_push(visitor, ast_expr(expr->field.expr));
+        break;
+    case EXPR_COMPOUND:
+        visit_push_exprs(visitor, expr->compound.args, expr->compound.num_args);
+        visit_push(visitor, ast_typespec(expr->compound.type));
+        break;
+    case EXPR_UNARY:
+        visit_push(visitor, ast_expr(expr->unary.expr));
+        break;
+    case EXPR_BINARY:
+        visit_push(visitor, ast_expr(expr->binary.right));
+        visit_push(visitor, ast_expr(expr->binary.left));
+        break;
+    case EXPR_TERNARY:
+        visit_push(visitor, ast_expr(expr->ternary.else_expr));
+        visit_push(visitor, ast_expr(expr->ternary.then_expr));
+        visit_push(visitor, ast_expr(expr->ternary.cond));
+        break;
+    default:
+        break;
+    }
+}
+
+void visit_push_stmt_children(AstVisitor *visitor, Stmt *stmt) {
+    switch (stmt->kind) {
+    case STMT_RETURN:
+        visit_push(visitor, ast_expr(stmt->return_stmt.expr));
+        break;
+    case STMT_BLOCK:
+        visit_push_stmt_block(visitor, stmt->block);
+        break;
+    case STMT_IF:
+        visit_push_stmt_block(visitor, stmt->if_stmt.else_block);
+        for (size_t i = stmt->if_stmt.num_elseifs; i > 0; i--) {
+            ElseIf *elseif = &stmt->if_stmt.elseifs[i - 1];
+            visit_push_stmt_block(visitor, elseif->block);
+            visit_push(visitor, ast_expr(elseif->cond));
+        }
+        visit_push_stmt_block(visitor, stmt->if_stmt.then_block);
+        visit_push(visitor, ast_expr(stmt->if_stmt.cond));
+        break;
+    case STMT_WHILE:
+    case STMT_DO_WHILE:
+        visit_push_stmt_block(visitor, stmt->while_stmt.block);
+        visit_push(visitor, ast_expr(stmt->while_stmt.cond));
+        break;
+    case STMT_FOR:
+        visit_push_stmt_block(visitor, stmt->for_stmt.block);
+        visit_push(visitor, ast_stmt(stmt->for_stmt.next));
+        visit_push(visitor, ast_expr(stmt->for_stmt.cond));
+        visit_push(visitor, ast_stmt(stmt->for_stmt.init));
+        break;
+    case STMT_SWITCH:
+        for (size_t i = stmt->switch_stmt.num_cases; i > 0; i--) {
+            SwitchCase *c = &stmt->switch_stmt.cases[i - 1];
+            visit_push_stmt_block(visitor, c->block);
+            visit_push_exprs(visitor, c->exprs, c->num_exprs);
+        }
+        visit_push(visitor, ast_expr(stmt->switch_stmt.expr));
+        break;
+    case STMT_ASSIGN:
+        visit_push(visitor, ast_expr(stmt->assign.right));
+        visit_push(visitor, ast_expr(stmt->assign.left));
+        break;
+    case STMT_INIT:
+        visit_push(visitor, ast_expr(stmt->init.expr));
+        break;
+    case STMT_EXPR:
+        visit_push(visitor, ast_expr(stmt->expr));
+        break;
+    default:
+        break;
+    }
+}
+
+void visit_push_children(AstVisitor *visitor, AstNode node) {
+    switch (node.kind) {
+    case AST_TYPESPEC:
+        visit_push_typespec_children(visitor, node.typespec);
+        break;
+    case AST_DECL:
+        visit_push_decl_children(visitor, node.decl);
+        break;
+    case AST_EXPR:
+        visit_push_expr_children(visitor, node.expr);
+        break;
+    case AST_STMT:
+        visit_push_stmt_children(visitor, node.stmt);
+        break;
+    default:
+        assert(0);
+        break;
+    }
+}
+
+// Returns false if a callback stopped the walk.
+bool ast_visit(AstVisitor *visitor, AstNode node) {
+    size_t base = buf_len(visitor->stack);
+    visit_push(visitor, node);
+    while (buf_len(visitor->stack) > base) {
+        VisitFrame frame = buf_pop(visitor->stack);
+        if (frame.post) {
+            if (visitor->post(frame.node, visitor->ctx) == VISIT_STOP) {
+                buf_truncate(visitor->stack, base);
+                return false;
+            }
+            continue;
+        }
+        VisitResult result = visitor->pre ? visitor->pre(frame.node, visitor->ctx) : VISIT_CONTINUE;
+        if (result == VISIT_STOP) {
+            buf_truncate(visitor->stack, base);
+            return false;
+        }
+        if (result == VISIT_SKIP) {
+            continue;
+        }
+        if (visitor->post) {
+            buf_push(visitor->stack, (VisitFrame){frame.node, true});
+        }
+        visit_push_children(visitor, frame.node);
+    }
+    return true;
+}
+
+bool ast_visit_decls(AstVisitor *visitor, Decl **decls, size_t num_decls) {
+    for (size_t i = 0; i < num_decls; i++) {
+        if (!ast_visit(visitor, ast_decl(decls[i]))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void visitor_free(AstVisitor *visitor) {
+    buf_free(visitor->stack);
+}
+
+typedef struct VisitTestCtx {
+    char *trace;
+    size_t depth;
+    size_t max_depth;
+    const char *stop_name;
+} VisitTestCtx;
+
+VisitResult visit_test_pre(AstNode node, void *ctx) {
+    VisitTestCtx *test = ctx;
+    test->depth++;
+    test->max_depth = test->depth > test->max_depth ? test->depth : test->max_depth;
+    if (node.kind == AST_EXPR && node.expr->kind == EXPR_IDENT) {
+        buf_printf(test->trace, "%s ", node.expr->name);
+        if (node.expr->name == test->stop_name) {
+            return VISIT_STOP;
+        }
+    } else if (node.kind == AST_EXPR && node.expr->kind == EXPR_INT) {
+        buf_printf(test->trace, "%llu ", node.expr->int_val);
+    } else if (node.kind == AST_STMT && node.stmt->kind == STMT_WHILE) {
+        test->depth--;
+        return VISIT_SKIP;
+    }
+    return VISIT_CONTINUE;
+}
+
+VisitResult visit_test_post(AstNode node, void *ctx) {
+    VisitTestCtx *test = ctx;
+    test->depth--;
+    if (node.kind == AST_DECL) {
+        buf_printf(test->trace, "/%s", node.decl->name);
+    }
+    return VISIT_CONTINUE;
+}
+
+void visit_test(void) {
+    init_stream("fn f(x: int): int { a := b[1] + c(2, d); if (e) { f; } else if (g) { h; } else { i; } while (j) { k; } return l ? m : 3; }");
+    Decl *decl = parse_decl();
+    VisitTestCtx ctx = {0};
+    AstVisitor visitor = {.pre = visit_test_pre, .post = visit_test_post, .ctx = &ctx};
+    assert(ast_visit(&visitor, ast_decl(decl)));
+    assert(strcmp(ctx.trace, "b 1 c 2 d e f g h i l m 3 /f") == 0);
+    assert(ctx.depth == 0 && buf_len(visitor.stack) == 0);
+
+    buf_clear(ctx.trace);
+    ctx.stop_name = str_intern("g");
+    assert(!ast_visit(&visitor, ast_decl(decl)));
+    assert(strcmp(ctx.trace, "b 1 c 2 d e f g ") == 0);
+    assert(buf_len(visitor.stack) == 0);
+
+    // A chain far deeper than a recursive walk could survive.
+    Expr *expr = expr_int(0);
+    for (int i = 0; i < 1000000; i++) {
+        expr = expr_unary('-', expr);
+    }
+    buf_clear(ctx.trace);
+    ctx.depth = ctx.max_depth = 0;
+    ctx.stop_name = NULL;
+    assert(ast_visit(&visitor, ast_expr(expr)));
+    assert(ctx.max_depth == 1000001 && strcmp(ctx.trace, "0 ") == 0);
+    buf_free(ctx.trace);
+    visitor_free(&visitor);
+}
+
+void typespec_test(void) {
+    Typespec *int_type = typespec_ident(str_intern("int"));
+    assert(typespec_ident(str_intern("int")) == int_type);
+    assert(typespec_ident(str_intern("float")) != int_type);
+    Typespec *int_ptr = typespec_ptr(int_type);
+    assert(typespec_ptr(typespec_ident(str_intern("int"))) == int_ptr);
+    assert(typespec_ptr(int_ptr) != int_ptr);
+
+    assert(typespec_array(int_type, expr_int(4)) == typespec_array(int_type, expr_int(4)));
+    assert(typespec_array(int_type, expr_int(4)) != typespec_array(int_type, expr_int(5)));
+    assert(typespec_array(int_type, expr_ident(str_intern("n"))) != typespec_array(int_type, expr_ident(str_intern("n"))));
+    assert(typespec_array(int_type, NULL) != typespec_array(int_type, expr_int(4)));
+    Expr *size = expr_binary('+', expr_int(1), expr_int(2));
+    assert(typespec_array(int_type, size) != typespec_array(int_type, expr_binary('+', expr_int(1), expr_int(2))));
+    assert(typespec_array(int_type, size) == typespec_array(int_type, size));
+
+    Typespec *args[] = {int_type, int_ptr};
+    Typespec *fn = typespec_fn(args, 2, int_type);
+    Typespec *same_args[] = {typespec_ident(str_intern("int")), typespec_ptr(int_type)};
+    assert(typespec_fn(same_args, 2, int_type) == fn);
+    assert(typespec_fn(args, 1, int_type) != fn);
+    assert(typespec_fn(args, 2, NULL) != fn);
+    assert(fn->fn.args != args && fn->fn.args[1] == int_ptr);
+
+    init_stream("fn f(a: int*, b: int*): int* { p := (:int*){a}; }");
+    Decl *d = parse_decl();
+    assert(d->fn.params[0].type == int_ptr && d->fn.params[1].type == int_ptr && d->fn.ret_type == int_ptr);
+    assert(d->fn.block.stmts[0]->init.expr->compound.type == int_ptr);
+
+    // The same size name bound to a global in one fn and to a param in the
+    // other must not share a node, or resolving one rebinds the other.
+    init_stream("const n = 4\n"
+                "fn g(): int { y := (:int[n]){1}; return y[0]; }\n"
+                "fn f(n: int): int { x := (:int[n]){1}; return x[0]; }");
+    Decl **decls = parse_file();
+    assert(num_syntax_errors == 0);
+    Typespec *g_type = decls[1]->fn.block.stmts[0]->init.expr->compound.type;
+    Typespec *f_type = decls[2]->fn.block.stmts[0]->init.expr->compound.type;
+    assert(g_type != f_type && g_type->array.size != f_type->array.size);
+    assert(resolve_decls(decls, buf_len(decls)));
+    assert(g_type->array.size->sym->kind == SYM_CONST && f_type->array.size->sym->kind == SYM_PARAM);
+    buf_free(decls);
+    resolve_reset();
+}
+
+void expr_hash_test(void) {
+    const char *exprs[] = {"a.b[i].x", "a.b[i].y", "a.b[j].x", "a.c[i].x", "f(x, 1)", "f(1, x)", "f(x)", "-x + 1",
+                           "x - 1", "c ? 1.5 : \"s\"", "c ? 1.5 : \"t\"", "(:int*){p}", "(:int*){q}"};
+    size_t n = sizeof(exprs) / sizeof(*exprs);
+    for (size_t i = 0; i < n; i++) {
+        init_stream(exprs[i]);
+        Expr *a = parse_expr();
+        for (size_t j = 0; j < n; j++) {
+            init_stream(exprs[j]);
+            Expr *b = parse_expr();
+            assert(expr_equal(a, b) == (i == j));
+            assert((expr_hash(a) == expr_hash(b)) == (i == j));
+        }
+    }
+}
+
+void ast_test(void) {
+    typespec_test();
+    expr_hash_test();
+    Arena old_arena = ast_arena;
+    TypespecTable old_table = typespec_table;
+    ast_arena = (Arena){0};
+    typespec_table = (TypespecTable){0};
+    init_stream("fn f(n: int*): int { for (i := 0; i < n; i++) { if (i) { g(i, 1); } else if (j) { break; } } return n; }");
+    Decl *decls[] = {parse_decl()};
+    Decl *old = decls[0];
+    Stmt *old_loop = old->fn.block.stmts[0];
+    old->fn.never_returns = true;
+    ast_compact(decls, 1);
+    Decl *d = decls[0];
+    assert(d != old && d->kind == DECL_FN && d->name == str_intern("f") && d->fn.never_returns);
+    assert(d->fn.num_params == 1 && d->fn.params[0].type->kind == TYPESPEC_PTR);
+    assert(d->fn.block.num_stmts == 2);
+    // Parents precede their subtrees: fn, then its params' types, then the loop.
+    Stmt *loop = d->fn.block.stmts[0];
+    assert(loop != old_loop && loop->kind == STMT_FOR);
+    assert((char *)d < (char *)d->fn.params[0].type && (char *)d->fn.params[0].type < (char *)loop);
+    assert((char *)loop < (char *)loop->for_stmt.init && (char *)loop->for_stmt.init < (char *)loop->for_stmt.cond);
+    Stmt *if_stmt = loop->for_stmt.block.stmts[0];
+    assert(if_stmt->kind == STMT_IF && if_stmt->if_stmt.num_elseifs == 1);
+    assert(if_stmt->if_stmt.elseifs[0].block.stmts[0]->kind == STMT_BREAK);
+    Expr *call = if_stmt->if_stmt.then_block.stmts[0]->expr;
+    assert(call->kind == EXPR_CALL && call->call.num_args == 2 && call->call.args[1]->int_val == 1);
+    assert(d->fn.block.stmts[1]->return_stmt.expr->name == str_intern("n"));
+    assert(d->fn.params[0].type == typespec_ptr(typespec_ident(str_intern("int"))));
+    arena_free(&ast_arena);
+    typespec_table_free();
+    ast_arena = old_arena;
+    typespec_table = old_table;
+    visit_test();
+}
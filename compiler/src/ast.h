@@ -7,9 +7,15 @@ typedef struct Expr Expr;
 typedef struct Stmt Stmt;
 typedef struct Decl Decl;
 typedef struct Typespec Typespec;
+typedef struct Sym Sym;
+typedef struct Type Type;
+typedef struct SwitchPlan SwitchPlan;
+
+extern Arena ast_arena;
 
 void *ast_alloc(size_t size);
 void *ast_dup(const void *src, size_t size);
+void *ast_place(char **cursor, const void *src, size_t size);
 
 typedef struct StmtBlock {
     Stmt **stmts;
@@ -22,6 +28,7 @@ typedef enum TypespecKind {
     TYPESPEC_FN,
     TYPESPEC_ARRAY,
     TYPESPEC_PTR,
+    TYPESPEC_ERROR,
 } TypespecKind;
 
 typedef struct FnTypespec {
@@ -41,7 +48,7 @@ typedef struct ArrayTypespec {
 
 struct Typespec {
     TypespecKind kind;
-    struct {
+    union {
         const char *name;
         FnTypespec fn;
         ArrayTypespec array;
@@ -54,6 +61,20 @@ Typespec *typespec_ident(const char *name);
 Typespec *typespec_ptr(Typespec *elem);
 Typespec *typespec_array(Typespec *elem, Expr *size);
 Typespec *typespec_fn(Typespec **args, size_t num_args, Typespec *ret);
+Typespec *typespec_error(void);
+
+typedef struct TypespecTable {
+    Typespec **slots;
+    size_t cap;
+    size_t len;
+    size_t bytes;
+    size_t uses;
+} TypespecTable;
+
+extern TypespecTable typespec_table;
+
+Typespec *typespec_canonical(Typespec *type);
+void typespec_table_free(void);
 
 typedef enum DeclKind {
     DECL_NONE,
@@ -64,6 +85,7 @@ typedef enum DeclKind {
     DECL_CONST,
     DECL_TYPEDEF,
     DECL_FN,
+    DECL_ERROR,
 } DeclKind;
 
 typedef struct EnumItem {
@@ -97,6 +119,7 @@ typedef struct FnDecl {
     size_t num_params;
     Typespec *ret_type;
     StmtBlock block;
+    bool never_returns; // Set by dce_decls
 } FnDecl;
 
 typedef struct TypedefDecl {
@@ -133,6 +156,7 @@ Decl *decl_let(const char *name, Typespec *type, Expr *expr);
 Decl *decl_fn(const char *name, FnParam *params, size_t num_params, Typespec *ret_type, StmtBlock block);
 Decl *decl_const(const char *name, Expr *expr);
 Decl *decl_typedef(const char *name, Typespec *type);
+Decl *decl_error(void);
 
 typedef enum ExprKind {
     EXPR_NONE,
@@ -148,6 +172,7 @@ typedef enum ExprKind {
     EXPR_UNARY,
     EXPR_BINARY,
     EXPR_TERNARY,
+    EXPR_ERROR,
 } ExprKind;
 
 typedef struct CompoundExpr {
@@ -196,11 +221,18 @@ typedef struct FieldExpr {
 
 struct Expr {
     ExprKind kind;
+    Type *type; // Set by the checker
     union {
-        uint64_t int_val;
+        struct {
+            uint64_t int_val;
+            TokenMod int_mod; // How the literal was written, for fmt
+        };
         double float_val;
         const char *str_val;
-        const char *name;
+        struct {
+            const char *name;
+            Sym *sym; // What the name is bound to, once resolved
+        };
         CompoundExpr compound;
         CastExpr cast;
         UnaryExpr unary;
@@ -225,6 +257,7 @@ Expr *expr_field(Expr *expr, const char *name);
 Expr *expr_unary(TokenKind op, Expr *expr);
 Expr *expr_binary(TokenKind op, Expr *left, Expr *right);
 Expr *expr_ternary(Expr *cond, Expr *then_expr, Expr *else_expr);
+Expr *expr_error(void);
 
 typedef enum StmtKind {
     STMT_NONE,
@@ -240,6 +273,7 @@ typedef enum StmtKind {
     STMT_ASSIGN,
     STMT_INIT,
     STMT_EXPR,
+    STMT_ERROR,
 } StmtKind;
 
 typedef struct ReturnStmt {
@@ -282,6 +316,7 @@ typedef struct SwitchStmt {
     Expr *expr;
     SwitchCase *cases;
     size_t num_cases;
+    SwitchPlan *plan; // Set by the checker when every case is constant
 } SwitchStmt;
 
 typedef struct AssignStmt {
@@ -323,20 +358,143 @@ Stmt *stmt_switch(Expr *expr, SwitchCase *cases, size_t num_cases);
 Stmt *stmt_assign(TokenKind op, Expr *left, Expr *right);
 Stmt *stmt_init(const char *name, Expr *expr);
 Stmt *stmt_expr(Expr *expr);
+Stmt *stmt_error(void);
+
+/*
+ * Nodes are right-sized: each is allocated with only the bytes its kind
+ * needs (*_size), not the full union, so never copy or assign a whole node
+ * struct and never change a node's kind to one with a larger payload. Child
+ * arrays passed to the builders are copied so they sit right after the node
+ * that owns them, and callers keep ownership of what they pass in.
+ */
+
+size_t typespec_size(TypespecKind kind);
+size_t decl_size(DeclKind kind);
+size_t expr_size(ExprKind kind);
+size_t stmt_size(StmtKind kind);
+
+/*
+ * Deep copies allocate parents before children, so a copied tree is laid
+ * out in the same depth-first order the recursive passes visit it in.
+ */
+
+Typespec *typespec_copy(Typespec *type);
+Expr *expr_copy(Expr *expr);
+Stmt *stmt_copy(Stmt *stmt);
+StmtBlock stmt_block_copy(StmtBlock block);
+Decl *decl_copy(Decl *decl);
+void ast_compact(Decl **decls, size_t num_decls);
+
+/*
+ * Structural hashing and equality. A node's hash mixes its own fields with
+ * its children's hashes, so equal trees hash equal wherever they sit.
+ * Resolved idents compare by sym and others by name.
+ */
+
+uint64_t expr_hash(Expr *expr);
+bool expr_equal(Expr *a, Expr *b);
+
+/*
+ * Iterative traversal. Nodes are visited in the same order the recursive
+ * passes use, but pending nodes live on the visitor's own stack instead of
+ * the C stack, so arbitrarily deep trees are safe. pre runs before a node's
+ * children and post after them; either may be NULL. Returning VISIT_SKIP
+ * from pre skips the node's children and its post callback, and VISIT_STOP
+ * from either callback ends the walk. The stack is kept between walks, so
+ * reuse one visitor and release it with visitor_free.
+ */
+
+typedef enum AstNodeKind {
+    AST_NONE,
+    AST_TYPESPEC,
+    AST_DECL,
+    AST_EXPR,
+    AST_STMT,
+} AstNodeKind;
+
+typedef struct AstNode {
+    AstNodeKind kind;
+    union {
+        void *ptr;
+        Typespec *typespec;
+        Decl *decl;
+        Expr *expr;
+        Stmt *stmt;
+    };
+} AstNode;
+
+typedef enum VisitResult {
+    VISIT_CONTINUE,
+    VISIT_SKIP,
+    VISIT_STOP,
+} VisitResult;
+
+typedef VisitResult (*VisitFunc)(AstNode node, void *ctx);
+
+typedef struct VisitFrame {
+    AstNode node;
+    bool post;
+} VisitFrame;
+
+typedef struct AstVisitor {
+    VisitFunc pre;
+    VisitFunc post;
+    void *ctx;
+    VisitFrame *stack;
+} AstVisitor;
+
+AstNode ast_typespec(Typespec *typespec);
+AstNode ast_decl(Decl *decl);
+AstNode ast_expr(Expr *expr);
+AstNode ast_stmt(Stmt *stmt);
+bool ast_visit(AstVisitor *visitor, AstNode node);
+bool ast_visit_decls(AstVisitor *visitor, Decl **decls, size_t num_decls);
+void visitor_free(AstVisitor *visitor);
+void ast_test(void);
 
 /*
  * print.c
+ *
+ * The printer appends to printer.buf and writes it out in bulk to
+ * printer.file (stdout when NULL) whenever it passes PRINT_FLUSH_SIZE.
+ * Anything that mixes printf with printing AST nodes must call print_flush
+ * first. While capturing, output stays in memory until print_release.
  */
 
+#define PRINT_FLUSH_SIZE (64 * 1024)
+
+typedef struct Printer {
+    char *buf;
+    FILE *file;
+    bool capture;
+} Printer;
+
+extern Printer printer;
+
+void print_flush(void);
+void print_capture(void);
+char *print_release(void);
+char *print_reserve(size_t len);
+void print_chars(const char *str, size_t len);
+void print_str(const char *str);
+void print_char(char c);
+void print_uint(uint64_t val);
+void print_double(double val);
+void print_syntax_errors(void);
 void print_expr(Expr *expr);
 void print_stmt(Stmt *stmt);
 void print_decl(Decl *decl);
+void print_decls(Decl **decls, size_t num_decls);
 void print_test(void);
+void print_sink_test(void);
 
 /*
  * parse.c
  */
 
+bool is_decl_keyword(void);
+bool is_stmt_keyword(void);
+void synchronize(const char *start, bool in_block);
 Typespec *parse_type_fn(void);
 Typespec *parse_type_base(void);
 Typespec *parse_type(void);
@@ -376,5 +534,909 @@ Decl *parse_decl_typedef(void);
 FnParam parse_decl_fn_param(void);
 Decl *parse_decl_fn(void);
 Decl *parse_decl(void);
+Decl **parse_file(void);
+void free_stmt_block(StmtBlock block);
 void parse_and_print_decl(const char *str);
 void parse_test(void);
+
+/*
+ * pool.c
+ *
+ * Alternative compact AST: nodes live in per-kind pools and refer to each
+ * other through 32-bit handles instead of pointers. A handle packs the node
+ * kind into its top POOL_KIND_BITS and the index into that kind's pool into
+ * the rest; 0 is the null handle since every *_NONE kind is 0. Child lists
+ * (call args, block statements, ...) are IdList ranges into the shared
+ * ast_pool.ids array. Kinds with identical payloads share a pool.
+ */
+
+typedef uint32_t ExprId;
+typedef uint32_t StmtId;
+typedef uint32_t DeclId;
+typedef uint32_t TypespecId;
+
+#define POOL_NONE 0
+#define POOL_KIND_BITS 4
+#define POOL_INDEX_BITS (32 - POOL_KIND_BITS)
+#define POOL_MAX_INDEX (1u << POOL_INDEX_BITS)
+#define POOL_MAKE_ID(kind, index) (assert((size_t)(index) < POOL_MAX_INDEX), ((uint32_t)(kind) << POOL_INDEX_BITS) | (uint32_t)(index))
+#define POOL_KIND(id) ((id) >> POOL_INDEX_BITS)
+#define POOL_INDEX(id) ((id) & (POOL_MAX_INDEX - 1))
+
+typedef struct IdList {
+    uint32_t start;
+    uint32_t len;
+} IdList;
+
+typedef struct PoolCastExpr {
+    TypespecId type;
+    ExprId expr;
+} PoolCastExpr;
+
+typedef struct PoolCallExpr {
+    ExprId expr;
+    IdList args;
+} PoolCallExpr;
+
+typedef struct PoolCompoundExpr {
+    TypespecId type;
+    IdList args;
+} PoolCompoundExpr;
+
+typedef struct PoolIndexExpr {
+    ExprId expr;
+    ExprId index;
+} PoolIndexExpr;
+
+typedef struct PoolFieldExpr {
+    const char *name;
+    ExprId expr;
+} PoolFieldExpr;
+
+typedef struct PoolUnaryExpr {
+    TokenKind op;
+    ExprId expr;
+} PoolUnaryExpr;
+
+typedef struct PoolBinaryExpr {
+    TokenKind op;
+    ExprId left;
+    ExprId right;
+} PoolBinaryExpr;
+
+typedef struct PoolTernaryExpr {
+    ExprId cond;
+    ExprId then_expr;
+    ExprId else_expr;
+} PoolTernaryExpr;
+
+typedef struct PoolElseIf {
+    ExprId cond;
+    IdList block;
+} PoolElseIf;
+
+typedef struct PoolIfStmt {
+    ExprId cond;
+    IdList then_block;
+    IdList elseifs;
+    IdList else_block;
+} PoolIfStmt;
+
+typedef struct PoolWhileStmt {
+    ExprId cond;
+    IdList block;
+} PoolWhileStmt;
+
+typedef struct PoolForStmt {
+    StmtId init;
+    ExprId cond;
+    StmtId next;
+    IdList block;
+} PoolForStmt;
+
+typedef struct PoolSwitchCase {
+    IdList exprs;
+    bool is_default;
+    IdList block;
+} PoolSwitchCase;
+
+typedef struct PoolSwitchStmt {
+    ExprId expr;
+    IdList cases;
+} PoolSwitchStmt;
+
+typedef struct PoolAssignStmt {
+    TokenKind op;
+    ExprId left;
+    ExprId right;
+} PoolAssignStmt;
+
+typedef struct PoolInitStmt {
+    const char *name;
+    ExprId expr;
+} PoolInitStmt;
+
+typedef struct PoolEnumItem {
+    const char *name;
+    ExprId expr;
+} PoolEnumItem;
+
+typedef struct PoolAggregateItem {
+    IdList names;
+    TypespecId type;
+} PoolAggregateItem;
+
+typedef struct PoolFnParam {
+    const char *name;
+    TypespecId type;
+} PoolFnParam;
+
+// One record serves every decl kind: items indexes enum_items,
+// aggregate_items or params depending on the kind, type is the let/typedef
+// type or fn return type and block is the fn body.
+typedef struct PoolDecl {
+    const char *name;
+    TypespecId type;
+    ExprId expr;
+    IdList items;
+    IdList block;
+} PoolDecl;
+
+typedef struct PoolFnTypespec {
+    IdList args;
+    TypespecId ret;
+} PoolFnTypespec;
+
+typedef struct PoolArrayTypespec {
+    TypespecId elem;
+    ExprId size;
+} PoolArrayTypespec;
+
+typedef struct AstPool {
+    uint64_t *ints;
+    double *floats;
+    const char **names;
+    PoolCastExpr *casts;
+    PoolCallExpr *calls;
+    PoolIndexExpr *indexes;
+    PoolFieldExpr *fields;
+    PoolCompoundExpr *compounds;
+    PoolUnaryExpr *unaries;
+    PoolBinaryExpr *binaries;
+    PoolTernaryExpr *ternaries;
+    ExprId *stmt_exprs;
+    IdList *blocks;
+    PoolIfStmt *ifs;
+    PoolElseIf *elseifs;
+    PoolWhileStmt *whiles;
+    PoolForStmt *fors;
+    PoolSwitchStmt *switches;
+    PoolSwitchCase *cases;
+    PoolAssignStmt *assigns;
+    PoolInitStmt *inits;
+    PoolDecl *decls;
+    PoolEnumItem *enum_items;
+    PoolAggregateItem *aggregate_items;
+    PoolFnParam *params;
+    PoolFnTypespec *typespec_fns;
+    PoolArrayTypespec *typespec_arrays;
+    uint32_t *ids;
+} AstPool;
+
+extern AstPool ast_pool;
+
+void pool_reset(void);
+size_t pool_bytes(void);
+
+TypespecId pool_typespec_ident(const char *name);
+TypespecId pool_typespec_ptr(TypespecId elem);
+TypespecId pool_typespec_array(TypespecId elem, ExprId size);
+TypespecId pool_typespec_fn(TypespecId *args, size_t num_args, TypespecId ret);
+TypespecId pool_typespec_error(void);
+
+DeclId pool_decl_enum(const char *name, PoolEnumItem *items, size_t num_items);
+DeclId pool_decl_aggregate(DeclKind kind, const char *name, PoolAggregateItem *items, size_t num_items);
+DeclId pool_decl_let(const char *name, TypespecId type, ExprId expr);
+DeclId pool_decl_fn(const char *name, PoolFnParam *params, size_t num_params, TypespecId ret_type, IdList block);
+DeclId pool_decl_const(const char *name, ExprId expr);
+DeclId pool_decl_typedef(const char *name, TypespecId type);
+DeclId pool_decl_error(void);
+
+ExprId pool_expr_int(uint64_t value);
+ExprId pool_expr_float(double value);
+ExprId pool_expr_str(const char *str);
+ExprId pool_expr_ident(const char *name);
+ExprId pool_expr_compound(TypespecId type, ExprId *args, size_t num_args);
+ExprId pool_expr_cast(TypespecId type, ExprId expr);
+ExprId pool_expr_call(ExprId expr, ExprId *args, size_t num_args);
+ExprId pool_expr_index(ExprId expr, ExprId index);
+ExprId pool_expr_field(ExprId expr, const char *name);
+ExprId pool_expr_unary(TokenKind op, ExprId expr);
+ExprId pool_expr_binary(TokenKind op, ExprId left, ExprId right);
+ExprId pool_expr_ternary(ExprId cond, ExprId then_expr, ExprId else_expr);
+ExprId pool_expr_error(void);
+
+IdList pool_stmt_list(StmtId *stmts, size_t num_stmts);
+StmtId pool_stmt_return(ExprId expr);
+StmtId pool_stmt_break(void);
+StmtId pool_stmt_continue(void);
+StmtId pool_stmt_block(IdList block);
+StmtId pool_stmt_if(ExprId cond, IdList then_block, PoolElseIf *elseifs, size_t num_elseifs, IdList else_block);
+StmtId pool_stmt_while(ExprId cond, IdList block);
+StmtId pool_stmt_do_while(ExprId cond, IdList block);
+StmtId pool_stmt_for(StmtId init, ExprId cond, StmtId next, IdList block);
+StmtId pool_stmt_switch(ExprId expr, PoolSwitchCase *cases, size_t num_cases);
+StmtId pool_stmt_assign(TokenKind op, ExprId left, ExprId right);
+StmtId pool_stmt_init(const char *name, ExprId expr);
+StmtId pool_stmt_expr(ExprId expr);
+StmtId pool_stmt_error(void);
+
+TypespecId pool_from_typespec(Typespec *type);
+ExprId pool_from_expr(Expr *expr);
+StmtId pool_from_stmt(Stmt *stmt);
+IdList pool_from_stmt_block(StmtBlock block);
+DeclId pool_from_decl(Decl *decl);
+void pool_test(void);
+
+/*
+ * astfile.c
+ *
+ * Binary AST files. The image section holds the nodes in the arena's
+ * right-sized layout and depth-first order, with each pointer stored as an
+ * offset into the image and each string as an index into the string table.
+ * The relocation tables list those slots, so loading never decodes nodes:
+ * the file is mapped privately, pointers are rebased in place and strings
+ * are interned. Typespec slots have their own table so loaded typespecs can
+ * be merged into the hash-consing table. Files are tied to the writer's
+ * pointer size and byte order, and only offsets are validated on load.
+ */
+
+#define AST_FILE_MAGIC "RIONAST"
+#define AST_FILE_VERSION 5
+
+typedef struct AstFileSection {
+    uint64_t offset;
+    uint64_t count;
+} AstFileSection;
+
+typedef struct AstFileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t ptr_size;
+    uint32_t byte_order;
+    uint32_t reserved;
+    uint64_t file_size;
+    AstFileSection image;       // Node bytes.
+    AstFileSection decls;       // Root Decl * array, as an image offset.
+    AstFileSection strs;        // Packed uint32 length, bytes, NUL.
+    AstFileSection relocs;      // uint32 image offsets of pointer slots.
+    AstFileSection str_relocs;  // uint32 image offsets of string slots.
+    AstFileSection type_relocs; // uint32 image offsets of Typespec * slots.
+    AstFileSection typespecs;   // uint32 Typespec node offsets, children first.
+} AstFileHeader;
+
+extern const char *ast_file_error;
+
+char *ast_file_write_mem(Decl **decls, size_t num_decls);
+bool ast_file_write(const char *path, Decl **decls, size_t num_decls);
+Decl **ast_file_load_mem(char *data, size_t size, size_t *num_decls);
+Decl **ast_file_load(const char *path, size_t *num_decls);
+void ast_file_test(void);
+
+/*
+ * cache.c
+ *
+ * On-disk cache of parsed top-level declarations, keyed by a hash of each
+ * declaration's token text, so changes to layout or to other declarations
+ * still hit. Each source file gets a pack: its decls in one AST file,
+ * behind their hashes and, when the whole file parsed cleanly, a hash of
+ * its text and the order of its decls. A pack is read with a single call,
+ * and an unchanged file is rebuilt from it without being lexed at all.
+ * Decls parsed since the pack was written go to a small delta pack next to
+ * it, and once that holds more than 1/DECL_CACHE_DELTA_RATIO of the file's
+ * decls both are replaced by one new pack. Packs are written to a
+ * temporary name and renamed into place. Loading refreshes a pack's mtime
+ * (at most once per DECL_CACHE_TOUCH_SECS), and once the directory grows
+ * past max_bytes the least recently used packs are deleted. Declarations
+ * with errors are never cached. With resident set, parsed and loaded decls
+ * are also kept in memory by hash and shared by later parses, for
+ * long-running processes.
+ */
+
+#define DECL_CACHE_MAX_BYTES (256 << 20)
+#define DECL_CACHE_TOUCH_SECS 60
+#define DECL_CACHE_DELTA_RATIO 4
+#define DECL_CACHE_PACK_MAGIC "RIONPAK"
+
+typedef struct CachePack {
+    bool loaded;
+    uint64_t src_hash;
+    const uint64_t *order; // Decl hashes in source order, if complete
+    size_t num_order;
+    size_t num_decls;
+    Map decls; // Decl hash to decl
+} CachePack;
+
+typedef struct DeclCache {
+    const char *dir;
+    size_t max_bytes;
+    size_t hits;
+    size_t misses;
+    size_t loads;
+    size_t stores;
+    size_t evictions;
+    char **entries; // Loaded pack contents, which cached decls point into.
+    bool resident;
+    Map resident_decls;
+} DeclCache;
+
+extern DeclCache decl_cache;
+
+bool decl_cache_init(const char *dir);
+Decl **parse_file_cached(void);
+void decl_cache_evict(void);
+void decl_cache_free(void);
+void cache_test(void);
+
+/*
+ * fmt.c
+ *
+ * `rionc fmt` regenerates canonical source from the AST through the
+ * printer: four-space indents, one statement per line and only the
+ * parentheses precedence requires. Int literals keep their base or char
+ * form, which the AST records, but other literals come out in canonical
+ * form from their values.
+ */
+
+#define FMT_MAX_ARENA_BLOCKS 256
+
+void fmt_decl(Decl *decl);
+bool fmt_stream(void);
+int fmt_path(const char *path, bool write);
+int fmt_paths(const char **paths, size_t num_paths, bool write, int num_jobs);
+void fmt_test(void);
+
+/*
+ * server.c
+ *
+ * Warm compiler daemon. `rionc --serve socket` keeps keywords, interned
+ * strings and resident parsed decls across requests, which arrive one per
+ * connection as a line of text ("compile <path>" or "shutdown"). The reply
+ * is a "<status> <length>" line followed by the output the request would
+ * have printed. Fatal errors fail only the request that raised them.
+ */
+
+#define SERVER_MAX_ARENA_BLOCKS (1 << 20)
+#define SERVER_TIMEOUT_SECS 10.0
+
+extern double server_timeout_secs;
+
+int server_run(int (*fn)(const char *arg), const char *arg, char **output);
+bool server_handle(int conn);
+int serve(const char *socket_path);
+int server_request(const char *socket_path, const char *request, FILE *out);
+void server_test(void);
+
+/*
+ * export.c
+ *
+ * Streams decls through the printer as JSON or as a compact binary form.
+ * Both follow the AST field order. JSON nodes are objects tagged by
+ * "kind", with null for absent children. Binary nodes are a varint kind
+ * (0 for NULL) followed by their fields, lists are a varint count plus
+ * items, floats are 8 little-endian bytes and names go through a string
+ * table: 0, length and bytes the first time, index + 1 afterwards. Bump
+ * AST_EXPORT_VERSION whenever either layout changes.
+ */
+
+#define AST_EXPORT_MAGIC "RIONEXP"
+#define AST_EXPORT_VERSION 1
+
+void ast_export_json(Decl **decls, size_t num_decls);
+void ast_export_binary(Decl **decls, size_t num_decls);
+Decl **ast_import_binary(const char *data, size_t size);
+void export_test(void);
+
+/*
+ * resolve.c
+ *
+ * Global symbol table. Every top-level decl and enum item gets a Sym keyed
+ * by its interned name, so lookups are one hash probe and declaration order
+ * does not matter. resolve_decls then fills ordered_syms so each decl comes
+ * after everything it needs complete, reporting unresolved names, duplicate
+ * definitions and cycles in resolve_errors. It then resolves fn bodies, so
+ * every EXPR_IDENT's sym is the global, param or local it names.
+ */
+
+typedef enum SymKind {
+    SYM_NONE,
+    SYM_TYPE,
+    SYM_CONST,
+    SYM_ENUM_CONST,
+    SYM_LET,
+    SYM_FN,
+    SYM_PARAM,
+    SYM_LOCAL,
+} SymKind;
+
+typedef struct ConstVal {
+    Type *type;
+    union {
+        int64_t i; // Every integer type but uint
+        uint64_t u;
+        double f;
+    };
+} ConstVal;
+
+typedef enum SymState {
+    SYM_UNRESOLVED,
+    SYM_RESOLVING,
+    SYM_RESOLVED,
+} SymState;
+
+struct Sym {
+    const char *name;
+    SymKind kind;
+    SymState state;
+    Decl *decl; // NULL for builtin types; the enclosing fn for locals
+    Sym *parent; // The enum's sym for enum items
+    size_t id; // Index in syms, or the slot number within the fn for locals
+    size_t deps_start; // Slice of sym_deps
+    size_t num_deps;
+    Stmt *init; // Defining init stmt for locals
+    Sym *shadowed; // Binding of the same name this local hides
+    int depth; // Block nesting depth for locals
+    Type *type; // Set by the checker; unused for locals, whose init expr has it
+    SymState check_state;
+    SymState eval_state;
+    ConstVal val; // Value of consts and enum items; a NULL type if it failed
+};
+
+#define RESOLVE_MIN_FNS_PER_THREAD 64
+
+extern const char *sym_kind_names[];
+extern Arena sym_arena;
+extern Sym **syms;
+extern Sym **sym_deps;
+extern Sym **ordered_syms;
+extern char **resolve_errors;
+extern size_t resolve_threads; // Workers for local resolution; 0 means one per CPU
+
+Sym *sym_get(const char *name);
+void resolve_globals(Decl **decls, size_t num_decls);
+void resolve_locals(Decl **decls, size_t num_decls);
+bool resolve_decls(Decl **decls, size_t num_decls);
+void resolve_reset(void);
+void resolve_test(void);
+
+/*
+ * type.c
+ *
+ * Semantic types. Pointer, array and fn types are interned in type_table
+ * by structure, so every distinct type has one canonical node and type
+ * equality is pointer equality. Structs, unions and enums are nominal: one
+ * node per decl, created incomplete and given fields when checked.
+ */
+
+// Sizes stay within what an int can hold.
+#define TYPE_MAX_SIZE ((size_t)INT64_MAX)
+
+typedef enum TypeKind {
+    TYPE_NONE,
+    TYPE_ERROR,
+    TYPE_VOID,
+    TYPE_BOOL,
+    TYPE_CHAR,
+    TYPE_INT,
+    TYPE_UINT,
+    TYPE_FLOAT,
+    TYPE_ENUM,
+    TYPE_PTR,
+    TYPE_ARRAY,
+    TYPE_FN,
+    TYPE_STRUCT,
+    TYPE_UNION,
+} TypeKind;
+
+typedef struct TypeField {
+    const char *name;
+    Type *type;
+    size_t offset;
+} TypeField;
+
+struct Type {
+    TypeKind kind;
+    bool complete;
+    size_t size;
+    size_t align;
+    Sym *sym; // The decl's sym for named types
+    union {
+        struct {
+            Type *elem;
+        } ptr;
+        struct {
+            Type *elem;
+            size_t len; // 0 for arrays of unknown size
+        } array;
+        struct {
+            Type **params;
+            size_t num_params;
+            Type *ret;
+        } fn;
+        struct {
+            TypeField *fields;
+            size_t num_fields;
+        } aggregate;
+    };
+};
+
+typedef struct TypeTable {
+    Type **slots;
+    size_t cap;
+    size_t len;
+    size_t named; // Struct, union and enum types, which are not interned
+    size_t bytes; // Arena bytes held by all types and their fields
+    size_t uses; // Lookups, hits included
+} TypeTable;
+
+extern Type *type_void;
+extern Type *type_bool;
+extern Type *type_char;
+extern Type *type_int;
+extern Type *type_uint;
+extern Type *type_float;
+extern Type *type_error;
+extern TypeTable type_table;
+
+Type *type_builtin(const char *name);
+bool is_integer_type(Type *type);
+bool is_arithmetic_type(Type *type);
+bool is_scalar_type(Type *type);
+bool is_aggregate_type(Type *type);
+Type *type_ptr(Type *elem);
+bool type_array_fits(Type *elem, size_t len);
+Type *type_array(Type *elem, size_t len);
+Type *type_fn(Type **params, size_t num_params, Type *ret);
+Type *type_named(TypeKind kind, Sym *sym);
+bool type_complete_aggregate(Type *type, TypeField *fields, size_t num_fields);
+TypeField *type_field(Type *type, const char *name);
+void type_to_str(char **buf, Type *type);
+const char *temp_type_str(Type *type);
+void type_table_free(void);
+void type_test(void);
+
+/*
+ * check.c
+ *
+ * Type checker. Runs resolution, then gives every global sym its type on
+ * demand (so order does not matter), checks fn bodies and sets the type of
+ * every Expr. Errors go to check_errors as "Type Error: ... in '<decl>'".
+ */
+
+extern char **check_errors;
+
+void vcheck_error(const char *prefix, const char *fmt, va_list args);
+void check_error(const char *fmt, ...);
+Type *sym_type(Sym *sym);
+void check_sym(Sym *sym);
+Type *type_promote(Type *type);
+Type *type_arithmetic(Type *left, Type *right);
+bool type_convertible(Type *from, Type *to);
+void check_syms(void);
+typedef enum PassTestFlags {
+    PASS_TEST_TYPED = 1 << 0, // Check the source before the pass
+    PASS_TEST_CHECK = 1 << 1, // Check the result from scratch after it
+    PASS_TEST_ALL = 1 << 2, // Print every decl, not just the last
+} PassTestFlags;
+
+bool check_decls(Decl **decls, size_t num_decls);
+void check_reset(void);
+void pass_test_case(void (*pass)(Decl **decls, size_t num_decls), PassTestFlags flags, const char *src,
+                    const char *expected);
+void check_test(void);
+
+/*
+ * const.c
+ *
+ * Compile-time evaluation of const initializers, enum items and array
+ * sizes. Each const, and each enum as a whole, is evaluated once when the
+ * checker finishes it and memoized in its syms, with enum items counting
+ * up from the previous one. Integer overflow, division by zero, bad shift
+ * counts and out-of-range conversions are errors ("Const Error: ...").
+ */
+
+extern size_t const_nodes; // Expression nodes evaluated so far
+extern bool const_quiet; // Fail without reporting, for callers that just skip
+
+bool const_eval(Expr *expr, ConstVal *val);
+bool const_truth(ConstVal val);
+bool const_binary_op(TokenKind op, ConstVal left, ConstVal right, ConstVal *val);
+bool const_unary_op(TokenKind op, ConstVal *val);
+bool const_convert(ConstVal *val, Type *type, bool wrap);
+void const_eval_sym(Sym *sym);
+bool decl_const_val(Decl *decl, const char *name, ConstVal *val);
+void print_const_val(ConstVal val);
+void const_test(void);
+
+/*
+ * fold.c
+ *
+ * In-place simplifier. Folds arithmetic, comparisons and ternaries over
+ * int and float literals with the evaluator's rules, leaving anything that
+ * would overflow or divide by zero. On checked trees it also drops
+ * identities (x + 0, x * 1, x | 0, -(-x), ...) and strength-reduces integer
+ * multiplies by powers of two to shifts, and uint divides and remainders to
+ * shifts and masks. Results reuse the nodes they replace.
+ */
+
+typedef struct FoldStats {
+    size_t folded; // Operations on constants replaced by their value
+    size_t simplified; // Identities and constant ternaries removed
+    size_t reduced; // Multiplies, divides and remainders made shifts or masks
+} FoldStats;
+
+extern FoldStats fold_stats;
+
+bool fold_const(Expr *expr, ConstVal *val);
+bool fold_pure(Expr *expr);
+Expr *fold_expr(Expr *expr);
+void fold_decls(Decl **decls, size_t num_decls);
+void fold_test(void);
+
+/*
+ * dce.c
+ *
+ * Dead code elimination over fn bodies, best run after folding. Drops
+ * statements after return, break and continue, if arms whose conditions
+ * are constant, loops that never run and do-while(0) wrappers, rewriting
+ * nodes in place where a statement turns into a block. Conditions count as
+ * constant when they are literals or, on checked trees, const expressions.
+ * Fns with no reachable return and no reachable end get never_returns.
+ */
+
+typedef struct DceStats {
+    size_t stmts_removed;
+    size_t branches_pruned; // if and elseif arms with constant conditions
+    size_t loops_removed;
+    size_t never_returns;
+} DceStats;
+
+extern DceStats dce_stats;
+
+void dce_decls(Decl **decls, size_t num_decls);
+void dce_test(void);
+
+/*
+ * tco.c
+ *
+ * Self tail-call elimination. A fn that returns a call to itself, or ends
+ * in one when it has no return type, has its body wrapped in while (1) and
+ * each such call replaced by assignments to its params and a continue.
+ * Where the call is one operand of +, *, | or ^ on an integer result and
+ * the other is pure, that operand goes into an accumulator that the
+ * remaining returns apply. Works on parsed trees, before resolve_decls, so
+ * the new names and loops are bound and checked like hand-written ones.
+ * Fns that take addresses, or whose locals shadow a param or the fn, are
+ * left alone, as are calls inside loops of the fn's own.
+ */
+
+typedef struct TcoStats {
+    size_t fns;
+    size_t calls; // Tail calls turned into jumps
+    size_t accumulated; // Of those, calls whose result fed an accumulator
+    size_t accumulators;
+} TcoStats;
+
+extern TcoStats tco_stats;
+
+void tco_decls(Decl **decls, size_t num_decls);
+void tco_test(void);
+
+/*
+ * switch.c
+ *
+ * Lowering plans for switches, made by the checker once a switch's cases
+ * are checked. Case values are evaluated at compile time and put in a hash
+ * set, which reports duplicates ("duplicate case 3"). Sorted, they are
+ * gathered into ranges: runs of consecutive values that go to the same
+ * case, grown into jump tables while enough of the table is cases. A
+ * switch that is one table is dense, one with a few ranges is clustered
+ * and checks each in turn, and the rest are sparse and binary search the
+ * ranges. Values are compared as keys that order like the switch's type,
+ * so signed and unsigned switches share the code. A switch with any case
+ * that is not constant has no plan. Plans live in the AST arena like the
+ * switch they belong to, and are copied along with it.
+ */
+
+#define SWITCH_MAX_RANGES 4 // Most ranges checked in turn
+#define SWITCH_MIN_DENSITY 40 // Percent of a jump table's entries that must be cases
+#define SWITCH_MAX_TABLE 4096
+
+typedef enum SwitchKind {
+    SWITCH_TABLE,
+    SWITCH_RANGES,
+    SWITCH_TREE,
+} SwitchKind;
+
+typedef struct SwitchRange {
+    uint64_t lo; // Keys, inclusive
+    uint64_t hi;
+    size_t target; // Case index
+    size_t *table; // Or the case index of each key from lo, for a table
+} SwitchRange;
+
+struct SwitchPlan {
+    SwitchKind kind;
+    size_t default_case; // num_cases without one
+    SwitchRange *ranges; // Sorted
+    size_t num_ranges;
+};
+
+extern const char *switch_kind_names[];
+
+uint64_t switch_key(ConstVal val);
+SwitchPlan *switch_plan(Stmt *stmt, Type *type);
+SwitchPlan *switch_plan_copy(SwitchPlan *plan);
+size_t switch_dispatch(SwitchPlan *plan, uint64_t key);
+void switch_reset(void);
+void switch_test(void);
+
+/*
+ * inline.c
+ *
+ * Inlines calls to small fns on checked trees, keeping them checked. A fn
+ * is small when its body has at most inline_budget nodes, and it must not
+ * refer to itself. One whose body is a lone return has its expr put in
+ * place of the call wherever the call is, with the args substituted for
+ * the params, when the args allow that without temporaries. Otherwise a
+ * fn with its only return at the end, or none, is spliced in where the
+ * call is a whole statement, an init, an assignment's value or a return:
+ * params become locals, and its own locals are renamed to fresh names
+ * built from the callee's, so nothing in the caller is captured. Casts
+ * keep conversions at the call boundary.
+ */
+
+#define INLINE_BUDGET 24
+
+typedef struct InlineStats {
+    size_t calls;
+    size_t exprs; // Calls replaced by a substituted expr
+    size_t splices; // Calls replaced by a spliced body
+    size_t nodes; // Body nodes copied in
+} InlineStats;
+
+extern InlineStats inline_stats;
+extern size_t inline_budget;
+
+void inline_decls(Decl **decls, size_t num_decls);
+void inline_test(void);
+
+/*
+ * unroll.c
+ *
+ * Unrolls for loops with constant trip counts on checked trees, keeping
+ * them checked. A loop counts an int variable from a constant towards a
+ * constant bound by a constant step, and its body must not break out of
+ * it, continue it, assign the variable or take its address. Loops whose
+ * copied bodies fit in unroll_budget nodes are replaced by one block per
+ * trip with the variable's value written in. Others whose body fits
+ * unroll_factor times run that many copies per trip, with the variable
+ * stepped between them, and the original loop finishes any remainder.
+ * Copies get locals of their own, and inner loops are unrolled first.
+ */
+
+#define UNROLL_BUDGET 64
+#define UNROLL_FACTOR 4
+
+typedef struct UnrollStats {
+    size_t full; // Loops replaced by straight-line copies
+    size_t partial; // Loops given several copies per trip
+    size_t copies; // Bodies copied
+} UnrollStats;
+
+extern UnrollStats unroll_stats;
+extern size_t unroll_budget;
+extern size_t unroll_factor;
+
+void unroll_decls(Decl **decls, size_t num_decls);
+void unroll_test(void);
+
+/*
+ * purity.c
+ *
+ * Side effects of fns on checked trees. Each fn's body is scanned once
+ * for what it does itself: reading or writing globals, reading or writing
+ * memory through pointers, and calls through anything but a fn's name.
+ * Writes to a local's own fields and elements stay inside the fn. What a
+ * fn calls adds to what it does, so results are solved over the call
+ * graph one strongly connected component at a time, callees first, and
+ * every fn of a cycle shares its result. Results are cached per fn and
+ * solved on demand. When one fn changes, purity_invalidate rescans just
+ * that fn and re-solves just the fns that reach it. check_reset drops the
+ * cache.
+ */
+
+typedef enum PurityEffect {
+    PURITY_READS_GLOBALS = 1 << 0,
+    PURITY_WRITES_GLOBALS = 1 << 1,
+    PURITY_READS_MEMORY = 1 << 2,
+    PURITY_WRITES_MEMORY = 1 << 3,
+    PURITY_CALLS_UNKNOWN = 1 << 4,
+} PurityEffect;
+
+#define PURITY_WRITES (PURITY_WRITES_GLOBALS | PURITY_WRITES_MEMORY | PURITY_CALLS_UNKNOWN)
+
+typedef struct PurityFn PurityFn;
+
+struct PurityFn {
+    Decl *decl;
+    bool scanned; // own and callees are current
+    unsigned own; // PurityEffects of its own body
+    Decl **callees; // Each once
+    PurityFn **callers; // Every fn that called it when scanned
+    bool solved; // effects and recursive are current
+    unsigned effects; // Including everything it calls
+    bool recursive; // Can call itself
+    size_t index; // Tarjan's, while being solved
+    size_t lowlink;
+    size_t next_callee;
+    bool on_stack;
+};
+
+typedef struct PurityStats {
+    size_t scans;
+    size_t sccs; // Solved
+    size_t invalidated; // Results dropped by purity_invalidate
+} PurityStats;
+
+extern PurityStats purity_stats;
+
+PurityFn *purity_fn(Decl *decl);
+unsigned purity_of(Decl *decl);
+bool purity_pure(Decl *decl); // Depends only on its args
+bool purity_side_effect_free(Decl *decl);
+void purity_invalidate(Decl *decl);
+void purity_reset(void);
+void purity_test(void);
+
+/*
+ * cse.c
+ *
+ * Eliminates common subexpressions on checked trees, keeping them checked.
+ * A region is a run of stmts in one block with no compound stmt between
+ * them. Scalar exprs that read something and make no calls with side
+ * effects, as purity.c finds them, are hashed and compared structurally
+ * as the region is scanned in evaluation order, and one equal to an expr
+ * seen earlier in it is replaced by a temp initialized with that earlier
+ * one just before its stmt. Assignments kill what they may change: exprs
+ * that read a local or param, or memory for any other target, as do calls
+ * with side effects. Calls that read nothing but their args are not memory.
+ */
+
+typedef struct CseStats {
+    size_t temps;
+    size_t replaced; // Repeats replaced by a temp
+    size_t nodes; // Expr nodes no longer evaluated
+} CseStats;
+
+extern CseStats cse_stats;
+
+void cse_decls(Decl **decls, size_t num_decls);
+void cse_test(void);
+
+/*
+ * driver.c
+ *
+ * Whole-file steps shared by the command line, the server and the
+ * benchmarks.
+ */
+
+Decl **parse_path(const char *path);
+int compile_file(const char *path);
+
+/*
+ * bench.c
+ */
+
+char *bench_source(size_t num_decls);
+void run_benchmarks(void);
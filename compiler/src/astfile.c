@@ -0,0 +1,723 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "ast.h"
+
+#define AST_FILE_BYTE_ORDER 0x01020304
+
+typedef struct AstWriter {
+    char *image;
+    uint32_t *relocs;
+    uint32_t *str_relocs;
+    uint32_t *type_relocs;
+    uint32_t *typespecs;
+    const char **strs;
+    Map str_map;
+    Map typespec_map;
+} AstWriter;
+
+AstWriter ast_writer;
+const char *ast_file_error;
+
+#define SLOT(offset, type, field) ((offset) + offsetof(type, field))
+
+// Appends size bytes of src to the image, zero-padded to the arena
+// alignment, and returns their offset. Offset 0 is reserved for NULL.
+size_t write_bytes(const void *src, size_t size) {
+    if (size == 0) {
+        return 0;
+    }
+    size_t offset = buf_len(ast_writer.image);
+    size_t aligned = ALIGN_UP(size, ARENA_ALIGNMENT);
+    buf_resize(ast_writer.image, offset + aligned);
+    memcpy(ast_writer.image + offset, src, size);
+    memset(ast_writer.image + offset + size, 0, aligned - size);
+    return offset;
+}
+
+uint64_t read_slot(size_t slot) {
+    uintptr_t value;
+    memcpy(&value, ast_writer.image + slot, sizeof(value));
+    return value;
+}
+
+void store_slot(size_t slot, uint64_t value) {
+    uintptr_t ptr = value;
+    memcpy(ast_writer.image + slot, &ptr, sizeof(ptr));
+}
+
+void write_ptr(size_t slot, size_t target) {
+    if (target) {
+        store_slot(slot, target);
+        buf_push(ast_writer.relocs, slot);
+    }
+}
+
+void write_str(size_t slot, const char *str) {
+    if (!str) {
+        return;
+    }
+    uint64_t index = map_get_uint64(&ast_writer.str_map, (uintptr_t)str);
+    if (!index) {
+        buf_push(ast_writer.strs, str);
+        index = buf_len(ast_writer.strs);
+        map_put_uint64(&ast_writer.str_map, (uintptr_t)str, index);
+    }
+    store_slot(slot, index - 1);
+    buf_push(ast_writer.str_relocs, slot);
+}
+
+size_t write_typespec(Typespec *type);
+size_t write_expr(Expr *expr);
+size_t write_stmt(Stmt *stmt);
+
+void write_type_slot(size_t slot, Typespec *type) {
+    size_t target = write_typespec(type);
+    if (target) {
+        store_slot(slot, target);
+        buf_push(ast_writer.type_relocs, slot);
+    }
+}
+
+size_t write_typespec(Typespec *type) {
+    if (!type) {
+        return 0;
+    }
+    size_t offset = map_get_uint64(&ast_writer.typespec_map, (uintptr_t)type);
+    if (offset) {
+        return offset;
+    }
+    offset = write_bytes(type, typespec_size(type->kind));
+    map_put_uint64(&ast_writer.typespec_map, (uintptr_t)type, offset);
+    switch (type->kind) {
+    case TYPESPEC_IDENT:
+        write_str(SLOT(offset, Typespec, name), type->name);
+        break;
+    case TYPESPEC_FN: {
+        size_t args = write_bytes(type->fn.args, type->fn.num_args * sizeof(Typespec *));
+        write_ptr(SLOT(offset, Typespec, fn.args), args);
+        for (size_t i = 0; i < type->fn.num_args; i++) {
+            write_type_slot(args + i * sizeof(Typespec *), type->fn.args[i]);
+        }
+        write_type_slot(SLOT(offset, Typespec, fn.ret), type->fn.ret);
+        break;
+    }
+    case TYPESPEC_ARRAY:
+        write_type_slot(SLOT(offset, Typespec, array.elem), type->array.elem);
+        write_ptr(SLOT(offset, Typespec, array.size), write_expr(type->array.size));
+        break;
+    case TYPESPEC_PTR:
+        write_type_slot(SLOT(offset, Typespec, ptr.elem), type->ptr.elem);
+        break;
+    default:
+        // Error typespecs aren't hash-consed.
+        return offset;
+    }
+    buf_push(ast_writer.typespecs, offset);
+    return offset;
+}
+
+/*
+ * Arrays are written right after the node that owns them, as the builders
+ * lay them out, and their elements are written once all of the node's
+ * arrays are in place.
+ */
+
+void write_array(size_t slot, const void *src, size_t size) {
+    write_ptr(slot, write_bytes(src, size));
+}
+
+void write_expr_elems(size_t slot, Expr **exprs, size_t num_exprs) {
+    size_t array = read_slot(slot);
+    for (size_t i = 0; i < num_exprs; i++) {
+        write_ptr(array + i * sizeof(Expr *), write_expr(exprs[i]));
+    }
+}
+
+void write_block_array(size_t slot, StmtBlock block) {
+    write_array(slot + offsetof(StmtBlock, stmts), block.stmts, block.num_stmts * sizeof(Stmt *));
+}
+
+void write_block_elems(size_t slot, StmtBlock block) {
+    size_t array = read_slot(slot + offsetof(StmtBlock, stmts));
+    for (size_t i = 0; i < block.num_stmts; i++) {
+        write_ptr(array + i * sizeof(Stmt *), write_stmt(block.stmts[i]));
+    }
+}
+
+size_t write_expr(Expr *expr) {
+    if (!expr) {
+        return 0;
+    }
+    size_t offset = write_bytes(expr, expr_size(expr->kind));
+    store_slot(SLOT(offset, Expr, type), 0);
+    switch (expr->kind) {
+    case EXPR_STR:
+        write_str(SLOT(offset, Expr, str_val), expr->str_val);
+        break;
+    case EXPR_IDENT:
+        write_str(SLOT(offset, Expr, name), expr->name);
+        store_slot(SLOT(offset, Expr, sym), 0);
+        break;
+    case EXPR_CAST:
+        write_type_slot(SLOT(offset, Expr, cast.type), expr->cast.type);
+        write_ptr(SLOT(offset, Expr, cast.expr), write_expr(expr->cast.expr));
+        break;
+    case EXPR_CALL:
+        write_array(SLOT(offset, Expr, call.args), expr->call.args, expr->call.num_args * sizeof(Expr *));
+        write_ptr(SLOT(offset, Expr, call.expr), write_expr(expr->call.expr));
+        write_expr_elems(SLOT(offset, Expr, call.args), expr->call.args, expr->call.num_args);
+        break;
+    case EXPR_INDEX:
+        write_ptr(SLOT(offset, Expr, index.expr), write_expr(expr->index.expr));
+        write_ptr(SLOT(offset, Expr, index.index), write_expr(expr->index.index));
+        break;
+    case EXPR_FIELD:
+        write_ptr(SLOT(offset, Expr, field.expr), write_expr(expr->field.expr));
+        write_str(SLOT(offset, Expr, field.name), expr->field.name);
+        break;
+    case EXPR_COMPOUND:
+        write_array(SLOT(offset, Expr, compound.args), expr->compound.args, expr->compound.num_args * sizeof(Expr *));
+        write_type_slot(SLOT(offset, Expr, compound.type), expr->compound.type);
+        write_expr_elems(SLOT(offset, Expr, compound.args), expr->compound.args, expr->compound.num_args);
+        break;
+    case EXPR_UNARY:
+        write_ptr(SLOT(offset, Expr, unary.expr), write_expr(expr->unary.expr));
+        break;
+    case EXPR_BINARY:
+        write_ptr(SLOT(offset, Expr, binary.left), write_expr(expr->binary.left));
+        write_ptr(SLOT(offset, Expr, binary.right), write_expr(expr->binary.right));
+        break;
+    case EXPR_TERNARY:
+        write_ptr(SLOT(offset, Expr, ternary.cond), write_expr(expr->ternary.cond));
+        write_ptr(SLOT(offset, Expr, ternary.then_expr), write_expr(expr->ternary.then_expr));
+        write_ptr(SLOT(offset, Expr, ternary.else_expr), write_expr(expr->ternary.else_expr));
+        break;
+    default:
+        break;
+    }
+    return offset;
+}
+
+size_t write_stmt(Stmt *stmt) {
+    if (!stmt) {
+        return 0;
+    }
+    size_t offset = write_bytes(stmt, stmt_size(stmt->kind));
+    switch (stmt->kind) {
+    case STMT_RETURN:
+        write_ptr(SLOT(offset, Stmt, return_stmt.expr), write_expr(stmt->return_stmt.expr));
+        break;
+    case STMT_BLOCK:
+        write_block_array(SLOT(offset, Stmt, block), stmt->block);
+        write_block_elems(SLOT(offset, Stmt, block), stmt->block);
+        break;
+    case STMT_IF: {
+        IfStmt *if_stmt = &stmt->if_stmt;
+        size_t elseifs_slot = SLOT(offset, Stmt, if_stmt.elseifs);
+        write_block_array(SLOT(offset, Stmt, if_stmt.then_block), if_stmt->then_block);
+        write_array(elseifs_slot, if_stmt->elseifs, if_stmt->num_elseifs * sizeof(ElseIf));
+        size_t elseifs = read_slot(elseifs_slot);
+        for (size_t i = 0; i < if_stmt->num_elseifs; i++) {
+            write_block_array(elseifs + i * sizeof(ElseIf) + offsetof(ElseIf, block), if_stmt->elseifs[i].block);
+        }
+        write_block_array(SLOT(offset, Stmt, if_stmt.else_block), if_stmt->else_block);
+        write_ptr(SLOT(offset, Stmt, if_stmt.cond), write_expr(if_stmt->cond));
+        write_block_elems(SLOT(offset, Stmt, if_stmt.then_block), if_stmt->then_block);
+        for (size_t i = 0; i < if_stmt->num_elseifs; i++) {
+            size_t elseif = elseifs + i * sizeof(ElseIf);
+            write_ptr(elseif + offsetof(ElseIf, cond), write_expr(if_stmt->elseifs[i].cond));
+            write_block_elems(elseif + offsetof(ElseIf, block), if_stmt->elseifs[i].block);
+        }
+        write_block_elems(SLOT(offset, Stmt, if_stmt.else_block), if_stmt->else_block);
+        break;
+    }
+    case STMT_WHILE:
+    case STMT_DO_WHILE:
+        write_block_array(SLOT(offset, Stmt, while_stmt.block), stmt->while_stmt.block);
+        write_ptr(SLOT(offset, Stmt, while_stmt.cond), write_expr(stmt->while_stmt.cond));
+        write_block_elems(SLOT(offset, Stmt, while_stmt.block), stmt->while_stmt.block);
+        break;
+    case STMT_FOR:
+        write_block_array(SLOT(offset, Stmt, for_stmt.block), stmt->for_stmt.block);
+        write_ptr(SLOT(offset, Stmt, for_stmt.init), write_stmt(stmt->for_stmt.init));
+        write_ptr(SLOT(offset, Stmt, for_stmt.cond), write_expr(stmt->for_stmt.cond));
+        write_ptr(SLOT(offset, Stmt, for_stmt.next), write_stmt(stmt->for_stmt.next));
+        write_block_elems(SLOT(offset, Stmt, for_stmt.block), stmt->for_stmt.block);
+        break;
+    case STMT_SWITCH: {
+        SwitchStmt *switch_stmt = &stmt->switch_stmt;
+        size_t cases_slot = SLOT(offset, Stmt, switch_stmt.cases);
+        write_array(cases_slot, switch_stmt->cases, switch_stmt->num_cases * sizeof(SwitchCase));
+        size_t cases = read_slot(cases_slot);
+        for (size_t i = 0; i < switch_stmt->num_cases; i++) {
+            SwitchCase *c = &switch_stmt->cases[i];
+            size_t case_offset = cases + i * sizeof(SwitchCase);
+            write_array(case_offset + offsetof(SwitchCase, exprs), c->exprs, c->num_exprs * sizeof(Expr *));
+            write_block_array(case_offset + offsetof(SwitchCase, block), c->block);
+        }
+        write_ptr(SLOT(offset, Stmt, switch_stmt.expr), write_expr(switch_stmt->expr));
+        store_slot(SLOT(offset, Stmt, switch_stmt.plan), 0);
+        for (size_t i = 0; i < switch_stmt->num_cases; i++) {
+            SwitchCase *c = &switch_stmt->cases[i];
+            size_t case_offset = cases + i * sizeof(SwitchCase);
+            write_expr_elems(case_offset + offsetof(SwitchCase, exprs), c->exprs, c->num_exprs);
+            write_block_elems(case_offset + offsetof(SwitchCase, block), c->block);
+        }
+        break;
+    }
+    case STMT_ASSIGN:
+        write_ptr(SLOT(offset, Stmt, assign.left), write_expr(stmt->assign.left));
+        write_ptr(SLOT(offset, Stmt, assign.right), write_expr(stmt->assign.right));
+        break;
+    case STMT_INIT:
+        write_str(SLOT(offset, Stmt, init.name), stmt->init.name);
+        write_ptr(SLOT(offset, Stmt, init.expr), write_expr(stmt->init.expr));
+        break;
+    case STMT_EXPR:
+        write_ptr(SLOT(offset, Stmt, expr), write_expr(stmt->expr));
+        break;
+    default:
+        break;
+    }
+    return offset;
+}
+
+size_t write_decl(Decl *decl) {
+    size_t offset = write_bytes(decl, decl_size(decl->kind));
+    write_str(SLOT(offset, Decl, name), decl->name);
+    switch (decl->kind) {
+    case DECL_ENUM: {
+        size_t items_slot = SLOT(offset, Decl, enum_decl.items);
+        write_array(items_slot, decl->enum_decl.items, decl->enum_decl.num_items * sizeof(EnumItem));
+        size_t items = read_slot(items_slot);
+        for (size_t i = 0; i < decl->enum_decl.num_items; i++) {
+            size_t item = items + i * sizeof(EnumItem);
+            write_str(item + offsetof(EnumItem, name), decl->enum_decl.items[i].name);
+            write_ptr(item + offsetof(EnumItem, expr), write_expr(decl->enum_decl.items[i].expr));
+        }
+        break;
+    }
+    case DECL_STRUCT:
+    case DECL_UNION: {
+        AggregateDecl *aggregate = &decl->aggregate;
+        size_t items_slot = SLOT(offset, Decl, aggregate.items);
+        write_array(items_slot, aggregate->items, aggregate->num_items * sizeof(AggregateItem));
+        size_t items = read_slot(items_slot);
+        for (size_t i = 0; i < aggregate->num_items; i++) {
+            AggregateItem *item = &aggregate->items[i];
+            size_t names_slot = items + i * sizeof(AggregateItem) + offsetof(AggregateItem, names);
+            write_array(names_slot, item->names, item->num_names * sizeof(const char *));
+            size_t names = read_slot(names_slot);
+            for (size_t j = 0; j < item->num_names; j++) {
+                write_str(names + j * sizeof(const char *), item->names[j]);
+            }
+        }
+        for (size_t i = 0; i < aggregate->num_items; i++) {
+            write_type_slot(items + i * sizeof(AggregateItem) + offsetof(AggregateItem, types), aggregate->items[i].types);
+        }
+        break;
+    }
+    case DECL_LET:
+        write_type_slot(SLOT(offset, Decl, let.type), decl->let.type);
+        write_ptr(SLOT(offset, Decl, let.expr), write_expr(decl->let.expr));
+        break;
+    case DECL_CONST:
+        write_ptr(SLOT(offset, Decl, const_decl.expr), write_expr(decl->const_decl.expr));
+        break;
+    case DECL_TYPEDEF:
+        write_type_slot(SLOT(offset, Decl, typedef_decl.type), decl->typedef_decl.type);
+        break;
+    case DECL_FN: {
+        FnDecl *fn = &decl->fn;
+        size_t params_slot = SLOT(offset, Decl, fn.params);
+        write_array(params_slot, fn->params, fn->num_params * sizeof(FnParam));
+        write_block_array(SLOT(offset, Decl, fn.block), fn->block);
+        size_t params = read_slot(params_slot);
+        for (size_t i = 0; i < fn->num_params; i++) {
+            size_t param = params + i * sizeof(FnParam);
+            write_str(param + offsetof(FnParam, name), fn->params[i].name);
+            write_type_slot(param + offsetof(FnParam, type), fn->params[i].type);
+        }
+        write_type_slot(SLOT(offset, Decl, fn.ret_type), fn->ret_type);
+        write_block_elems(SLOT(offset, Decl, fn.block), fn->block);
+        break;
+    }
+    default:
+        break;
+    }
+    return offset;
+}
+
+size_t append_section(char **out, AstFileSection *section, const void *src, size_t count, size_t elem_size) {
+    size_t offset = buf_len(*out);
+    size_t size = count * elem_size;
+    buf_resize(*out, offset + ALIGN_UP(size, ARENA_ALIGNMENT));
+    if (size) {
+        memcpy(*out + offset, src, size);
+    }
+    memset(*out + offset + size, 0, buf_len(*out) - offset - size);
+    *section = (AstFileSection){offset, count};
+    return offset;
+}
+
+// Returns the file contents as a stretchy buffer.
+char *ast_file_write_mem(Decl **decls, size_t num_decls) {
+    ast_writer = (AstWriter){0};
+    buf_resize(ast_writer.image, ARENA_ALIGNMENT);
+    memset(ast_writer.image, 0, ARENA_ALIGNMENT);
+    size_t roots = write_bytes(decls, num_decls * sizeof(Decl *));
+    for (size_t i = 0; i < num_decls; i++) {
+        write_ptr(roots + i * sizeof(Decl *), write_decl(decls[i]));
+    }
+    if (buf_len(ast_writer.image) > UINT32_MAX) {
+        fatal("AST too large for an AST file");
+    }
+
+    char *packed = NULL;
+    for (const char **it = ast_writer.strs; it != buf_end(ast_writer.strs); it++) {
+        uint32_t len = (uint32_t)strlen(*it);
+        size_t offset = buf_len(packed);
+        buf_resize(packed, offset + sizeof(len) + len + 1);
+        memcpy(packed + offset, &len, sizeof(len));
+        memcpy(packed + offset + sizeof(len), *it, len + 1);
+    }
+
+    AstFileHeader header = {
+        .magic = AST_FILE_MAGIC,
+        .version = AST_FILE_VERSION,
+        .ptr_size = sizeof(void *),
+        .byte_order = AST_FILE_BYTE_ORDER,
+        .decls = {roots, num_decls},
+    };
+    char *out = NULL;
+    AstFileSection header_section;
+    append_section(&out, &header_section, &header, 1, sizeof(header));
+    append_section(&out, &header.image, ast_writer.image, buf_len(ast_writer.image), 1);
+    append_section(&out, &header.strs, packed, buf_len(packed), 1);
+    header.strs.count = buf_len(ast_writer.strs);
+    append_section(&out, &header.relocs, ast_writer.relocs, buf_len(ast_writer.relocs), sizeof(uint32_t));
+    append_section(&out, &header.str_relocs, ast_writer.str_relocs, buf_len(ast_writer.str_relocs), sizeof(uint32_t));
+    append_section(&out, &header.type_relocs, ast_writer.type_relocs, buf_len(ast_writer.type_relocs), sizeof(uint32_t));
+    append_section(&out, &header.typespecs, ast_writer.typespecs, buf_len(ast_writer.typespecs), sizeof(uint32_t));
+    header.file_size = buf_len(out);
+    memcpy(out, &header, sizeof(header));
+
+    buf_free(packed);
+    buf_free(ast_writer.image);
+    buf_free(ast_writer.relocs);
+    buf_free(ast_writer.str_relocs);
+    buf_free(ast_writer.type_relocs);
+    buf_free(ast_writer.typespecs);
+    buf_free(ast_writer.strs);
+    map_free(&ast_writer.str_map);
+    map_free(&ast_writer.typespec_map);
+    return out;
+}
+
+bool ast_file_write(const char *path, Decl **decls, size_t num_decls) {
+    char *data = ast_file_write_mem(decls, num_decls);
+    FILE *file = fopen(path, "wb");
+    bool ok = file && fwrite(data, 1, buf_len(data), file) == buf_len(data);
+    if (file && fclose(file) != 0) {
+        ok = false;
+    }
+    buf_free(data);
+    return ok;
+}
+
+/*
+ * Loading.
+ */
+
+bool check_section(AstFileSection section, size_t elem_size, size_t size) {
+    return section.offset % ARENA_ALIGNMENT == 0 && section.offset <= size &&
+           section.count <= (size - section.offset) / elem_size;
+}
+
+Decl **load_error(const char *msg) {
+    ast_file_error = msg;
+    return NULL;
+}
+
+uintptr_t load_slot(char *slot) {
+    uintptr_t value;
+    memcpy(&value, slot, sizeof(value));
+    return value;
+}
+
+void load_store(char *slot, const void *ptr) {
+    memcpy(slot, &ptr, sizeof(ptr));
+}
+
+// Rebases every slot in a relocation table, checking both the slot and its
+// target fall inside the image.
+bool load_relocs(char *data, AstFileSection relocs, char *image, size_t image_size) {
+    uint32_t *slots = (uint32_t *)(data + relocs.offset);
+    for (size_t i = 0; i < relocs.count; i++) {
+        uint32_t slot = slots[i];
+        if (slot % sizeof(void *) || slot > image_size - sizeof(void *)) {
+            return false;
+        }
+        uintptr_t target = load_slot(image + slot);
+        if (target >= image_size) {
+            return false;
+        }
+        load_store(image + slot, image + target);
+    }
+    return true;
+}
+
+// Checks ptr points at size bytes inside the image.
+bool load_fits(char *image, size_t image_size, const void *ptr, size_t size) {
+    uintptr_t offset = (uintptr_t)ptr - (uintptr_t)image;
+    return (uintptr_t)ptr >= (uintptr_t)image && offset % sizeof(void *) == 0 && offset <= image_size &&
+           size <= image_size - offset;
+}
+
+// Checks everything typespec_canonical reads from the node at offset lies
+// inside the image.
+bool load_typespec_valid(char *image, size_t image_size, uint32_t offset) {
+    Typespec *type = (Typespec *)(image + offset);
+    if (!load_fits(image, image_size, type, offsetof(Typespec, name))) {
+        return false;
+    }
+    switch (type->kind) {
+    case TYPESPEC_IDENT:
+    case TYPESPEC_PTR:
+        return load_fits(image, image_size, type, typespec_size(type->kind));
+    case TYPESPEC_FN:
+        return load_fits(image, image_size, type, typespec_size(TYPESPEC_FN)) &&
+               type->fn.num_args <= image_size / sizeof(Typespec *) &&
+               (type->fn.num_args == 0 ||
+                load_fits(image, image_size, type->fn.args, type->fn.num_args * sizeof(Typespec *)));
+    case TYPESPEC_ARRAY: {
+        if (!load_fits(image, image_size, type, typespec_size(TYPESPEC_ARRAY))) {
+            return false;
+        }
+        Expr *size = type->array.size;
+        return !size || (load_fits(image, image_size, size, offsetof(Expr, type)) &&
+                         (size->kind != EXPR_INT || load_fits(image, image_size, size, expr_size(EXPR_INT))));
+    }
+    default:
+        return false;
+    }
+}
+
+Typespec *load_forward(Map *forward, Typespec *type) {
+    Typespec *canonical = map_get(forward, type);
+    return canonical ? canonical : type;
+}
+
+// data must be writable, 8-byte aligned and outlive the returned AST, which
+// points into it.
+Decl **ast_file_load_mem(char *data, size_t size, size_t *num_decls) {
+    AstFileHeader header;
+    if (size < sizeof(header)) {
+        return load_error("file too small");
+    }
+    memcpy(&header, data, sizeof(header));
+    if (memcmp(header.magic, AST_FILE_MAGIC, sizeof(header.magic)) != 0) {
+        return load_error("not an AST file");
+    }
+    if (header.version != AST_FILE_VERSION) {
+        return load_error("unsupported AST file version");
+    }
+    if (header.ptr_size != sizeof(void *) || header.byte_order != AST_FILE_BYTE_ORDER) {
+        return load_error("AST file written for a different architecture");
+    }
+    if (header.file_size != size || !check_section(header.image, 1, size) || !check_section(header.strs, 1, size) ||
+        !check_section(header.relocs, sizeof(uint32_t), size) || !check_section(header.str_relocs, sizeof(uint32_t), size) ||
+        !check_section(header.type_relocs, sizeof(uint32_t), size) || !check_section(header.typespecs, sizeof(uint32_t), size) ||
+        header.image.count < sizeof(void *) || !check_section(header.decls, sizeof(Decl *), header.image.count)) {
+        return load_error("corrupt AST file");
+    }
+    char *image = data + header.image.offset;
+    size_t image_size = header.image.count;
+
+    const char **strs = xmalloc((header.strs.count + 1) * sizeof(const char *));
+    char *packed = data + header.strs.offset;
+    char *packed_end = data + size;
+    for (size_t i = 0; i < header.strs.count; i++) {
+        uint32_t len;
+        if ((size_t)(packed_end - packed) < sizeof(len)) {
+            free(strs);
+            return load_error("corrupt AST string table");
+        }
+        memcpy(&len, packed, sizeof(len));
+        packed += sizeof(len);
+        if ((size_t)(packed_end - packed) <= len) {
+            free(strs);
+            return load_error("corrupt AST string table");
+        }
+        strs[i] = str_intern_range(packed, packed + len);
+        packed += len + 1;
+    }
+
+    bool ok = load_relocs(data, header.relocs, image, image_size) && load_relocs(data, header.type_relocs, image, image_size);
+    uint32_t *str_slots = (uint32_t *)(data + header.str_relocs.offset);
+    for (size_t i = 0; ok && i < header.str_relocs.count; i++) {
+        uint32_t slot = str_slots[i];
+        ok = slot % sizeof(void *) == 0 && slot <= image_size - sizeof(void *) && load_slot(image + slot) < header.strs.count;
+        if (ok) {
+            load_store(image + slot, strs[load_slot(image + slot)]);
+        }
+    }
+    free(strs);
+    if (!ok) {
+        return load_error("corrupt AST relocations");
+    }
+
+    // Every entry is checked before any is canonicalized, so a corrupt file
+    // never leaves nodes from its image in the typespec table.
+    uint32_t *typespecs = (uint32_t *)(data + header.typespecs.offset);
+    for (size_t i = 0; i < header.typespecs.count; i++) {
+        if (!load_typespec_valid(image, image_size, typespecs[i])) {
+            return load_error("corrupt AST typespec table");
+        }
+    }
+
+    // Children come first, so each node's children are already canonical
+    // when it is looked up.
+    Map forward = {0};
+    for (size_t i = 0; i < header.typespecs.count; i++) {
+        Typespec *type = (Typespec *)(image + typespecs[i]);
+        switch (type->kind) {
+        case TYPESPEC_FN:
+            for (size_t j = 0; j < type->fn.num_args; j++) {
+                type->fn.args[j] = load_forward(&forward, type->fn.args[j]);
+            }
+            type->fn.ret = load_forward(&forward, type->fn.ret);
+            break;
+        case TYPESPEC_ARRAY:
+            type->array.elem = load_forward(&forward, type->array.elem);
+            break;
+        case TYPESPEC_PTR:
+            type->ptr.elem = load_forward(&forward, type->ptr.elem);
+            break;
+        default:
+            break;
+        }
+        Typespec *canonical = typespec_canonical(type);
+        if (canonical != type) {
+            map_put(&forward, type, canonical);
+        }
+    }
+    if (forward.len) {
+        uint32_t *type_slots = (uint32_t *)(data + header.type_relocs.offset);
+        for (size_t i = 0; i < header.type_relocs.count; i++) {
+            char *slot = image + type_slots[i];
+            load_store(slot, load_forward(&forward, (Typespec *)load_slot(slot)));
+        }
+    }
+    map_free(&forward);
+
+    *num_decls = header.decls.count;
+    return (Decl **)(image + header.decls.offset);
+}
+
+// The file stays mapped for as long as the process runs.
+Decl **ast_file_load(const char *path, size_t *num_decls) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return load_error("cannot open file");
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        close(fd);
+        return load_error("cannot read file");
+    }
+    void *data = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        return load_error("cannot map file");
+    }
+    Decl **decls = ast_file_load_mem(data, st.st_size, num_decls);
+    if (!decls) {
+        munmap(data, st.st_size);
+    }
+    return decls;
+}
+
+void ast_file_test(void) {
+    const char *src =
+        "const n = 1 << 4\n"
+        "let g: int[n] = {1, 2.5, \"s\"}\n"
+        "typedef T = fn(int*, float): int*\n"
+        "struct S { x, y: int; next: S*; }\n"
+        "union U { a: int; b: float[2]; }\n"
+        "enum E { A = 1 B C = n }\n"
+        "fn f(a: int*, b: T): int* {\n"
+        "    x := (:int*){a};\n"
+        "    for (i := 0; i < 10; i++) { x += i; continue; }\n"
+        "    if (a) { return a; } else if (b) { b.c[1](2); } else { break; }\n"
+        "    while (x) { x -= 1; }\n"
+        "    do { x++; } while (x < 2);\n"
+        "    switch (x) { case 1: case 2: { return -x; } default { { g; } } }\n"
+        "    return x ? a : -b;\n"
+        "}\n";
+    init_stream(src);
+    Decl **decls = parse_file();
+    assert(num_syntax_errors == 0 && buf_len(decls) == 7);
+
+    char *file = ast_file_write_mem(decls, buf_len(decls));
+    char *data = xmalloc(buf_len(file));
+    memcpy(data, file, buf_len(file));
+    size_t num_decls = 0;
+    Decl **loaded = ast_file_load_mem(data, buf_len(file), &num_decls);
+    assert(loaded && num_decls == 7);
+
+    // Loading is exact: writing what was loaded reproduces the file.
+    char *rewritten = ast_file_write_mem(loaded, num_decls);
+    assert(buf_len(rewritten) == buf_len(file) && memcmp(rewritten, file, buf_len(file)) == 0);
+
+    Typespec *int_ptr = typespec_ptr(typespec_ident(str_intern("int")));
+    Decl *fn = loaded[6];
+    assert(fn->kind == DECL_FN && fn->name == str_intern("f"));
+    assert(fn->fn.params[0].type == int_ptr && fn->fn.ret_type == int_ptr);
+    assert(loaded[2]->typedef_decl.type->fn.ret == int_ptr);
+    assert(loaded[3]->aggregate.items[0].names[1] == str_intern("y"));
+    assert(loaded[5]->enum_decl.items[2].expr->name == str_intern("n"));
+    assert(fn->fn.block.stmts[5]->switch_stmt.cases[1].is_default);
+
+    // The loaded image stays alive like a mapped file would, since the
+    // typespec table can hold nodes from it.
+    char *bad = xmalloc(buf_len(file));
+    memcpy(bad, file, buf_len(file));
+    bad[0] = 'X';
+    assert(!ast_file_load_mem(bad, buf_len(file), &num_decls) && ast_file_error);
+    memcpy(bad, file, buf_len(file));
+    assert(!ast_file_load_mem(bad, buf_len(file) - 8, &num_decls));
+
+    // A corrupt typespec rejects the file before any earlier one is
+    // canonicalized.
+    init_stream("fn h(a: Fresh1*, b: Fresh2[3]): Fresh3* {}");
+    Decl **fresh = parse_file();
+    char *fresh_file = ast_file_write_mem(fresh, buf_len(fresh));
+    bad = xrealloc(bad, buf_len(fresh_file));
+    memcpy(bad, fresh_file, buf_len(fresh_file));
+    AstFileHeader header;
+    memcpy(&header, bad, sizeof(header));
+    assert(header.typespecs.count > 1);
+    uint32_t last;
+    memcpy(&last, bad + header.typespecs.offset + (header.typespecs.count - 1) * sizeof(uint32_t), sizeof(last));
+    TypespecKind kind = TYPESPEC_ERROR;
+    memcpy(bad + header.image.offset + last + offsetof(Typespec, kind), &kind, sizeof(kind));
+    size_t len = typespec_table.len;
+    assert(!ast_file_load_mem(bad, buf_len(fresh_file), &num_decls) && typespec_table.len == len);
+    memcpy(bad, fresh_file, buf_len(fresh_file));
+    uint32_t past_end = (uint32_t)header.image.count;
+    memcpy(bad + header.typespecs.offset, &past_end, sizeof(past_end));
+    assert(!ast_file_load_mem(bad, buf_len(fresh_file), &num_decls) && typespec_table.len == len);
+
+    free(bad);
+    buf_free(fresh_file);
+    buf_free(fresh);
+    buf_free(rewritten);
+    buf_free(file);
+    buf_free(decls);
+}
@@ -0,0 +1,1725 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "ast.h"
+#include "common.h"
+#include "lex.h"
+
+#define BENCH_REPEAT 5
+
+// Deterministic synthetic corpus. Each group of five declarations covers
+// every declaration kind plus the common statement and expression forms, so
+// benchmarks exercise the whole front end rather than one hot path.
+char *bench_source(size_t num_decls) {
+    char *src = NULL;
+    for (size_t i = 0; i < num_decls; i++) {
+        switch (i % 5) {
+        case 0:
+            buf_printf(src, "const c%zu = %zu * 2 + (1 << 3)\n", i, i);
+            break;
+        case 1:
+            buf_printf(src, "let g%zu: int[16] = {1, 2, 3}\n", i);
+            break;
+        case 2:
+            buf_printf(src, "struct S%zu { x, y: int; next: S%zu*; f: fn(int, float): int; }\n", i, i);
+            break;
+        case 3:
+            buf_printf(src, "enum E%zu { A%zu = 1 B%zu C%zu = 3 }\n", i, i, i, i);
+            break;
+        case 4:
+            buf_printf(src,
+                       "fn f%zu(a: int, b: int): int {\n"
+                       "    x := a + b * 2;\n"
+                       "    for (i := 0; i < 10; i++) {\n"
+                       "        x += i * a - v.p[i].q;\n"
+                       "        if (x > 100) { x -= b; } else if (x < 0) { x += 1; } else { x *= 2; }\n"
+                       "    }\n"
+                       "    while (x > 1000) { x -= 1000; }\n"
+                       "    switch (x) { case 1: case 2: { return a; } default { trace(\"x\"); } }\n"
+                       "    return x == 0 ? f%zu(a, b) : -x;\n"
+                       "}\n",
+                       i, i);
+            break;
+        }
+    }
+    return src;
+}
+
+void bench_report(const char *name, double secs, size_t bytes, size_t items, const char *item_name) {
+    printf("%-28s %9.3f ms  %8.1f MB/s  %10.0f %s/s\n", name, secs * 1e3, bytes / secs / 1e6, items / secs, item_name);
+}
+
+void parse_bench(void) {
+    char *src = bench_source(20000);
+    double best = 1e9;
+    size_t num_decls = 0;
+    for (int i = 0; i < BENCH_REPEAT; i++) {
+        double start = time_now();
+        init_stream(src);
+        Decl **decls = parse_file();
+        double secs = time_now() - start;
+        best = secs < best ? secs : best;
+        num_decls = buf_len(decls);
+        buf_free(decls);
+    }
+    assert(num_syntax_errors == 0);
+    bench_report("parse", best, buf_len(src), num_decls, "decls");
+    buf_free(src);
+}
+
+/*
+ * Reference traversals over the pointer AST and the pooled AST. Both visit
+ * every node and fold literal values into walk_sum so the walks can't be
+ * optimized away; the pointer walk also tallies arena bytes per node.
+ */
+
+size_t walk_nodes;
+size_t walk_bytes;
+uint64_t walk_sum;
+
+// Locality proxy for when hardware cache counters aren't available: a visit
+// is a jump unless the node starts within a cache line or two after the
+// previously visited one.
+size_t walk_jumps;
+char *walk_last;
+
+// Typespec references, and the bytes they would take unshared.
+size_t walk_typespecs;
+size_t walk_typespec_bytes;
+
+#define WALK_ALLOC(size) (walk_bytes += ALIGN_UP((size), ARENA_ALIGNMENT))
+#define WALK_JUMP_DISTANCE 128
+
+void walk_visit(void *node) {
+    walk_nodes++;
+    char *ptr = node;
+    if (ptr < walk_last || ptr > walk_last + WALK_JUMP_DISTANCE) {
+        walk_jumps++;
+    }
+    walk_last = ptr;
+}
+
+void walk_expr(Expr *e);
+
+void walk_typespec(Typespec *t) {
+    if (!t) {
+        return;
+    }
+    walk_visit(t);
+    WALK_ALLOC(typespec_size(t->kind));
+    walk_typespecs++;
+    walk_typespec_bytes += ALIGN_UP(typespec_size(t->kind), ARENA_ALIGNMENT);
+    switch (t->kind) {
+    case TYPESPEC_FN:
+        WALK_ALLOC(t->fn.num_args * sizeof(Typespec *));
+        walk_typespec_bytes += ALIGN_UP(t->fn.num_args * sizeof(Typespec *), ARENA_ALIGNMENT);
+        for (size_t i = 0; i < t->fn.num_args; i++) {
+            walk_typespec(t->fn.args[i]);
+        }
+        walk_typespec(t->fn.ret);
+        break;
+    case TYPESPEC_ARRAY:
+        walk_typespec(t->array.elem);
+        walk_expr(t->array.size);
+        break;
+    case TYPESPEC_PTR:
+        walk_typespec(t->ptr.elem);
+        break;
+    default:
+        break;
+    }
+}
+
+void walk_expr(Expr *e) {
+    if (!e) {
+        return;
+    }
+    walk_visit(e);
+    WALK_ALLOC(expr_size(e->kind));
+    switch (e->kind) {
+    case EXPR_INT:
+        walk_sum += e->int_val;
+        break;
+    case EXPR_CAST:
+        walk_typespec(e->cast.type);
+        walk_expr(e->cast.expr);
+        break;
+    case EXPR_CALL:
+        walk_expr(e->call.expr);
+        WALK_ALLOC(e->call.num_args * sizeof(Expr *));
+        for (size_t i = 0; i < e->call.num_args; i++) {
+            walk_expr(e->call.args[i]);
+        }
+        break;
+    case EXPR_COMPOUND:
+        walk_typespec(e->compound.type);
+        WALK_ALLOC(e->compound.num_args * sizeof(Expr *));
+        for (size_t i = 0; i < e->compound.num_args; i++) {
+            walk_expr(e->compound.args[i]);
+        }
+        break;
+    case EXPR_INDEX:
+        walk_expr(e->index.expr);
+        walk_expr(e->index.index);
+        break;
+    case EXPR_FIELD:
+        walk_expr(e->field.expr);
+        break;
+    case EXPR_UNARY:
+        walk_expr(e->unary.expr);
+        break;
+    case EXPR_BINARY:
+        walk_expr(e->binary.left);
+        walk_expr(e->binary.right);
+        break;
+    case EXPR_TERNARY:
+        walk_expr(e->ternary.cond);
+        walk_expr(e->ternary.then_expr);
+        walk_expr(e->ternary.else_expr);
+        break;
+    default:
+        break;
+    }
+}
+
+void walk_stmt(Stmt *s);
+
+void walk_stmt_block(StmtBlock block) {
+    WALK_ALLOC(block.num_stmts * sizeof(Stmt *));
+    for (size_t i = 0; i < block.num_stmts; i++) {
+        walk_stmt(block.stmts[i]);
+    }
+}
+
+void walk_stmt(Stmt *s) {
+    if (!s) {
+        return;
+    }
+    walk_visit(s);
+    WALK_ALLOC(stmt_size(s->kind));
+    switch (s->kind) {
+    case STMT_RETURN:
+        walk_expr(s->return_stmt.expr);
+        break;
+    case STMT_BLOCK:
+        walk_stmt_block(s->block);
+        break;
+    case STMT_IF:
+        walk_expr(s->if_stmt.cond);
+        walk_stmt_block(s->if_stmt.then_block);
+        WALK_ALLOC(s->if_stmt.num_elseifs * sizeof(ElseIf));
+        for (size_t i = 0; i < s->if_stmt.num_elseifs; i++) {
+            walk_expr(s->if_stmt.elseifs[i].cond);
+            walk_stmt_block(s->if_stmt.elseifs[i].block);
+        }
+        walk_stmt_block(s->if_stmt.else_block);
+        break;
+    case STMT_WHILE:
+    case STMT_DO_WHILE:
+        walk_expr(s->while_stmt.cond);
+        walk_stmt_block(s->while_stmt.block);
+        break;
+    case STMT_FOR:
+        walk_stmt(s->for_stmt.init);
+        walk_expr(s->for_stmt.cond);
+        walk_stmt(s->for_stmt.next);
+        walk_stmt_block(s->for_stmt.block);
+        break;
+    case STMT_SWITCH:
+        walk_expr(s->switch_stmt.expr);
+        WALK_ALLOC(s->switch_stmt.num_cases * sizeof(SwitchCase));
+        for (size_t i = 0; i < s->switch_stmt.num_cases; i++) {
+            SwitchCase *c = &s->switch_stmt.cases[i];
+            WALK_ALLOC(c->num_exprs * sizeof(Expr *));
+            for (size_t j = 0; j < c->num_exprs; j++) {
+                walk_expr(c->exprs[j]);
+            }
+            walk_stmt_block(c->block);
+        }
+        break;
+    case STMT_ASSIGN:
+        walk_expr(s->assign.left);
+        walk_expr(s->assign.right);
+        break;
+    case STMT_INIT:
+        walk_expr(s->init.expr);
+        break;
+    case STMT_EXPR:
+        walk_expr(s->expr);
+        break;
+    default:
+        break;
+    }
+}
+
+void walk_decl(Decl *d) {
+    walk_visit(d);
+    WALK_ALLOC(decl_size(d->kind));
+    switch (d->kind) {
+    case DECL_ENUM:
+        WALK_ALLOC(d->enum_decl.num_items * sizeof(EnumItem));
+        for (size_t i = 0; i < d->enum_decl.num_items; i++) {
+            walk_expr(d->enum_decl.items[i].expr);
+        }
+        break;
+    case DECL_STRUCT:
+    case DECL_UNION:
+        WALK_ALLOC(d->aggregate.num_items * sizeof(AggregateItem));
+        for (size_t i = 0; i < d->aggregate.num_items; i++) {
+            WALK_ALLOC(d->aggregate.items[i].num_names * sizeof(const char *));
+            walk_typespec(d->aggregate.items[i].types);
+        }
+        break;
+    case DECL_LET:
+        walk_typespec(d->let.type);
+        walk_expr(d->let.expr);
+        break;
+    case DECL_CONST:
+        walk_expr(d->const_decl.expr);
+        break;
+    case DECL_TYPEDEF:
+        walk_typespec(d->typedef_decl.type);
+        break;
+    case DECL_FN:
+        WALK_ALLOC(d->fn.num_params * sizeof(FnParam));
+        for (size_t i = 0; i < d->fn.num_params; i++) {
+            walk_typespec(d->fn.params[i].type);
+        }
+        walk_typespec(d->fn.ret_type);
+        walk_stmt_block(d->fn.block);
+        break;
+    default:
+        break;
+    }
+}
+
+void walk_pool_expr(ExprId id);
+
+void walk_pool_typespec(TypespecId id) {
+    if (!id) {
+        return;
+    }
+    walk_nodes++;
+    switch (POOL_KIND(id)) {
+    case TYPESPEC_FN: {
+        PoolFnTypespec *fn = &ast_pool.typespec_fns[POOL_INDEX(id)];
+        for (uint32_t i = 0; i < fn->args.len; i++) {
+            walk_pool_typespec(ast_pool.ids[fn->args.start + i]);
+        }
+        walk_pool_typespec(fn->ret);
+        break;
+    }
+    case TYPESPEC_ARRAY: {
+        PoolArrayTypespec *array = &ast_pool.typespec_arrays[POOL_INDEX(id)];
+        walk_pool_typespec(array->elem);
+        walk_pool_expr(array->size);
+        break;
+    }
+    case TYPESPEC_PTR:
+        walk_pool_typespec(ast_pool.ids[POOL_INDEX(id)]);
+        break;
+    default:
+        break;
+    }
+}
+
+void walk_pool_exprs(IdList list) {
+    for (uint32_t i = 0; i < list.len; i++) {
+        walk_pool_expr(ast_pool.ids[list.start + i]);
+    }
+}
+
+void walk_pool_expr(ExprId id) {
+    if (!id) {
+        return;
+    }
+    walk_nodes++;
+    uint32_t index = POOL_INDEX(id);
+    switch (POOL_KIND(id)) {
+    case EXPR_INT:
+        walk_sum += ast_pool.ints[index];
+        break;
+    case EXPR_CAST:
+        walk_pool_typespec(ast_pool.casts[index].type);
+        walk_pool_expr(ast_pool.casts[index].expr);
+        break;
+    case EXPR_CALL:
+        walk_pool_expr(ast_pool.calls[index].expr);
+        walk_pool_exprs(ast_pool.calls[index].args);
+        break;
+    case EXPR_COMPOUND:
+        walk_pool_typespec(ast_pool.compounds[index].type);
+        walk_pool_exprs(ast_pool.compounds[index].args);
+        break;
+    case EXPR_INDEX:
+        walk_pool_expr(ast_pool.indexes[index].expr);
+        walk_pool_expr(ast_pool.indexes[index].index);
+        break;
+    case EXPR_FIELD:
+        walk_pool_expr(ast_pool.fields[index].expr);
+        break;
+    case EXPR_UNARY:
+        walk_pool_expr(ast_pool.unaries[index].expr);
+        break;
+    case EXPR_BINARY:
+        walk_pool_expr(ast_pool.binaries[index].left);
+        walk_pool_expr(ast_pool.binaries[index].right);
+        break;
+    case EXPR_TERNARY:
+        walk_pool_expr(ast_pool.ternaries[index].cond);
+        walk_pool_expr(ast_pool.ternaries[index].then_expr);
+        walk_pool_expr(ast_pool.ternaries[index].else_expr);
+        break;
+    default:
+        break;
+    }
+}
+
+void walk_pool_stmt(StmtId id);
+
+void walk_pool_stmts(IdList list) {
+    for (uint32_t i = 0; i < list.len; i++) {
+        walk_pool_stmt(ast_pool.ids[list.start + i]);
+    }
+}
+
+void walk_pool_stmt(StmtId id) {
+    if (!id) {
+        return;
+    }
+    walk_nodes++;
+    uint32_t index = POOL_INDEX(id);
+    switch (POOL_KIND(id)) {
+    case STMT_RETURN:
+    case STMT_EXPR:
+        walk_pool_expr(ast_pool.stmt_exprs[index]);
+        break;
+    case STMT_BLOCK:
+        walk_pool_stmts(ast_pool.blocks[index]);
+        break;
+    case STMT_IF: {
+        PoolIfStmt *s = &ast_pool.ifs[index];
+        walk_pool_expr(s->cond);
+        walk_pool_stmts(s->then_block);
+        for (uint32_t i = 0; i < s->elseifs.len; i++) {
+            walk_pool_expr(ast_pool.elseifs[s->elseifs.start + i].cond);
+            walk_pool_stmts(ast_pool.elseifs[s->elseifs.start + i].block);
+        }
+        walk_pool_stmts(s->else_block);
+        break;
+    }
+    case STMT_WHILE:
+    case STMT_DO_WHILE:
+        walk_pool_expr(ast_pool.whiles[index].cond);
+        walk_pool_stmts(ast_pool.whiles[index].block);
+        break;
+    case STMT_FOR: {
+        PoolForStmt *s = &ast_pool.fors[index];
+        walk_pool_stmt(s->init);
+        walk_pool_expr(s->cond);
+        walk_pool_stmt(s->next);
+        walk_pool_stmts(s->block);
+        break;
+    }
+    case STMT_SWITCH: {
+        PoolSwitchStmt *s = &ast_pool.switches[index];
+        walk_pool_expr(s->expr);
+        for (uint32_t i = 0; i < s->cases.len; i++) {
+            walk_pool_exprs(ast_pool.cases[s->cases.start + i].exprs);
+            walk_pool_stmts(ast_pool.cases[s->cases.start + i].block);
+        }
+        break;
+    }
+    case STMT_ASSIGN:
+        walk_pool_expr(ast_pool.assigns[index].left);
+        walk_pool_expr(ast_pool.assigns[index].right);
+        break;
+    case STMT_INIT:
+        walk_pool_expr(ast_pool.inits[index].expr);
+        break;
+    default:
+        break;
+    }
+}
+
+void walk_pool_decl(DeclId id) {
+    walk_nodes++;
+    PoolDecl *d = &ast_pool.decls[POOL_INDEX(id)];
+    switch (POOL_KIND(id)) {
+    case DECL_ENUM:
+        for (uint32_t i = 0; i < d->items.len; i++) {
+            walk_pool_expr(ast_pool.enum_items[d->items.start + i].expr);
+        }
+        break;
+    case DECL_STRUCT:
+    case DECL_UNION:
+        for (uint32_t i = 0; i < d->items.len; i++) {
+            walk_pool_typespec(ast_pool.aggregate_items[d->items.start + i].type);
+        }
+        break;
+    case DECL_LET:
+    case DECL_CONST:
+    case DECL_TYPEDEF:
+        walk_pool_typespec(d->type);
+        walk_pool_expr(d->expr);
+        break;
+    case DECL_FN:
+        for (uint32_t i = 0; i < d->items.len; i++) {
+            walk_pool_typespec(ast_pool.params[d->items.start + i].type);
+        }
+        walk_pool_typespec(d->type);
+        walk_pool_stmts(d->block);
+        break;
+    default:
+        break;
+    }
+}
+
+void walk_reset(void) {
+    walk_nodes = 0;
+    walk_bytes = 0;
+    walk_sum = 0;
+    walk_jumps = 0;
+    walk_last = NULL;
+    walk_typespecs = 0;
+    walk_typespec_bytes = 0;
+}
+
+double walk_decls_time(Decl **decls) {
+    double best = 1e9;
+    for (int r = 0; r < BENCH_REPEAT; r++) {
+        walk_reset();
+        double start = time_now();
+        for (Decl **it = decls; it != buf_end(decls); it++) {
+            walk_decl(*it);
+        }
+        double secs = time_now() - start;
+        best = secs < best ? secs : best;
+    }
+    return best;
+}
+
+void pool_bench(void) {
+    char *src = bench_source(20000);
+    init_stream(src);
+    Decl **decls = parse_file();
+
+    double ptr_secs = walk_decls_time(decls);
+    size_t ptr_nodes = walk_nodes;
+    size_t ptr_bytes = walk_bytes;
+    uint64_t ptr_sum = walk_sum;
+
+    pool_reset();
+    DeclId *ids = NULL;
+    for (Decl **it = decls; it != buf_end(decls); it++) {
+        buf_push(ids, pool_from_decl(*it));
+    }
+    double pool_secs = 1e9;
+    for (int r = 0; r < BENCH_REPEAT; r++) {
+        walk_reset();
+        double start = time_now();
+        for (DeclId *it = ids; it != buf_end(ids); it++) {
+            walk_pool_decl(*it);
+        }
+        double secs = time_now() - start;
+        pool_secs = secs < pool_secs ? secs : pool_secs;
+    }
+    assert(walk_nodes == ptr_nodes && walk_sum == ptr_sum);
+    size_t pool_total = pool_bytes();
+
+    printf("%-28s %9zu nodes  %6.1f bytes/node  %8.3f ms walk\n", "ast pointers", ptr_nodes, (double)ptr_bytes / ptr_nodes, ptr_secs * 1e3);
+    printf("%-28s %9zu nodes  %6.1f bytes/node  %8.3f ms walk\n", "ast pool handles", walk_nodes, (double)pool_total / walk_nodes, pool_secs * 1e3);
+    pool_reset();
+    buf_free(ids);
+    buf_free(decls);
+    buf_free(src);
+}
+
+void compact_bench(void) {
+    char *src = bench_source(200000);
+    init_stream(src);
+    Decl **decls = parse_file();
+
+    double parsed_secs = walk_decls_time(decls);
+    size_t parsed_nodes = walk_nodes;
+    size_t parsed_jumps = walk_jumps;
+    uint64_t parsed_sum = walk_sum;
+
+    double start = time_now();
+    ast_compact(decls, buf_len(decls));
+    double compact_secs = time_now() - start;
+
+    double compacted_secs = walk_decls_time(decls);
+    assert(walk_nodes == parsed_nodes && walk_sum == parsed_sum);
+
+    printf("%-28s %9zu nodes  %6.1f%% jumps  %8.3f ms walk\n", "ast as parsed", parsed_nodes, 100.0 * parsed_jumps / parsed_nodes, parsed_secs * 1e3);
+    printf("%-28s %9zu nodes  %6.1f%% jumps  %8.3f ms walk  %8.3f ms compact\n", "ast compacted", walk_nodes, 100.0 * walk_jumps / walk_nodes, compacted_secs * 1e3, compact_secs * 1e3);
+    buf_free(decls);
+    buf_free(src);
+}
+
+VisitResult visit_bench_pre(AstNode node, void *ctx) {
+    (void)ctx;
+    walk_nodes++;
+    if (node.kind == AST_EXPR && node.expr->kind == EXPR_INT) {
+        walk_sum += node.expr->int_val;
+    }
+    return VISIT_CONTINUE;
+}
+
+VisitResult visit_bench_post(AstNode node, void *ctx) {
+    (void)node;
+    (void)ctx;
+    return VISIT_CONTINUE;
+}
+
+void visit_bench_run(const char *name, Decl **decls, size_t num_decls) {
+    double rec_secs = 1e9;
+    for (int r = 0; r < BENCH_REPEAT; r++) {
+        walk_reset();
+        double start = time_now();
+        for (size_t i = 0; i < num_decls; i++) {
+            walk_decl(decls[i]);
+        }
+        double secs = time_now() - start;
+        rec_secs = secs < rec_secs ? secs : rec_secs;
+    }
+    size_t rec_nodes = walk_nodes;
+    uint64_t rec_sum = walk_sum;
+
+    AstVisitor visitor = {.pre = visit_bench_pre};
+    double pre_secs = 1e9;
+    double post_secs = 1e9;
+    for (int r = 0; r < BENCH_REPEAT; r++) {
+        walk_reset();
+        visitor.post = NULL;
+        double start = time_now();
+        ast_visit_decls(&visitor, decls, num_decls);
+        double secs = time_now() - start;
+        pre_secs = secs < pre_secs ? secs : pre_secs;
+        assert(walk_nodes == rec_nodes && walk_sum == rec_sum);
+
+        walk_reset();
+        visitor.post = visit_bench_post;
+        start = time_now();
+        ast_visit_decls(&visitor, decls, num_decls);
+        secs = time_now() - start;
+        post_secs = secs < post_secs ? secs : post_secs;
+    }
+    visitor_free(&visitor);
+    printf("%-28s %9zu nodes  %8.3f ms recursive  %8.3f ms visitor  %8.3f ms with post\n", name, rec_nodes, rec_secs * 1e3, pre_secs * 1e3, post_secs * 1e3);
+}
+
+void visit_bench(void) {
+    char *src = bench_source(20000);
+    init_stream(src);
+    Decl **decls = parse_file();
+    ast_compact(decls, buf_len(decls));
+    visit_bench_run("visit wide (corpus)", decls, buf_len(decls));
+
+    // Kept shallow enough for the recursive walk's C stack.
+    Expr *expr = expr_int(1);
+    for (int i = 0; i < 100000; i++) {
+        expr = expr_binary('+', expr_int(i), expr);
+    }
+    Decl *deep = decl_const(str_intern("deep"), expr);
+    visit_bench_run("visit deep (100k levels)", &deep, 1);
+    buf_free(decls);
+    buf_free(src);
+}
+
+void typespec_bench(void) {
+    char *src = bench_source(100000);
+    typespec_table_free();
+    init_stream(src);
+    Decl **decls = parse_file();
+    walk_decls_time(decls);
+    printf("%-28s %9zu uses   %9zu bytes unshared  %9zu nodes  %6zu bytes shared\n", "typespecs hash-consed", walk_typespecs,
+           walk_typespec_bytes, typespec_table.len, typespec_table.bytes);
+    buf_free(decls);
+    buf_free(src);
+}
+
+#define BENCH_AST_PATH "rionc_bench.ast"
+
+void ast_file_bench(void) {
+    char *src = bench_source(20000);
+    double parse_secs = 1e9;
+    Decl **decls = NULL;
+    for (int r = 0; r < BENCH_REPEAT; r++) {
+        buf_free(decls);
+        double start = time_now();
+        init_stream(src);
+        decls = parse_file();
+        double secs = time_now() - start;
+        parse_secs = secs < parse_secs ? secs : parse_secs;
+    }
+    double start = time_now();
+    if (!ast_file_write(BENCH_AST_PATH, decls, buf_len(decls))) {
+        printf("error: cannot write '%s'\n", BENCH_AST_PATH);
+        return;
+    }
+    double write_secs = time_now() - start;
+
+    double load_secs = 1e9;
+    size_t num_decls = 0;
+    for (int r = 0; r < BENCH_REPEAT; r++) {
+        start = time_now();
+        Decl **loaded = ast_file_load(BENCH_AST_PATH, &num_decls);
+        double secs = time_now() - start;
+        load_secs = secs < load_secs ? secs : load_secs;
+        assert(loaded && num_decls == buf_len(decls));
+    }
+    FILE *file = fopen(BENCH_AST_PATH, "rb");
+    fseek(file, 0, SEEK_END);
+    long file_size = ftell(file);
+    fclose(file);
+    remove(BENCH_AST_PATH);
+
+    printf("%-28s %9.3f ms  %9zu source bytes\n", "lex+parse", parse_secs * 1e3, buf_len(src));
+    printf("%-28s %9.3f ms  %9ld file bytes  %8.3f ms write\n", "ast file load (mmap)", load_secs * 1e3, file_size, write_secs * 1e3);
+    buf_free(decls);
+    buf_free(src);
+}
+
+double cache_bench_run(const char *name, const char *src, bool cached) {
+    size_t hits = decl_cache.hits;
+    size_t misses = decl_cache.misses;
+    double start = time_now();
+    init_stream(src);
+    Decl **decls = cached ? parse_file_cached() : parse_file();
+    double secs = time_now() - start;
+    assert(num_syntax_errors == 0);
+    printf("%-28s %9.3f ms  %6zu hits  %6zu misses\n", name, secs * 1e3, decl_cache.hits - hits, decl_cache.misses - misses);
+    buf_free(decls);
+    return secs;
+}
+
+void cache_bench(void) {
+    char dir[] = "/tmp/rionc-bench-cache-XXXXXX";
+    if (!mkdtemp(dir) || !decl_cache_init(dir)) {
+        printf("error: cannot create cache directory\n");
+        return;
+    }
+    char *src = bench_source(20000);
+    double uncached = cache_bench_run("parse, no cache", src, false);
+    cache_bench_run("parse, cold cache", src, true);
+    double warm = cache_bench_run("parse, warm cache", src, true);
+    printf("%-28s %9.2fx faster than no cache\n", "warm cache", uncached / warm);
+    char *edit = strstr(src, "b * 2;");
+    edit[4] = '3';
+    cache_bench_run("parse, one fn edited", src, true);
+    cache_bench_run("parse, edit cached", src, true);
+
+    decl_cache_free();
+    DIR *d = opendir(dir);
+    char path[4096];
+    for (struct dirent *ent = readdir(d); ent; ent = readdir(d)) {
+        snprintf(path, sizeof(path), "%s/%s", dir, ent->d_name);
+        unlink(path);
+    }
+    closedir(d);
+    rmdir(dir);
+    decl_cache = (DeclCache){0};
+    buf_free(src);
+}
+
+// Times print_decls with stdout pointed at fd. Returns the best of
+// BENCH_REPEAT runs.
+double print_bench_run(Decl **decls, int fd) {
+    double best = 1e9;
+    for (int r = 0; r < BENCH_REPEAT; r++) {
+        fflush(stdout);
+        int saved_stdout = dup(STDOUT_FILENO);
+        dup2(fd, STDOUT_FILENO);
+        double start = time_now();
+        print_decls(decls, buf_len(decls));
+        fflush(stdout);
+        double secs = time_now() - start;
+        dup2(saved_stdout, STDOUT_FILENO);
+        close(saved_stdout);
+        best = MIN(best, secs);
+    }
+    return best;
+}
+
+void print_bench(void) {
+    char *src = bench_source(20000);
+    init_stream(src);
+    Decl **decls = parse_file();
+    FILE *sized = tmpfile();
+    print_bench_run(decls, fileno(sized));
+    size_t bytes = lseek(fileno(sized), 0, SEEK_END) / BENCH_REPEAT;
+    fclose(sized);
+    int null_fd = open("/dev/null", O_WRONLY);
+    bench_report("print to /dev/null", print_bench_run(decls, null_fd), bytes, buf_len(decls), "decls");
+    close(null_fd);
+    double best = 1e9;
+    for (int r = 0; r < BENCH_REPEAT; r++) {
+        double start = time_now();
+        print_capture();
+        print_decls(decls, buf_len(decls));
+        char *output = print_release();
+        best = MIN(best, time_now() - start);
+        assert(buf_len(output) == bytes + 1);
+        buf_free(output);
+    }
+    bench_report("print to memory", best, bytes, buf_len(decls), "decls");
+    buf_free(decls);
+    buf_free(src);
+}
+
+#define FORMAT_BENCH_VALUES 1000000
+
+// Bit patterns spread over every exponent, then values like the ones in
+// source code.
+double format_bench_double(uint64_t x, size_t i) {
+    double val;
+    if (i % 2) {
+        memcpy(&val, &x, sizeof(val));
+        return isfinite(val) ? val : 1.0;
+    }
+    return (double)(x % 100000) / 100;
+}
+
+void format_bench(void) {
+    uint64_t *ints = xmalloc(FORMAT_BENCH_VALUES * sizeof(*ints));
+    double *doubles = xmalloc(FORMAT_BENCH_VALUES * sizeof(*doubles));
+    uint64_t x = 88172645463325252ull;
+    for (size_t i = 0; i < FORMAT_BENCH_VALUES; i++) {
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        ints[i] = x >> (i % 64);
+        doubles[i] = format_bench_double(x, i);
+    }
+    char str[64];
+    size_t bytes = 0;
+    double start = time_now();
+    for (size_t i = 0; i < FORMAT_BENCH_VALUES; i++) {
+        bytes += snprintf(str, sizeof(str), "%llu", (unsigned long long)ints[i]);
+    }
+    bench_report("snprintf %llu", time_now() - start, bytes, FORMAT_BENCH_VALUES, "ints");
+    bytes = 0;
+    start = time_now();
+    for (size_t i = 0; i < FORMAT_BENCH_VALUES; i++) {
+        bytes += format_uint64(str, ints[i]);
+    }
+    bench_report("format_uint64", time_now() - start, bytes, FORMAT_BENCH_VALUES, "ints");
+    bytes = 0;
+    start = time_now();
+    for (size_t i = 0; i < FORMAT_BENCH_VALUES; i++) {
+        bytes += snprintf(str, sizeof(str), "%f", doubles[i]);
+    }
+    bench_report("snprintf %f (inexact)", time_now() - start, bytes, FORMAT_BENCH_VALUES, "doubles");
+    bytes = 0;
+    start = time_now();
+    for (size_t i = 0; i < FORMAT_BENCH_VALUES; i++) {
+        bytes += snprintf(str, sizeof(str), "%.17g", doubles[i]);
+    }
+    bench_report("snprintf %.17g", time_now() - start, bytes, FORMAT_BENCH_VALUES, "doubles");
+    bytes = 0;
+    start = time_now();
+    for (size_t i = 0; i < FORMAT_BENCH_VALUES; i++) {
+        bytes += format_double(str, doubles[i]);
+    }
+    bench_report("format_double (shortest)", time_now() - start, bytes, FORMAT_BENCH_VALUES, "doubles");
+    free(ints);
+    free(doubles);
+}
+
+void fmt_bench(void) {
+    char *src = bench_source(20000);
+    FILE *null_out = fopen("/dev/null", "w");
+    Arena old_arena = ast_arena;
+    TypespecTable old_table = typespec_table;
+    ast_arena = (Arena){0};
+    typespec_table = (TypespecTable){0};
+    double best = 1e9;
+    for (int r = 0; r < BENCH_REPEAT; r++) {
+        double start = time_now();
+        printer.file = null_out;
+        init_stream(src);
+        bool ok = fmt_stream();
+        print_flush();
+        best = MIN(best, time_now() - start);
+        assert(ok);
+    }
+    printer.file = NULL;
+    bench_report("fmt to /dev/null", best, buf_len(src), 20000, "decls");
+    typespec_table_free();
+    arena_free(&ast_arena);
+    ast_arena = old_arena;
+    typespec_table = old_table;
+    fclose(null_out);
+    buf_free(src);
+}
+
+#define SERVER_BENCH_DECLS 2000
+#define SERVER_BENCH_WARM 200
+#define SERVER_BENCH_COLD 50
+
+int double_cmp(const void *a, const void *b) {
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return x < y ? -1 : x > y;
+}
+
+void latency_report(const char *name, double *secs, size_t n) {
+    qsort(secs, n, sizeof(*secs), double_cmp);
+    printf("%-28s p50 %8.3f ms  p99 %8.3f ms  (%zu runs)\n", name, secs[n / 2] * 1e3, secs[n * 99 / 100] * 1e3, n);
+}
+
+// Runs a fresh rionc on path with its output discarded.
+bool cold_compile(const char *path) {
+    pid_t pid = fork();
+    if (pid == 0) {
+        int null_fd = open("/dev/null", O_WRONLY);
+        dup2(null_fd, STDOUT_FILENO);
+        execl("/proc/self/exe", "rionc", path, (char *)NULL);
+        _exit(127);
+    }
+    int status;
+    return pid > 0 && waitpid(pid, &status, 0) == pid && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+void server_bench(void) {
+    char path[] = "/tmp/rionc-bench-server-XXXXXX";
+    int fd = mkstemp(path);
+    char *src = bench_source(SERVER_BENCH_DECLS);
+    if (fd < 0 || write(fd, src, buf_len(src)) != (ssize_t)buf_len(src)) {
+        printf("error: cannot write server benchmark source\n");
+        return;
+    }
+    close(fd);
+    char socket_path[64];
+    snprintf(socket_path, sizeof(socket_path), "/tmp/rionc-bench-%d.sock", (int)getpid());
+    char request[128];
+    snprintf(request, sizeof(request), "compile %s", path);
+
+    // A fresh process, since a fork would start with every earlier bench's
+    // memory and can be killed for it.
+    fflush(stdout);
+    pid_t server = fork();
+    if (server == 0) {
+        fclose(stdin);
+        execl("/proc/self/exe", "rionc", "--serve", socket_path, (char *)NULL);
+        _exit(127);
+    }
+    FILE *null_out = fopen("/dev/null", "w");
+    bool up = false;
+    for (int i = 0; i < 1000 && !up; i++) {
+        up = server_request(socket_path, request, null_out) == 0;
+        if (!up) {
+            nanosleep(&(struct timespec){.tv_nsec = 1000000}, NULL);
+        }
+    }
+    if (up) {
+        double warm[SERVER_BENCH_WARM];
+        for (size_t i = 0; i < SERVER_BENCH_WARM; i++) {
+            double start = time_now();
+            int status = server_request(socket_path, request, null_out);
+            warm[i] = time_now() - start;
+            assert(status == 0);
+        }
+        latency_report("server, warm request", warm, SERVER_BENCH_WARM);
+        server_request(socket_path, "shutdown", null_out);
+    } else {
+        printf("error: server did not start\n");
+        kill(server, SIGTERM);
+    }
+    waitpid(server, NULL, 0);
+
+    double cold[SERVER_BENCH_COLD];
+    for (size_t i = 0; i < SERVER_BENCH_COLD; i++) {
+        double start = time_now();
+        bool ok = cold_compile(path);
+        cold[i] = time_now() - start;
+        assert(ok);
+    }
+    latency_report("cold process launch", cold, SERVER_BENCH_COLD);
+
+    fclose(null_out);
+    unlink(path);
+    buf_free(src);
+}
+
+// Generic S-expression tree, the least a reader of print_decl output
+// would have to build.
+typedef struct Sexpr Sexpr;
+
+struct Sexpr {
+    const char *atom; // NULL for lists
+    size_t len;
+    Sexpr *first;
+    Sexpr *next;
+};
+
+Arena sexpr_arena;
+size_t sexpr_nodes;
+
+Sexpr *sexpr_read(const char **str) {
+    const char *it = *str;
+    while (isspace((unsigned char)*it)) {
+        it++;
+    }
+    Sexpr *node = arena_alloc(&sexpr_arena, sizeof(Sexpr));
+    *node = (Sexpr){0};
+    sexpr_nodes++;
+    if (*it == '(') {
+        it++;
+        Sexpr **tail = &node->first;
+        for (;;) {
+            while (isspace((unsigned char)*it)) {
+                it++;
+            }
+            if (*it == ')' || !*it) {
+                break;
+            }
+            *tail = sexpr_read(&it);
+            tail = &(*tail)->next;
+        }
+        it += *it == ')';
+    } else if (*it == '"') {
+        node->atom = it++;
+        while (*it && *it != '"') {
+            it++;
+        }
+        it += *it == '"';
+        node->len = it - node->atom;
+    } else {
+        node->atom = it;
+        while (*it && *it != '(' && *it != ')' && !isspace((unsigned char)*it)) {
+            it++;
+        }
+        node->len = it - node->atom;
+    }
+    *str = it;
+    return node;
+}
+
+#define EXPORT_BENCH_DECLS 60000
+
+void export_bench(void) {
+    char *src = bench_source(EXPORT_BENCH_DECLS);
+    init_stream(src);
+    Decl **decls = parse_file();
+    size_t num_decls = buf_len(decls);
+    walk_decls_time(decls);
+    size_t num_nodes = walk_nodes;
+
+    double sexpr_write = 1e9, json_write = 1e9, bin_write = 1e9;
+    char *sexpr = NULL, *json = NULL, *bin = NULL;
+    for (int r = 0; r < BENCH_REPEAT; r++) {
+        buf_free(sexpr);
+        buf_free(json);
+        buf_free(bin);
+        double start = time_now();
+        print_capture();
+        print_decls(decls, num_decls);
+        sexpr = print_release();
+        double mid = time_now();
+        print_capture();
+        ast_export_json(decls, num_decls);
+        json = print_release();
+        double end = time_now();
+        print_capture();
+        ast_export_binary(decls, num_decls);
+        bin = print_release();
+        sexpr_write = MIN(sexpr_write, mid - start);
+        json_write = MIN(json_write, end - mid);
+        bin_write = MIN(bin_write, time_now() - end);
+    }
+    size_t bin_size = buf_len(bin) - 1;
+
+    double sexpr_read_secs = 1e9;
+    for (int r = 0; r < BENCH_REPEAT; r++) {
+        arena_free(&sexpr_arena);
+        sexpr_nodes = 0;
+        double start = time_now();
+        const char *it = sexpr;
+        while (*it) {
+            sexpr_read(&it);
+            while (isspace((unsigned char)*it)) {
+                it++;
+            }
+        }
+        sexpr_read_secs = MIN(sexpr_read_secs, time_now() - start);
+    }
+    arena_free(&sexpr_arena);
+
+    double bin_read = 1e9;
+    for (int r = 0; r < BENCH_REPEAT; r++) {
+        double start = time_now();
+        Decl **imported = ast_import_binary(bin, bin_size);
+        bin_read = MIN(bin_read, time_now() - start);
+        assert(buf_len(imported) == num_decls);
+        buf_free(imported);
+    }
+
+    printf("%zu decls, %zu nodes\n", num_decls, num_nodes);
+    bench_report("s-expr write", sexpr_write, buf_len(sexpr) - 1, num_nodes, "nodes");
+    bench_report("json write", json_write, buf_len(json) - 1, num_nodes, "nodes");
+    bench_report("binary write", bin_write, bin_size, num_nodes, "nodes");
+    bench_report("s-expr read (generic tree)", sexpr_read_secs, buf_len(sexpr) - 1, num_nodes, "nodes");
+    bench_report("binary read (Decl tree)", bin_read, bin_size, num_nodes, "nodes");
+    printf("%-28s %9zu s-expr  %9zu json  %9zu binary bytes\n", "size", buf_len(sexpr) - 1, buf_len(json) - 1, bin_size);
+    buf_free(sexpr);
+    buf_free(json);
+    buf_free(bin);
+    buf_free(decls);
+    buf_free(src);
+}
+
+double resolve_bench_run(const char *name, const char *src) {
+    init_stream(src);
+    Decl **decls = parse_file();
+    double best = 1e9;
+    for (int r = 0; r < BENCH_REPEAT; r++) {
+        double start = time_now();
+        resolve_globals(decls, buf_len(decls));
+        best = MIN(best, time_now() - start);
+        assert(buf_len(resolve_errors) == 0);
+    }
+    printf("%-28s %9.3f ms  %7zu decls  %7zu edges  %6.1f ns/decl+edge\n", name, best * 1e3, buf_len(decls),
+           buf_len(sym_deps), best * 1e9 / (buf_len(decls) + buf_len(sym_deps)));
+    resolve_reset();
+    buf_free(decls);
+    return best;
+}
+
+// Corpus decls are mostly independent; the chains are declared
+// back to front so every one of them has to be reordered.
+char *resolve_bench_chains(size_t num_decls, size_t chain_len) {
+    char *src = NULL;
+    for (size_t i = num_decls; i-- > 0;) {
+        if (i % chain_len == 0) {
+            buf_printf(src, "const k%zu = %zu\n", i, i);
+        } else {
+            buf_printf(src, "let k%zu: T%zu[k%zu] = {k%zu}\ntypedef T%zu = int\n", i, i, i - 1, i - 1, i);
+        }
+    }
+    return src;
+}
+
+void resolve_bench(void) {
+    char *src = bench_source(10000);
+    resolve_bench_run("resolve corpus 10k", src);
+    buf_free(src);
+    src = bench_source(100000);
+    resolve_bench_run("resolve corpus 100k", src);
+    buf_free(src);
+    src = resolve_bench_chains(50000, 100);
+    resolve_bench_run("resolve chains 100k", src);
+    buf_free(src);
+    src = resolve_bench_chains(50000, 50000);
+    resolve_bench_run("resolve one chain 100k", src);
+    buf_free(src);
+}
+
+VisitResult count_idents_pre(AstNode node, void *ctx) {
+    if (node.kind == AST_EXPR && node.expr->kind == EXPR_IDENT) {
+        (*(size_t *)ctx)++;
+    }
+    return VISIT_CONTINUE;
+}
+
+VisitResult count_idents_post(AstNode node, void *ctx) {
+    (void)node;
+    (void)ctx;
+    return VISIT_CONTINUE;
+}
+
+// The corpus bodies call trace and read v, so declare them first.
+void locals_bench(void) {
+    char *src = NULL;
+    buf_printf(src, "fn trace(s: char*) {}\nstruct P { q: int; }\nstruct V { p: P*; }\nlet v: V\n");
+    char *corpus = bench_source(100000);
+    buf_printf(src, "%s", corpus);
+    buf_free(corpus);
+    init_stream(src);
+    Decl **decls = parse_file();
+    size_t num_idents = 0;
+    AstVisitor visitor = {.pre = count_idents_pre, .post = count_idents_post, .ctx = &num_idents};
+    ast_visit_decls(&visitor, decls, buf_len(decls));
+    visitor_free(&visitor);
+    size_t saved_threads = resolve_threads;
+    size_t thread_counts[] = {1, 2, 4};
+    for (size_t i = 0; i < sizeof(thread_counts) / sizeof(*thread_counts); i++) {
+        resolve_threads = thread_counts[i];
+        double best = 1e9;
+        for (int r = 0; r < BENCH_REPEAT; r++) {
+            resolve_globals(decls, buf_len(decls));
+            double start = time_now();
+            resolve_locals(decls, buf_len(decls));
+            best = MIN(best, time_now() - start);
+            assert(buf_len(resolve_errors) == 0);
+        }
+        char name[64];
+        snprintf(name, sizeof(name), "resolve locals, %zu thread%s", thread_counts[i], thread_counts[i] > 1 ? "s" : "");
+        printf("%-28s %9.3f ms  %7zu idents  %6.1f ns/ident\n", name, best * 1e3, num_idents, best * 1e9 / num_idents);
+    }
+    resolve_threads = saved_threads;
+    resolve_reset();
+    buf_free(decls);
+    buf_free(src);
+}
+
+void check_bench(void) {
+    char *src = NULL;
+    buf_printf(src, "fn trace(s: char*) {}\nstruct P { q: int; }\nstruct V { p: P*; }\nlet v: V\n");
+    char *corpus = bench_source(100000);
+    buf_printf(src, "%s", corpus);
+    buf_free(corpus);
+    size_t num_lines = 0;
+    for (const char *c = src; *c; c++) {
+        num_lines += *c == '\n';
+    }
+    init_stream(src);
+    Decl **decls = parse_file();
+    double best = 1e9;
+    for (int i = 0; i < BENCH_REPEAT; i++) {
+        check_reset();
+        resolve_decls(decls, buf_len(decls));
+        double start = time_now();
+        check_syms();
+        best = MIN(best, time_now() - start);
+        assert(buf_len(resolve_errors) == 0 && buf_len(check_errors) == 0);
+    }
+    printf("%-28s %9.3f ms  %7zu lines  %6.2f ms/100k lines\n", "check", best * 1e3, num_lines, best * 1e3 * 1e5 / num_lines);
+    size_t num_types = type_table.len + type_table.named;
+    printf("%-28s %9zu interned  %7zu named  %6.1f bytes/type  %5.1f uses/interned\n", "check types", type_table.len,
+           type_table.named, (double)type_table.bytes / num_types, (double)type_table.uses / type_table.len);
+    check_reset();
+    resolve_reset();
+    buf_free(decls);
+    buf_free(src);
+}
+
+// A 10k-item enum, mostly auto-incremented, feeding a 100k-long const chain.
+void const_bench(void) {
+    char *src = NULL;
+    buf_printf(src, "enum Big {");
+    for (int i = 0; i < 10000; i++) {
+        if (i % 100) {
+            buf_printf(src, " X%d", i);
+        } else {
+            buf_printf(src, " X%d = %d", i, i);
+        }
+    }
+    buf_printf(src, " }\nconst k0 = X9999\n");
+    for (int i = 1; i < 100000; i++) {
+        buf_printf(src, "const k%d = k%d * 3 / 3 + (k%d & 1)\n", i, i - 1, i - 1);
+    }
+    init_stream(src);
+    Decl **decls = parse_file();
+    double best = 1e9;
+    size_t num_nodes = 0;
+    for (int i = 0; i < BENCH_REPEAT; i++) {
+        check_reset();
+        resolve_decls(decls, buf_len(decls));
+        const_nodes = 0;
+        double start = time_now();
+        check_syms();
+        best = MIN(best, time_now() - start);
+        num_nodes = const_nodes;
+        assert(buf_len(check_errors) == 0);
+    }
+    printf("%-28s %9.3f ms  %7zu nodes  %6.1f ns/node\n", "check + eval consts", best * 1e3, num_nodes, best * 1e9 / num_nodes);
+    check_reset();
+    resolve_reset();
+    buf_free(decls);
+    buf_free(src);
+}
+
+VisitResult count_exprs_pre(AstNode node, void *ctx) {
+    if (node.kind == AST_EXPR) {
+        (*(size_t *)ctx)++;
+    }
+    return VISIT_CONTINUE;
+}
+
+size_t count_exprs(Decl **decls, size_t num_decls) {
+    size_t num_exprs = 0;
+    AstVisitor visitor = {.pre = count_exprs_pre, .post = count_idents_post, .ctx = &num_exprs};
+    ast_visit_decls(&visitor, decls, num_decls);
+    visitor_free(&visitor);
+    return num_exprs;
+}
+
+void fold_bench(void) {
+    char *src = NULL;
+    buf_printf(src, "fn trace(s: char*) {}\nstruct P { q: int; }\nstruct V { p: P*; }\nlet v: V\n");
+    char *corpus = bench_source(100000);
+    buf_printf(src, "%s", corpus);
+    buf_free(corpus);
+    double best = 1e9;
+    size_t before = 0, after = 0;
+    for (int i = 0; i < BENCH_REPEAT; i++) {
+        init_stream(src);
+        Decl **decls = parse_file();
+        assert(check_decls(decls, buf_len(decls)));
+        before = count_exprs(decls, buf_len(decls));
+        fold_stats = (FoldStats){0};
+        double start = time_now();
+        fold_decls(decls, buf_len(decls));
+        best = MIN(best, time_now() - start);
+        after = count_exprs(decls, buf_len(decls));
+        buf_free(decls);
+    }
+    printf("%-28s %9.3f ms  %7zu -> %zu exprs (-%.1f%%)  %6.1f ns/expr\n", "fold", best * 1e3, before, after,
+           100.0 * (before - after) / before, best * 1e9 / before);
+    printf("%-28s %9zu folded  %7zu simplified  %7zu reduced\n", "fold rewrites", fold_stats.folded,
+           fold_stats.simplified, fold_stats.reduced);
+    fold_stats = (FoldStats){0};
+    check_reset();
+    resolve_reset();
+    buf_free(src);
+}
+
+VisitResult count_stmts_pre(AstNode node, void *ctx) {
+    if (node.kind == AST_STMT) {
+        (*(size_t *)ctx)++;
+    }
+    return VISIT_CONTINUE;
+}
+
+size_t count_stmts(Decl **decls, size_t num_decls) {
+    size_t num_stmts = 0;
+    AstVisitor visitor = {.pre = count_stmts_pre, .post = count_idents_post, .ctx = &num_stmts};
+    ast_visit_decls(&visitor, decls, num_decls);
+    visitor_free(&visitor);
+    return num_stmts;
+}
+
+// The usual corpus, where little is dead, plus fns with debug-only code.
+void dce_bench(void) {
+    char *src = NULL;
+    buf_printf(src, "fn trace(s: char*) {}\nstruct P { q: int; }\nstruct V { p: P*; }\nlet v: V\nconst DEBUG = 0\n");
+    char *corpus = bench_source(100000);
+    buf_printf(src, "%s", corpus);
+    buf_free(corpus);
+    for (int i = 0; i < 20000; i++) {
+        buf_printf(src,
+                   "fn d%d(a: int): int {\n"
+                   "    if (DEBUG) { trace(\"d\"); a++; }\n"
+                   "    while (a > 1) { a -= 2; continue; a++; }\n"
+                   "    if (DEBUG > 1) { return 0; } else if (a) { return a; } else { a--; }\n"
+                   "    return a;\n"
+                   "    trace(\"unreachable\");\n"
+                   "}\n",
+                   i);
+    }
+    double best = 1e9;
+    size_t before = 0, after = 0;
+    for (int i = 0; i < BENCH_REPEAT; i++) {
+        init_stream(src);
+        Decl **decls = parse_file();
+        assert(check_decls(decls, buf_len(decls)));
+        fold_decls(decls, buf_len(decls));
+        before = count_stmts(decls, buf_len(decls));
+        dce_stats = (DceStats){0};
+        double start = time_now();
+        dce_decls(decls, buf_len(decls));
+        best = MIN(best, time_now() - start);
+        after = count_stmts(decls, buf_len(decls));
+        buf_free(decls);
+    }
+    printf("%-28s %9.3f ms  %7zu -> %zu stmts (-%.1f%%)  %6.1f ns/stmt\n", "dce", best * 1e3, before, after,
+           100.0 * (before - after) / before, best * 1e9 / before);
+    printf("%-28s %9zu removed  %7zu arms  %7zu loops\n", "dce rewrites", dce_stats.stmts_removed,
+           dce_stats.branches_pruned, dce_stats.loops_removed);
+    dce_stats = (DceStats){0};
+    check_reset();
+    resolve_reset();
+    buf_free(src);
+}
+
+// The usual corpus, which has no recursion, plus self-recursive fns in the
+// plain, accumulator and void styles.
+void tco_bench(void) {
+    char *src = NULL;
+    buf_printf(src, "fn trace(s: char*) {}\nstruct P { q: int; }\nstruct V { p: P*; }\nlet v: V\n");
+    char *corpus = bench_source(100000);
+    buf_printf(src, "%s", corpus);
+    buf_free(corpus);
+    for (int i = 0; i < 20000; i++) {
+        buf_printf(src,
+                   "fn fact%d(n: int): int { if (n == 0) { return 1; } return n * fact%d(n - 1); }\n"
+                   "fn gcd%d(a: int, b: int): int { if (b == 0) { return a; } return gcd%d(b, a %% b); }\n"
+                   "fn down%d(n: int) { if (n > 0) { trace(\"down\"); down%d(n - 1); } }\n",
+                   i, i, i, i, i, i);
+    }
+    double best = 1e9;
+    size_t num_fns = 0;
+    for (int i = 0; i < BENCH_REPEAT; i++) {
+        init_stream(src);
+        Decl **decls = parse_file();
+        num_fns = 0;
+        for (size_t j = 0; j < buf_len(decls); j++) {
+            num_fns += decls[j]->kind == DECL_FN;
+        }
+        tco_stats = (TcoStats){0};
+        double start = time_now();
+        tco_decls(decls, buf_len(decls));
+        best = MIN(best, time_now() - start);
+        assert(check_decls(decls, buf_len(decls)));
+        buf_free(decls);
+    }
+    printf("%-28s %9.3f ms  %7zu fns  %7zu loops  %6.1f ns/fn\n", "tco", best * 1e3, num_fns, tco_stats.fns,
+           best * 1e9 / num_fns);
+    printf("%-28s %9zu calls  %7zu accumulated\n", "tco rewrites", tco_stats.calls, tco_stats.accumulated);
+    tco_stats = (TcoStats){0};
+    check_reset();
+    resolve_reset();
+    buf_free(src);
+}
+
+VisitResult count_calls_pre(AstNode node, void *ctx) {
+    size_t *counts = ctx;
+    counts[0]++;
+    if (node.kind == AST_EXPR && node.expr->kind == EXPR_CALL) {
+        counts[1]++;
+    }
+    return node.kind == AST_TYPESPEC ? VISIT_SKIP : VISIT_CONTINUE;
+}
+
+// Counts nodes into counts[0] and calls into counts[1].
+void count_calls(Decl **decls, size_t num_decls, size_t counts[2]) {
+    counts[0] = counts[1] = 0;
+    AstVisitor visitor = {.pre = count_calls_pre, .post = count_idents_post, .ctx = counts};
+    ast_visit_decls(&visitor, decls, num_decls);
+    visitor_free(&visitor);
+}
+
+// The usual corpus, whose only calls are to the empty trace, plus small
+// helpers in the getter, expression and statement styles and their callers.
+void inline_bench(void) {
+    char *src = NULL;
+    buf_printf(src, "fn trace(s: char*) {}\nstruct P { q: int; }\nstruct V { p: P*; }\nlet v: V\n");
+    char *corpus = bench_source(100000);
+    buf_printf(src, "%s", corpus);
+    buf_free(corpus);
+    for (int i = 0; i < 20000; i++) {
+        buf_printf(src,
+                   "fn q%d(p: P*): int { return p.q; }\n"
+                   "fn twice%d(x: int): int { return x + x; }\n"
+                   "fn clamp%d(x: int, lo: int, hi: int): int { y := x; if (y < lo) { y = lo; } if (y > hi) { y = hi; } return y; }\n"
+                   "fn use%d(a: int): int { b := clamp%d(twice%d(a), 0, q%d(v.p)); trace(\"use\"); return twice%d(b + 1); }\n",
+                   i, i, i, i, i, i, i, i);
+    }
+    double best = 1e9;
+    size_t before[2] = {0}, after[2] = {0};
+    for (int i = 0; i < BENCH_REPEAT; i++) {
+        init_stream(src);
+        Decl **decls = parse_file();
+        assert(check_decls(decls, buf_len(decls)));
+        count_calls(decls, buf_len(decls), before);
+        inline_stats = (InlineStats){0};
+        double start = time_now();
+        inline_decls(decls, buf_len(decls));
+        best = MIN(best, time_now() - start);
+        count_calls(decls, buf_len(decls), after);
+        check_reset();
+        resolve_reset();
+        assert(check_decls(decls, buf_len(decls)));
+        buf_free(decls);
+    }
+    printf("%-28s %9.3f ms  %7zu -> %zu calls (-%.1f%%)  %6.1f ns/node\n", "inline", best * 1e3, before[1], after[1],
+           100.0 * (before[1] - after[1]) / before[1], best * 1e9 / before[0]);
+    printf("%-28s %9zu exprs  %7zu splices  %zu -> %zu nodes (+%.1f%%)\n", "inline growth", inline_stats.exprs,
+           inline_stats.splices, before[0], after[0], 100.0 * ((double)after[0] - before[0]) / before[0]);
+    inline_stats = (InlineStats){0};
+    check_reset();
+    resolve_reset();
+    buf_free(src);
+}
+
+// The usual corpus plus fns with short, long and unbounded counting loops.
+void unroll_bench(void) {
+    char *src = NULL;
+    buf_printf(src, "fn trace(s: char*) {}\nstruct P { q: int; }\nstruct V { p: P*; }\nlet v: V\n");
+    char *corpus = bench_source(100000);
+    buf_printf(src, "%s", corpus);
+    buf_free(corpus);
+    for (int i = 0; i < 20000; i++) {
+        buf_printf(src,
+                   "fn sum%d(p: int*, n: int): int {\n"
+                   "    s := 0;\n"
+                   "    for (i := 0; i < 4; i++) { s += p[i]; }\n"
+                   "    for (i := 0; i < 1000; i += 2) { t := p[i] * p[i + 1]; s += t; }\n"
+                   "    for (i := 0; i < n; i++) { s -= p[i]; }\n"
+                   "    return s;\n"
+                   "}\n",
+                   i);
+    }
+    double best = 1e9;
+    size_t before[2] = {0}, after[2] = {0};
+    for (int i = 0; i < BENCH_REPEAT; i++) {
+        init_stream(src);
+        Decl **decls = parse_file();
+        assert(check_decls(decls, buf_len(decls)));
+        count_calls(decls, buf_len(decls), before);
+        unroll_stats = (UnrollStats){0};
+        double start = time_now();
+        unroll_decls(decls, buf_len(decls));
+        best = MIN(best, time_now() - start);
+        count_calls(decls, buf_len(decls), after);
+        check_reset();
+        resolve_reset();
+        assert(check_decls(decls, buf_len(decls)));
+        buf_free(decls);
+    }
+    printf("%-28s %9.3f ms  %7zu nodes  %6.1f ns/node\n", "unroll", best * 1e3, before[0], best * 1e9 / before[0]);
+    printf("%-28s %9zu full  %7zu partial  %7zu copies  %zu -> %zu nodes (+%.1f%%)\n", "unroll growth",
+           unroll_stats.full, unroll_stats.partial, unroll_stats.copies, before[0], after[0],
+           100.0 * ((double)after[0] - before[0]) / before[0]);
+    unroll_stats = (UnrollStats){0};
+    check_reset();
+    resolve_reset();
+    buf_free(src);
+}
+
+// Solving side effects for the corpus plus 200 call chains of 100 fns,
+// every fn also calling one shared leaf. A third of the chains loop back
+// on themselves and a third write a global at the bottom. Then one fn is
+// changed: first the leaf, which every chain reaches, then a fn halfway
+// up one chain.
+void purity_bench(void) {
+    char *src = NULL;
+    buf_printf(src, "fn trace(s: char*) {}\nstruct P { q: int; }\nstruct V { p: P*; }\nlet v: V\nlet g: int\n"
+                    "fn leaf(x: int): int { return x * 2; }\n");
+    char *corpus = bench_source(100000);
+    buf_printf(src, "%s", corpus);
+    buf_free(corpus);
+    for (int c = 0; c < 200; c++) {
+        for (int i = 0; i < 100; i++) {
+            buf_printf(src, "fn c%d_%d(p: int*, n: int): int { ", c, i);
+            if (i == 0 && c % 3 == 1) {
+                buf_printf(src, "g = n; ");
+            }
+            if (i > 0) {
+                buf_printf(src, "return n > 0 ? c%d_%d(p, n - 1) + leaf(n) : p[0]; }\n", c, i - 1);
+            } else if (c % 3 == 0) {
+                buf_printf(src, "return n > 0 ? c%d_99(p, n - 1) + leaf(n) : 0; }\n", c);
+            } else {
+                buf_printf(src, "return leaf(n); }\n");
+            }
+        }
+    }
+    init_stream(src);
+    Decl **decls = parse_file();
+    assert(check_decls(decls, buf_len(decls)));
+    Decl **fns = NULL;
+    for (size_t i = 0; i < buf_len(decls); i++) {
+        if (decls[i]->kind == DECL_FN) {
+            buf_push(fns, decls[i]);
+        }
+    }
+    Decl *leaf = NULL, *mid = NULL;
+    for (size_t i = 0; i < buf_len(fns); i++) {
+        if (strcmp(fns[i]->name, "leaf") == 0) {
+            leaf = fns[i];
+        } else if (strcmp(fns[i]->name, "c1_50") == 0) {
+            mid = fns[i];
+        }
+    }
+    double best[3] = {1e9, 1e9, 1e9};
+    PurityStats stats[3] = {0};
+    size_t counts[3] = {0};
+    for (int i = 0; i < BENCH_REPEAT; i++) {
+        purity_reset();
+        Decl *changed[3] = {NULL, leaf, mid};
+        for (int k = 0; k < 3; k++) {
+            purity_stats = (PurityStats){0};
+            if (changed[k]) {
+                purity_invalidate(changed[k]);
+            }
+            double start = time_now();
+            size_t pure = 0, effect_free = 0;
+            for (size_t j = 0; j < buf_len(fns); j++) {
+                pure += purity_pure(fns[j]);
+                effect_free += purity_side_effect_free(fns[j]);
+            }
+            best[k] = MIN(best[k], time_now() - start);
+            stats[k] = purity_stats;
+            counts[0] = pure;
+            counts[1] = effect_free;
+            counts[2] = buf_len(fns) - effect_free;
+        }
+    }
+    printf("%-28s %9.3f ms  %7zu fns  %7zu sccs  %6.1f ns/fn\n", "purity", best[0] * 1e3, buf_len(fns),
+           stats[0].sccs, best[0] * 1e9 / buf_len(fns));
+    printf("%-28s %9zu pure  %7zu no side effects  %7zu with\n", "purity results", counts[0], counts[1], counts[2]);
+    const char *names[3] = {NULL, "purity leaf changed", "purity mid-chain changed"};
+    for (int k = 1; k < 3; k++) {
+        printf("%-28s %9.3f ms  %7zu invalidated  %7zu rescanned  %zu sccs\n", names[k], best[k] * 1e3,
+               stats[k].invalidated, stats[k].scans, stats[k].sccs);
+    }
+    purity_stats = (PurityStats){0};
+    buf_free(fns);
+    buf_free(decls);
+    check_reset();
+    resolve_reset();
+    buf_free(src);
+}
+
+// The corpus plus fns that read the same fields and elements over and over,
+// as code indexing into nested structs does, with writes in between that
+// end some of the reuse.
+void cse_bench(void) {
+    char *src = NULL;
+    buf_printf(src, "fn trace(s: char*) {}\nstruct P { q: int; }\nstruct V { p: P*; }\nlet v: V\n"
+                    "struct Pt { x: int; y: int; }\nstruct Poly { pts: Pt*; n: int; }\n"
+                    "fn dot(a: Pt, b: Pt): int { return a.x * b.x + a.y * b.y; }\n");
+    char *corpus = bench_source(100000);
+    buf_printf(src, "%s", corpus);
+    buf_free(corpus);
+    for (int i = 0; i < 20000; i++) {
+        buf_printf(src,
+                   "fn area%d(g: Poly*, i: int, k: int): int {\n"
+                   "    dx := g.pts[i + 1].x - g.pts[i].x;\n"
+                   "    dy := g.pts[i + 1].y - g.pts[i].y;\n"
+                   "    s := dx * dx + dy * dy + g.pts[i].x * g.pts[i + 1].y - g.pts[i + 1].x * g.pts[i].y;\n"
+                   "    g.pts[i].x = s * k;\n"
+                   "    s += g.pts[i].x * k + dot(g.pts[i], g.pts[i + 1]) * k;\n"
+                   "    return s + (g.n > i ? g.n - i : 0);\n"
+                   "}\n",
+                   i);
+    }
+    double best = 1e9;
+    size_t before[2] = {0}, after[2] = {0};
+    for (int i = 0; i < BENCH_REPEAT; i++) {
+        init_stream(src);
+        Decl **decls = parse_file();
+        assert(check_decls(decls, buf_len(decls)));
+        count_calls(decls, buf_len(decls), before);
+        cse_stats = (CseStats){0};
+        double start = time_now();
+        cse_decls(decls, buf_len(decls));
+        best = MIN(best, time_now() - start);
+        count_calls(decls, buf_len(decls), after);
+        check_reset();
+        resolve_reset();
+        assert(check_decls(decls, buf_len(decls)));
+        buf_free(decls);
+    }
+    printf("%-28s %9.3f ms  %7zu nodes  %6.1f ns/node\n", "cse", best * 1e3, before[0], best * 1e9 / before[0]);
+    printf("%-28s %9zu temps  %7zu replaced  %7zu nodes eliminated  %zu -> %zu nodes\n", "cse savings",
+           cse_stats.temps, cse_stats.replaced, cse_stats.nodes, before[0], after[0]);
+    cse_stats = (CseStats){0};
+    check_reset();
+    resolve_reset();
+    buf_free(src);
+}
+
+// Switches of 256 cases: nearly consecutive, in four clusters, and spread
+// out. Dispatching a spread of values through each plan is compared with
+// trying the cases in order, as an if chain would.
+void switch_bench(void) {
+    char *src = NULL;
+    const char *shapes[] = {"dense", "clustered", "sparse"};
+    for (int k = 0; k < 3; k++) {
+        buf_printf(src, "fn %s(x: int) { switch (x) {", shapes[k]);
+        for (int i = 0; i < 256; i++) {
+            int value = k == 0 ? i + i / 16 : k == 1 ? (i / 64) * 100000 + i % 64 : i * 7919 + (i % 7) * 13;
+            buf_printf(src, " case %d: {}", value);
+        }
+        buf_printf(src, " default {} } }\n");
+    }
+    init_stream(src);
+    Decl **decls = parse_file();
+    assert(check_decls(decls, buf_len(decls)));
+    enum { NUM_KEYS = 1 << 16 };
+    for (int k = 0; k < 3; k++) {
+        Stmt *stmt = decls[k]->fn.block.stmts[0];
+        SwitchPlan *plan = stmt->switch_stmt.plan;
+        uint64_t *chain = NULL;
+        for (size_t i = 0; i < stmt->switch_stmt.num_cases; i++) {
+            SwitchCase *c = &stmt->switch_stmt.cases[i];
+            for (size_t j = 0; j < c->num_exprs; j++) {
+                ConstVal val;
+                bool ok = const_eval(c->exprs[j], &val);
+                assert(ok);
+                buf_push(chain, switch_key(val));
+            }
+        }
+        size_t num_chain = buf_len(chain);
+        uint64_t lo = plan->ranges[0].lo;
+        uint64_t span = plan->ranges[plan->num_ranges - 1].hi - lo + 1;
+        uint64_t *keys = NULL;
+        for (uint64_t i = 0; i < NUM_KEYS; i++) {
+            buf_push(keys, i % 2 ? chain[(i * 2654435761u) % num_chain] : lo + (i * 2654435761u) % span);
+        }
+        double best_plan = 1e9, best_chain = 1e9, best_build = 1e9;
+        size_t sum = 0;
+        for (int r = 0; r < BENCH_REPEAT; r++) {
+            double start = time_now();
+            for (int n = 0; n < 16; n++) {
+                switch_plan(stmt, type_int);
+            }
+            best_build = MIN(best_build, (time_now() - start) / 16);
+            start = time_now();
+            for (size_t i = 0; i < NUM_KEYS; i++) {
+                sum += switch_dispatch(plan, keys[i]);
+            }
+            best_plan = MIN(best_plan, time_now() - start);
+            start = time_now();
+            for (size_t i = 0; i < NUM_KEYS; i++) {
+                size_t target = num_chain;
+                for (size_t j = 0; j < num_chain; j++) {
+                    if (chain[j] == keys[i]) {
+                        target = j;
+                        break;
+                    }
+                }
+                sum -= target;
+            }
+            best_chain = MIN(best_chain, time_now() - start);
+        }
+        char name[64];
+        snprintf(name, sizeof(name), "switch %s", shapes[k]);
+        printf("%-28s %9s  %3zu ranges  %6.1f us plan  %6.1f ns/dispatch  %7.1f ns/chain (%zu)\n", name,
+               switch_kind_names[plan->kind], plan->num_ranges, best_build * 1e6, best_plan * 1e9 / NUM_KEYS,
+               best_chain * 1e9 / NUM_KEYS, sum % 2);
+        buf_free(chain);
+        buf_free(keys);
+    }
+    buf_free(decls);
+    buf_free(src);
+    check_reset();
+    resolve_reset();
+}
+
+void run_benchmarks(void) {
+    init_keywords();
+    parse_bench();
+    pool_bench();
+    compact_bench();
+    visit_bench();
+    typespec_bench();
+    ast_file_bench();
+    cache_bench();
+    format_bench();
+    print_bench();
+    fmt_bench();
+    export_bench();
+    resolve_bench();
+    locals_bench();
+    check_bench();
+    const_bench();
+    fold_bench();
+    dce_bench();
+    tco_bench();
+    inline_bench();
+    unroll_bench();
+    switch_bench();
+    purity_bench();
+    cse_bench();
+    server_bench();
+}
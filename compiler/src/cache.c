@@ -0,0 +1,580 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "ast.h"
+
+DeclCache decl_cache;
+
+// A NULL dir keeps the cache in memory only, when resident is set.
+bool decl_cache_init(const char *dir) {
+    if (dir && mkdir(dir, 0755) != 0 && errno != EEXIST) {
+        return false;
+    }
+    decl_cache = (DeclCache){
+        .dir = dir,
+        .max_bytes = DECL_CACHE_MAX_BYTES,
+    };
+    return true;
+}
+
+// Releases loaded packs, so every decl that came from disk is gone, and
+// forgets the resident decls.
+void decl_cache_free(void) {
+    for (char **it = decl_cache.entries; it != buf_end(decl_cache.entries); it++) {
+        free(*it);
+    }
+    buf_free(decl_cache.entries);
+    map_free(&decl_cache.resident_decls);
+}
+
+void cache_path(char *path, size_t size, uint64_t hash, const char *suffix) {
+    snprintf(path, size, "%s/%016llx.ast%s", decl_cache.dir, (unsigned long long)hash, suffix);
+}
+
+// Hashes the text of every token from the current one up to the next
+// declaration keyword outside any brackets, leaving the lexer there. The
+// string literals it passes are freed, since a miss lexes them again; the
+// first token is kept for the caller to restore.
+uint64_t scan_decl(void) {
+    uint64_t hash = hash_mix(AST_FILE_VERSION, sizeof(void *));
+    int depth = 0;
+    bool first = true;
+    do {
+        hash = hash_mix(hash, hash_bytes(token.lo, token.hi - token.lo));
+        if (!first && is_token(TOKEN_STR)) {
+            char *str = (char *)token.str_val;
+            buf_free(str);
+        }
+        if (is_token('{') || is_token('(') || is_token('[')) {
+            depth++;
+        } else if (is_token('}') || is_token(')') || is_token(']')) {
+            depth--;
+        }
+        next_token();
+        first = false;
+    } while (!is_token(TOKEN_EOF) && !(depth <= 0 && is_decl_keyword()));
+    return hash;
+}
+
+typedef struct CachePackHeader {
+    char magic[8];
+    uint64_t src_hash;
+    uint64_t num_order;
+    uint64_t num_decls;
+} CachePackHeader;
+
+// Names the pack of the source being lexed. Its delta pack is named after
+// the next key.
+uint64_t cache_pack_key(void) {
+    const char *name = token.pos.name ? token.pos.name : "";
+    return hash_mix(hash_mix(AST_FILE_VERSION, sizeof(void *)), hash_bytes(name, strlen(name)));
+}
+
+// The layout is the header, then num_order and num_decls hashes, then an
+// AST file of the decls.
+bool cache_pack_load(CachePack *pack, uint64_t key) {
+    char path[4096];
+    cache_path(path, sizeof(path), key, "");
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(CachePackHeader)) {
+        close(fd);
+        return false;
+    }
+    size_t size = st.st_size;
+    char *data = xmalloc(size);
+    size_t len = 0;
+    while (len < size) {
+        ssize_t n = read(fd, data + len, size - len);
+        if (n <= 0) {
+            break;
+        }
+        len += n;
+    }
+    if (len == size && time(NULL) - st.st_mtime > DECL_CACHE_TOUCH_SECS) {
+        futimens(fd, NULL);
+    }
+    close(fd);
+    CachePackHeader header;
+    memcpy(&header, data, sizeof(header));
+    size_t offset = sizeof(header) + (header.num_order + header.num_decls) * sizeof(uint64_t);
+    // Everything is checked before loading, since a successful load puts
+    // nodes from data in the typespec table and data must then stay alive.
+    size_t num_decls = 0;
+    Decl **decls = NULL;
+    if (len == size && memcmp(header.magic, DECL_CACHE_PACK_MAGIC, sizeof(header.magic)) == 0 &&
+        header.num_order <= size / sizeof(uint64_t) && header.num_decls <= size / sizeof(uint64_t) &&
+        offset < size && size - offset >= sizeof(AstFileHeader)) {
+        AstFileHeader ast_header;
+        memcpy(&ast_header, data + offset, sizeof(ast_header));
+        if (ast_header.decls.count == header.num_decls) {
+            decls = ast_file_load_mem(data + offset, size - offset, &num_decls);
+        }
+    }
+    if (!decls) {
+        // Stale or damaged; the next store replaces it.
+        free(data);
+        return false;
+    }
+    buf_push(decl_cache.entries, data);
+    const uint64_t *hashes = (const uint64_t *)(data + sizeof(header));
+    *pack = (CachePack){.loaded = true, .src_hash = header.src_hash, .order = hashes, .num_order = header.num_order,
+                        .num_decls = num_decls};
+    for (size_t i = 0; i < num_decls; i++) {
+        map_put_uint64(&pack->decls, hashes[header.num_order + i], (uintptr_t)decls[i]);
+    }
+    decl_cache.loads++;
+    return true;
+}
+
+void cache_pack_store(uint64_t key, uint64_t src_hash, uint64_t *order, Decl **decls, uint64_t *hashes) {
+    char path[4096];
+    char tmp_path[4096];
+    char suffix[32];
+    cache_path(path, sizeof(path), key, "");
+    snprintf(suffix, sizeof(suffix), ".tmp%ld", (long)getpid());
+    cache_path(tmp_path, sizeof(tmp_path), key, suffix);
+    CachePackHeader header = {DECL_CACHE_PACK_MAGIC, src_hash, buf_len(order), buf_len(decls)};
+    char *ast = ast_file_write_mem(decls, buf_len(decls));
+    int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    struct {
+        const void *ptr;
+        size_t size;
+    } parts[] = {
+        {&header, sizeof(header)},
+        {order, buf_sizeof(order)},
+        {hashes, buf_sizeof(hashes)},
+        {ast, buf_len(ast)},
+    };
+    bool ok = fd >= 0;
+    for (size_t i = 0; ok && i < sizeof(parts) / sizeof(*parts); i++) {
+        const char *data = parts[i].ptr;
+        for (size_t len = 0; ok && len < parts[i].size;) {
+            ssize_t n = write(fd, data + len, parts[i].size - len);
+            ok = n > 0;
+            len += ok ? n : 0;
+        }
+    }
+    if (fd >= 0 && close(fd) != 0) {
+        ok = false;
+    }
+    // rename is atomic, so readers see the whole pack or none of it.
+    if (ok && rename(tmp_path, path) == 0) {
+        decl_cache.stores++;
+    } else {
+        unlink(tmp_path);
+    }
+    buf_free(ast);
+}
+
+void cache_pack_remove(uint64_t key) {
+    char path[4096];
+    cache_path(path, sizeof(path), key, "");
+    unlink(path);
+}
+
+void cache_packs_load(CachePack *packs, uint64_t key) {
+    cache_pack_load(&packs[0], key);
+    cache_pack_load(&packs[1], hash_mix(key, 1));
+}
+
+Decl *cache_packs_get(CachePack *packs, uint64_t hash) {
+    Decl *decl = (Decl *)(uintptr_t)map_get_uint64(&packs[0].decls, hash);
+    return decl ? decl : (Decl *)(uintptr_t)map_get_uint64(&packs[1].decls, hash);
+}
+// Rebuilds an unchanged source from the newest of its packs, if that has
+// the order of its decls. Leaves the lexer at end on success.
+Decl **cache_packs_rebuild(CachePack *packs, uint64_t src_hash, const char *end) {
+    CachePack *newest = packs[1].loaded ? &packs[1] : &packs[0];
+    if (!newest->loaded || !newest->num_order || newest->src_hash != src_hash) {
+        return NULL;
+    }
+    Decl **decls = NULL;
+    for (size_t i = 0; i < newest->num_order; i++) {
+        Decl *decl = cache_packs_get(packs, newest->order[i]);
+        if (!decl) {
+            buf_free(decls);
+            return NULL;
+        }
+        buf_push(decls, decl);
+    }
+    decl_cache.hits += buf_len(decls);
+    stream = end;
+    next_token();
+    return decls;
+}
+
+// Writes the cacheable decls of a source: the ones its pack lacks go in a
+// delta pack while they stay a small share of the source, or else all of
+// them go in one pack, which replaces both.
+void cache_packs_store(CachePack *packs, uint64_t key, uint64_t src_hash, Decl **cached, uint64_t *hashes,
+                       bool complete) {
+    Decl **delta = NULL;
+    uint64_t *delta_hashes = NULL;
+    for (size_t i = 0; i < buf_len(cached); i++) {
+        if (!map_get_uint64(&packs[0].decls, hashes[i])) {
+            buf_push(delta, cached[i]);
+            buf_push(delta_hashes, hashes[i]);
+        }
+    }
+    uint64_t *order = complete ? hashes : NULL;
+    if (packs[0].loaded && buf_len(delta) * DECL_CACHE_DELTA_RATIO <= buf_len(cached)) {
+        cache_pack_store(hash_mix(key, 1), src_hash, order, delta, delta_hashes);
+    } else {
+        cache_pack_store(key, src_hash, order, cached, hashes);
+        cache_pack_remove(hash_mix(key, 1));
+    }
+    buf_free(delta);
+    buf_free(delta_hashes);
+    decl_cache_evict();
+}
+
+Decl **parse_file_cached(void) {
+    Decl **decls = NULL;
+    bool on_disk = decl_cache.dir != NULL;
+    uint64_t pack_key = 0;
+    uint64_t src_hash = 0;
+    CachePack packs[2] = {0};
+    bool packs_loaded = false;
+    if (on_disk) {
+        pack_key = cache_pack_key();
+        const char *end = token.lo + strlen(token.lo);
+        src_hash = hash_bytes(token.lo, end - token.lo);
+        // Resident decls are looked up first, so packs wait for a miss.
+        if (!decl_cache.resident) {
+            cache_packs_load(packs, pack_key);
+            packs_loaded = true;
+            decls = cache_packs_rebuild(packs, src_hash, end);
+        }
+    }
+    bool rebuilt = decls != NULL;
+    // What a new pack of the source would hold.
+    Decl **cached = NULL;
+    uint64_t *hashes = NULL;
+    bool complete = true;
+    size_t parsed = 0;
+    while (!rebuilt && !is_token(TOKEN_EOF)) {
+        LexState start = lex_save();
+        size_t num_errors = num_syntax_errors;
+        uint64_t hash = scan_decl();
+        uint64_t key = hash ? hash : 1;
+        // Lexical errors get reported again when the decl is parsed.
+        bool cacheable = num_syntax_errors == num_errors;
+        truncate_syntax_errors(num_errors);
+        bool resident = decl_cache.resident && cacheable;
+        Decl *decl = resident ? (Decl *)(uintptr_t)map_get_uint64(&decl_cache.resident_decls, key) : NULL;
+        if (!decl && on_disk && cacheable) {
+            if (!packs_loaded) {
+                cache_packs_load(packs, pack_key);
+                packs_loaded = true;
+            }
+            decl = cache_packs_get(packs, key);
+            if (decl && resident) {
+                map_put_uint64(&decl_cache.resident_decls, key, (uintptr_t)decl);
+            }
+        }
+        if (decl) {
+            decl_cache.hits++;
+        } else {
+            if (resident || on_disk) {
+                decl_cache.misses++;
+            }
+            const char *end = token.lo;
+            lex_restore(start);
+            decl = parse_decl();
+            cacheable = cacheable && num_syntax_errors == num_errors && token.lo == end;
+            if (cacheable && resident) {
+                map_put_uint64(&decl_cache.resident_decls, key, (uintptr_t)decl);
+            }
+            parsed += cacheable;
+            if (panic_mode) {
+                synchronize(start.token.lo, false);
+            }
+        }
+        buf_push(decls, decl);
+        complete = complete && cacheable;
+        if (on_disk && cacheable) {
+            buf_push(cached, decl);
+            buf_push(hashes, key);
+        }
+    }
+    // Only a parse that read the packs can tell what they lack. One served
+    // from resident decls alone has nothing new for them.
+    CachePack *newest = packs[1].loaded ? &packs[1] : &packs[0];
+    bool relaid = complete && (!newest->loaded || newest->src_hash != src_hash);
+    if (packs_loaded && (parsed || relaid)) {
+        cache_packs_store(packs, pack_key, src_hash, cached, hashes, complete);
+    }
+    map_free(&packs[0].decls);
+    map_free(&packs[1].decls);
+    buf_free(cached);
+    buf_free(hashes);
+    return decls;
+}
+
+typedef struct CacheEntry {
+    char *name;
+    time_t mtime;
+    size_t size;
+} CacheEntry;
+
+int cache_entry_cmp(const void *a, const void *b) {
+    time_t x = ((const CacheEntry *)a)->mtime;
+    time_t y = ((const CacheEntry *)b)->mtime;
+    return x < y ? -1 : x > y;
+}
+
+bool is_cache_entry_name(const char *name) {
+    size_t len = strlen(name);
+    return len > 4 && strcmp(name + len - 4, ".ast") == 0;
+}
+
+// Deletes least recently used entries until the directory is back under
+// three quarters of max_bytes, so the next few stores don't rescan it.
+void decl_cache_evict(void) {
+    DIR *dir = opendir(decl_cache.dir);
+    if (!dir) {
+        return;
+    }
+    CacheEntry *entries = NULL;
+    size_t total = 0;
+    char path[4096];
+    for (struct dirent *ent = readdir(dir); ent; ent = readdir(dir)) {
+        struct stat st;
+        snprintf(path, sizeof(path), "%s/%s", decl_cache.dir, ent->d_name);
+        if (is_cache_entry_name(ent->d_name) && stat(path, &st) == 0 && S_ISREG(st.st_mode)) {
+            size_t len = strlen(ent->d_name) + 1;
+            buf_push(entries, (CacheEntry){memcpy(xmalloc(len), ent->d_name, len), st.st_mtime, st.st_size});
+            total += st.st_size;
+        }
+    }
+    closedir(dir);
+    if (total > decl_cache.max_bytes) {
+        qsort(entries, buf_len(entries), sizeof(*entries), cache_entry_cmp);
+        for (CacheEntry *it = entries; it != buf_end(entries) && total > decl_cache.max_bytes / 4 * 3; it++) {
+            snprintf(path, sizeof(path), "%s/%s", decl_cache.dir, it->name);
+            if (unlink(path) == 0) {
+                total -= it->size;
+                decl_cache.evictions++;
+            }
+        }
+    }
+    for (CacheEntry *it = entries; it != buf_end(entries); it++) {
+        free(it->name);
+    }
+    buf_free(entries);
+}
+
+void cache_test_free_entries(CacheEntry *entries) {
+    for (CacheEntry *it = entries; it != buf_end(entries); it++) {
+        free(it->name);
+    }
+    buf_free(entries);
+}
+
+// Lists the cache's entries, in the order their names sort.
+CacheEntry *cache_test_entries(const char *dir) {
+    DIR *d = opendir(dir);
+    CacheEntry *entries = NULL;
+    char path[4096];
+    for (struct dirent *ent = readdir(d); ent; ent = readdir(d)) {
+        struct stat st;
+        snprintf(path, sizeof(path), "%s/%s", dir, ent->d_name);
+        if (is_cache_entry_name(ent->d_name) && stat(path, &st) == 0) {
+            size_t len = strlen(ent->d_name) + 1;
+            buf_push(entries, (CacheEntry){memcpy(xmalloc(len), ent->d_name, len), st.st_mtime, st.st_size});
+        }
+    }
+    closedir(d);
+    for (size_t i = 1; i < buf_len(entries); i++) {
+        for (size_t j = i; j > 0 && strcmp(entries[j - 1].name, entries[j].name) > 0; j--) {
+            CacheEntry tmp = entries[j];
+            entries[j] = entries[j - 1];
+            entries[j - 1] = tmp;
+        }
+    }
+    return entries;
+}
+
+void cache_test_set_mtime(const char *dir, const char *name, time_t mtime) {
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+    struct timespec times[2] = {{mtime, 0}, {mtime, 0}};
+    assert(utimensat(AT_FDCWD, path, times, 0) == 0);
+}
+
+void cache_test_remove_dir(const char *dir) {
+    DIR *d = opendir(dir);
+    char path[4096];
+    for (struct dirent *ent = readdir(d); ent; ent = readdir(d)) {
+        if (strcmp(ent->d_name, ".") != 0 && strcmp(ent->d_name, "..") != 0) {
+            snprintf(path, sizeof(path), "%s/%s", dir, ent->d_name);
+            unlink(path);
+        }
+    }
+    closedir(d);
+    rmdir(dir);
+}
+
+Decl **cache_test_parse(const char *src) {
+    init_stream(src);
+    Decl **decls = parse_file_cached();
+    assert(num_syntax_errors == 0);
+    return decls;
+}
+
+void cache_test(void) {
+    char dir[] = "/tmp/rionc-cache-XXXXXX";
+    assert(mkdtemp(dir));
+    assert(decl_cache_init(dir));
+    const char *src =
+        "fn f(a: int): int { return a + 1; }\n"
+        "const c = 1\n"
+        "struct S { x, y: int; next: S*; }\n"
+        "fn g(s: S*): int { return s.x * f(s.y); }\n";
+    Decl **decls = cache_test_parse(src);
+    assert(buf_len(decls) == 4 && decl_cache.misses == 4 && decl_cache.stores == 1 && decl_cache.hits == 0);
+    char *expected = ast_file_write_mem(decls, buf_len(decls));
+    buf_free(decls);
+
+    // Layout doesn't change a declaration's tokens. The new layout goes in a
+    // delta pack with nothing else in it.
+    const char *relaid =
+        "fn f(a: int): int {\n    return a + 1;\n}\n"
+        "const c = 1 struct S { x, y: int; next: S*; } fn g(s: S*): int { return s.x * f(s.y); }";
+    decls = cache_test_parse(relaid);
+    assert(buf_len(decls) == 4 && decl_cache.hits == 4 && decl_cache.misses == 4 && decl_cache.stores == 2);
+    char *cached = ast_file_write_mem(decls, buf_len(decls));
+    assert(buf_len(cached) == buf_len(expected) && memcmp(cached, expected, buf_len(expected)) == 0);
+    assert(decls[3]->fn.params[0].type == typespec_ptr(typespec_ident(str_intern("S"))));
+    buf_free(cached);
+    buf_free(decls);
+
+    // An unchanged source is rebuilt from its packs without being lexed.
+    decls = cache_test_parse(relaid);
+    assert(buf_len(decls) == 4 && decl_cache.hits == 8 && decl_cache.stores == 2 && decl_cache.loads == 3);
+    assert(is_token(TOKEN_EOF) && decls[1]->name == str_intern("c"));
+    cached = ast_file_write_mem(decls, buf_len(decls));
+    assert(buf_len(cached) == buf_len(expected) && memcmp(cached, expected, buf_len(expected)) == 0);
+    buf_free(cached);
+    buf_free(decls);
+
+    // An edited decl joins the delta until that outgrows its share.
+    decls = cache_test_parse(
+        "fn f(a: int): int { return a + 2; }\n"
+        "const c = 1\n"
+        "struct S { x, y: int; next: S*; }\n"
+        "fn g(s: S*): int { return s.x * f(s.y); }\n");
+    assert(decl_cache.hits == 11 && decl_cache.misses == 5 && decl_cache.stores == 3);
+    assert(decls[0]->fn.block.stmts[0]->return_stmt.expr->binary.right->int_val == 2);
+    buf_free(decls);
+    decls = cache_test_parse(
+        "fn f(a: int): int { return a + 3; }\n"
+        "const c = 2\n"
+        "struct S { x, y: int; next: S*; }\n"
+        "fn g(s: S*): int { return s.x * f(s.y); }\n");
+    assert(decl_cache.hits == 13 && decl_cache.misses == 7 && decl_cache.stores == 4);
+    buf_free(decls);
+    CacheEntry *entries = cache_test_entries(dir);
+    assert(buf_len(entries) == 1);
+    cache_test_free_entries(entries);
+
+    // Decls with errors are never stored.
+    init_stream("fn h(): int { return 1 + ; }");
+    decls = parse_file_cached();
+    assert(num_syntax_errors == 1 && decl_cache.stores == 4);
+    reset_syntax_errors();
+    buf_free(decls);
+    buf_free(expected);
+
+    // Age one pack per source a minute apart, then evict: only the newest
+    // survive.
+    cache_test_remove_dir(dir);
+    assert(mkdir(dir, 0755) == 0);
+    for (char name[] = "a.rion"; name[0] < 'e'; name[0]++) {
+        init_stream_name(name, src);
+        decls = parse_file_cached();
+        buf_free(decls);
+    }
+    entries = cache_test_entries(dir);
+    assert(buf_len(entries) == 4);
+    size_t total = 0;
+    for (size_t i = 0; i < buf_len(entries); i++) {
+        cache_test_set_mtime(dir, entries[i].name, time(NULL) - 60 * (i + 1));
+        total += entries[i].size;
+    }
+    decl_cache.max_bytes = total - 1;
+    decl_cache.evictions = 0;
+    decl_cache_evict();
+    assert(decl_cache.evictions == 2);
+    CacheEntry *survivors = cache_test_entries(dir);
+    assert(buf_len(survivors) == 2);
+    for (size_t i = 0; i < buf_len(survivors); i++) {
+        assert(strcmp(survivors[i].name, entries[i].name) == 0);
+    }
+    cache_test_free_entries(survivors);
+    cache_test_free_entries(entries);
+
+    // A pack whose header disagrees with its AST file is rejected before any
+    // of its typespecs reach the table. Moving a hash between the counts keeps
+    // the AST file in place, and renaming a type makes its typespecs new.
+    init_stream_name("z.rion", "fn z(a: Packed*, b: Packed[2]) {}");
+    decls = parse_file_cached();
+    buf_free(decls);
+    uint64_t key = cache_pack_key();
+    char path[4096];
+    cache_path(path, sizeof(path), key, "");
+    struct stat st;
+    assert(stat(path, &st) == 0);
+    char *pack_data = read_file(path);
+    CachePackHeader header;
+    memcpy(&header, pack_data, sizeof(header));
+    header.num_order--;
+    header.num_decls++;
+    memcpy(pack_data, &header, sizeof(header));
+    for (size_t i = 0; i + 6 <= (size_t)st.st_size; i++) {
+        if (memcmp(pack_data + i, "Packed", 6) == 0) {
+            pack_data[i] = 'Q';
+        }
+    }
+    FILE *file = fopen(path, "wb");
+    assert(file && fwrite(pack_data, st.st_size, 1, file) == 1);
+    fclose(file);
+    free(pack_data);
+    size_t len = typespec_table.len;
+    CachePack pack = {0};
+    assert(!cache_pack_load(&pack, key) && typespec_table.len == len);
+
+    decl_cache.max_bytes = 0;
+    decl_cache_evict();
+    decl_cache.max_bytes = DECL_CACHE_MAX_BYTES;
+    size_t stores = decl_cache.stores;
+    decls = cache_test_parse(src);
+    assert(decl_cache.stores == stores + 1);
+    buf_free(decls);
+
+    // Resident decls are shared without touching the disk.
+    decl_cache.resident = true;
+    Decl **first = cache_test_parse(src);
+    size_t hits = decl_cache.hits;
+    size_t loads = decl_cache.loads;
+    decls = cache_test_parse(src);
+    assert(decl_cache.hits == hits + 4 && decl_cache.stores == stores + 1 && decl_cache.loads == loads);
+    for (size_t i = 0; i < 4; i++) {
+        assert(decls[i] == first[i]);
+    }
+    buf_free(first);
+    buf_free(decls);
+
+    decl_cache_free();
+    cache_test_remove_dir(dir);
+    decl_cache = (DeclCache){0};
+}
@@ -0,0 +1,883 @@
+#include "ast.h"
+
+char **check_errors;
+Sym *checking_sym;
+Type *checking_fn;
+
+void vcheck_error(const char *prefix, const char *fmt, va_list args) {
+    char buf[1024];
+    int n = snprintf(buf, sizeof(buf), "%s", prefix);
+    n += vsnprintf(buf + n, sizeof(buf) - n, fmt, args);
+    if (checking_sym && n < (int)sizeof(buf)) {
+        snprintf(buf + n, sizeof(buf) - n, " in '%s'", checking_sym->name);
+    }
+    size_t len = strlen(buf) + 1;
+    buf_push(check_errors, memcpy(xmalloc(len), buf, len));
+}
+
+void check_error(const char *fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    vcheck_error("Type Error: ", fmt, args);
+    va_end(args);
+}
+
+void check_reset(void) {
+    for (char **it = check_errors; it != buf_end(check_errors); it++) {
+        free(*it);
+    }
+    buf_free(check_errors);
+    type_table_free();
+    switch_reset();
+    purity_reset();
+}
+
+/*
+ * Globals are checked on demand, so a decl can use any other decl's type no
+ * matter which comes first. Aggregates get their named type as soon as it
+ * is asked for and are completed separately, which lets pointers to a
+ * struct appear before its fields are known. Cycles were already reported
+ * by resolution; here they just produce error types.
+ */
+
+Type *check_expr(Expr *expr, Type *expected);
+
+Type *sym_type(Sym *sym) {
+    switch (sym->kind) {
+    case SYM_TYPE:
+        if (!sym->type && sym->decl && sym->decl->kind != DECL_TYPEDEF) {
+            sym->type = type_named(sym->decl->kind == DECL_ENUM ? TYPE_ENUM : sym->decl->kind == DECL_STRUCT ? TYPE_STRUCT : TYPE_UNION, sym);
+        } else if (!sym->type) {
+            check_sym(sym);
+        }
+        return sym->type;
+    case SYM_PARAM:
+        return checking_fn->fn.params[sym->id];
+    case SYM_LOCAL:
+        return sym->init->init.expr->type;
+    case SYM_ENUM_CONST:
+        return sym_type(sym->parent);
+    default:
+        check_sym(sym);
+        return sym->type;
+    }
+}
+
+// Completes an aggregate that has only been referred to through pointers.
+bool type_complete(Type *type) {
+    if (is_aggregate_type(type) && !type->complete) {
+        check_sym(type->sym);
+    }
+    return type->complete;
+}
+
+Type *check_typespec(Typespec *typespec) {
+    if (!typespec) {
+        return type_void;
+    }
+    switch (typespec->kind) {
+    case TYPESPEC_IDENT: {
+        Sym *sym = sym_get(typespec->name);
+        if (!sym) {
+            return type_error;
+        }
+        if (sym->kind != SYM_TYPE) {
+            check_error("'%s' is not a type", sym->name);
+            return type_error;
+        }
+        return sym_type(sym);
+    }
+    case TYPESPEC_PTR:
+        return type_ptr(check_typespec(typespec->ptr.elem));
+    case TYPESPEC_ARRAY: {
+        Type *elem = check_typespec(typespec->array.elem);
+        if (!type_complete(elem)) {
+            check_error("array of incomplete type '%s'", temp_type_str(elem));
+            return type_error;
+        }
+        if (!typespec->array.size) {
+            return type_array(elem, 0);
+        }
+        Type *size_type = check_expr(typespec->array.size, NULL);
+        if (size_type == type_error) {
+            return type_error;
+        }
+        if (!is_integer_type(size_type)) {
+            check_error("array size must be an integer, not '%s'", temp_type_str(size_type));
+            return type_error;
+        }
+        ConstVal len;
+        if (!const_eval(typespec->array.size, &len) || !const_convert(&len, type_int, false)) {
+            return type_error;
+        }
+        if (len.i <= 0) {
+            check_error("array size must be positive");
+            return type_error;
+        }
+        if (!type_array_fits(elem, len.i)) {
+            check_error("array of %lld '%s' is too large", (long long)len.i, temp_type_str(elem));
+            return type_error;
+        }
+        return type_array(elem, len.i);
+    }
+    case TYPESPEC_FN: {
+        Type **params = NULL;
+        for (size_t i = 0; i < typespec->fn.num_args; i++) {
+            buf_push(params, check_typespec(typespec->fn.args[i]));
+        }
+        Type *type = type_fn(params, typespec->fn.num_args, check_typespec(typespec->fn.ret));
+        buf_free(params);
+        return type;
+    }
+    case TYPESPEC_ERROR:
+        return type_error;
+    default:
+        assert(0);
+        return type_error;
+    }
+}
+
+void check_aggregate(Sym *sym) {
+    Decl *decl = sym->decl;
+    Type *type = sym_type(sym);
+    TypeField *fields = NULL;
+    for (size_t i = 0; i < decl->aggregate.num_items; i++) {
+        AggregateItem *item = &decl->aggregate.items[i];
+        Type *field_type = check_typespec(item->types);
+        if (!type_complete(field_type)) {
+            check_error("field '%s' has incomplete type '%s'", item->names[0], temp_type_str(field_type));
+            field_type = type_error;
+        }
+        for (size_t j = 0; j < item->num_names; j++) {
+            for (TypeField *it = fields; it != buf_end(fields); it++) {
+                if (it->name == item->names[j]) {
+                    check_error("duplicate field '%s'", item->names[j]);
+                }
+            }
+            buf_push(fields, (TypeField){item->names[j], field_type, 0});
+        }
+    }
+    if (!type_complete_aggregate(type, fields, buf_len(fields))) {
+        check_error("fields are too large");
+    }
+    buf_free(fields);
+}
+
+void check_sym(Sym *sym) {
+    if (sym->kind == SYM_ENUM_CONST) {
+        sym = sym->parent;
+    }
+    if (sym->check_state != SYM_UNRESOLVED) {
+        if (sym->check_state == SYM_RESOLVING && !sym->type) {
+            sym->type = type_error;
+        }
+        return;
+    }
+    sym->check_state = SYM_RESOLVING;
+    Sym *saved_sym = checking_sym;
+    checking_sym = sym;
+    Decl *decl = sym->decl;
+    switch (decl->kind) {
+    case DECL_STRUCT:
+    case DECL_UNION:
+        check_aggregate(sym);
+        break;
+    case DECL_ENUM:
+        sym_type(sym);
+        for (size_t i = 0; i < decl->enum_decl.num_items; i++) {
+            Expr *expr = decl->enum_decl.items[i].expr;
+            if (expr && !is_integer_type(check_expr(expr, type_int)) && expr->type != type_error) {
+                check_error("enum item '%s' must be an integer", decl->enum_decl.items[i].name);
+            }
+        }
+        break;
+    case DECL_TYPEDEF:
+        sym->type = check_typespec(decl->typedef_decl.type);
+        break;
+    case DECL_CONST: {
+        Type *type = check_expr(decl->const_decl.expr, NULL);
+        if (!is_arithmetic_type(type) && type != type_error) {
+            check_error("const must be a number, not '%s'", temp_type_str(type));
+            type = type_error;
+        }
+        sym->type = type;
+        break;
+    }
+    case DECL_LET: {
+        Type *type = decl->let.type ? check_typespec(decl->let.type) : NULL;
+        if (decl->let.expr) {
+            Type *init = check_expr(decl->let.expr, type);
+            if (!type) {
+                type = init;
+            } else if (!type_convertible(init, type)) {
+                check_error("cannot initialize '%s' with '%s'", temp_type_str(type), temp_type_str(init));
+            }
+        }
+        // An unsized array takes its size from the initializer.
+        if (type->kind == TYPE_ARRAY && !type->complete && decl->let.expr) {
+            type = decl->let.expr->type;
+        }
+        if (!type_complete(type)) {
+            check_error("variable of incomplete type '%s'", temp_type_str(type));
+            type = type_error;
+        }
+        sym->type = type;
+        break;
+    }
+    case DECL_FN: {
+        Type **params = NULL;
+        for (size_t i = 0; i < decl->fn.num_params; i++) {
+            buf_push(params, check_typespec(decl->fn.params[i].type));
+        }
+        sym->type = type_fn(params, decl->fn.num_params, check_typespec(decl->fn.ret_type));
+        buf_free(params);
+        break;
+    }
+    default:
+        assert(0);
+        break;
+    }
+    if (decl->kind == DECL_CONST || decl->kind == DECL_ENUM) {
+        const_eval_sym(sym);
+    }
+    checking_sym = saved_sym;
+    sym->check_state = SYM_RESOLVED;
+}
+
+/*
+ * Expressions. Every Expr gets its type, with type_error standing in after
+ * a mistake so that one error is not reported again by each enclosing
+ * expression.
+ */
+
+bool type_convertible(Type *from, Type *to) {
+    if (from == to || from == type_error || to == type_error) {
+        return true;
+    }
+    if (is_arithmetic_type(from) && is_arithmetic_type(to)) {
+        return true;
+    }
+    if (from->kind == TYPE_PTR && to->kind == TYPE_PTR) {
+        return from->ptr.elem == type_void || to->ptr.elem == type_void;
+    }
+    return from->kind == TYPE_ARRAY && to->kind == TYPE_PTR && from->array.elem == to->ptr.elem;
+}
+
+bool type_castable(Type *from, Type *to) {
+    if (type_convertible(from, to)) {
+        return true;
+    }
+    if (from->kind == TYPE_PTR) {
+        return to->kind == TYPE_PTR || is_integer_type(to);
+    }
+    return is_integer_type(from) && to->kind == TYPE_PTR;
+}
+
+Type *type_promote(Type *type) {
+    return type->kind < TYPE_INT || type->kind == TYPE_ENUM ? type_int : type;
+}
+
+Type *type_arithmetic(Type *left, Type *right) {
+    if (left->kind == TYPE_FLOAT || right->kind == TYPE_FLOAT) {
+        return type_float;
+    }
+    return left->kind == TYPE_UINT || right->kind == TYPE_UINT ? type_uint : type_int;
+}
+
+bool is_lvalue(Expr *expr) {
+    switch (expr->kind) {
+    case EXPR_IDENT:
+        return expr->sym && (expr->sym->kind == SYM_LET || expr->sym->kind == SYM_PARAM || expr->sym->kind == SYM_LOCAL);
+    case EXPR_INDEX:
+    case EXPR_FIELD:
+        return true;
+    case EXPR_UNARY:
+        return expr->unary.op == '*';
+    default:
+        return false;
+    }
+}
+
+Type *check_cond(Expr *expr) {
+    Type *type = check_expr(expr, NULL);
+    if (!is_scalar_type(type) && type != type_error) {
+        check_error("condition must be a number or pointer, not '%s'", temp_type_str(type));
+    }
+    return type;
+}
+
+Type *check_compound(Expr *expr, Type *expected) {
+    Type *type = expr->compound.type ? check_typespec(expr->compound.type) : expected;
+    size_t num_args = expr->compound.num_args;
+    if (!type) {
+        check_error("compound literal has no type");
+        type = type_error;
+    }
+    if (type->kind == TYPE_ARRAY) {
+        if (!type->complete && !type_array_fits(type->array.elem, MAX(num_args, 1))) {
+            check_error("%zu initializers for '%s' are too large", num_args, temp_type_str(type));
+        } else if (!type->complete) {
+            type = type_array(type->array.elem, MAX(num_args, 1));
+        } else if (num_args > type->array.len) {
+            check_error("%zu initializers for '%s'", num_args, temp_type_str(type));
+        }
+        for (size_t i = 0; i < num_args; i++) {
+            Type *arg = check_expr(expr->compound.args[i], type->array.elem);
+            if (!type_convertible(arg, type->array.elem)) {
+                check_error("cannot convert '%s' to '%s'", temp_type_str(arg), temp_type_str(type->array.elem));
+            }
+        }
+    } else if (type_complete(type) && is_aggregate_type(type)) {
+        size_t max_args = type->kind == TYPE_UNION ? MIN(type->aggregate.num_fields, 1) : type->aggregate.num_fields;
+        if (num_args > max_args) {
+            check_error("%zu initializers for '%s'", num_args, temp_type_str(type));
+        }
+        for (size_t i = 0; i < num_args; i++) {
+            Type *field = i < max_args ? type->aggregate.fields[i].type : NULL;
+            Type *arg = check_expr(expr->compound.args[i], field);
+            if (field && !type_convertible(arg, field)) {
+                check_error("cannot convert '%s' to '%s'", temp_type_str(arg), temp_type_str(field));
+            }
+        }
+    } else if (is_scalar_type(type)) {
+        if (num_args > 1) {
+            check_error("%zu initializers for '%s'", num_args, temp_type_str(type));
+        }
+        for (size_t i = 0; i < num_args; i++) {
+            Type *arg = check_expr(expr->compound.args[i], type);
+            if (!type_convertible(arg, type)) {
+                check_error("cannot convert '%s' to '%s'", temp_type_str(arg), temp_type_str(type));
+            }
+        }
+    } else if (type != type_error) {
+        check_error("cannot build a '%s' from a compound literal", temp_type_str(type));
+        type = type_error;
+    }
+    return type;
+}
+
+Type *check_call(Expr *expr) {
+    Type *fn = check_expr(expr->call.expr, NULL);
+    if (fn->kind == TYPE_PTR && fn->ptr.elem->kind == TYPE_FN) {
+        fn = fn->ptr.elem;
+    }
+    if (fn->kind != TYPE_FN) {
+        if (fn != type_error) {
+            check_error("cannot call a '%s'", temp_type_str(fn));
+        }
+        for (size_t i = 0; i < expr->call.num_args; i++) {
+            check_expr(expr->call.args[i], NULL);
+        }
+        return type_error;
+    }
+    if (expr->call.num_args != fn->fn.num_params) {
+        check_error("call with %zu arguments to a '%s'", expr->call.num_args, temp_type_str(fn));
+    }
+    for (size_t i = 0; i < expr->call.num_args; i++) {
+        Type *param = i < fn->fn.num_params ? fn->fn.params[i] : NULL;
+        Type *arg = check_expr(expr->call.args[i], param);
+        if (param && !type_convertible(arg, param)) {
+            check_error("cannot pass '%s' as '%s'", temp_type_str(arg), temp_type_str(param));
+        }
+    }
+    return fn->fn.ret;
+}
+
+Type *check_unary(Expr *expr) {
+    Type *operand = check_expr(expr->unary.expr, NULL);
+    if (operand == type_error) {
+        return type_error;
+    }
+    switch ((int)expr->unary.op) {
+    case '+':
+    case '-':
+        if (is_arithmetic_type(operand)) {
+            return type_promote(operand);
+        }
+        break;
+    case '*':
+        if (operand->kind == TYPE_PTR && operand->ptr.elem != type_void) {
+            return operand->ptr.elem;
+        }
+        break;
+    case '&':
+        if (is_lvalue(expr->unary.expr)) {
+            return type_ptr(operand);
+        }
+        check_error("cannot take the address of a value");
+        return type_error;
+    default:
+        break;
+    }
+    check_error("operator '%s' does not apply to '%s'", temp_token_kind_str(expr->unary.op), temp_type_str(operand));
+    return type_error;
+}
+
+Type *check_binary(Expr *expr) {
+    Type *left = check_expr(expr->binary.left, NULL);
+    Type *right = check_expr(expr->binary.right, NULL);
+    if (left == type_error || right == type_error) {
+        return type_error;
+    }
+    switch ((int)expr->binary.op) {
+    case '+':
+        if (left->kind == TYPE_PTR && is_integer_type(right)) {
+            return left;
+        }
+        if (is_integer_type(left) && right->kind == TYPE_PTR) {
+            return right;
+        }
+        // fallthrough
+    case '*':
+    case '/':
+        if (is_arithmetic_type(left) && is_arithmetic_type(right)) {
+            return type_arithmetic(left, right);
+        }
+        break;
+    case '-':
+        if (left->kind == TYPE_PTR && is_integer_type(right)) {
+            return left;
+        }
+        if (left->kind == TYPE_PTR && left == right) {
+            return type_int;
+        }
+        if (is_arithmetic_type(left) && is_arithmetic_type(right)) {
+            return type_arithmetic(left, right);
+        }
+        break;
+    case '%':
+    case '&':
+    case '|':
+    case '^':
+        if (is_integer_type(left) && is_integer_type(right)) {
+            return type_arithmetic(left, right);
+        }
+        break;
+    case TOKEN_LSHIFT:
+    case TOKEN_RSHIFT:
+        if (is_integer_type(left) && is_integer_type(right)) {
+            return type_promote(left);
+        }
+        break;
+    case '<':
+    case '>':
+    case TOKEN_EQ:
+    case TOKEN_NOTEQ:
+    case TOKEN_LTEQ:
+    case TOKEN_GTEQ:
+        if ((is_arithmetic_type(left) && is_arithmetic_type(right)) ||
+            (left->kind == TYPE_PTR && right->kind == TYPE_PTR && type_convertible(left, right))) {
+            return type_bool;
+        }
+        break;
+    case TOKEN_AND:
+    case TOKEN_OR:
+        if (is_scalar_type(left) && is_scalar_type(right)) {
+            return type_bool;
+        }
+        break;
+    default:
+        break;
+    }
+    check_error("operator '%s' does not apply to '%s' and '%s'", temp_token_kind_str(expr->binary.op), temp_type_str(left),
+                temp_type_str(right));
+    return type_error;
+}
+
+Type *check_field(Expr *expr) {
+    Type *type = check_expr(expr->field.expr, NULL);
+    if (type->kind == TYPE_PTR) {
+        type = type->ptr.elem;
+    }
+    if (type == type_error) {
+        return type_error;
+    }
+    if (!is_aggregate_type(type) || !type_complete(type)) {
+        check_error("'%s' has no fields", temp_type_str(type));
+        return type_error;
+    }
+    TypeField *field = type_field(type, expr->field.name);
+    if (!field) {
+        check_error("'%s' has no field '%s'", temp_type_str(type), expr->field.name);
+        return type_error;
+    }
+    return field->type;
+}
+
+Type *check_expr_kind(Expr *expr, Type *expected) {
+    switch (expr->kind) {
+    case EXPR_INT:
+        return type_int;
+    case EXPR_FLOAT:
+        return type_float;
+    case EXPR_STR:
+        return type_ptr(type_char);
+    case EXPR_IDENT:
+        if (!expr->sym) {
+            return type_error;
+        }
+        if (expr->sym->kind == SYM_TYPE) {
+            check_error("type '%s' used as a value", expr->name);
+            return type_error;
+        }
+        return sym_type(expr->sym);
+    case EXPR_CAST: {
+        Type *type = check_typespec(expr->cast.type);
+        Type *from = check_expr(expr->cast.expr, NULL);
+        if (!type_castable(from, type)) {
+            check_error("cannot cast '%s' to '%s'", temp_type_str(from), temp_type_str(type));
+        }
+        return type;
+    }
+    case EXPR_CALL:
+        return check_call(expr);
+    case EXPR_INDEX: {
+        Type *base = check_expr(expr->index.expr, NULL);
+        Type *index = check_expr(expr->index.index, NULL);
+        if (!is_integer_type(index) && index != type_error) {
+            check_error("index must be an integer, not '%s'", temp_type_str(index));
+        }
+        if (base->kind == TYPE_ARRAY) {
+            return base->array.elem;
+        }
+        if (base->kind == TYPE_PTR && base->ptr.elem != type_void) {
+            return base->ptr.elem;
+        }
+        if (base != type_error) {
+            check_error("cannot index a '%s'", temp_type_str(base));
+        }
+        return type_error;
+    }
+    case EXPR_FIELD:
+        return check_field(expr);
+    case EXPR_COMPOUND:
+        return check_compound(expr, expected);
+    case EXPR_UNARY:
+        return check_unary(expr);
+    case EXPR_BINARY:
+        return check_binary(expr);
+    case EXPR_TERNARY: {
+        check_cond(expr->ternary.cond);
+        Type *then_type = check_expr(expr->ternary.then_expr, expected);
+        Type *else_type = check_expr(expr->ternary.else_expr, expected);
+        if (then_type == else_type || then_type == type_error || else_type == type_error) {
+            return then_type == type_error ? else_type : then_type;
+        }
+        if (is_arithmetic_type(then_type) && is_arithmetic_type(else_type)) {
+            return type_arithmetic(then_type, else_type);
+        }
+        if (type_convertible(else_type, then_type)) {
+            return then_type;
+        }
+        check_error("ternary branches of types '%s' and '%s'", temp_type_str(then_type), temp_type_str(else_type));
+        return type_error;
+    }
+    case EXPR_ERROR:
+        return type_error;
+    default:
+        assert(0);
+        return type_error;
+    }
+}
+
+Type *check_expr(Expr *expr, Type *expected) {
+    expr->type = check_expr_kind(expr, expected);
+    return expr->type;
+}
+
+/*
+ * Statements
+ */
+
+void check_stmt(Stmt *stmt);
+
+void check_stmt_block(StmtBlock block) {
+    for (size_t i = 0; i < block.num_stmts; i++) {
+        check_stmt(block.stmts[i]);
+    }
+}
+
+void check_assign(Stmt *stmt) {
+    Type *left = check_expr(stmt->assign.left, NULL);
+    Type *right = stmt->assign.right ? check_expr(stmt->assign.right, left) : type_int;
+    if (!is_lvalue(stmt->assign.left)) {
+        check_error("cannot assign to a value");
+        return;
+    }
+    if (left == type_error || right == type_error) {
+        return;
+    }
+    bool ok;
+    switch ((int)stmt->assign.op) {
+    case '=':
+        ok = type_convertible(right, left);
+        break;
+    case TOKEN_INC:
+    case TOKEN_DEC:
+        ok = is_scalar_type(left);
+        break;
+    case TOKEN_ADD_ASSIGN:
+    case TOKEN_SUB_ASSIGN:
+        ok = (is_arithmetic_type(left) && is_arithmetic_type(right)) || (left->kind == TYPE_PTR && is_integer_type(right));
+        break;
+    case TOKEN_MUL_ASSIGN:
+    case TOKEN_DIV_ASSIGN:
+        ok = is_arithmetic_type(left) && is_arithmetic_type(right);
+        break;
+    default:
+        ok = is_integer_type(left) && is_integer_type(right);
+        break;
+    }
+    if (!ok) {
+        check_error("operator '%s' does not apply to '%s' and '%s'", temp_token_kind_str(stmt->assign.op), temp_type_str(left),
+                    temp_type_str(right));
+    }
+}
+
+void check_stmt(Stmt *stmt) {
+    switch (stmt->kind) {
+    case STMT_RETURN: {
+        Type *ret = checking_fn->fn.ret;
+        if (!stmt->return_stmt.expr) {
+            if (ret != type_void) {
+                check_error("missing return value");
+            }
+            break;
+        }
+        Type *type = check_expr(stmt->return_stmt.expr, ret);
+        if (ret == type_void) {
+            check_error("returning a value from a fn without a return type");
+        } else if (!type_convertible(type, ret)) {
+            check_error("cannot return '%s' as '%s'", temp_type_str(type), temp_type_str(ret));
+        }
+        break;
+    }
+    case STMT_BREAK:
+    case STMT_CONTINUE:
+    case STMT_ERROR:
+        break;
+    case STMT_BLOCK:
+        check_stmt_block(stmt->block);
+        break;
+    case STMT_IF:
+        check_cond(stmt->if_stmt.cond);
+        check_stmt_block(stmt->if_stmt.then_block);
+        for (size_t i = 0; i < stmt->if_stmt.num_elseifs; i++) {
+            check_cond(stmt->if_stmt.elseifs[i].cond);
+            check_stmt_block(stmt->if_stmt.elseifs[i].block);
+        }
+        check_stmt_block(stmt->if_stmt.else_block);
+        break;
+    case STMT_WHILE:
+    case STMT_DO_WHILE:
+        check_cond(stmt->while_stmt.cond);
+        check_stmt_block(stmt->while_stmt.block);
+        break;
+    case STMT_FOR:
+        if (stmt->for_stmt.init) {
+            check_stmt(stmt->for_stmt.init);
+        }
+        if (stmt->for_stmt.cond) {
+            check_cond(stmt->for_stmt.cond);
+        }
+        if (stmt->for_stmt.next) {
+            check_stmt(stmt->for_stmt.next);
+        }
+        check_stmt_block(stmt->for_stmt.block);
+        break;
+    case STMT_SWITCH: {
+        Type *type = check_expr(stmt->switch_stmt.expr, NULL);
+        if (!is_integer_type(type) && type != type_error) {
+            check_error("switch on a '%s'", temp_type_str(type));
+        }
+        for (size_t i = 0; i < stmt->switch_stmt.num_cases; i++) {
+            SwitchCase *c = &stmt->switch_stmt.cases[i];
+            for (size_t j = 0; j < c->num_exprs; j++) {
+                Type *case_type = check_expr(c->exprs[j], type);
+                if (!is_integer_type(case_type) && case_type != type_error) {
+                    check_error("case of type '%s'", temp_type_str(case_type));
+                }
+            }
+            check_stmt_block(c->block);
+        }
+        stmt->switch_stmt.plan = is_integer_type(type) ? switch_plan(stmt, type) : NULL;
+        break;
+    }
+    case STMT_ASSIGN:
+        check_assign(stmt);
+        break;
+    case STMT_INIT: {
+        Type *type = check_expr(stmt->init.expr, NULL);
+        if (type == type_void) {
+            check_error("cannot initialize '%s' with no value", stmt->init.name);
+            stmt->init.expr->type = type_error;
+        }
+        break;
+    }
+    case STMT_EXPR:
+        check_expr(stmt->expr, NULL);
+        break;
+    default:
+        assert(0);
+        break;
+    }
+}
+
+void check_fn_body(Sym *sym) {
+    checking_sym = sym;
+    checking_fn = sym_type(sym);
+    check_stmt_block(sym->decl->fn.block);
+    checking_sym = NULL;
+    checking_fn = NULL;
+}
+
+// Checks every resolved global, then every fn body.
+void check_syms(void) {
+    for (Sym **it = ordered_syms; it != buf_end(ordered_syms); it++) {
+        check_sym(*it);
+    }
+    for (Sym **it = ordered_syms; it != buf_end(ordered_syms); it++) {
+        if ((*it)->kind == SYM_FN) {
+            check_fn_body(*it);
+        }
+    }
+}
+
+// Resolves and checks decls, leaving errors in resolve_errors and
+// check_errors.
+bool check_decls(Decl **decls, size_t num_decls) {
+    check_reset();
+    resolve_decls(decls, num_decls);
+    check_syms();
+    return buf_len(resolve_errors) == 0 && buf_len(check_errors) == 0;
+}
+
+VisitResult expr_type_trace_pre(AstNode node, void *ctx) {
+    if (node.kind == AST_EXPR) {
+        char **trace = ctx;
+        assert(node.expr->type);
+        type_to_str(trace, node.expr->type);
+        buf_printf(*trace, " ");
+    }
+    return VISIT_CONTINUE;
+}
+
+VisitResult expr_type_trace_post(AstNode node, void *ctx) {
+    (void)node;
+    (void)ctx;
+    return VISIT_CONTINUE;
+}
+
+// Checks src and compares "name:type" for each global in order, then the
+// type of every expr in preorder, against expected.
+void check_test_case(const char *src, const char *expected, const char *error) {
+    init_stream(src);
+    Decl **decls = parse_file();
+    assert(num_syntax_errors == 0);
+    bool ok = check_decls(decls, buf_len(decls));
+    assert(ok == !error);
+    if (error) {
+        assert(buf_len(check_errors) > 0 && strstr(check_errors[0], error));
+    }
+    char *trace = NULL;
+    for (Sym **it = ordered_syms; it != buf_end(ordered_syms); it++) {
+        buf_printf(trace, "%s:", (*it)->name);
+        type_to_str(&trace, sym_type(*it));
+        buf_printf(trace, " ");
+    }
+    buf_printf(trace, "|");
+    AstVisitor visitor = {.pre = expr_type_trace_pre, .post = expr_type_trace_post, .ctx = &trace};
+    ast_visit_decls(&visitor, decls, buf_len(decls));
+    visitor_free(&visitor);
+    assert(!expected || strcmp(trace, expected) == 0);
+    buf_free(trace);
+    buf_free(decls);
+}
+
+// Runs pass over src and compares the printed result with expected: the
+// last decl, or every decl a line each with PASS_TEST_ALL. Checker state is
+// always reset after, whether or not anything was checked.
+void pass_test_case(void (*pass)(Decl **decls, size_t num_decls), PassTestFlags flags, const char *src,
+                    const char *expected) {
+    init_stream(src);
+    Decl **decls = parse_file();
+    assert(num_syntax_errors == 0);
+    if (flags & PASS_TEST_TYPED) {
+        assert(check_decls(decls, buf_len(decls)));
+    }
+    pass(decls, buf_len(decls));
+    print_capture();
+    for (size_t i = flags & PASS_TEST_ALL ? 0 : buf_len(decls) - 1; i < buf_len(decls); i++) {
+        if (decls[i]->kind == DECL_FN && decls[i]->fn.never_returns) {
+            print_str("noreturn ");
+        }
+        print_decl(decls[i]);
+        if (flags & PASS_TEST_ALL) {
+            print_char('\n');
+        }
+    }
+    char *output = print_release();
+    assert(strcmp(output, expected) == 0);
+    check_reset();
+    resolve_reset();
+    // What the pass made has to bind and check like hand-written code.
+    if (flags & PASS_TEST_CHECK) {
+        assert(check_decls(decls, buf_len(decls)));
+        check_reset();
+        resolve_reset();
+    }
+    buf_free(output);
+    buf_free(decls);
+}
+
+void check_test(void) {
+    check_test_case("const n = 2 * 3 const f = n / 2.0", "n:int f:float |int int int float int float ", NULL);
+    check_test_case("struct L { next: L*; v: int; } fn len(l: L*): int { return l ? 1 + len(l.next) : 0; }",
+                    "L:L len:fn(L*): int |int L* int int int fn(L*): int L* L* int ", NULL);
+    check_test_case("let a: char[N] const N = 4 typedef P = int* let p: P = &k let k = 1",
+                    "N:int a:char[4] P:int* k:int p:int* |int int int* int int ", NULL);
+    check_test_case("enum E { A = 1 B } fn f(e: E): bool { x := e + B; return x < A && e == B; }",
+                    "E:E f:fn(E): bool |int int E E bool bool int E bool E E ", NULL);
+    check_test_case("union U { i: int; f: float; } let u = (:U){1} let s: char* = \"hi\"",
+                    "U:U u:U s:char* |U int char* ", NULL);
+    check_test_case("fn f(p: int*, n: int) { q := p + n; q[0] += 1; *q -= 2; n--; p = q; n = q[0]; }", NULL, NULL);
+
+    check_test_case("const a = 1.5 + \"s\"", NULL, "operator '+' does not apply to 'float' and 'char*' in 'a'");
+    check_test_case("fn f(): int* { return 1.5; }", NULL, "cannot return 'float' as 'int*' in 'f'");
+    check_test_case("fn f() { return 1; }", NULL, "returning a value from a fn without a return type in 'f'");
+    check_test_case("fn f(a: int) { f(a, a); }", NULL, "call with 2 arguments to a 'fn(int)' in 'f'");
+    check_test_case("fn f(a: int*) { f(1.5); }", NULL, "cannot pass 'float' as 'int*' in 'f'");
+    check_test_case("struct S { a: int; } fn f(s: S) { s.b += 1; }", NULL, "'S' has no field 'b' in 'f'");
+    check_test_case("struct S { a: int; a: int; }", NULL, "duplicate field 'a' in 'S'");
+    check_test_case("let v: void", NULL, "variable of incomplete type 'void' in 'v'");
+    check_test_case("fn f(p: int*) { p = 1.5; }", NULL, "operator '=' does not apply to 'int*' and 'float' in 'f'");
+    check_test_case("fn f() { 1 += 2; }", NULL, "cannot assign to a value in 'f'");
+    check_test_case("fn f(s: float) { switch (s) { case 1: {} } }", NULL, "switch on a 'float' in 'f'");
+    check_test_case("const n = 0 let a: int[n]", NULL, "array size must be positive in 'a'");
+    check_test_case("let x = 1 let a: int[x]", NULL, "'x' is not a constant in 'a'");
+    check_test_case("let a: int[9223372036854775807]", NULL, "array of 9223372036854775807 'int' is too large in 'a'");
+    check_test_case("let a: int[2305843009213693952]", NULL, "array of 2305843009213693952 'int' is too large in 'a'");
+    check_test_case("let a: char[9223372036854775807]", "a:char[9223372036854775807] |int ", NULL);
+    check_test_case("struct S { a: char[9223372036854775807]; b: char; }", NULL, "fields are too large in 'S'");
+    check_test_case("let a = (:char[4611686018427387904][]){{}, {}}", NULL,
+                    "2 initializers for 'char[4611686018427387904][]' are too large in 'a'");
+    check_test_case("let a: int[1.5]", NULL, "array size must be an integer, not 'float' in 'a'");
+    check_test_case("enum E { A = 1.5 }", NULL, "enum item 'A' must be an integer in 'E'");
+    check_test_case("let x: int = 1 let y: x", NULL, "'x' is not a type in 'y'");
+
+    // A size naming a param isn't constant, whichever fn comes first, and
+    // doesn't disturb the same size naming the global in another fn.
+    const char *size_srcs[] = {
+        "const n = 4 fn g() { y := (:int[n]){1}; } fn f(n: int) { x := (:int[n]){1}; }",
+        "const n = 4 fn f(n: int) { x := (:int[n]){1}; } fn g() { y := (:int[n]){1}; }",
+    };
+    for (size_t i = 0; i < sizeof(size_srcs) / sizeof(*size_srcs); i++) {
+        init_stream(size_srcs[i]);
+        Decl **decls = parse_file();
+        assert(!check_decls(decls, buf_len(decls)));
+        assert(buf_len(check_errors) == 1 && strstr(check_errors[0], "'n' is not a constant in 'f'"));
+        buf_free(decls);
+    }
+    check_reset();
+    resolve_reset();
+}
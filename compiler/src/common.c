@@ -18,9 +18,26 @@ void *xmalloc(size_t num_bytes) {
     return ptr;
 }
 
+void *xcalloc(size_t num_elems, size_t elem_size) {
+    void *ptr = calloc(num_elems, elem_size);
+    if (!ptr) {
+        perror("calloc failed");
+        exit(EXIT_FAILURE);
+    }
+    return ptr;
+}
+
+jmp_buf *fatal_jmp;
+char fatal_message[1024];
+
 void fatal(const char *fmt, ...) {
     va_list args;
     va_start(args, fmt);
+    if (fatal_jmp) {
+        vsnprintf(fatal_message, sizeof(fatal_message), fmt, args);
+        va_end(args);
+        longjmp(*fatal_jmp, 1);
+    }
     printf("FATAL: ");
     vprintf(fmt, args);
     printf("\n");
@@ -28,25 +45,104 @@ void fatal(const char *fmt, ...) {
     exit(1);
 }
 
-void syntax_error(const char *fmt, ...) {
+char **syntax_errors;
+size_t num_syntax_errors;
+size_t max_syntax_errors = MAX_SYNTAX_ERRORS;
+SrcPos syntax_error_pos; // Of the last error
+
+void vsyntax_error(SrcPos pos, const char *fmt, va_list args) {
+    // Recovery can fail several times in one place, like once per unclosed
+    // block at EOF. Only the first error there is reported.
+    if (num_syntax_errors && pos.name == syntax_error_pos.name && pos.line == syntax_error_pos.line &&
+        pos.col == syntax_error_pos.col) {
+        return;
+    }
+    syntax_error_pos = pos;
+    num_syntax_errors++;
+    if (buf_len(syntax_errors) >= max_syntax_errors) {
+        return;
+    }
+    char buf[1024];
+    int n = snprintf(buf, sizeof(buf), "%s:%d:%d: Syntax Error: ", pos.name ? pos.name : "<string>", pos.line, pos.col);
+    vsnprintf(buf + n, sizeof(buf) - n, fmt, args);
+    size_t len = strlen(buf) + 1;
+    buf_push(syntax_errors, memcpy(xmalloc(len), buf, len));
+}
+
+void syntax_error(SrcPos pos, const char *fmt, ...) {
     va_list args;
     va_start(args, fmt);
-    printf("Syntax Error: ");
-    vprintf(fmt, args);
-    printf("\n");
+    vsyntax_error(pos, fmt, args);
     va_end(args);
 }
 
-void fatal_syntax_error(const char *fmt, ...) {
+void fatal_syntax_error(SrcPos pos, const char *fmt, ...) {
     va_list args;
     va_start(args, fmt);
-    printf("Syntax Error: ");
-    vprintf(fmt, args);
-    printf("\n");
+    vsyntax_error(pos, fmt, args);
     va_end(args);
+    if (fatal_jmp) {
+        longjmp(*fatal_jmp, 1);
+    }
+    flush_syntax_errors();
     exit(1);
 }
 
+void reset_syntax_errors(void) {
+    for (char **it = syntax_errors; it != buf_end(syntax_errors); it++) {
+        free(*it);
+    }
+    buf_free(syntax_errors);
+    num_syntax_errors = 0;
+}
+
+// Forgets every error after the first num_errors, for callers that lex
+// ahead speculatively and will report errors again when they parse.
+void truncate_syntax_errors(size_t num_errors) {
+    assert(num_errors <= num_syntax_errors);
+    for (size_t i = num_errors; i < buf_len(syntax_errors); i++) {
+        free(syntax_errors[i]);
+    }
+    buf_truncate(syntax_errors, MIN(num_errors, buf_len(syntax_errors)));
+    num_syntax_errors = num_errors;
+    syntax_error_pos = (SrcPos){0};
+}
+
+void flush_syntax_errors(void) {
+    for (char **it = syntax_errors; it != buf_end(syntax_errors); it++) {
+        printf("%s\n", *it);
+    }
+    if (num_syntax_errors > buf_len(syntax_errors)) {
+        printf("%zu more syntax errors not shown\n", num_syntax_errors - buf_len(syntax_errors));
+    }
+    reset_syntax_errors();
+}
+
+double time_now(void) {
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+char *read_file(const char *path) {
+    FILE *file = fopen(path, "rb");
+    if (!file) {
+        return NULL;
+    }
+    fseek(file, 0, SEEK_END);
+    long len = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    char *buf = xmalloc(len + 1);
+    if (len && fread(buf, len, 1, file) != 1) {
+        fclose(file);
+        free(buf);
+        return NULL;
+    }
+    fclose(file);
+    buf[len] = 0;
+    return buf;
+}
+
 void *buf__grow(const void *buf, size_t new_len, size_t elem_size) {
     size_t new_cap = MAX(1 + GROWTH_FACTOR * buf_cap(buf), new_len);
     assert(new_len <= new_cap);
@@ -62,6 +158,24 @@ void *buf__grow(const void *buf, size_t new_len, size_t elem_size) {
     return new_hdr->buf;
 }
 
+char *buf__printf(char *buf, const char *fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    size_t cap = buf_cap(buf) - buf_len(buf);
+    size_t n = 1 + vsnprintf(buf_end(buf), cap, fmt, args);
+    va_end(args);
+    if (n > cap) {
+        buf_fit(buf, n + buf_len(buf));
+        va_start(args, fmt);
+        cap = buf_cap(buf) - buf_len(buf);
+        n = 1 + vsnprintf(buf_end(buf), cap, fmt, args);
+        assert(n <= cap);
+        va_end(args);
+    }
+    buf__hdr(buf)->len += n - 1;
+    return buf;
+}
+
 void buf_test(void) {
     size_t num = 1024;
     size_t *vec = NULL;
@@ -76,6 +190,15 @@ void buf_test(void) {
     buf_free(vec);
     assert(vec == NULL);
     assert(buf_len(vec) == 0);
+
+    char *str = NULL;
+    buf_printf(str, "one: %d\n", 1);
+    assert(strcmp(str, "one: 1\n") == 0);
+    buf_printf(str, "hex: 0x%x\n", 0x12345678);
+    assert(strcmp(str, "one: 1\nhex: 0x12345678\n") == 0);
+    buf_clear(str);
+    assert(buf_len(str) == 0);
+    buf_free(str);
 }
 
 void arena_grow(Arena *arena, size_t min_size) {
@@ -101,11 +224,673 @@ void *arena_alloc(Arena *arena, size_t size) {
 void arena_free(Arena *arena) {
     for (char **it = arena->blocks; it != buf_end(arena->blocks); it++)
         free(*it);
+    buf_free(arena->blocks);
+    arena->ptr = NULL;
+    arena->end = NULL;
+}
+
+uint64_t hash_uint64(uint64_t x) {
+    x *= 0xff51afd7ed558ccdull;
+    x ^= x >> 32;
+    return x;
+}
+
+uint64_t hash_ptr(const void *ptr) {
+    return hash_uint64((uintptr_t)ptr);
+}
+
+uint64_t hash_mix(uint64_t x, uint64_t y) {
+    x ^= y;
+    x *= 0xff51afd7ed558ccdull;
+    x ^= x >> 32;
+    return x;
+}
+
+// FNV-1a.
+uint64_t hash_bytes(const void *ptr, size_t len) {
+    uint64_t x = 0xcbf29ce484222325ull;
+    const char *buf = ptr;
+    for (size_t i = 0; i < len; i++) {
+        x ^= buf[i];
+        x *= 0x100000001b3ull;
+        x ^= x >> 32;
+    }
+    return x;
+}
+
+void hash_test(void) {
+    assert(hash_uint64(1) != hash_uint64(2));
+    assert(hash_mix(hash_mix(0, 1), 2) != hash_mix(hash_mix(0, 2), 1));
+    assert(hash_bytes("abc", 3) == hash_bytes("abcd", 3));
+    assert(hash_bytes("abc", 3) != hash_bytes("abd", 3));
+}
+
+void map_grow(Map *map, size_t new_cap) {
+    new_cap = new_cap < 16 ? 16 : new_cap;
+    Map new_map = {
+        .keys = xcalloc(new_cap, sizeof(uint64_t)),
+        .vals = xmalloc(new_cap * sizeof(uint64_t)),
+        .cap = new_cap,
+    };
+    for (size_t i = 0; i < map->cap; i++) {
+        if (map->keys[i]) {
+            map_put_uint64(&new_map, map->keys[i], map->vals[i]);
+        }
+    }
+    map_free(map);
+    *map = new_map;
+}
+
+uint64_t map_get_uint64(Map *map, uint64_t key) {
+    assert(key);
+    if (map->len == 0) {
+        return 0;
+    }
+    size_t mask = map->cap - 1;
+    for (size_t i = hash_uint64(key) & mask;; i = (i + 1) & mask) {
+        if (map->keys[i] == key) {
+            return map->vals[i];
+        } else if (!map->keys[i]) {
+            return 0;
+        }
+    }
+}
+
+void map_put_uint64(Map *map, uint64_t key, uint64_t val) {
+    assert(key);
+    if (2 * map->len >= map->cap) {
+        map_grow(map, 2 * map->cap);
+    }
+    size_t mask = map->cap - 1;
+    for (size_t i = hash_uint64(key) & mask;; i = (i + 1) & mask) {
+        if (!map->keys[i]) {
+            map->len++;
+            map->keys[i] = key;
+            map->vals[i] = val;
+            return;
+        } else if (map->keys[i] == key) {
+            map->vals[i] = val;
+            return;
+        }
+    }
+}
+
+void *map_get(Map *map, const void *key) {
+    return (void *)(uintptr_t)map_get_uint64(map, (uint64_t)(uintptr_t)key);
+}
+
+void map_put(Map *map, const void *key, void *val) {
+    map_put_uint64(map, (uint64_t)(uintptr_t)key, (uint64_t)(uintptr_t)val);
+}
+
+void map_free(Map *map) {
+    free(map->keys);
+    free(map->vals);
+    *map = (Map){0};
+}
+
+void map_test(void) {
+    Map map = {0};
+    enum { N = 1024 };
+    for (size_t i = 1; i < N; i++) {
+        map_put(&map, (void *)i, (void *)(i + 1));
+    }
+    for (size_t i = 1; i < N; i++) {
+        assert(map_get(&map, (void *)i) == (void *)(i + 1));
+    }
+    assert(map.len == N - 1 && map_get(&map, (void *)N) == NULL);
+    map_put_uint64(&map, 1, 42);
+    assert(map_get_uint64(&map, 1) == 42 && map.len == N - 1);
+    map_free(&map);
+    assert(map_get_uint64(&map, 1) == 0);
+}
+
+const char digit_pairs[201] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+const uint64_t pow10_uint64[20] = {
+    1ull,
+    10ull,
+    100ull,
+    1000ull,
+    10000ull,
+    100000ull,
+    1000000ull,
+    10000000ull,
+    100000000ull,
+    1000000000ull,
+    10000000000ull,
+    100000000000ull,
+    1000000000000ull,
+    10000000000000ull,
+    100000000000000ull,
+    1000000000000000ull,
+    10000000000000000ull,
+    100000000000000000ull,
+    1000000000000000000ull,
+    10000000000000000000ull,
+};
+
+// The comparisons compile to flag sets rather than branches.
+size_t uint64_num_digits(uint64_t val) {
+    size_t n = 1;
+    for (size_t i = 1; i < 20; i++) {
+        n += val >= pow10_uint64[i];
+    }
+    return n;
+}
+
+size_t format_uint64(char *dest, uint64_t val) {
+    size_t len = uint64_num_digits(val);
+    char *ptr = dest + len;
+    while (val >= 100) {
+        uint64_t pair = val % 100;
+        val /= 100;
+        ptr -= 2;
+        memcpy(ptr, digit_pairs + 2 * pair, 2);
+    }
+    if (val >= 10) {
+        memcpy(ptr - 2, digit_pairs + 2 * val, 2);
+    } else {
+        ptr[-1] = '0' + (char)val;
+    }
+    return len;
+}
+
+// Shortest round-trip doubles, after Ulf Adams' Ryu (PLDI 2018). The
+// 128-bit multipliers are the leading bits of 5^i and of 2^k / 5^i; rather
+// than carrying them as literal tables they're computed on first use with
+// a small bignum.
+#define DOUBLE_MANTISSA_BITS 52
+#define DOUBLE_EXPONENT_BITS 11
+#define DOUBLE_BIAS 1023
+#define DOUBLE_POW5_BITCOUNT 125
+#define DOUBLE_POW5_INV_BITCOUNT 125
+#define DOUBLE_POW5_TABLE_SIZE 326
+#define DOUBLE_POW5_INV_TABLE_SIZE 342
+#define POW5_BIGNUM_WORDS 30
+
+uint64_t double_pow5_split[DOUBLE_POW5_TABLE_SIZE][2];
+uint64_t double_pow5_inv_split[DOUBLE_POW5_INV_TABLE_SIZE][2];
+bool double_pow5_ready;
+
+// ceil(log2(5^e)) for e > 0, and 1 for e == 0.
+int32_t pow5_bits(int32_t e) {
+    return (int32_t)(((uint32_t)e * 1217359) >> 19) + 1;
+}
+
+uint32_t log10_pow2(int32_t e) {
+    return ((uint32_t)e * 78913) >> 18;
+}
+
+uint32_t log10_pow5(int32_t e) {
+    return ((uint32_t)e * 732923) >> 20;
+}
+
+// Little-endian 32-bit words.
+typedef struct Pow5Bignum {
+    uint32_t words[POW5_BIGNUM_WORDS];
+} Pow5Bignum;
+
+uint64_t pow5_bignum_bits(const Pow5Bignum *num, int32_t lo) {
+    uint64_t bits = 0;
+    for (int32_t i = 63; i >= 0; i--) {
+        int32_t bit = lo + i;
+        bits <<= 1;
+        if (bit >= 0) {
+            bits |= (num->words[bit / 32] >> (bit % 32)) & 1;
+        }
+    }
+    return bits;
+}
+
+int pow5_bignum_cmp(const Pow5Bignum *a, const Pow5Bignum *b) {
+    for (int i = POW5_BIGNUM_WORDS - 1; i >= 0; i--) {
+        if (a->words[i] != b->words[i]) {
+            return a->words[i] < b->words[i] ? -1 : 1;
+        }
+    }
+    return 0;
+}
+
+void pow5_bignum_sub(Pow5Bignum *a, const Pow5Bignum *b) {
+    uint64_t borrow = 0;
+    for (int i = 0; i < POW5_BIGNUM_WORDS; i++) {
+        uint64_t diff = (uint64_t)a->words[i] - b->words[i] - borrow;
+        a->words[i] = (uint32_t)diff;
+        borrow = diff >> 63;
+    }
+}
+
+void pow5_bignum_mul(Pow5Bignum *a, uint32_t factor, uint32_t carry) {
+    for (int i = 0; i < POW5_BIGNUM_WORDS; i++) {
+        uint64_t product = (uint64_t)a->words[i] * factor + carry;
+        a->words[i] = (uint32_t)product;
+        carry = (uint32_t)(product >> 32);
+    }
+    assert(carry == 0);
+}
+
+void init_double_pow5(void) {
+    Pow5Bignum pow5 = {{1}};
+    for (int32_t i = 0; i < DOUBLE_POW5_INV_TABLE_SIZE; i++) {
+        int32_t len = pow5_bits(i);
+        if (i < DOUBLE_POW5_TABLE_SIZE) {
+            // pow5 shifted so it's exactly DOUBLE_POW5_BITCOUNT bits long.
+            int32_t shift = len - DOUBLE_POW5_BITCOUNT;
+            double_pow5_split[i][0] = pow5_bignum_bits(&pow5, shift);
+            double_pow5_split[i][1] = pow5_bignum_bits(&pow5, shift + 64);
+        }
+        // floor(2^(len - 1 + DOUBLE_POW5_INV_BITCOUNT) / pow5) + 1 by long
+        // division, starting from the first dividend bit that can matter.
+        Pow5Bignum rem = {{0}};
+        rem.words[(len - 1) / 32] = 1u << ((len - 1) % 32);
+        uint64_t quot[2] = {0, 0};
+        for (int32_t bit = 0; bit <= DOUBLE_POW5_INV_BITCOUNT; bit++) {
+            if (bit > 0) {
+                pow5_bignum_mul(&rem, 2, 0);
+            }
+            quot[1] = quot[1] << 1 | quot[0] >> 63;
+            quot[0] <<= 1;
+            if (pow5_bignum_cmp(&rem, &pow5) >= 0) {
+                pow5_bignum_sub(&rem, &pow5);
+                quot[0] |= 1;
+            }
+        }
+        quot[0]++;
+        quot[1] += quot[0] == 0;
+        double_pow5_inv_split[i][0] = quot[0];
+        double_pow5_inv_split[i][1] = quot[1];
+        pow5_bignum_mul(&pow5, 5, 0);
+    }
+    double_pow5_ready = true;
+}
+
+uint64_t umul128(uint64_t a, uint64_t b, uint64_t *hi) {
+    uint64_t a_lo = (uint32_t)a;
+    uint64_t a_hi = a >> 32;
+    uint64_t b_lo = (uint32_t)b;
+    uint64_t b_hi = b >> 32;
+    uint64_t b00 = a_lo * b_lo;
+    uint64_t b01 = a_lo * b_hi;
+    uint64_t b10 = a_hi * b_lo;
+    uint64_t b11 = a_hi * b_hi;
+    uint64_t mid1 = b10 + (b00 >> 32);
+    uint64_t mid2 = b01 + (uint32_t)mid1;
+    *hi = b11 + (mid1 >> 32) + (mid2 >> 32);
+    return (mid2 << 32) | (uint32_t)b00;
+}
+
+// (m * mul) >> j for 64 < j < 128.
+uint64_t mul_shift64(uint64_t m, const uint64_t mul[2], int32_t j) {
+    uint64_t high1;
+    uint64_t low1 = umul128(m, mul[1], &high1);
+    uint64_t high0;
+    umul128(m, mul[0], &high0);
+    uint64_t sum = high0 + low1;
+    high1 += sum < high0;
+    int32_t dist = j - 64;
+    assert(0 < dist && dist < 64);
+    return (high1 << (64 - dist)) | (sum >> dist);
+}
+
+uint32_t pow5_factor(uint64_t val) {
+    uint32_t count = 0;
+    while (val % 5 == 0) {
+        val /= 5;
+        count++;
+    }
+    return count;
+}
+
+bool is_multiple_of_pow5(uint64_t val, uint32_t p) {
+    return pow5_factor(val) >= p;
+}
+
+bool is_multiple_of_pow2(uint64_t val, uint32_t p) {
+    return (val & ((1ull << p) - 1)) == 0;
+}
+
+// Finds the shortest decimal digits * 10^exponent that reads back as the
+// finite, positive double with the given IEEE fields.
+uint64_t double_shortest(uint64_t ieee_mantissa, uint32_t ieee_exponent, int32_t *exponent) {
+    int32_t e2;
+    uint64_t m2;
+    if (ieee_exponent == 0) {
+        e2 = 1 - DOUBLE_BIAS - DOUBLE_MANTISSA_BITS - 2;
+        m2 = ieee_mantissa;
+    } else {
+        e2 = (int32_t)ieee_exponent - DOUBLE_BIAS - DOUBLE_MANTISSA_BITS - 2;
+        m2 = (1ull << DOUBLE_MANTISSA_BITS) | ieee_mantissa;
+    }
+    bool accept_bounds = (m2 & 1) == 0;
+
+    // The halfway points to the neighbouring doubles are (mv - mm_shift - 1)
+    // and (mv + 2), all scaled by 2^e2.
+    uint64_t mv = 4 * m2;
+    uint32_t mm_shift = ieee_mantissa != 0 || ieee_exponent <= 1;
+
+    // Scale by a power of ten into vm < vr < vp, tracking whether the
+    // truncated digits were all zero.
+    uint64_t vr, vp, vm;
+    int32_t e10;
+    bool vm_trailing_zeros = false;
+    bool vr_trailing_zeros = false;
+    if (e2 >= 0) {
+        uint32_t q = log10_pow2(e2) - (e2 > 3);
+        e10 = (int32_t)q;
+        int32_t k = DOUBLE_POW5_INV_BITCOUNT + pow5_bits((int32_t)q) - 1;
+        int32_t i = -e2 + (int32_t)q + k;
+        vr = mul_shift64(4 * m2, double_pow5_inv_split[q], i);
+        vp = mul_shift64(4 * m2 + 2, double_pow5_inv_split[q], i);
+        vm = mul_shift64(4 * m2 - 1 - mm_shift, double_pow5_inv_split[q], i);
+        if (q <= 21) {
+            if (mv % 5 == 0) {
+                vr_trailing_zeros = is_multiple_of_pow5(mv, q);
+            } else if (accept_bounds) {
+                vm_trailing_zeros = is_multiple_of_pow5(mv - 1 - mm_shift, q);
+            } else {
+                vp -= is_multiple_of_pow5(mv + 2, q);
+            }
+        }
+    } else {
+        uint32_t q = log10_pow5(-e2) - (-e2 > 1);
+        e10 = (int32_t)q + e2;
+        int32_t i = -e2 - (int32_t)q;
+        int32_t k = pow5_bits(i) - DOUBLE_POW5_BITCOUNT;
+        int32_t j = (int32_t)q - k;
+        vr = mul_shift64(4 * m2, double_pow5_split[i], j);
+        vp = mul_shift64(4 * m2 + 2, double_pow5_split[i], j);
+        vm = mul_shift64(4 * m2 - 1 - mm_shift, double_pow5_split[i], j);
+        if (q <= 1) {
+            vr_trailing_zeros = true;
+            if (accept_bounds) {
+                vm_trailing_zeros = mm_shift == 1;
+            } else {
+                vp--;
+            }
+        } else if (q < 63) {
+            vr_trailing_zeros = is_multiple_of_pow2(mv, q);
+        }
+    }
+
+    // Drop digits while the interval still holds a shorter number.
+    int32_t removed = 0;
+    uint64_t output;
+    if (vm_trailing_zeros || vr_trailing_zeros) {
+        uint32_t last_removed = 0;
+        while (vp / 10 > vm / 10) {
+            vm_trailing_zeros &= vm % 10 == 0;
+            vr_trailing_zeros &= last_removed == 0;
+            last_removed = vr % 10;
+            vr /= 10;
+            vp /= 10;
+            vm /= 10;
+            removed++;
+        }
+        if (vm_trailing_zeros) {
+            while (vm % 10 == 0) {
+                vr_trailing_zeros &= last_removed == 0;
+                last_removed = vr % 10;
+                vr /= 10;
+                vp /= 10;
+                vm /= 10;
+                removed++;
+            }
+        }
+        if (vr_trailing_zeros && last_removed == 5 && vr % 2 == 0) {
+            // Exactly halfway: round to even.
+            last_removed = 4;
+        }
+        output = vr + ((vr == vm && (!accept_bounds || !vm_trailing_zeros)) || last_removed >= 5);
+    } else {
+        // The common case, with no exact-halfway or boundary ties.
+        bool round_up = false;
+        if (vp / 100 > vm / 100) {
+            round_up = vr % 100 >= 50;
+            vr /= 100;
+            vp /= 100;
+            vm /= 100;
+            removed += 2;
+        }
+        while (vp / 10 > vm / 10) {
+            round_up = vr % 10 >= 5;
+            vr /= 10;
+            vp /= 10;
+            vm /= 10;
+            removed++;
+        }
+        output = vr + (vr == vm || round_up);
+    }
+    *exponent = e10 + removed;
+    return output;
+}
+
+// Writes the digits in plain notation when the decimal point lands within
+// a few places of them (-6 <= exponent < 21, as JavaScript does) and in
+// scientific notation otherwise. Finite values always include a '.' or an
+// 'e' so they read back as floats.
+size_t format_double(char *dest, double val) {
+    uint64_t bits;
+    memcpy(&bits, &val, sizeof(bits));
+    bool sign = bits >> 63;
+    uint64_t ieee_mantissa = bits & ((1ull << DOUBLE_MANTISSA_BITS) - 1);
+    uint32_t ieee_exponent = (uint32_t)(bits >> DOUBLE_MANTISSA_BITS) & ((1u << DOUBLE_EXPONENT_BITS) - 1);
+    char *ptr = dest;
+    if (ieee_exponent == (1u << DOUBLE_EXPONENT_BITS) - 1 && ieee_mantissa) {
+        memcpy(ptr, "nan", 3);
+        return 3;
+    }
+    if (sign) {
+        *ptr++ = '-';
+    }
+    if (ieee_exponent == (1u << DOUBLE_EXPONENT_BITS) - 1) {
+        memcpy(ptr, "inf", 3);
+        return ptr + 3 - dest;
+    }
+    if (ieee_exponent == 0 && ieee_mantissa == 0) {
+        memcpy(ptr, "0.0", 3);
+        return ptr + 3 - dest;
+    }
+    if (!double_pow5_ready) {
+        init_double_pow5();
+    }
+    int32_t exponent;
+    uint64_t output = double_shortest(ieee_mantissa, ieee_exponent, &exponent);
+    char digits[FORMAT_UINT64_SIZE];
+    int32_t num_digits = (int32_t)format_uint64(digits, output);
+    int32_t sci_exponent = exponent + num_digits - 1;
+    if (sci_exponent >= 21 || sci_exponent < -6) {
+        *ptr++ = digits[0];
+        if (num_digits > 1) {
+            *ptr++ = '.';
+            memcpy(ptr, digits + 1, num_digits - 1);
+            ptr += num_digits - 1;
+        }
+        *ptr++ = 'e';
+        if (sci_exponent < 0) {
+            *ptr++ = '-';
+            sci_exponent = -sci_exponent;
+        }
+        ptr += format_uint64(ptr, (uint64_t)sci_exponent);
+    } else if (exponent >= 0) {
+        memcpy(ptr, digits, num_digits);
+        ptr += num_digits;
+        memset(ptr, '0', exponent);
+        ptr += exponent;
+        memcpy(ptr, ".0", 2);
+        ptr += 2;
+    } else if (sci_exponent >= 0) {
+        memcpy(ptr, digits, sci_exponent + 1);
+        ptr += sci_exponent + 1;
+        *ptr++ = '.';
+        memcpy(ptr, digits + sci_exponent + 1, num_digits - sci_exponent - 1);
+        ptr += num_digits - sci_exponent - 1;
+    } else {
+        memcpy(ptr, "0.", 2);
+        ptr += 2;
+        memset(ptr, '0', -sci_exponent - 1);
+        ptr += -sci_exponent - 1;
+        memcpy(ptr, digits, num_digits);
+        ptr += num_digits;
+    }
+    return ptr - dest;
+}
+
+// Splits a formatted number into its significant digits, without leading
+// or trailing zeros, and the power of ten of the first one.
+void format_test_digits(const char *str, char *digits, int *exponent) {
+    const char *e = strpbrk(str, "eE");
+    int exp10 = e ? atoi(e + 1) : 0;
+    const char *end = e ? e : str + strlen(str);
+    size_t n = 0;
+    int point = -1;
+    int pos = 0;
+    bool leading = true;
+    for (const char *it = str; it != end; it++) {
+        if (*it == '.') {
+            point = pos;
+        } else if (isdigit(*it)) {
+            if (leading && *it == '0') {
+                exp10--;
+            } else {
+                leading = false;
+                digits[n++] = *it;
+            }
+            pos++;
+        }
+    }
+    while (n > 1 && digits[n - 1] == '0') {
+        n--;
+    }
+    digits[n] = 0;
+    if (point < 0) {
+        point = pos;
+    }
+    *exponent = exp10 + point - 1;
+}
+
+// Checks that val formats to digits that read back exactly, that no
+// number with fewer digits would, and that when the nearest number with as
+// many digits also reads back, that's the one chosen.
+void format_test_double(double val) {
+    char str[FORMAT_DOUBLE_SIZE + 1];
+    str[format_double(str, val)] = 0;
+    double back = strtod(str, NULL);
+    assert(memcmp(&back, &val, sizeof(val)) == 0);
+    assert(strpbrk(str, ".e"));
+    if (val == 0) {
+        return;
+    }
+    char digits[32];
+    int exponent;
+    format_test_digits(str, digits, &exponent);
+    int num_digits = (int)strlen(digits);
+    char ref[64];
+    char ref_digits[32];
+    int ref_exponent;
+    snprintf(ref, sizeof(ref), "%.*e", num_digits - 1, val);
+    if (strtod(ref, NULL) == val) {
+        format_test_digits(ref, ref_digits, &ref_exponent);
+        assert(strcmp(digits, ref_digits) == 0 && exponent == ref_exponent);
+    }
+    if (num_digits > 1) {
+        // The only candidates one digit shorter are the two around val.
+        snprintf(ref, sizeof(ref), "%.*e", num_digits - 2, val);
+        format_test_digits(ref, ref_digits, &ref_exponent);
+        unsigned long long mantissa = strtoull(ref_digits, NULL, 10);
+        for (size_t i = strlen(ref_digits); i < (size_t)num_digits - 1; i++) {
+            mantissa *= 10;
+        }
+        int scale = ref_exponent - (num_digits - 2);
+        for (int delta = -1; delta <= 1; delta++) {
+            snprintf(ref, sizeof(ref), "%llue%d", mantissa + delta, scale);
+            assert(strtod(ref, NULL) != val);
+        }
+    }
+}
+
+void format_test(void) {
+    uint64_t ints[] = {0, 1, 9, 10, 99, 100, 101, 12345, 4294967295ull, 9999999999999999999ull, 10000000000000000000ull, UINT64_MAX};
+    for (size_t i = 0; i < sizeof(ints) / sizeof(*ints); i++) {
+        char str[FORMAT_UINT64_SIZE + 1];
+        char ref[32];
+        str[format_uint64(str, ints[i])] = 0;
+        snprintf(ref, sizeof(ref), "%llu", (unsigned long long)ints[i]);
+        assert(strcmp(str, ref) == 0);
+    }
+
+    char str[FORMAT_DOUBLE_SIZE + 1];
+    struct {
+        double val;
+        const char *str;
+    } doubles[] = {
+        {0.0, "0.0"},
+        {-0.0, "-0.0"},
+        {1.0, "1.0"},
+        {3.5, "3.5"},
+        {0.1, "0.1"},
+        {0.3, "0.3"},
+        {3e-10, "3e-10"},
+        {1e21, "1e21"},
+        {1e20, "100000000000000000000.0"},
+        {1e-7, "1e-7"},
+        {1.5e-7, "1.5e-7"},
+        {0.000001, "0.000001"},
+        {123.456, "123.456"},
+        {-2.5e100, "-2.5e100"},
+        {5e-324, "5e-324"},
+        {1.7976931348623157e308, "1.7976931348623157e308"},
+        {2.2250738585072014e-308, "2.2250738585072014e-308"},
+        {9007199254740993.0, "9007199254740992.0"},
+        {1e23, "1e23"},
+        {HUGE_VAL, "inf"},
+        {-HUGE_VAL, "-inf"},
+    };
+    for (size_t i = 0; i < sizeof(doubles) / sizeof(*doubles); i++) {
+        str[format_double(str, doubles[i].val)] = 0;
+        assert(strcmp(str, doubles[i].str) == 0);
+    }
+    str[format_double(str, NAN)] = 0;
+    assert(strcmp(str, "nan") == 0);
+
+    // Random bit patterns cover every exponent; random small integers and
+    // short decimals cover the exact and tie-breaking paths.
+    uint64_t x = 88172645463325252ull;
+    for (int i = 0; i < 20000; i++) {
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        double val;
+        memcpy(&val, &x, sizeof(val));
+        if (isfinite(val)) {
+            format_test_double(val);
+        }
+        format_test_double((double)(x % 1000000));
+        format_test_double((double)(x % 100000) / 1000);
+        format_test_double(ldexp((double)(x >> 11), (int)(x % 200) - 100));
+    }
+    for (int e = -1074; e <= 1023; e++) {
+        format_test_double(ldexp(1.0, e));
+    }
 }
 
 const char *str_intern_range(const char *start, const char *end) {
     size_t len = end - start;
-    for (Intern *it = interns; it != buf_end(interns); it++) {
+    uint64_t hash = hash_bytes(start, len);
+    uint64_t key = hash ? hash : 1;
+    size_t first = map_get_uint64(&intern_map, key);
+    for (size_t i = first; i; i = interns[i - 1].next) {
+        Intern *it = &interns[i - 1];
         if (it->len == len && strncmp(it->str, start, len) == 0) {
             return it->str;
         }
@@ -113,7 +898,8 @@ const char *str_intern_range(const char *start, const char *end) {
     char *str = arena_alloc(&str_arena, len + 1);
     memcpy(str, start, len);
     str[len] = 0;
-    buf_push(interns, (Intern){len, str});
+    buf_push(interns, (Intern){len, str, first});
+    map_put_uint64(&intern_map, key, buf_len(interns));
     return str;
 }
 
@@ -135,7 +921,33 @@ void str_intern_test(void) {
     assert(str_intern(a) != str_intern(d));
 }
 
+void syntax_error_test(void) {
+    size_t old_max = max_syntax_errors;
+    max_syntax_errors = 2;
+    SrcPos pos = {"test", 1, 1};
+    syntax_error(pos, "first");
+    pos.col++;
+    syntax_error(pos, "second %d", 2);
+    syntax_error(pos, "repeat");
+    pos.line++;
+    syntax_error(pos, "third");
+    assert(num_syntax_errors == 3);
+    assert(buf_len(syntax_errors) == 2);
+    assert(strcmp(syntax_errors[1], "test:1:2: Syntax Error: second 2") == 0);
+    truncate_syntax_errors(1);
+    assert(num_syntax_errors == 1 && buf_len(syntax_errors) == 1);
+    syntax_error(pos, "fourth");
+    assert(strcmp(syntax_errors[1], "test:2:2: Syntax Error: fourth") == 0);
+    reset_syntax_errors();
+    assert(num_syntax_errors == 0 && buf_len(syntax_errors) == 0);
+    max_syntax_errors = old_max;
+}
+
 void common_test(void) {
     buf_test();
+    hash_test();
+    map_test();
+    format_test();
     str_intern_test();
+    syntax_error_test();
 }
@@ -3,6 +3,7 @@
 #include <assert.h>
 #include <ctype.h>
 #include <math.h>
+#include <setjmp.h>
 #include <stdarg.h>
 #include <stdbool.h>
 #include <stddef.h>
@@ -10,8 +11,10 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 #define MAX(x, y) ((x) >= (y) ? (x) : (y))
+#define MIN(x, y) ((x) <= (y) ? (x) : (y))
 #define ALIGN_DOWN(n, a) ((n) & ~((a)-1))
 #define ALIGN_UP(n, a) ALIGN_DOWN((n) + (a)-1, (a))
 #define ALIGN_DOWN_PTR(p, a) ((void *)ALIGN_DOWN((uintptr_t)(p), (a)))
@@ -19,10 +22,37 @@
 
 void *xrealloc(void *ptr, size_t num_bytes);
 void *xmalloc(size_t num_bytes);
+void *xcalloc(size_t num_elems, size_t elem_size);
+
+typedef struct SrcPos {
+    const char *name;
+    int line;
+    int col;
+} SrcPos;
+
+#define MAX_SYNTAX_ERRORS 100
+
+// Syntax errors are buffered rather than printed, so a single run can report
+// every error in a file. Only the first max_syntax_errors messages are kept;
+// num_syntax_errors keeps counting past the cap. An error at the same place
+// as the one before it is dropped.
+extern char **syntax_errors;
+extern size_t num_syntax_errors;
+extern size_t max_syntax_errors;
+
+// When set, fatal errors longjmp here instead of exiting, so a long-running
+// process can fail one request and carry on. The message is left in
+// fatal_message and syntax errors stay buffered, for the catcher to report.
+extern jmp_buf *fatal_jmp;
+extern char fatal_message[1024];
 
 void fatal(const char *fmt, ...);
-void syntax_error(const char *fmt, ...);
-void fatal_syntax_error(const char *fmt, ...);
+void vsyntax_error(SrcPos pos, const char *fmt, va_list args);
+void syntax_error(SrcPos pos, const char *fmt, ...);
+void fatal_syntax_error(SrcPos pos, const char *fmt, ...);
+void flush_syntax_errors(void);
+void reset_syntax_errors(void);
+void truncate_syntax_errors(size_t num_errors);
 
 #define GROWTH_FACTOR 2
 
@@ -45,7 +75,14 @@ typedef struct BufHdr {
 #define buf_push(b, ...) \
     (buf_fit((b), 1 + buf_len(b)), (b)[buf__hdr(b)->len++] = (__VA_ARGS__))
 
+#define buf_clear(b) ((b) ? (buf__hdr(b)->len = 0) : 0)
+#define buf_pop(b) (assert(buf_len(b) > 0), (b)[--buf__hdr(b)->len])
+#define buf_resize(b, n) (buf_fit((b), (n)), (b) ? buf__hdr(b)->len = (n) : 0)
+#define buf_truncate(b, n) ((b) ? (assert((n) <= buf_len(b)), buf__hdr(b)->len = (n)) : 0)
+#define buf_printf(b, ...) ((b) = buf__printf((b), __VA_ARGS__))
+
 void *buf__grow(const void *buf, size_t new_len, size_t elem_size);
+char *buf__printf(char *buf, const char *fmt, ...);
 
 typedef struct Arena {
     char *ptr;
@@ -60,15 +97,50 @@ void arena_grow(Arena *arena, size_t min_size);
 void *arena_alloc(Arena *arena, size_t size);
 void arena_free(Arena *arena);
 
+uint64_t hash_uint64(uint64_t x);
+uint64_t hash_ptr(const void *ptr);
+uint64_t hash_mix(uint64_t x, uint64_t y);
+uint64_t hash_bytes(const void *ptr, size_t len);
+
+// Open-addressed hash map from nonzero uint64 keys to uint64 values; a
+// missing key reads as 0. map_get/map_put wrap it for pointers.
+typedef struct Map {
+    uint64_t *keys;
+    uint64_t *vals;
+    size_t len;
+    size_t cap;
+} Map;
+
+uint64_t map_get_uint64(Map *map, uint64_t key);
+void map_put_uint64(Map *map, uint64_t key, uint64_t val);
+void *map_get(Map *map, const void *key);
+void map_put(Map *map, const void *key, void *val);
+void map_free(Map *map);
+
+// Number to text without printf. Neither writes a terminating NUL; both
+// return the length. format_double writes the shortest digits that read
+// back as exactly the same double.
+#define FORMAT_UINT64_SIZE 20
+#define FORMAT_DOUBLE_SIZE 32
+
+size_t format_uint64(char *dest, uint64_t val);
+size_t format_double(char *dest, double val);
+
+// next chains interns whose hashes collide, as an index + 1 into interns.
 typedef struct Intern {
     size_t len;
     const char *str;
+    size_t next;
 } Intern;
 
 Intern *interns;
+Map intern_map;
 Arena str_arena;
 
 const char *str_intern_range(const char *start, const char *end);
 const char *str_intern(const char *str);
 
+double time_now(void);
+char *read_file(const char *path);
+
 void common_test(void);
@@ -0,0 +1,609 @@
+#include "ast.h"
+
+size_t const_nodes;
+bool const_quiet;
+
+bool const_error(const char *fmt, ...) {
+    if (const_quiet) {
+        return false;
+    }
+    va_list args;
+    va_start(args, fmt);
+    vcheck_error("Const Error: ", fmt, args);
+    va_end(args);
+    return false;
+}
+
+bool const_truth(ConstVal val) {
+    switch (val.type->kind) {
+    case TYPE_FLOAT:
+        return val.f != 0;
+    case TYPE_UINT:
+        return val.u != 0;
+    default:
+        return val.i != 0;
+    }
+}
+
+ConstVal const_bool(bool value) {
+    return (ConstVal){type_bool, .i = value};
+}
+
+/*
+ * Conversions. Floats, uints and every other integer type (held in i) each
+ * have their own representation. Casts and the usual arithmetic conversions
+ * wrap integers the way C does; any other conversion has to keep the value.
+ * Floats only convert to integers that can hold them.
+ */
+
+bool const_convert(ConstVal *val, Type *type, bool wrap) {
+    ConstVal v = *val;
+    TypeKind from = v.type->kind;
+    switch (type->kind) {
+    case TYPE_FLOAT:
+        val->f = from == TYPE_FLOAT ? v.f : from == TYPE_UINT ? (double)v.u : (double)v.i;
+        break;
+    case TYPE_UINT:
+        if (from == TYPE_FLOAT) {
+            if (!(v.f > -1.0 && v.f < 18446744073709551616.0)) {
+                return const_error("%g is out of range for 'uint'", v.f);
+            }
+            val->u = (uint64_t)v.f;
+        } else if (from != TYPE_UINT) {
+            if (v.i < 0 && !wrap) {
+                return const_error("%lld is out of range for 'uint'", (long long)v.i);
+            }
+            val->u = (uint64_t)v.i;
+        }
+        break;
+    case TYPE_BOOL:
+        val->i = const_truth(v);
+        break;
+    case TYPE_CHAR:
+    case TYPE_INT:
+    case TYPE_ENUM:
+        if (from == TYPE_FLOAT) {
+            if (!(v.f >= -9223372036854775808.0 && v.f < 9223372036854775808.0)) {
+                return const_error("%g is out of range for '%s'", v.f, temp_type_str(type));
+            }
+            val->i = (int64_t)v.f;
+        } else if (from == TYPE_UINT) {
+            if (v.u > INT64_MAX && !wrap) {
+                return const_error("%llu is out of range for '%s'", (unsigned long long)v.u, temp_type_str(type));
+            }
+            val->i = (int64_t)v.u;
+        }
+        if (type->kind == TYPE_CHAR && (val->i < 0 || val->i > UINT8_MAX)) {
+            if (!wrap) {
+                return const_error("%lld is out of range for 'char'", (long long)val->i);
+            }
+            val->i = (uint8_t)val->i;
+        }
+        break;
+    default:
+        return const_error("'%s' is not a constant type", temp_type_str(type));
+    }
+    val->type = type;
+    return true;
+}
+
+/*
+ * Overflow checks, done before the operation so nothing ever wraps or hits
+ * undefined behavior on the host.
+ */
+
+bool int_add_overflows(int64_t left, int64_t right) {
+    return right > 0 ? left > INT64_MAX - right : left < INT64_MIN - right;
+}
+
+bool int_sub_overflows(int64_t left, int64_t right) {
+    return right < 0 ? left > INT64_MAX + right : left < INT64_MIN + right;
+}
+
+bool int_mul_overflows(int64_t left, int64_t right) {
+    if (left == 0 || right == 0) {
+        return false;
+    }
+    if (left > 0) {
+        return right > 0 ? left > INT64_MAX / right : right < INT64_MIN / left;
+    }
+    return right > 0 ? left < INT64_MIN / right : left < INT64_MAX / right;
+}
+
+bool const_eval_expr(Expr *expr, ConstVal *val);
+
+bool const_shift_count(ConstVal count, int *shift) {
+    bool in_range = count.type->kind == TYPE_UINT ? count.u < 64 : count.i >= 0 && count.i < 64;
+    if (!in_range) {
+        return count.type->kind == TYPE_UINT ? const_error("shift by %llu", (unsigned long long)count.u)
+                                              : const_error("shift by %lld", (long long)count.i);
+    }
+    *shift = count.type->kind == TYPE_UINT ? (int)count.u : (int)count.i;
+    return true;
+}
+
+bool const_float_binary(TokenKind op, double left, double right, ConstVal *val) {
+    switch ((int)op) {
+    case '+':
+        val->f = left + right;
+        return true;
+    case '-':
+        val->f = left - right;
+        return true;
+    case '*':
+        val->f = left * right;
+        return true;
+    case '/':
+        val->f = left / right;
+        return true;
+    case '<':
+        *val = const_bool(left < right);
+        return true;
+    case '>':
+        *val = const_bool(left > right);
+        return true;
+    case TOKEN_LTEQ:
+        *val = const_bool(left <= right);
+        return true;
+    case TOKEN_GTEQ:
+        *val = const_bool(left >= right);
+        return true;
+    case TOKEN_EQ:
+        *val = const_bool(left == right);
+        return true;
+    case TOKEN_NOTEQ:
+        *val = const_bool(left != right);
+        return true;
+    default:
+        assert(0);
+        return false;
+    }
+}
+
+bool const_uint_binary(TokenKind op, uint64_t left, uint64_t right, ConstVal *val) {
+    switch ((int)op) {
+    case '+':
+        if (left > UINT64_MAX - right) {
+            break;
+        }
+        val->u = left + right;
+        return true;
+    case '-':
+        if (left < right) {
+            break;
+        }
+        val->u = left - right;
+        return true;
+    case '*':
+        if (left && right > UINT64_MAX / left) {
+            break;
+        }
+        val->u = left * right;
+        return true;
+    case '/':
+    case '%':
+        if (right == 0) {
+            return const_error("division by zero");
+        }
+        val->u = op == '/' ? left / right : left % right;
+        return true;
+    case '&':
+        val->u = left & right;
+        return true;
+    case '|':
+        val->u = left | right;
+        return true;
+    case '^':
+        val->u = left ^ right;
+        return true;
+    case '<':
+        *val = const_bool(left < right);
+        return true;
+    case '>':
+        *val = const_bool(left > right);
+        return true;
+    case TOKEN_LTEQ:
+        *val = const_bool(left <= right);
+        return true;
+    case TOKEN_GTEQ:
+        *val = const_bool(left >= right);
+        return true;
+    case TOKEN_EQ:
+        *val = const_bool(left == right);
+        return true;
+    case TOKEN_NOTEQ:
+        *val = const_bool(left != right);
+        return true;
+    default:
+        assert(0);
+        return false;
+    }
+    return const_error("'%llu %s %llu' overflows 'uint'", (unsigned long long)left, temp_token_kind_str(op),
+                       (unsigned long long)right);
+}
+
+bool const_int_binary(TokenKind op, int64_t left, int64_t right, ConstVal *val) {
+    switch ((int)op) {
+    case '+':
+        if (int_add_overflows(left, right)) {
+            break;
+        }
+        val->i = left + right;
+        return true;
+    case '-':
+        if (int_sub_overflows(left, right)) {
+            break;
+        }
+        val->i = left - right;
+        return true;
+    case '*':
+        if (int_mul_overflows(left, right)) {
+            break;
+        }
+        val->i = left * right;
+        return true;
+    case '/':
+    case '%':
+        if (right == 0) {
+            return const_error("division by zero");
+        }
+        if (left == INT64_MIN && right == -1) {
+            break;
+        }
+        val->i = op == '/' ? left / right : left % right;
+        return true;
+    case '&':
+        val->i = left & right;
+        return true;
+    case '|':
+        val->i = left | right;
+        return true;
+    case '^':
+        val->i = left ^ right;
+        return true;
+    case '<':
+        *val = const_bool(left < right);
+        return true;
+    case '>':
+        *val = const_bool(left > right);
+        return true;
+    case TOKEN_LTEQ:
+        *val = const_bool(left <= right);
+        return true;
+    case TOKEN_GTEQ:
+        *val = const_bool(left >= right);
+        return true;
+    case TOKEN_EQ:
+        *val = const_bool(left == right);
+        return true;
+    case TOKEN_NOTEQ:
+        *val = const_bool(left != right);
+        return true;
+    default:
+        assert(0);
+        return false;
+    }
+    return const_error("'%lld %s %lld' overflows 'int'", (long long)left, temp_token_kind_str(op), (long long)right);
+}
+
+bool const_shift(TokenKind op, ConstVal left, ConstVal right, ConstVal *val) {
+    int shift;
+    if (!const_convert(&left, type_promote(left.type), false) || !const_shift_count(right, &shift)) {
+        return false;
+    }
+    *val = left;
+    if (left.type->kind == TYPE_UINT) {
+        if (op == TOKEN_LSHIFT && left.u > UINT64_MAX >> shift) {
+            return const_error("'%llu << %d' overflows 'uint'", (unsigned long long)left.u, shift);
+        }
+        val->u = op == TOKEN_LSHIFT ? left.u << shift : left.u >> shift;
+    } else {
+        if (op == TOKEN_LSHIFT && (left.i < 0 || left.i > INT64_MAX >> shift)) {
+            return const_error("'%lld << %d' overflows 'int'", (long long)left.i, shift);
+        }
+        val->i = op == TOKEN_LSHIFT ? left.i << shift : left.i >> shift;
+    }
+    return true;
+}
+
+// Applies op to two values, converting them the way the checker types the
+// expression. Unlike evaluation, && and || see both operands.
+bool const_binary_op(TokenKind op, ConstVal left, ConstVal right, ConstVal *val) {
+    if (op == TOKEN_AND || op == TOKEN_OR) {
+        *val = const_bool(op == TOKEN_AND ? const_truth(left) && const_truth(right) : const_truth(left) || const_truth(right));
+        return true;
+    }
+    if (op == TOKEN_LSHIFT || op == TOKEN_RSHIFT) {
+        return const_shift(op, left, right, val);
+    }
+    Type *type = type_arithmetic(left.type, right.type);
+    if (!const_convert(&left, type, true) || !const_convert(&right, type, true)) {
+        return false;
+    }
+    val->type = type;
+    if (type == type_float) {
+        return const_float_binary(op, left.f, right.f, val);
+    } else if (type == type_uint) {
+        return const_uint_binary(op, left.u, right.u, val);
+    } else {
+        return const_int_binary(op, left.i, right.i, val);
+    }
+}
+
+bool const_unary_op(TokenKind op, ConstVal *val) {
+    assert(op == '+' || op == '-');
+    if (!const_convert(val, type_promote(val->type), false)) {
+        return false;
+    }
+    if (op == '-') {
+        if (val->type == type_float) {
+            val->f = -val->f;
+        } else if (val->type == type_uint) {
+            if (val->u) {
+                return const_error("'-%llu' overflows 'uint'", (unsigned long long)val->u);
+            }
+        } else if (val->i == INT64_MIN) {
+            return const_error("'-%lld' overflows 'int'", (long long)val->i);
+        } else {
+            val->i = -val->i;
+        }
+    }
+    return true;
+}
+
+bool const_binary(Expr *expr, ConstVal *val) {
+    TokenKind op = expr->binary.op;
+    ConstVal left, right;
+    if (!const_eval_expr(expr->binary.left, &left)) {
+        return false;
+    }
+    // Short-circuit, so "n && k / n" is fine for n == 0.
+    if ((op == TOKEN_AND || op == TOKEN_OR) && const_truth(left) == (op == TOKEN_OR)) {
+        *val = const_bool(const_truth(left));
+        return true;
+    }
+    return const_eval_expr(expr->binary.right, &right) && const_binary_op(op, left, right, val);
+}
+
+bool const_ident(Expr *expr, ConstVal *val) {
+    Sym *sym = expr->sym;
+    if (sym->kind != SYM_CONST && sym->kind != SYM_ENUM_CONST) {
+        return const_error("'%s' is not a constant", sym->name);
+    }
+    check_sym(sym);
+    if (sym->eval_state != SYM_RESOLVED) {
+        // Cycles were reported by resolution; only the enum case is new.
+        if (sym->kind == SYM_ENUM_CONST && sym->parent->eval_state == SYM_RESOLVING) {
+            return const_error("'%s' is used before its value is known", sym->name);
+        }
+        return false;
+    }
+    if (!sym->val.type) {
+        return false;
+    }
+    *val = sym->val;
+    return true;
+}
+
+bool const_eval_expr(Expr *expr, ConstVal *val) {
+    const_nodes++;
+    if (!expr->type || expr->type == type_error) {
+        return false;
+    }
+    switch (expr->kind) {
+    case EXPR_INT:
+        if (expr->int_val > INT64_MAX) {
+            return const_error("%llu is out of range for 'int'", (unsigned long long)expr->int_val);
+        }
+        *val = (ConstVal){type_int, .i = (int64_t)expr->int_val};
+        return true;
+    case EXPR_FLOAT:
+        *val = (ConstVal){type_float, .f = expr->float_val};
+        return true;
+    case EXPR_IDENT:
+        return const_ident(expr, val);
+    case EXPR_CAST:
+        if (!is_arithmetic_type(expr->type)) {
+            break;
+        }
+        return const_eval_expr(expr->cast.expr, val) && const_convert(val, expr->type, true);
+    case EXPR_COMPOUND:
+        // A scalar compound literal such as (:uint){1} is a typed constant.
+        if (!is_arithmetic_type(expr->type) || expr->compound.num_args > 1) {
+            break;
+        }
+        if (expr->compound.num_args == 0) {
+            *val = (ConstVal){type_int, .i = 0};
+            return const_convert(val, expr->type, false);
+        }
+        return const_eval_expr(expr->compound.args[0], val) && const_convert(val, expr->type, false);
+    case EXPR_UNARY:
+        if (expr->unary.op != '+' && expr->unary.op != '-') {
+            break;
+        }
+        return const_eval_expr(expr->unary.expr, val) && const_unary_op(expr->unary.op, val);
+    case EXPR_BINARY:
+        return const_binary(expr, val);
+    case EXPR_TERNARY: {
+        ConstVal cond;
+        if (!const_eval_expr(expr->ternary.cond, &cond)) {
+            return false;
+        }
+        Expr *branch = const_truth(cond) ? expr->ternary.then_expr : expr->ternary.else_expr;
+        return const_eval_expr(branch, val) && const_convert(val, expr->type, true);
+    }
+    default:
+        break;
+    }
+    return const_error("expression is not constant");
+}
+
+// Evaluates expr, which must already be checked.
+bool const_eval(Expr *expr, ConstVal *val) {
+    return const_eval_expr(expr, val);
+}
+
+/*
+ * Decls. A const's value, or every item of an enum, is computed once when
+ * the checker finishes the decl, so consts come out in dependency order and
+ * later uses only read sym->val. Failed values are left with a NULL type,
+ * which uses give up on quietly.
+ */
+
+void const_eval_enum(Sym *sym) {
+    Decl *decl = sym->decl;
+    ConstVal prev = {type_int, .i = -1};
+    for (size_t i = 0; i < decl->enum_decl.num_items; i++) {
+        EnumItem *item = &decl->enum_decl.items[i];
+        Sym *item_sym = sym_get(item->name);
+        ConstVal val = {0};
+        if (item->expr) {
+            if (!const_eval(item->expr, &val) || !const_convert(&val, type_int, false)) {
+                val.type = NULL;
+            }
+        } else if (prev.type) {
+            if (prev.i == INT64_MAX) {
+                const_error("enum item '%s' overflows 'int'", item->name);
+            } else {
+                val = (ConstVal){type_int, .i = prev.i + 1};
+            }
+        }
+        prev = val;
+        if (item_sym && item_sym->parent == sym) {
+            item_sym->val = val;
+            if (val.type) {
+                item_sym->val.type = sym->type;
+            }
+            item_sym->eval_state = SYM_RESOLVED;
+        }
+    }
+}
+
+void const_eval_sym(Sym *sym) {
+    if (sym->eval_state != SYM_UNRESOLVED) {
+        return;
+    }
+    sym->eval_state = SYM_RESOLVING;
+    if (sym->decl->kind == DECL_ENUM) {
+        const_eval_enum(sym);
+    } else {
+        assert(sym->decl->kind == DECL_CONST);
+        ConstVal val = {0};
+        if (sym->type != type_error && const_eval(sym->decl->const_decl.expr, &val)) {
+            sym->val = val;
+        }
+    }
+    sym->eval_state = SYM_RESOLVED;
+}
+
+// Looks up the evaluated value of a const or enum item named name in decl.
+bool decl_const_val(Decl *decl, const char *name, ConstVal *val) {
+    Sym *sym = sym_get(name);
+    if (!sym || sym->eval_state != SYM_RESOLVED || !sym->val.type) {
+        return false;
+    }
+    if (sym->kind == SYM_ENUM_CONST ? sym->parent->decl != decl : sym->decl != decl) {
+        return false;
+    }
+    *val = sym->val;
+    return true;
+}
+
+void print_const_val(ConstVal val) {
+    switch (val.type->kind) {
+    case TYPE_FLOAT:
+        print_double(val.f);
+        break;
+    case TYPE_UINT:
+        print_uint(val.u);
+        break;
+    default:
+        if (val.i < 0) {
+            print_char('-');
+        }
+        print_uint(val.i < 0 ? 0 - (uint64_t)val.i : (uint64_t)val.i);
+        break;
+    }
+}
+
+char *const_print_decls(const char *src) {
+    init_stream(src);
+    Decl **decls = parse_file();
+    assert(num_syntax_errors == 0);
+    check_decls(decls, buf_len(decls));
+    print_capture();
+    for (size_t i = 0; i < buf_len(decls); i++) {
+        print_decl(decls[i]);
+        print_char('\n');
+    }
+    buf_free(decls);
+    return print_release();
+}
+
+void const_test_case(const char *src, const char *expected, const char *error) {
+    char *output = const_print_decls(src);
+    if (error) {
+        assert(buf_len(check_errors) > 0 && strstr(check_errors[0], error));
+    } else {
+        assert(buf_len(resolve_errors) == 0 && buf_len(check_errors) == 0);
+    }
+    if (expected) {
+        assert(strcmp(output, expected) == 0);
+    }
+    buf_free(output);
+}
+
+void const_test(void) {
+    const_test_case("const b = a * 2 const a = 1 + 2", "(const b (* a 2) = 6)\n(const a (+ 1 2) = 3)\n", NULL);
+    const_test_case("enum E { A B = 10 C D = A + C }", "(enum E\n  (A nil = 0)\n  (B 10 = 10)\n  (C nil = 11)\n  (D (+ A C) = 11))\n",
+                    NULL);
+    const_test_case("const f = 1 / 4.0 const k = (:int){-2.9} + (1 < 2) const u = (:uint){1} << 63 >> 60",
+                    "(const f (/ 1 4.0) = 0.25)\n(const k (+ (compound int (- 2.9)) (< 1 2)) = -1)\n"
+                    "(const u (>> (<< (compound uint 1) 63) 60) = 8)\n",
+                    NULL);
+    const_test_case("const n = 3 let a: int[n * 2] let b: int[n < 2 ? 1 : 0]", NULL, "array size must be positive in 'b'");
+    const_test_case("const k = 1 < 0 && 1 / 0 == 1", "(const k (&& (< 1 0) (== (/ 1 0) 1)) = 0)\n", NULL);
+
+    const_test_case("const a = 9223372036854775807 + 1", NULL, "'9223372036854775807 + 1' overflows 'int' in 'a'");
+    const_test_case("const a = 4611686018427387904 * -2 * -1", NULL, "'-9223372036854775808 * -1' overflows 'int' in 'a'");
+    const_test_case("const a = 1 << 63", NULL, "'1 << 63' overflows 'int' in 'a'");
+    const_test_case("const a = 1 >> 64", NULL, "shift by 64 in 'a'");
+    const_test_case("const a = (:uint){0} - 1", NULL, "'0 - 1' overflows 'uint' in 'a'");
+    const_test_case("const a = 7 % (2 - 2)", NULL, "division by zero in 'a'");
+    const_test_case("const a = (:int){1e300}", NULL, "1e+300 is out of range for 'int' in 'a'");
+    const_test_case("const a = (:char){300}", NULL, "300 is out of range for 'char' in 'a'");
+    const_test_case("const a = 18446744073709551615", NULL, "18446744073709551615 is out of range for 'int' in 'a'");
+    const_test_case("enum E { A = 9223372036854775807 B }", NULL, "enum item 'B' overflows 'int' in 'E'");
+    const_test_case("enum E { A = B B = 1 }", NULL, "'B' is used before its value is known in 'E'");
+    const_test_case("let x = 1 const a = x + 1", NULL, "'x' is not a constant in 'a'");
+    const_test_case("fn f(): int { return 1; } let a: int[f()]", NULL, "expression is not constant in 'a'");
+
+    // An error is reported once, not again by everything that uses the value.
+    const_test_case("const a = 1 / 0 const b = a + 1 const c = b * a", NULL, "division by zero in 'a'");
+    assert(buf_len(check_errors) == 1);
+
+    // Long chains and large enums are evaluated once per decl, so the work is
+    // linear in the number of expression nodes.
+    char *src = NULL;
+    enum { N = 100000 };
+    buf_printf(src, "enum Big {");
+    for (int i = 0; i < N; i++) {
+        buf_printf(src, i % 10 ? " X%d" : " X%d = %d", i, i);
+    }
+    buf_printf(src, " }\nconst k0 = X%d\n", N - 1);
+    for (int i = 1; i < N; i++) {
+        buf_printf(src, "const k%d = k%d + %d\n", i, i - 1, i % 10 == 0 ? 1 : 0);
+    }
+    init_stream(src);
+    Decl **decls = parse_file();
+    const_nodes = 0;
+    assert(check_decls(decls, buf_len(decls)));
+    assert(const_nodes == N / 10 + 1 + 3 * (N - 1));
+    ConstVal val;
+    assert(decl_const_val(decls[N], str_intern("k99999"), &val) && val.i == N - 1 + N / 10 - 1);
+    assert(decl_const_val(decls[0], str_intern("X12345"), &val) && val.i == 12345 && val.type->kind == TYPE_ENUM);
+    buf_free(decls);
+    buf_free(src);
+    check_reset();
+    resolve_reset();
+}
@@ -0,0 +1,611 @@
+#include "ast.h"
+
+CseStats cse_stats;
+
+// The fn whose regions are being scanned.
+typedef struct CseFn {
+    Decl *decl;
+    bool takes_addrs;
+    Map addr_taken; // Params and locals whose address is taken, read as memory
+    bool scanned;
+    Map names; // Every name in the fn, so temps cannot clash with one
+    Map locals; // Init stmts to the locals they define, for those in use
+    size_t num_locals; // Next local slot
+} CseFn;
+
+// What a candidate reads, and whether it can be evaluated early at all.
+typedef struct CseInfo {
+    bool pure; // No calls with side effects
+    bool memory; // Reads globals, pointers, fields, elements or address-taken locals
+    uint64_t reads; // Bit per local or param read, by the low bits of its slot
+    size_t nodes;
+} CseInfo;
+
+// A candidate seen earlier in the region, where it first occurred.
+typedef struct CseEntry CseEntry;
+
+struct CseEntry {
+    Expr *expr;
+    Expr **slot; // Holds the temp's ident once hoisted
+    Stmt *stmt; // The stmt it occurs in
+    CseEntry *parent; // Nearest enclosing entry, or NULL
+    CseEntry *next; // With the same key
+    Stmt *init; // The init stmt whose whole expr it is
+    CseInfo info;
+    bool killed;
+    Sym *temp; // Or the local it initializes
+};
+
+// A temp's init, to be put before its anchor.
+typedef struct CseTemp CseTemp;
+
+struct CseTemp {
+    Stmt *init;
+    CseTemp *next;
+};
+
+// The region being scanned: a run of stmts in one block with no compound
+// stmt between them.
+typedef struct CseRegion {
+    uint64_t id; // Mixed into keys, so a new region needs no new map
+    Map entries; // Keys to CseEntry chains
+    CseEntry **live;
+    Stmt *stmt;
+    bool impure; // The stmt makes a call with side effects
+    bool hoisted;
+    Map temps; // Anchors to the CseTemps put before them
+} CseRegion;
+
+Arena cse_arena;
+CseFn cse_fn;
+CseRegion cse_region;
+AstVisitor cse_addr_visitor;
+AstVisitor cse_scan_visitor;
+
+VisitResult cse_addr_pre(AstNode node, void *ctx) {
+    (void)ctx;
+    if (node.kind == AST_TYPESPEC) {
+        return VISIT_SKIP;
+    }
+    if (node.kind == AST_EXPR && node.expr->kind == EXPR_UNARY && node.expr->unary.op == '&') {
+        Expr *base = node.expr->unary.expr;
+        while (base->kind == EXPR_FIELD || base->kind == EXPR_INDEX) {
+            base = base->kind == EXPR_FIELD ? base->field.expr : base->index.expr;
+        }
+        if (base->kind == EXPR_IDENT && base->sym) {
+            cse_fn.takes_addrs = true;
+            map_put(&cse_fn.addr_taken, base->sym, base->sym);
+        }
+    }
+    return VISIT_CONTINUE;
+}
+
+bool cse_addr_taken(Sym *sym) {
+    return cse_fn.takes_addrs && map_get(&cse_fn.addr_taken, sym);
+}
+
+VisitResult cse_scan_pre(AstNode node, void *ctx) {
+    (void)ctx;
+    if (node.kind == AST_TYPESPEC) {
+        return VISIT_SKIP;
+    }
+    if (node.kind == AST_EXPR && node.expr->kind == EXPR_IDENT) {
+        map_put(&cse_fn.names, node.expr->name, (void *)node.expr->name);
+        Sym *sym = node.expr->sym;
+        if (sym && sym->kind == SYM_LOCAL) {
+            map_put(&cse_fn.locals, sym->init, sym);
+        }
+    } else if (node.kind == AST_STMT && node.stmt->kind == STMT_INIT) {
+        map_put(&cse_fn.names, node.stmt->init.name, (void *)node.stmt->init.name);
+        cse_fn.num_locals++;
+    }
+    return VISIT_CONTINUE;
+}
+
+// Gathers the fn's names and locals the first time a repeat is found. Most
+// fns have none.
+void cse_scan(void) {
+    if (cse_fn.scanned) {
+        return;
+    }
+    cse_fn.scanned = true;
+    Decl *decl = cse_fn.decl;
+    cse_fn.num_locals = decl->fn.num_params;
+    for (size_t i = 0; i < decl->fn.num_params; i++) {
+        map_put(&cse_fn.names, decl->fn.params[i].name, (void *)decl->fn.params[i].name);
+    }
+    for (size_t i = 0; i < decl->fn.block.num_stmts; i++) {
+        ast_visit(&cse_scan_visitor, ast_stmt(decl->fn.block.stmts[i]));
+    }
+}
+
+// Gets the effects of a direct call, as purity.c finds them. Calls through
+// fn pointers have none to get.
+bool cse_call_effects(Expr *expr, unsigned *effects) {
+    Expr *callee = expr->call.expr;
+    if (callee->kind != EXPR_IDENT || !callee->sym || callee->sym->kind != SYM_FN) {
+        return false;
+    }
+    *effects = purity_of(callee->sym->decl);
+    return true;
+}
+
+uint64_t cse_read_bit(Sym *sym) {
+    return (uint64_t)1 << (sym->id & 63);
+}
+
+void cse_info_expr(Expr *expr, CseInfo *info) {
+    info->nodes++;
+    switch (expr->kind) {
+    case EXPR_IDENT:
+        if (!expr->sym) {
+            info->memory = true;
+        } else if (expr->sym->kind == SYM_LET || cse_addr_taken(expr->sym)) {
+            info->memory = true;
+        } else if (expr->sym->kind == SYM_LOCAL || expr->sym->kind == SYM_PARAM) {
+            info->reads |= cse_read_bit(expr->sym);
+        }
+        break;
+    case EXPR_CAST:
+        cse_info_expr(expr->cast.expr, info);
+        break;
+    case EXPR_CALL: {
+        unsigned effects;
+        if (!cse_call_effects(expr, &effects) || (effects & PURITY_WRITES)) {
+            info->pure = false;
+        } else if (effects) {
+            info->memory = true;
+        }
+        for (size_t i = 0; i < expr->call.num_args; i++) {
+            cse_info_expr(expr->call.args[i], info);
+        }
+        break;
+    }
+    case EXPR_INDEX:
+        info->memory = true;
+        cse_info_expr(expr->index.expr, info);
+        cse_info_expr(expr->index.index, info);
+        break;
+    case EXPR_FIELD:
+        info->memory = true;
+        cse_info_expr(expr->field.expr, info);
+        break;
+    case EXPR_COMPOUND:
+        for (size_t i = 0; i < expr->compound.num_args; i++) {
+            cse_info_expr(expr->compound.args[i], info);
+        }
+        break;
+    case EXPR_UNARY:
+        info->memory |= expr->unary.op == '*';
+        cse_info_expr(expr->unary.expr, info);
+        break;
+    case EXPR_BINARY:
+        cse_info_expr(expr->binary.left, info);
+        cse_info_expr(expr->binary.right, info);
+        break;
+    case EXPR_TERNARY:
+        cse_info_expr(expr->ternary.cond, info);
+        cse_info_expr(expr->ternary.then_expr, info);
+        cse_info_expr(expr->ternary.else_expr, info);
+        break;
+    default:
+        break;
+    }
+}
+
+CseInfo cse_info(Expr *expr) {
+    CseInfo info = {.pure = true};
+    cse_info_expr(expr, &info);
+    return info;
+}
+
+// Kinds worth a temp. Leaves are already as cheap as one, compound
+// literals are not scalars and taking an address reads nothing.
+bool cse_candidate(Expr *expr) {
+    switch (expr->kind) {
+    case EXPR_CAST:
+    case EXPR_CALL:
+    case EXPR_INDEX:
+    case EXPR_FIELD:
+    case EXPR_BINARY:
+    case EXPR_TERNARY:
+        break;
+    case EXPR_UNARY:
+        if (expr->unary.op == '&') {
+            return false;
+        }
+        break;
+    default:
+        return false;
+    }
+    return expr->type && is_scalar_type(expr->type);
+}
+
+uint64_t cse_key(uint64_t hash) {
+    uint64_t key = hash_mix(hash, cse_region.id);
+    return key ? key : 1;
+}
+
+CseEntry *cse_lookup(uint64_t key, Expr *expr) {
+    CseEntry *entry = (CseEntry *)(uintptr_t)map_get_uint64(&cse_region.entries, key);
+    for (; entry; entry = entry->next) {
+        if (!entry->killed && expr_equal(entry->expr, expr)) {
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+CseEntry *cse_add(uint64_t key, Expr **slot, CseEntry *parent, CseInfo info) {
+    CseEntry *entry = arena_alloc(&cse_arena, sizeof(CseEntry));
+    *entry = (CseEntry){.expr = *slot, .slot = slot, .stmt = cse_region.stmt, .parent = parent, .info = info};
+    entry->next = (CseEntry *)(uintptr_t)map_get_uint64(&cse_region.entries, key);
+    map_put_uint64(&cse_region.entries, key, (uint64_t)(uintptr_t)entry);
+    buf_push(cse_region.live, entry);
+    return entry;
+}
+
+// Returns a name starting with cse that nothing in the fn uses.
+const char *cse_fresh(void) {
+    cse_scan();
+    char buf[32] = "cse";
+    const char *fresh = str_intern(buf);
+    for (int i = 1; map_get(&cse_fn.names, fresh); i++) {
+        snprintf(buf + 3, sizeof(buf) - 3, "%d", i);
+        fresh = str_intern(buf);
+    }
+    map_put(&cse_fn.names, fresh, (void *)fresh);
+    return fresh;
+}
+
+Expr *cse_ident(Sym *sym) {
+    Expr *expr = expr_ident(sym->name);
+    expr->sym = sym;
+    expr->type = sym->init->init.expr->type;
+    return expr;
+}
+
+// Moves the entry's first occurrence into the init of a new temp, put just
+// before the stmt it came from or, when it sits inside the expr of an
+// enclosing entry that was hoisted since, just before that one's init.
+void cse_hoist(CseEntry *entry) {
+    Stmt *anchor = entry->stmt;
+    for (CseEntry *parent = entry->parent; parent; parent = parent->parent) {
+        if (parent->temp) {
+            anchor = parent->temp->init;
+            break;
+        }
+    }
+    Stmt *init = stmt_init(cse_fresh(), entry->expr);
+    Sym *sym = arena_alloc(&sym_arena, sizeof(Sym));
+    *sym = (Sym){.name = init->init.name, .kind = SYM_LOCAL, .state = SYM_RESOLVED, .decl = cse_fn.decl,
+                 .id = cse_fn.num_locals++, .init = init};
+    entry->temp = sym;
+    *entry->slot = cse_ident(sym);
+    CseTemp *temp = arena_alloc(&cse_arena, sizeof(CseTemp));
+    *temp = (CseTemp){.init = init};
+    CseTemp *last = map_get(&cse_region.temps, anchor);
+    if (!last) {
+        map_put(&cse_region.temps, anchor, temp);
+    } else {
+        while (last->next) {
+            last = last->next;
+        }
+        last->next = temp;
+    }
+    cse_region.hoisted = true;
+    cse_stats.temps++;
+}
+
+void cse_expr(Expr **slot, CseEntry *parent, bool conditional);
+
+// Walks expr's children, which may be candidates even where expr itself,
+// being assigned to or having its address taken, is not.
+void cse_children(Expr *expr, CseEntry *parent, bool conditional) {
+    switch (expr->kind) {
+    case EXPR_CAST:
+        cse_expr(&expr->cast.expr, parent, conditional);
+        break;
+    case EXPR_CALL:
+        for (size_t i = 0; i < expr->call.num_args; i++) {
+            cse_expr(&expr->call.args[i], parent, conditional);
+        }
+        break;
+    case EXPR_INDEX:
+        cse_expr(&expr->index.expr, parent, conditional);
+        cse_expr(&expr->index.index, parent, conditional);
+        break;
+    case EXPR_FIELD:
+        cse_expr(&expr->field.expr, parent, conditional);
+        break;
+    case EXPR_COMPOUND:
+        for (size_t i = 0; i < expr->compound.num_args; i++) {
+            cse_expr(&expr->compound.args[i], parent, conditional);
+        }
+        break;
+    case EXPR_UNARY:
+        if (expr->unary.op == '&') {
+            cse_children(expr->unary.expr, parent, conditional);
+        } else {
+            cse_expr(&expr->unary.expr, parent, conditional);
+        }
+        break;
+    case EXPR_BINARY: {
+        cse_expr(&expr->binary.left, parent, conditional);
+        bool short_circuit = expr->binary.op == TOKEN_AND || expr->binary.op == TOKEN_OR;
+        cse_expr(&expr->binary.right, parent, conditional || short_circuit);
+        break;
+    }
+    case EXPR_TERNARY:
+        cse_expr(&expr->ternary.cond, parent, conditional);
+        cse_expr(&expr->ternary.then_expr, parent, true);
+        cse_expr(&expr->ternary.else_expr, parent, true);
+        break;
+    default:
+        break;
+    }
+}
+
+// Replaces the expr in slot by a temp when an equal one was evaluated
+// earlier in the region and nothing it reads has changed since. Outer
+// exprs are tried first, so a repeat is replaced whole. Exprs that may
+// not be evaluated at all, behind && and || or in a ternary's branches,
+// can reuse a temp but never start one.
+void cse_expr(Expr **slot, CseEntry *parent, bool conditional) {
+    Expr *expr = *slot;
+    if (cse_candidate(expr)) {
+        CseInfo info = cse_info(expr);
+        if (info.pure && (info.reads || info.memory) && !(info.memory && cse_region.impure)) {
+            uint64_t key = cse_key(expr_hash(expr));
+            CseEntry *entry = cse_lookup(key, expr);
+            if (entry) {
+                if (!entry->temp && entry->init) {
+                    cse_scan();
+                    Sym *sym = map_get(&cse_fn.locals, entry->init);
+                    entry->temp = sym && !cse_addr_taken(sym) ? sym : NULL;
+                }
+                if (!entry->temp) {
+                    cse_hoist(entry);
+                }
+                *slot = cse_ident(entry->temp);
+                cse_stats.replaced++;
+                cse_stats.nodes += info.nodes - 1;
+                return;
+            }
+            if (!conditional) {
+                parent = cse_add(key, slot, parent, info);
+            }
+        }
+    }
+    cse_children(expr, parent, conditional);
+}
+
+// Kills entries that read memory, if memory changed, or any of the locals
+// and params in reads, or the value a local was initialized with, if init
+// is its init stmt.
+void cse_kill(bool memory, uint64_t reads, Stmt *init) {
+    size_t len = 0;
+    for (size_t i = 0; i < buf_len(cse_region.live); i++) {
+        CseEntry *entry = cse_region.live[i];
+        if ((memory && entry->info.memory) || (entry->info.reads & reads) || (init && entry->init == init)) {
+            entry->killed = true;
+        } else {
+            cse_region.live[len++] = entry;
+        }
+    }
+    buf_truncate(cse_region.live, len);
+}
+
+// Kills the entries an assignment to left may change. Locals and params
+// whose address is never taken change alone; anything else may be seen
+// through memory.
+void cse_kill_assign(Expr *left) {
+    if (left->kind == EXPR_IDENT && left->sym && (left->sym->kind == SYM_LOCAL || left->sym->kind == SYM_PARAM) &&
+        !cse_addr_taken(left->sym)) {
+        cse_kill(false, cse_read_bit(left->sym), left->sym->init);
+        return;
+    }
+    Expr *base = left;
+    while (base->kind == EXPR_FIELD || base->kind == EXPR_INDEX) {
+        base = base->kind == EXPR_FIELD ? base->field.expr : base->index.expr;
+    }
+    uint64_t reads = 0;
+    if (base->kind == EXPR_IDENT && base->sym && (base->sym->kind == SYM_LOCAL || base->sym->kind == SYM_PARAM)) {
+        reads = cse_read_bit(base->sym);
+    }
+    cse_kill(true, reads, NULL);
+}
+
+void cse_region_reset(void) {
+    cse_region.id++;
+    buf_clear(cse_region.live);
+}
+
+// Scans one stmt of the region: its exprs are matched and recorded in
+// evaluation order, then whatever it writes is killed.
+// An assignment's value is scanned before its target, whose own parts are
+// read before the write.
+void cse_stmt(Stmt *stmt, Expr **slot) {
+    cse_region.stmt = stmt;
+    Expr *right = stmt->kind == STMT_ASSIGN ? stmt->assign.right : NULL;
+    cse_region.impure = !cse_info(*slot).pure || (right && !cse_info(right).pure);
+    if (stmt->kind == STMT_ASSIGN) {
+        if (right) {
+            cse_expr(&stmt->assign.right, NULL, false);
+        }
+        cse_children(stmt->assign.left, NULL, false);
+        cse_kill_assign(stmt->assign.left);
+    } else {
+        size_t start = buf_len(cse_region.live);
+        cse_expr(slot, NULL, false);
+        if (stmt->kind == STMT_INIT && buf_len(cse_region.live) > start && cse_region.live[start]->slot == slot) {
+            // The local may stand in for its value until it is assigned.
+            cse_region.live[start]->init = stmt;
+        }
+    }
+    if (cse_region.impure) {
+        cse_kill(true, 0, NULL);
+    }
+}
+
+// Puts stmt in stmts after the temps anchored to it, and theirs before them.
+void cse_emit(Stmt ***stmts, Stmt *stmt) {
+    for (CseTemp *temp = map_get(&cse_region.temps, stmt); temp; temp = temp->next) {
+        cse_emit(stmts, temp->init);
+    }
+    buf_push(*stmts, stmt);
+}
+
+// One pass over the block's regions. Returns whether it hoisted anything.
+// An if's first cond and a switch's expr run before anything else in the
+// stmt, so they end the region before it instead of starting a new one.
+bool cse_pass(StmtBlock *block) {
+    cse_region_reset();
+    cse_region.hoisted = false;
+    for (size_t i = 0; i < block->num_stmts; i++) {
+        Stmt *stmt = block->stmts[i];
+        switch (stmt->kind) {
+        case STMT_RETURN:
+            if (stmt->return_stmt.expr) {
+                cse_stmt(stmt, &stmt->return_stmt.expr);
+            }
+            break;
+        case STMT_ASSIGN:
+            cse_stmt(stmt, &stmt->assign.left);
+            break;
+        case STMT_INIT:
+            cse_stmt(stmt, &stmt->init.expr);
+            break;
+        case STMT_EXPR:
+            cse_stmt(stmt, &stmt->expr);
+            break;
+        case STMT_IF:
+            cse_stmt(stmt, &stmt->if_stmt.cond);
+            cse_region_reset();
+            break;
+        case STMT_SWITCH:
+            cse_stmt(stmt, &stmt->switch_stmt.expr);
+            cse_region_reset();
+            break;
+        default:
+            cse_region_reset();
+            break;
+        }
+    }
+    if (!cse_region.hoisted) {
+        return false;
+    }
+    Stmt **stmts = NULL;
+    for (size_t i = 0; i < block->num_stmts; i++) {
+        cse_emit(&stmts, block->stmts[i]);
+    }
+    *block = (StmtBlock){ast_dup(stmts, buf_len(stmts) * sizeof(Stmt *)), buf_len(stmts)};
+    buf_free(stmts);
+    map_free(&cse_region.temps);
+    return true;
+}
+
+void cse_block(StmtBlock *block);
+
+void cse_nested(Stmt *stmt) {
+    switch (stmt->kind) {
+    case STMT_BLOCK:
+        cse_block(&stmt->block);
+        break;
+    case STMT_IF:
+        cse_block(&stmt->if_stmt.then_block);
+        for (size_t i = 0; i < stmt->if_stmt.num_elseifs; i++) {
+            cse_block(&stmt->if_stmt.elseifs[i].block);
+        }
+        cse_block(&stmt->if_stmt.else_block);
+        break;
+    case STMT_WHILE:
+    case STMT_DO_WHILE:
+        cse_block(&stmt->while_stmt.block);
+        break;
+    case STMT_FOR:
+        cse_block(&stmt->for_stmt.block);
+        break;
+    case STMT_SWITCH:
+        for (size_t i = 0; i < stmt->switch_stmt.num_cases; i++) {
+            cse_block(&stmt->switch_stmt.cases[i].block);
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+// Each pass can uncover more: a repeat of an expr whose first occurrence
+// had part of it hoisted no longer matches it until the next pass.
+void cse_block(StmtBlock *block) {
+    for (size_t i = 0; i < block->num_stmts; i++) {
+        cse_nested(block->stmts[i]);
+    }
+    while (cse_pass(block)) {
+    }
+}
+
+void cse_decls(Decl **decls, size_t num_decls) {
+    cse_addr_visitor = (AstVisitor){.pre = cse_addr_pre};
+    cse_scan_visitor = (AstVisitor){.pre = cse_scan_pre};
+    for (size_t i = 0; i < num_decls; i++) {
+        Decl *decl = decls[i];
+        if (decl->kind != DECL_FN) {
+            continue;
+        }
+        cse_fn = (CseFn){.decl = decl};
+        for (size_t j = 0; j < decl->fn.block.num_stmts; j++) {
+            ast_visit(&cse_addr_visitor, ast_stmt(decl->fn.block.stmts[j]));
+        }
+        cse_block(&decl->fn.block);
+        map_free(&cse_fn.names);
+        map_free(&cse_fn.addr_taken);
+        map_free(&cse_fn.locals);
+        map_free(&cse_region.entries);
+    }
+    cse_fn = (CseFn){0};
+    buf_free(cse_region.live);
+    cse_region = (CseRegion){0};
+    arena_free(&cse_arena);
+    visitor_free(&cse_addr_visitor);
+    visitor_free(&cse_scan_visitor);
+}
+
+void cse_test(void) {
+    // Repeats are replaced whole, and a second pass picks up those whose
+    // first occurrence had part of it hoisted.
+    pass_test_case(cse_decls, PASS_TEST_TYPED | PASS_TEST_CHECK,
+                   "struct B { x: int; y: int; } struct A { b: B*; }\n"
+                   "fn f(a: A, i: int): int { s := a.b[i].x + a.b[i].y; s += a.b[i].x; return s; }",
+                   "(fn f ( a A i int ) int\n  (block\n    (:= cse (field a b))\n    (:= cse1 (field (index cse i) x))\n"
+                   "    (:= s (+ cse1 (field (index cse i) y)))\n    (+= s cse1)\n    (return s)))");
+    // Writes to memory or to what an expr reads end its reuse, and so does
+    // the end of the region. A local initialized with one stands in for it.
+    pass_test_case(cse_decls, PASS_TEST_TYPED | PASS_TEST_CHECK,
+                   "fn f(p: int*, i: int): int { x := p[i] + 1; p[i] = 2; y := p[i] + 1; i++; z := p[i] + 1;\n"
+                   "if (p[i] + 1 > x) { x = p[i] + 1 + x; } return x + y + z + p[i] * 2 + p[i] * 2; }",
+                   "(fn f ( p (ptr int) i int ) int\n  (block\n    (:= x (+ (index p i) 1))\n    (= (index p i) 2)\n"
+                   "    (:= y (+ (index p i) 1))\n    (++ i)\n    (:= z (+ (index p i) 1))\n    (if (> z x)\n"
+                   "      (block\n        (= x (+ (+ (index p i) 1) x))))\n    (:= cse (* (index p i) 2))\n"
+                   "    (return (+ (+ (+ (+ x y) z) cse) cse))))");
+    // Calls without side effects are shared, and those that read nothing
+    // but their args outlive writes to memory. Other calls are not, nor is
+    // memory around them. A ternary's branches only reuse what its cond
+    // computed.
+    pass_test_case(cse_decls, PASS_TEST_TYPED | PASS_TEST_CHECK,
+                   "fn sq(x: int): int { return x * x; } fn bump(p: int*): int { p[0]++; return p[0]; }\n"
+                   "fn f(p: int*, n: int): int { a := sq(n) + sq(n); b := bump(p) + bump(p); c := p[0] > 1 ? p[0] : 0;\n"
+                   "d := n * 3 + bump(p) + n * 3 + p[1] + p[1]; return a + b + c + d + (p[0] > 1 ? 1 : 0) + sq(n); }",
+                   "(fn f ( p (ptr int) n int ) int\n  (block\n    (:= cse (sq n))\n    (:= a (+ cse cse))\n"
+                   "    (:= b (+ (bump p) (bump p)))\n    (:= cse1 (index p 0))\n    (:= c (? (> cse1 1) cse1 0))\n"
+                   "    (:= cse2 (* n 3))\n    (:= d (+ (+ (+ (+ cse2 (bump p)) cse2) (index p 1)) (index p 1)))\n"
+                   "    (return (+ (+ (+ (+ (+ a b) c) d) (? (> (index p 0) 1) 1 0)) cse))))");
+    // Locals whose address is taken change with memory.
+    pass_test_case(cse_decls, PASS_TEST_TYPED | PASS_TEST_CHECK,
+                   "fn f(n: int): int { q := &n; a := n * 2; *q = 1; b := n * 2; return a + b + n * 2; }",
+                   "(fn f ( n int ) int\n  (block\n    (:= q (& n))\n    (:= a (* n 2))\n    (= (* q) 1)\n"
+                   "    (:= b (* n 2))\n    (return (+ (+ a b) b))))");
+    assert(cse_stats.temps == 6 && cse_stats.replaced == 10 && cse_stats.nodes == 21);
+    cse_stats = (CseStats){0};
+}
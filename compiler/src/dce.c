@@ -0,0 +1,311 @@
+#include "ast.h"
+
+DceStats dce_stats;
+bool dce_fn_returns; // A reachable return was seen in the fn being pruned
+
+// Whether expr is known at compile time, and if so whether it is true.
+// Literals always are; on checked trees so are consts and enum items.
+bool dce_truth(Expr *expr, bool *truth) {
+    ConstVal val;
+    const_quiet = true;
+    bool known = fold_const(expr, &val) || (expr->type && const_eval(expr, &val));
+    const_quiet = false;
+    if (known) {
+        *truth = const_truth(val);
+    }
+    return known;
+}
+
+size_t dce_count_stmts(Stmt *stmt);
+
+size_t dce_count_block(StmtBlock block) {
+    size_t count = 0;
+    for (size_t i = 0; i < block.num_stmts; i++) {
+        count += dce_count_stmts(block.stmts[i]);
+    }
+    return count;
+}
+
+size_t dce_count_stmts(Stmt *stmt) {
+    switch (stmt->kind) {
+    case STMT_BLOCK:
+        return 1 + dce_count_block(stmt->block);
+    case STMT_IF: {
+        size_t count = 1 + dce_count_block(stmt->if_stmt.then_block) + dce_count_block(stmt->if_stmt.else_block);
+        for (size_t i = 0; i < stmt->if_stmt.num_elseifs; i++) {
+            count += dce_count_block(stmt->if_stmt.elseifs[i].block);
+        }
+        return count;
+    }
+    case STMT_WHILE:
+    case STMT_DO_WHILE:
+        return 1 + dce_count_block(stmt->while_stmt.block);
+    case STMT_FOR:
+        return 1 + dce_count_block(stmt->for_stmt.block);
+    case STMT_SWITCH: {
+        size_t count = 1;
+        for (size_t i = 0; i < stmt->switch_stmt.num_cases; i++) {
+            count += dce_count_block(stmt->switch_stmt.cases[i].block);
+        }
+        return count;
+    }
+    default:
+        return 1;
+    }
+}
+
+// Whether block has a break or continue (kind) that leaves the innermost
+// enclosing loop. Nested loops own theirs; a switch owns its breaks.
+bool dce_jumps(StmtBlock block, StmtKind kind) {
+    for (size_t i = 0; i < block.num_stmts; i++) {
+        Stmt *stmt = block.stmts[i];
+        switch (stmt->kind) {
+        case STMT_BREAK:
+        case STMT_CONTINUE:
+            if (stmt->kind == kind) {
+                return true;
+            }
+            break;
+        case STMT_BLOCK:
+            if (dce_jumps(stmt->block, kind)) {
+                return true;
+            }
+            break;
+        case STMT_IF:
+            if (dce_jumps(stmt->if_stmt.then_block, kind) || dce_jumps(stmt->if_stmt.else_block, kind)) {
+                return true;
+            }
+            for (size_t j = 0; j < stmt->if_stmt.num_elseifs; j++) {
+                if (dce_jumps(stmt->if_stmt.elseifs[j].block, kind)) {
+                    return true;
+                }
+            }
+            break;
+        case STMT_SWITCH:
+            for (size_t j = 0; kind == STMT_CONTINUE && j < stmt->switch_stmt.num_cases; j++) {
+                if (dce_jumps(stmt->switch_stmt.cases[j].block, kind)) {
+                    return true;
+                }
+            }
+            break;
+        default:
+            break;
+        }
+    }
+    return false;
+}
+
+bool dce_block(StmtBlock *block);
+
+// Turns stmt into a plain block in place, or returns NULL when the block is
+// empty and the statement can go.
+Stmt *dce_replace_with_block(Stmt *stmt, StmtBlock block, bool *live) {
+    assert(stmt_size(STMT_BLOCK) <= stmt_size(stmt->kind));
+    stmt->kind = STMT_BLOCK;
+    stmt->block = block;
+    *live = dce_block(&stmt->block);
+    return stmt->block.num_stmts ? stmt : NULL;
+}
+
+Stmt *dce_if(Stmt *stmt, bool *live) {
+    IfStmt *if_stmt = &stmt->if_stmt;
+    bool truth;
+    // Constant-false arms fall away from the front until one is left to
+    // test or a constant-true arm takes the whole statement.
+    while (dce_truth(if_stmt->cond, &truth)) {
+        dce_stats.branches_pruned++;
+        if (truth) {
+            dce_stats.stmts_removed += dce_count_block(if_stmt->else_block);
+            for (size_t i = 0; i < if_stmt->num_elseifs; i++) {
+                dce_stats.stmts_removed += dce_count_block(if_stmt->elseifs[i].block);
+            }
+            return dce_replace_with_block(stmt, if_stmt->then_block, live);
+        }
+        dce_stats.stmts_removed += dce_count_block(if_stmt->then_block);
+        if (!if_stmt->num_elseifs) {
+            return dce_replace_with_block(stmt, if_stmt->else_block, live);
+        }
+        if_stmt->cond = if_stmt->elseifs[0].cond;
+        if_stmt->then_block = if_stmt->elseifs[0].block;
+        if_stmt->elseifs++;
+        if_stmt->num_elseifs--;
+    }
+    size_t num_elseifs = 0;
+    for (size_t i = 0; i < if_stmt->num_elseifs; i++) {
+        ElseIf elseif = if_stmt->elseifs[i];
+        if (!dce_truth(elseif.cond, &truth)) {
+            if_stmt->elseifs[num_elseifs++] = elseif;
+            continue;
+        }
+        dce_stats.branches_pruned++;
+        if (truth) {
+            // Everything after a constant-true elseif is unreachable.
+            dce_stats.stmts_removed += dce_count_block(if_stmt->else_block);
+            for (size_t j = i + 1; j < if_stmt->num_elseifs; j++) {
+                dce_stats.stmts_removed += dce_count_block(if_stmt->elseifs[j].block);
+            }
+            if_stmt->else_block = elseif.block;
+            break;
+        }
+        dce_stats.stmts_removed += dce_count_block(elseif.block);
+    }
+    if_stmt->num_elseifs = num_elseifs;
+    *live = dce_block(&if_stmt->then_block);
+    for (size_t i = 0; i < if_stmt->num_elseifs; i++) {
+        *live |= dce_block(&if_stmt->elseifs[i].block);
+    }
+    *live |= dce_block(&if_stmt->else_block);
+    return stmt;
+}
+
+Stmt *dce_loop(Stmt *stmt, bool *live) {
+    bool known, truth = false;
+    if (stmt->kind == STMT_FOR) {
+        known = !stmt->for_stmt.cond || dce_truth(stmt->for_stmt.cond, &truth);
+        truth |= !stmt->for_stmt.cond;
+    } else {
+        known = dce_truth(stmt->while_stmt.cond, &truth);
+    }
+    StmtBlock *body = stmt->kind == STMT_FOR ? &stmt->for_stmt.block : &stmt->while_stmt.block;
+    if (known && !truth && stmt->kind != STMT_DO_WHILE) {
+        // The body never runs; only a for loop's init is left.
+        dce_stats.loops_removed++;
+        dce_stats.stmts_removed += dce_count_block(*body) + (stmt->kind == STMT_FOR && stmt->for_stmt.next);
+        if (stmt->kind == STMT_FOR && stmt->for_stmt.init) {
+            Stmt *init = stmt->for_stmt.init;
+            *live = true;
+            return stmt_block((StmtBlock){&init, 1});
+        }
+        *live = true;
+        return NULL;
+    }
+    bool body_live = dce_block(body);
+    bool breaks = dce_jumps(*body, STMT_BREAK);
+    if (stmt->kind == STMT_DO_WHILE) {
+        bool continues = dce_jumps(*body, STMT_CONTINUE);
+        if (known && !truth && !breaks && !continues) {
+            // do { ... } while (0) runs its body once.
+            dce_stats.loops_removed++;
+            *live = body_live;
+            return body->num_stmts ? dce_replace_with_block(stmt, *body, live) : NULL;
+        }
+        *live = breaks || (!(known && truth) && (body_live || continues));
+    } else {
+        *live = breaks || !(known && truth);
+    }
+    return stmt;
+}
+
+Stmt *dce_switch(Stmt *stmt, bool *live) {
+    bool has_default = false;
+    *live = false;
+    for (size_t i = 0; i < stmt->switch_stmt.num_cases; i++) {
+        SwitchCase *c = &stmt->switch_stmt.cases[i];
+        has_default |= c->is_default;
+        *live |= dce_block(&c->block) || dce_jumps(c->block, STMT_BREAK);
+    }
+    *live |= !has_default;
+    return stmt;
+}
+
+// Prunes inside stmt and returns what should stand in its place, NULL if
+// nothing. live says whether control can reach the next statement.
+Stmt *dce_stmt(Stmt *stmt, bool *live) {
+    *live = true;
+    switch (stmt->kind) {
+    case STMT_RETURN:
+        dce_fn_returns = true;
+        *live = false;
+        return stmt;
+    case STMT_BREAK:
+    case STMT_CONTINUE:
+        *live = false;
+        return stmt;
+    case STMT_BLOCK:
+        *live = dce_block(&stmt->block);
+        return stmt->block.num_stmts ? stmt : NULL;
+    case STMT_IF:
+        return dce_if(stmt, live);
+    case STMT_WHILE:
+    case STMT_DO_WHILE:
+    case STMT_FOR:
+        return dce_loop(stmt, live);
+    case STMT_SWITCH:
+        return dce_switch(stmt, live);
+    default:
+        return stmt;
+    }
+}
+
+// Prunes block in place and returns whether control can fall off its end.
+bool dce_block(StmtBlock *block) {
+    size_t num_stmts = 0;
+    bool live = true;
+    for (size_t i = 0; i < block->num_stmts; i++) {
+        Stmt *stmt = block->stmts[i];
+        if (!live) {
+            dce_stats.stmts_removed += dce_count_stmts(stmt);
+            continue;
+        }
+        Stmt *kept = dce_stmt(stmt, &live);
+        if (kept) {
+            block->stmts[num_stmts++] = kept;
+        } else {
+            dce_stats.stmts_removed++;
+        }
+    }
+    block->num_stmts = num_stmts;
+    return live;
+}
+
+// Prunes every fn body and sets never_returns on fns with no reachable
+// return whose end cannot be reached either.
+void dce_decls(Decl **decls, size_t num_decls) {
+    for (size_t i = 0; i < num_decls; i++) {
+        Decl *decl = decls[i];
+        if (decl->kind != DECL_FN) {
+            continue;
+        }
+        dce_fn_returns = false;
+        bool live = dce_block(&decl->fn.block);
+        decl->fn.never_returns = !live && !dce_fn_returns;
+        dce_stats.never_returns += decl->fn.never_returns;
+    }
+}
+
+void dce_test(void) {
+    pass_test_case(dce_decls, PASS_TEST_ALL, "fn f(x: int): int { x++; return x; x--; { x--; } }",
+                   "(fn f ( x int ) int\n  (block\n    (++ x)\n    (return x)))\n");
+    pass_test_case(dce_decls, PASS_TEST_ALL,
+                   "fn f(x: int) { while (x) { if (x) { break; x++; } else { continue; } x--; } }",
+                   "(fn f ( x int ) nil\n  (block\n    (while x\n      (block\n        (if x\n          (block\n"
+                   "            (break))\n          else \n          (block\n            (continue)))))))\n");
+    pass_test_case(dce_decls, PASS_TEST_ALL,
+                   "fn f(x: int) { if (0) { x++; } else if (x) { x--; } else if (1) { x += 2; } else { x += 3; } }",
+                   "(fn f ( x int ) nil\n  (block\n    (if x\n      (block\n        (-- x))\n"
+                   "      else \n      (block\n        (+= x 2)))))\n");
+    pass_test_case(dce_decls, PASS_TEST_ALL,
+                   "fn f(x: int) { if (0) { x++; } while (0) { x++; } for (i := x; 0;) {} do { x++; } while (0); }",
+                   "(fn f ( x int ) nil\n  (block\n    (block\n      (:= i x))\n    (block\n      (++ x))))\n");
+    // Consts count as constants on checked trees.
+    pass_test_case(dce_decls, PASS_TEST_TYPED | PASS_TEST_CHECK | PASS_TEST_ALL,
+                   "const DEBUG = 0 enum M { OFF ON } fn f(x: int): int { if (DEBUG || ON == OFF) { x++; } return x; }",
+                   "(const DEBUG 0 = 0)\n(enum M\n  (OFF nil = 0)\n  (ON nil = 1))\n"
+                   "(fn f ( x int ) int\n  (block\n    (return x)))\n");
+
+    // Fns whose end and returns are all unreachable never return.
+    pass_test_case(dce_decls, PASS_TEST_ALL,
+                   "fn f() { while (1) {} } fn g() { for (;;) { if (0) { break; } } }\n"
+                   "fn h(): int { do { return 1; } while (1); } fn k() { while (1) { break; } }\n"
+                   "fn m(x: int) { switch (x) { case 1: { return x; } default { while (1) {} } } }",
+                   "noreturn (fn f ( ) nil\n  (block\n    (while 1\n      (block))))\n"
+                   "noreturn (fn g ( ) nil\n  (block\n    (for nilnilnil\n      (block))))\n"
+                   "(fn h ( ) int\n  (block\n    (do-while 1\n      (block\n        (return 1)))))\n"
+                   "(fn k ( ) nil\n  (block\n    (while 1\n      (block\n        (break)))))\n"
+                   "(fn m ( x int ) nil\n  (block\n    (switch x\n      (case ( 1 ) \n        (block\n"
+                   "          (return x))\n      (case ( default ) \n        (block\n          (while 1\n            (block))))))\n");
+    assert(dce_stats.stmts_removed && dce_stats.branches_pruned && dce_stats.loops_removed && dce_stats.never_returns == 2);
+    dce_stats = (DceStats){0};
+    check_reset();
+    resolve_reset();
+}
@@ -0,0 +1,43 @@
+#include "ast.h"
+
+// Parses path into a stretchy buffer of decls, or returns NULL after
+// reporting the errors.
+Decl **parse_path(const char *path) {
+    char *src = read_file(path);
+    if (!src) {
+        printf("error: cannot read '%s'\n", path);
+        return NULL;
+    }
+    init_keywords();
+    init_stream_name(path, src);
+    Decl **decls = parse_file();
+    free(src);
+    if (num_syntax_errors) {
+        flush_syntax_errors();
+        buf_free(decls);
+        return NULL;
+    }
+    return decls;
+}
+
+// Prints only through the printer, so the server can capture it.
+int compile_file(const char *path) {
+    char *src = read_file(path);
+    if (!src) {
+        print_str("error: cannot read '");
+        print_str(path);
+        print_str("'\n");
+        print_flush();
+        return 1;
+    }
+    init_keywords();
+    init_stream_name(path, src);
+    Decl **decls = decl_cache.dir || decl_cache.resident ? parse_file_cached() : parse_file();
+    print_decls(decls, buf_len(decls));
+    int result = num_syntax_errors ? 1 : 0;
+    print_syntax_errors();
+    print_flush();
+    buf_free(decls);
+    free(src);
+    return result;
+}
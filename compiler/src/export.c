@@ -0,0 +1,1183 @@
+#include "ast.h"
+
+const char *export_typespec_kinds[] = {
+    [TYPESPEC_IDENT] = "name",
+    [TYPESPEC_FN] = "fn",
+    [TYPESPEC_ARRAY] = "array",
+    [TYPESPEC_PTR] = "ptr",
+    [TYPESPEC_ERROR] = "error",
+};
+
+const char *export_expr_kinds[] = {
+    [EXPR_INT] = "int",
+    [EXPR_FLOAT] = "float",
+    [EXPR_STR] = "str",
+    [EXPR_IDENT] = "name",
+    [EXPR_CAST] = "cast",
+    [EXPR_CALL] = "call",
+    [EXPR_INDEX] = "index",
+    [EXPR_FIELD] = "field",
+    [EXPR_COMPOUND] = "compound",
+    [EXPR_UNARY] = "unary",
+    [EXPR_BINARY] = "binary",
+    [EXPR_TERNARY] = "ternary",
+    [EXPR_ERROR] = "error",
+};
+
+const char *export_stmt_kinds[] = {
+    [STMT_RETURN] = "return",
+    [STMT_BREAK] = "break",
+    [STMT_CONTINUE] = "continue",
+    [STMT_BLOCK] = "block",
+    [STMT_IF] = "if",
+    [STMT_WHILE] = "while",
+    [STMT_DO_WHILE] = "do_while",
+    [STMT_FOR] = "for",
+    [STMT_SWITCH] = "switch",
+    [STMT_ASSIGN] = "assign",
+    [STMT_INIT] = "init",
+    [STMT_EXPR] = "expr",
+    [STMT_ERROR] = "error",
+};
+
+const char *export_decl_kinds[] = {
+    [DECL_ENUM] = "enum",
+    [DECL_STRUCT] = "struct",
+    [DECL_UNION] = "union",
+    [DECL_LET] = "let",
+    [DECL_CONST] = "const",
+    [DECL_TYPEDEF] = "typedef",
+    [DECL_FN] = "fn",
+    [DECL_ERROR] = "error",
+};
+
+/*
+ * JSON
+ */
+
+const char *json_escapes[32] = {
+    ['\b'] = "\\b",
+    ['\f'] = "\\f",
+    ['\n'] = "\\n",
+    ['\r'] = "\\r",
+    ['\t'] = "\\t",
+};
+
+void json_str(const char *str) {
+    print_char('"');
+    const char *run = str;
+    for (const char *it = str; *it; it++) {
+        unsigned char c = *it;
+        if (c >= 32 && c != '"' && c != '\\') {
+            continue;
+        }
+        print_chars(run, it - run);
+        run = it + 1;
+        if (c == '"' || c == '\\') {
+            print_char('\\');
+            print_char(c);
+        } else if (json_escapes[c]) {
+            print_str(json_escapes[c]);
+        } else {
+            print_str("\\u00");
+            print_char("0123456789abcdef"[c >> 4]);
+            print_char("0123456789abcdef"[c & 15]);
+        }
+    }
+    print_str(run);
+    print_char('"');
+}
+
+// Starts an object with its "kind" member; callers add the rest with
+// json_key and close it with '}'.
+void json_kind(const char *kind) {
+    print_str("{\"kind\":\"");
+    print_str(kind);
+    print_char('"');
+}
+
+void json_key(const char *key) {
+    print_str(",\"");
+    print_str(key);
+    print_str("\":");
+}
+
+void json_op(TokenKind op) {
+    print_char('"');
+    print_str(temp_token_kind_str(op));
+    print_char('"');
+}
+
+void json_expr(Expr *expr);
+void json_stmt(Stmt *stmt);
+
+void json_typespec(Typespec *type) {
+    if (!type) {
+        print_str("null");
+        return;
+    }
+    Typespec *t = type;
+    json_kind(export_typespec_kinds[t->kind]);
+    switch (t->kind) {
+    case TYPESPEC_IDENT:
+        json_key("name");
+        json_str(t->name);
+        break;
+    case TYPESPEC_FN:
+        json_key("args");
+        print_char('[');
+        for (size_t i = 0; i < t->fn.num_args; i++) {
+            if (i) {
+                print_char(',');
+            }
+            json_typespec(t->fn.args[i]);
+        }
+        print_char(']');
+        json_key("ret");
+        json_typespec(t->fn.ret);
+        break;
+    case TYPESPEC_ARRAY:
+        json_key("elem");
+        json_typespec(t->array.elem);
+        json_key("size");
+        json_expr(t->array.size);
+        break;
+    case TYPESPEC_PTR:
+        json_key("elem");
+        json_typespec(t->ptr.elem);
+        break;
+    case TYPESPEC_ERROR:
+        break;
+    default:
+        assert(0);
+        break;
+    }
+    print_char('}');
+}
+
+void json_exprs(Expr **exprs, size_t num_exprs) {
+    print_char('[');
+    for (size_t i = 0; i < num_exprs; i++) {
+        if (i) {
+            print_char(',');
+        }
+        json_expr(exprs[i]);
+    }
+    print_char(']');
+}
+
+void json_expr(Expr *expr) {
+    if (!expr) {
+        print_str("null");
+        return;
+    }
+    Expr *e = expr;
+    json_kind(export_expr_kinds[e->kind]);
+    switch (e->kind) {
+    case EXPR_INT:
+        json_key("value");
+        print_uint(e->int_val);
+        break;
+    case EXPR_FLOAT:
+        json_key("value");
+        if (isfinite(e->float_val)) {
+            print_double(e->float_val);
+        } else {
+            print_str("null");
+        }
+        break;
+    case EXPR_STR:
+        json_key("value");
+        json_str(e->str_val);
+        break;
+    case EXPR_IDENT:
+        json_key("name");
+        json_str(e->name);
+        break;
+    case EXPR_CAST:
+        json_key("type");
+        json_typespec(e->cast.type);
+        json_key("expr");
+        json_expr(e->cast.expr);
+        break;
+    case EXPR_CALL:
+        json_key("expr");
+        json_expr(e->call.expr);
+        json_key("args");
+        json_exprs(e->call.args, e->call.num_args);
+        break;
+    case EXPR_INDEX:
+        json_key("expr");
+        json_expr(e->index.expr);
+        json_key("index");
+        json_expr(e->index.index);
+        break;
+    case EXPR_FIELD:
+        json_key("expr");
+        json_expr(e->field.expr);
+        json_key("name");
+        json_str(e->field.name);
+        break;
+    case EXPR_COMPOUND:
+        json_key("type");
+        json_typespec(e->compound.type);
+        json_key("args");
+        json_exprs(e->compound.args, e->compound.num_args);
+        break;
+    case EXPR_UNARY:
+        json_key("op");
+        json_op(e->unary.op);
+        json_key("expr");
+        json_expr(e->unary.expr);
+        break;
+    case EXPR_BINARY:
+        json_key("op");
+        json_op(e->binary.op);
+        json_key("left");
+        json_expr(e->binary.left);
+        json_key("right");
+        json_expr(e->binary.right);
+        break;
+    case EXPR_TERNARY:
+        json_key("cond");
+        json_expr(e->ternary.cond);
+        json_key("then");
+        json_expr(e->ternary.then_expr);
+        json_key("else");
+        json_expr(e->ternary.else_expr);
+        break;
+    case EXPR_ERROR:
+        break;
+    default:
+        assert(0);
+        break;
+    }
+    print_char('}');
+}
+
+void json_stmt_block(StmtBlock block) {
+    print_char('[');
+    for (size_t i = 0; i < block.num_stmts; i++) {
+        if (i) {
+            print_char(',');
+        }
+        json_stmt(block.stmts[i]);
+    }
+    print_char(']');
+}
+
+void json_stmt(Stmt *stmt) {
+    if (!stmt) {
+        print_str("null");
+        return;
+    }
+    Stmt *s = stmt;
+    json_kind(export_stmt_kinds[s->kind]);
+    switch (s->kind) {
+    case STMT_RETURN:
+        json_key("expr");
+        json_expr(s->return_stmt.expr);
+        break;
+    case STMT_BREAK:
+    case STMT_CONTINUE:
+    case STMT_ERROR:
+        break;
+    case STMT_BLOCK:
+        json_key("block");
+        json_stmt_block(s->block);
+        break;
+    case STMT_IF:
+        json_key("cond");
+        json_expr(s->if_stmt.cond);
+        json_key("then");
+        json_stmt_block(s->if_stmt.then_block);
+        json_key("elseifs");
+        print_char('[');
+        for (size_t i = 0; i < s->if_stmt.num_elseifs; i++) {
+            if (i) {
+                print_char(',');
+            }
+            print_str("{\"cond\":");
+            json_expr(s->if_stmt.elseifs[i].cond);
+            json_key("block");
+            json_stmt_block(s->if_stmt.elseifs[i].block);
+            print_char('}');
+        }
+        print_char(']');
+        json_key("else");
+        json_stmt_block(s->if_stmt.else_block);
+        break;
+    case STMT_WHILE:
+    case STMT_DO_WHILE:
+        json_key("cond");
+        json_expr(s->while_stmt.cond);
+        json_key("block");
+        json_stmt_block(s->while_stmt.block);
+        break;
+    case STMT_FOR:
+        json_key("init");
+        json_stmt(s->for_stmt.init);
+        json_key("cond");
+        json_expr(s->for_stmt.cond);
+        json_key("next");
+        json_stmt(s->for_stmt.next);
+        json_key("block");
+        json_stmt_block(s->for_stmt.block);
+        break;
+    case STMT_SWITCH:
+        json_key("expr");
+        json_expr(s->switch_stmt.expr);
+        json_key("cases");
+        print_char('[');
+        for (size_t i = 0; i < s->switch_stmt.num_cases; i++) {
+            SwitchCase *c = &s->switch_stmt.cases[i];
+            if (i) {
+                print_char(',');
+            }
+            print_str("{\"exprs\":");
+            json_exprs(c->exprs, c->num_exprs);
+            json_key("default");
+            print_str(c->is_default ? "true" : "false");
+            json_key("block");
+            json_stmt_block(c->block);
+            print_char('}');
+        }
+        print_char(']');
+        break;
+    case STMT_ASSIGN:
+        json_key("op");
+        json_op(s->assign.op);
+        json_key("left");
+        json_expr(s->assign.left);
+        json_key("right");
+        json_expr(s->assign.right);
+        break;
+    case STMT_INIT:
+        json_key("name");
+        json_str(s->init.name);
+        json_key("expr");
+        json_expr(s->init.expr);
+        break;
+    case STMT_EXPR:
+        json_key("expr");
+        json_expr(s->expr);
+        break;
+    default:
+        assert(0);
+        break;
+    }
+    print_char('}');
+}
+
+void json_decl(Decl *decl) {
+    Decl *d = decl;
+    json_kind(export_decl_kinds[d->kind]);
+    if (d->kind != DECL_ERROR) {
+        json_key("name");
+        json_str(d->name);
+    }
+    switch (d->kind) {
+    case DECL_ENUM:
+        json_key("items");
+        print_char('[');
+        for (size_t i = 0; i < d->enum_decl.num_items; i++) {
+            if (i) {
+                print_char(',');
+            }
+            print_str("{\"name\":");
+            json_str(d->enum_decl.items[i].name);
+            json_key("expr");
+            json_expr(d->enum_decl.items[i].expr);
+            print_char('}');
+        }
+        print_char(']');
+        break;
+    case DECL_STRUCT:
+    case DECL_UNION:
+        json_key("items");
+        print_char('[');
+        for (size_t i = 0; i < d->aggregate.num_items; i++) {
+            AggregateItem *item = &d->aggregate.items[i];
+            if (i) {
+                print_char(',');
+            }
+            print_str("{\"names\":[");
+            for (size_t j = 0; j < item->num_names; j++) {
+                if (j) {
+                    print_char(',');
+                }
+                json_str(item->names[j]);
+            }
+            print_char(']');
+            json_key("type");
+            json_typespec(item->types);
+            print_char('}');
+        }
+        print_char(']');
+        break;
+    case DECL_LET:
+        json_key("type");
+        json_typespec(d->let.type);
+        json_key("expr");
+        json_expr(d->let.expr);
+        break;
+    case DECL_CONST:
+        json_key("expr");
+        json_expr(d->const_decl.expr);
+        break;
+    case DECL_TYPEDEF:
+        json_key("type");
+        json_typespec(d->typedef_decl.type);
+        break;
+    case DECL_FN:
+        json_key("params");
+        print_char('[');
+        for (size_t i = 0; i < d->fn.num_params; i++) {
+            if (i) {
+                print_char(',');
+            }
+            print_str("{\"name\":");
+            json_str(d->fn.params[i].name);
+            json_key("type");
+            json_typespec(d->fn.params[i].type);
+            print_char('}');
+        }
+        print_char(']');
+        json_key("ret");
+        json_typespec(d->fn.ret_type);
+        json_key("block");
+        json_stmt_block(d->fn.block);
+        break;
+    case DECL_ERROR:
+        break;
+    default:
+        assert(0);
+        break;
+    }
+    print_char('}');
+}
+
+void ast_export_json(Decl **decls, size_t num_decls) {
+    print_str("{\"version\":");
+    print_uint(AST_EXPORT_VERSION);
+    print_str(",\"decls\":[");
+    for (size_t i = 0; i < num_decls; i++) {
+        print_str(i ? ",\n" : "\n");
+        json_decl(decls[i]);
+    }
+    print_str("\n]}\n");
+}
+
+/*
+ * Binary
+ */
+
+// Maps each name already written to its index + 1.
+Map export_strs;
+uint64_t export_num_strs;
+
+void bin_varint(uint64_t val) {
+    char *dest = print_reserve(10);
+    size_t len = 0;
+    while (val >= 0x80) {
+        dest[len++] = (char)(val | 0x80);
+        val >>= 7;
+    }
+    dest[len++] = (char)val;
+    buf__hdr(printer.buf)->len -= 10 - len;
+}
+
+// Names are written in full the first time (0, length, bytes) and as
+// their index + 1 after that.
+void bin_name(const char *name) {
+    uint64_t index = map_get_uint64(&export_strs, (uintptr_t)name);
+    if (index) {
+        bin_varint(index);
+        return;
+    }
+    map_put_uint64(&export_strs, (uintptr_t)name, ++export_num_strs);
+    size_t len = strlen(name);
+    bin_varint(0);
+    bin_varint(len);
+    print_chars(name, len);
+}
+
+void bin_str(const char *str) {
+    size_t len = strlen(str);
+    bin_varint(len);
+    print_chars(str, len);
+}
+
+void bin_expr(Expr *expr);
+void bin_stmt(Stmt *stmt);
+
+void bin_typespec(Typespec *type) {
+    if (!type) {
+        bin_varint(TYPESPEC_NONE);
+        return;
+    }
+    Typespec *t = type;
+    bin_varint(t->kind);
+    switch (t->kind) {
+    case TYPESPEC_IDENT:
+        bin_name(t->name);
+        break;
+    case TYPESPEC_FN:
+        bin_varint(t->fn.num_args);
+        for (size_t i = 0; i < t->fn.num_args; i++) {
+            bin_typespec(t->fn.args[i]);
+        }
+        bin_typespec(t->fn.ret);
+        break;
+    case TYPESPEC_ARRAY:
+        bin_typespec(t->array.elem);
+        bin_expr(t->array.size);
+        break;
+    case TYPESPEC_PTR:
+        bin_typespec(t->ptr.elem);
+        break;
+    case TYPESPEC_ERROR:
+        break;
+    default:
+        assert(0);
+        break;
+    }
+}
+
+void bin_exprs(Expr **exprs, size_t num_exprs) {
+    bin_varint(num_exprs);
+    for (size_t i = 0; i < num_exprs; i++) {
+        bin_expr(exprs[i]);
+    }
+}
+
+void bin_expr(Expr *expr) {
+    if (!expr) {
+        bin_varint(EXPR_NONE);
+        return;
+    }
+    Expr *e = expr;
+    bin_varint(e->kind);
+    switch (e->kind) {
+    case EXPR_INT:
+        bin_varint(e->int_val);
+        break;
+    case EXPR_FLOAT: {
+        uint64_t bits;
+        memcpy(&bits, &e->float_val, sizeof(bits));
+        char *dest = print_reserve(8);
+        for (int i = 0; i < 8; i++) {
+            dest[i] = (char)(bits >> (8 * i));
+        }
+        break;
+    }
+    case EXPR_STR:
+        bin_str(e->str_val);
+        break;
+    case EXPR_IDENT:
+        bin_name(e->name);
+        break;
+    case EXPR_CAST:
+        bin_typespec(e->cast.type);
+        bin_expr(e->cast.expr);
+        break;
+    case EXPR_CALL:
+        bin_expr(e->call.expr);
+        bin_exprs(e->call.args, e->call.num_args);
+        break;
+    case EXPR_INDEX:
+        bin_expr(e->index.expr);
+        bin_expr(e->index.index);
+        break;
+    case EXPR_FIELD:
+        bin_expr(e->field.expr);
+        bin_name(e->field.name);
+        break;
+    case EXPR_COMPOUND:
+        bin_typespec(e->compound.type);
+        bin_exprs(e->compound.args, e->compound.num_args);
+        break;
+    case EXPR_UNARY:
+        bin_varint(e->unary.op);
+        bin_expr(e->unary.expr);
+        break;
+    case EXPR_BINARY:
+        bin_varint(e->binary.op);
+        bin_expr(e->binary.left);
+        bin_expr(e->binary.right);
+        break;
+    case EXPR_TERNARY:
+        bin_expr(e->ternary.cond);
+        bin_expr(e->ternary.then_expr);
+        bin_expr(e->ternary.else_expr);
+        break;
+    case EXPR_ERROR:
+        break;
+    default:
+        assert(0);
+        break;
+    }
+}
+
+void bin_stmt_block(StmtBlock block) {
+    bin_varint(block.num_stmts);
+    for (size_t i = 0; i < block.num_stmts; i++) {
+        bin_stmt(block.stmts[i]);
+    }
+}
+
+void bin_stmt(Stmt *stmt) {
+    if (!stmt) {
+        bin_varint(STMT_NONE);
+        return;
+    }
+    Stmt *s = stmt;
+    bin_varint(s->kind);
+    switch (s->kind) {
+    case STMT_RETURN:
+        bin_expr(s->return_stmt.expr);
+        break;
+    case STMT_BREAK:
+    case STMT_CONTINUE:
+    case STMT_ERROR:
+        break;
+    case STMT_BLOCK:
+        bin_stmt_block(s->block);
+        break;
+    case STMT_IF:
+        bin_expr(s->if_stmt.cond);
+        bin_stmt_block(s->if_stmt.then_block);
+        bin_varint(s->if_stmt.num_elseifs);
+        for (size_t i = 0; i < s->if_stmt.num_elseifs; i++) {
+            bin_expr(s->if_stmt.elseifs[i].cond);
+            bin_stmt_block(s->if_stmt.elseifs[i].block);
+        }
+        bin_stmt_block(s->if_stmt.else_block);
+        break;
+    case STMT_WHILE:
+    case STMT_DO_WHILE:
+        bin_expr(s->while_stmt.cond);
+        bin_stmt_block(s->while_stmt.block);
+        break;
+    case STMT_FOR:
+        bin_stmt(s->for_stmt.init);
+        bin_expr(s->for_stmt.cond);
+        bin_stmt(s->for_stmt.next);
+        bin_stmt_block(s->for_stmt.block);
+        break;
+    case STMT_SWITCH:
+        bin_expr(s->switch_stmt.expr);
+        bin_varint(s->switch_stmt.num_cases);
+        for (size_t i = 0; i < s->switch_stmt.num_cases; i++) {
+            SwitchCase *c = &s->switch_stmt.cases[i];
+            bin_exprs(c->exprs, c->num_exprs);
+            bin_varint(c->is_default);
+            bin_stmt_block(c->block);
+        }
+        break;
+    case STMT_ASSIGN:
+        bin_varint(s->assign.op);
+        bin_expr(s->assign.left);
+        bin_expr(s->assign.right);
+        break;
+    case STMT_INIT:
+        bin_name(s->init.name);
+        bin_expr(s->init.expr);
+        break;
+    case STMT_EXPR:
+        bin_expr(s->expr);
+        break;
+    default:
+        assert(0);
+        break;
+    }
+}
+
+void bin_decl(Decl *decl) {
+    Decl *d = decl;
+    bin_varint(d->kind);
+    if (d->kind != DECL_ERROR) {
+        bin_name(d->name);
+    }
+    switch (d->kind) {
+    case DECL_ENUM:
+        bin_varint(d->enum_decl.num_items);
+        for (size_t i = 0; i < d->enum_decl.num_items; i++) {
+            bin_name(d->enum_decl.items[i].name);
+            bin_expr(d->enum_decl.items[i].expr);
+        }
+        break;
+    case DECL_STRUCT:
+    case DECL_UNION:
+        bin_varint(d->aggregate.num_items);
+        for (size_t i = 0; i < d->aggregate.num_items; i++) {
+            AggregateItem *item = &d->aggregate.items[i];
+            bin_varint(item->num_names);
+            for (size_t j = 0; j < item->num_names; j++) {
+                bin_name(item->names[j]);
+            }
+            bin_typespec(item->types);
+        }
+        break;
+    case DECL_LET:
+        bin_typespec(d->let.type);
+        bin_expr(d->let.expr);
+        break;
+    case DECL_CONST:
+        bin_expr(d->const_decl.expr);
+        break;
+    case DECL_TYPEDEF:
+        bin_typespec(d->typedef_decl.type);
+        break;
+    case DECL_FN:
+        bin_varint(d->fn.num_params);
+        for (size_t i = 0; i < d->fn.num_params; i++) {
+            bin_name(d->fn.params[i].name);
+            bin_typespec(d->fn.params[i].type);
+        }
+        bin_typespec(d->fn.ret_type);
+        bin_stmt_block(d->fn.block);
+        break;
+    case DECL_ERROR:
+        break;
+    default:
+        assert(0);
+        break;
+    }
+}
+
+void ast_export_binary(Decl **decls, size_t num_decls) {
+    print_chars(AST_EXPORT_MAGIC, sizeof(AST_EXPORT_MAGIC));
+    bin_varint(AST_EXPORT_VERSION);
+    bin_varint(num_decls);
+    for (size_t i = 0; i < num_decls; i++) {
+        bin_decl(decls[i]);
+    }
+    map_free(&export_strs);
+    export_num_strs = 0;
+}
+
+/*
+ * Binary import
+ */
+
+typedef struct AstImporter {
+    const char *ptr;
+    const char *end;
+    const char **strs;
+    bool failed;
+} AstImporter;
+
+AstImporter importer;
+
+// Reads past the end or bad data fail the import; reads then return 0 so
+// decoding can unwind normally.
+uint64_t import_varint(void) {
+    uint64_t val = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        if (importer.ptr == importer.end) {
+            break;
+        }
+        uint8_t byte = *importer.ptr++;
+        val |= (uint64_t)(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) {
+            return val;
+        }
+    }
+    importer.failed = true;
+    return 0;
+}
+
+// Counts that size arrays must fit in the remaining bytes, since every
+// element takes at least one.
+size_t import_count(void) {
+    uint64_t count = import_varint();
+    if (count > (uint64_t)(importer.end - importer.ptr)) {
+        importer.failed = true;
+        return 0;
+    }
+    return count;
+}
+
+const char *import_bytes(size_t len) {
+    if (len > (size_t)(importer.end - importer.ptr)) {
+        importer.failed = true;
+        return NULL;
+    }
+    const char *start = importer.ptr;
+    importer.ptr += len;
+    return start;
+}
+
+const char *import_name(void) {
+    uint64_t index = import_varint();
+    if (index) {
+        if (index > buf_len(importer.strs)) {
+            importer.failed = true;
+            return str_intern("");
+        }
+        return importer.strs[index - 1];
+    }
+    size_t len = import_count();
+    const char *start = import_bytes(len);
+    const char *name = start ? str_intern_range(start, start + len) : str_intern("");
+    buf_push(importer.strs, name);
+    return name;
+}
+
+const char *import_str(void) {
+    size_t len = import_count();
+    const char *start = import_bytes(len);
+    char *str = ast_alloc(len + 1);
+    if (start) {
+        memcpy(str, start, len);
+    }
+    str[start ? len : 0] = 0;
+    return str;
+}
+
+// Kinds outside [1, last] fail the import; 0 reads as NULL when allowed.
+uint64_t import_kind(uint64_t last, bool nullable) {
+    uint64_t kind = import_varint();
+    if ((kind == 0 && !nullable) || kind > last) {
+        importer.failed = true;
+        return 0;
+    }
+    return kind;
+}
+
+Expr *import_expr(bool nullable);
+Stmt *import_stmt(bool nullable);
+
+Typespec *import_typespec(bool nullable) {
+    switch (import_kind(TYPESPEC_ERROR, nullable)) {
+    case TYPESPEC_IDENT:
+        return typespec_ident(import_name());
+    case TYPESPEC_FN: {
+        size_t num_args = import_count();
+        Typespec **args = NULL;
+        for (size_t i = 0; i < num_args; i++) {
+            buf_push(args, import_typespec(false));
+        }
+        Typespec *ret = import_typespec(true);
+        Typespec *type = typespec_fn(args, num_args, ret);
+        buf_free(args);
+        return type;
+    }
+    case TYPESPEC_ARRAY: {
+        Typespec *elem = import_typespec(false);
+        return typespec_array(elem, import_expr(true));
+    }
+    case TYPESPEC_PTR:
+        return typespec_ptr(import_typespec(false));
+    case TYPESPEC_ERROR:
+        return typespec_error();
+    default:
+        return nullable && !importer.failed ? NULL : typespec_error();
+    }
+}
+
+Expr **import_exprs(size_t *num_exprs) {
+    *num_exprs = import_count();
+    Expr **exprs = NULL;
+    for (size_t i = 0; i < *num_exprs; i++) {
+        buf_push(exprs, import_expr(false));
+    }
+    return exprs;
+}
+
+Expr *import_expr(bool nullable) {
+    ExprKind kind = import_kind(EXPR_ERROR, nullable);
+    switch (kind) {
+    case EXPR_INT:
+        return expr_int(import_varint());
+    case EXPR_FLOAT: {
+        const char *bytes = import_bytes(8);
+        uint64_t bits = 0;
+        for (int i = 0; bytes && i < 8; i++) {
+            bits |= (uint64_t)(uint8_t)bytes[i] << (8 * i);
+        }
+        double val;
+        memcpy(&val, &bits, sizeof(val));
+        return expr_float(val);
+    }
+    case EXPR_STR:
+        return expr_str(import_str());
+    case EXPR_IDENT:
+        return expr_ident(import_name());
+    case EXPR_CAST: {
+        Typespec *type = import_typespec(false);
+        return expr_cast(type, import_expr(false));
+    }
+    case EXPR_CALL:
+    case EXPR_COMPOUND: {
+        bool is_call = kind == EXPR_CALL;
+        Expr *call_expr = is_call ? import_expr(false) : NULL;
+        Typespec *type = is_call ? NULL : import_typespec(true);
+        size_t num_args;
+        Expr **args = import_exprs(&num_args);
+        Expr *expr = is_call ? expr_call(call_expr, args, num_args) : expr_compound(type, args, num_args);
+        buf_free(args);
+        return expr;
+    }
+    case EXPR_INDEX: {
+        Expr *base = import_expr(false);
+        return expr_index(base, import_expr(false));
+    }
+    case EXPR_FIELD: {
+        Expr *base = import_expr(false);
+        return expr_field(base, import_name());
+    }
+    case EXPR_UNARY: {
+        TokenKind op = import_varint();
+        return expr_unary(op, import_expr(false));
+    }
+    case EXPR_BINARY: {
+        TokenKind op = import_varint();
+        Expr *left = import_expr(false);
+        return expr_binary(op, left, import_expr(false));
+    }
+    case EXPR_TERNARY: {
+        Expr *cond = import_expr(false);
+        Expr *then_expr = import_expr(false);
+        return expr_ternary(cond, then_expr, import_expr(false));
+    }
+    case EXPR_ERROR:
+        return expr_error();
+    default:
+        return nullable && !importer.failed ? NULL : expr_error();
+    }
+}
+
+StmtBlock import_stmt_block(void) {
+    size_t num_stmts = import_count();
+    Stmt **stmts = NULL;
+    for (size_t i = 0; i < num_stmts; i++) {
+        buf_push(stmts, import_stmt(false));
+    }
+    return (StmtBlock){stmts, num_stmts};
+}
+
+Stmt *import_stmt(bool nullable) {
+    StmtKind kind = import_kind(STMT_ERROR, nullable);
+    switch (kind) {
+    case STMT_RETURN:
+        return stmt_return(import_expr(false));
+    case STMT_BREAK:
+        return stmt_break();
+    case STMT_CONTINUE:
+        return stmt_continue();
+    case STMT_BLOCK: {
+        StmtBlock block = import_stmt_block();
+        Stmt *stmt = stmt_block(block);
+        free_stmt_block(block);
+        return stmt;
+    }
+    case STMT_IF: {
+        Expr *cond = import_expr(false);
+        StmtBlock then_block = import_stmt_block();
+        size_t num_elseifs = import_count();
+        ElseIf *elseifs = NULL;
+        for (size_t i = 0; i < num_elseifs; i++) {
+            Expr *elseif_cond = import_expr(false);
+            buf_push(elseifs, (ElseIf){elseif_cond, import_stmt_block()});
+        }
+        StmtBlock else_block = import_stmt_block();
+        Stmt *stmt = stmt_if(cond, then_block, elseifs, num_elseifs, else_block);
+        free_stmt_block(then_block);
+        for (ElseIf *it = elseifs; it != buf_end(elseifs); it++) {
+            free_stmt_block(it->block);
+        }
+        buf_free(elseifs);
+        free_stmt_block(else_block);
+        return stmt;
+    }
+    case STMT_WHILE:
+    case STMT_DO_WHILE: {
+        bool is_while = kind == STMT_WHILE;
+        Expr *cond = import_expr(false);
+        StmtBlock block = import_stmt_block();
+        Stmt *stmt = is_while ? stmt_while(cond, block) : stmt_do_while(cond, block);
+        free_stmt_block(block);
+        return stmt;
+    }
+    case STMT_FOR: {
+        Stmt *init = import_stmt(true);
+        Expr *cond = import_expr(true);
+        Stmt *next = import_stmt(true);
+        StmtBlock block = import_stmt_block();
+        Stmt *stmt = stmt_for(init, cond, next, block);
+        free_stmt_block(block);
+        return stmt;
+    }
+    case STMT_SWITCH: {
+        Expr *expr = import_expr(false);
+        size_t num_cases = import_count();
+        SwitchCase *cases = NULL;
+        for (size_t i = 0; i < num_cases; i++) {
+            size_t num_exprs;
+            Expr **exprs = import_exprs(&num_exprs);
+            bool is_default = import_varint() != 0;
+            buf_push(cases, (SwitchCase){exprs, num_exprs, is_default, import_stmt_block()});
+        }
+        Stmt *stmt = stmt_switch(expr, cases, num_cases);
+        for (SwitchCase *it = cases; it != buf_end(cases); it++) {
+            buf_free(it->exprs);
+            free_stmt_block(it->block);
+        }
+        buf_free(cases);
+        return stmt;
+    }
+    case STMT_ASSIGN: {
+        TokenKind op = import_varint();
+        Expr *left = import_expr(false);
+        return stmt_assign(op, left, import_expr(true));
+    }
+    case STMT_INIT: {
+        const char *name = import_name();
+        return stmt_init(name, import_expr(false));
+    }
+    case STMT_EXPR:
+        return stmt_expr(import_expr(false));
+    case STMT_ERROR:
+        return stmt_error();
+    default:
+        return nullable && !importer.failed ? NULL : stmt_error();
+    }
+}
+
+Decl *import_decl(void) {
+    DeclKind kind = import_kind(DECL_ERROR, false);
+    const char *name = kind != DECL_ERROR && kind != DECL_NONE ? import_name() : NULL;
+    switch (kind) {
+    case DECL_ENUM: {
+        size_t num_items = import_count();
+        EnumItem *items = NULL;
+        for (size_t i = 0; i < num_items; i++) {
+            const char *item_name = import_name();
+            buf_push(items, (EnumItem){item_name, import_expr(true)});
+        }
+        Decl *decl = decl_enum(name, items, num_items);
+        buf_free(items);
+        return decl;
+    }
+    case DECL_STRUCT:
+    case DECL_UNION: {
+        size_t num_items = import_count();
+        AggregateItem *items = NULL;
+        for (size_t i = 0; i < num_items; i++) {
+            size_t num_names = import_count();
+            const char **names = NULL;
+            for (size_t j = 0; j < num_names; j++) {
+                buf_push(names, import_name());
+            }
+            buf_push(items, (AggregateItem){names, num_names, import_typespec(false)});
+        }
+        Decl *decl = decl_aggregate(kind, name, items, num_items);
+        for (AggregateItem *it = items; it != buf_end(items); it++) {
+            buf_free(it->names);
+        }
+        buf_free(items);
+        return decl;
+    }
+    case DECL_LET: {
+        Typespec *type = import_typespec(true);
+        return decl_let(name, type, import_expr(true));
+    }
+    case DECL_CONST:
+        return decl_const(name, import_expr(false));
+    case DECL_TYPEDEF:
+        return decl_typedef(name, import_typespec(false));
+    case DECL_FN: {
+        size_t num_params = import_count();
+        FnParam *params = NULL;
+        for (size_t i = 0; i < num_params; i++) {
+            const char *param_name = import_name();
+            buf_push(params, (FnParam){param_name, import_typespec(false)});
+        }
+        Typespec *ret_type = import_typespec(true);
+        StmtBlock block = import_stmt_block();
+        Decl *decl = decl_fn(name, params, num_params, ret_type, block);
+        buf_free(params);
+        free_stmt_block(block);
+        return decl;
+    }
+    default:
+        return decl_error();
+    }
+}
+
+Decl **ast_import_binary(const char *data, size_t size) {
+    importer = (AstImporter){.ptr = data, .end = data + size};
+    if (size < sizeof(AST_EXPORT_MAGIC) || memcmp(data, AST_EXPORT_MAGIC, sizeof(AST_EXPORT_MAGIC)) != 0) {
+        return NULL;
+    }
+    importer.ptr += sizeof(AST_EXPORT_MAGIC);
+    if (import_varint() != AST_EXPORT_VERSION) {
+        return NULL;
+    }
+    size_t num_decls = import_count();
+    Decl **decls = NULL;
+    for (size_t i = 0; i < num_decls && !importer.failed; i++) {
+        buf_push(decls, import_decl());
+    }
+    if (importer.failed || importer.ptr != importer.end) {
+        buf_free(decls);
+    }
+    buf_free(importer.strs);
+    return decls;
+}
+
+void export_test(void) {
+    init_stream("fn f(a: int, s: S*): float { x := a[1].y; if (a) { return -1.5; } else if (b) {} for (;;) { x++; }"
+                " switch (a) { case 1: default { f(\"q\\t\"); } } return x ? (:int[2]){1} : 2; }"
+                " struct S { x, y: int; } enum E { A = 1 B } let v: fn(int): int[] typedef T = S");
+    Decl **decls = parse_file();
+    assert(num_syntax_errors == 0);
+
+    print_capture();
+    ast_export_json(decls, 1);
+    char *json = print_release();
+    assert(strstr(json, "{\"version\":1,\"decls\":[\n{\"kind\":\"fn\",\"name\":\"f\",\"params\":[{\"name\":\"a\",\"type\":{\"kind\":\"name\",\"name\":\"int\"}},"));
+    assert(strstr(json, "{\"kind\":\"unary\",\"op\":\"-\",\"expr\":{\"kind\":\"float\",\"value\":1.5}}"));
+    assert(strstr(json, "{\"kind\":\"str\",\"value\":\"q\\t\"}"));
+    assert(strstr(json, "\"init\":null,\"cond\":null,\"next\":null"));
+    buf_free(json);
+
+    print_capture();
+    for (Decl **it = decls; it != buf_end(decls); it++) {
+        print_decl(*it);
+        print_char('\n');
+    }
+    char *expected = print_release();
+    print_capture();
+    ast_export_binary(decls, buf_len(decls));
+    char *bin = print_release();
+    size_t bin_size = buf_len(bin) - 1;
+    assert(memcmp(bin, AST_EXPORT_MAGIC, sizeof(AST_EXPORT_MAGIC)) == 0);
+    Decl **imported = ast_import_binary(bin, bin_size);
+    assert(buf_len(imported) == buf_len(decls));
+    print_capture();
+    for (Decl **it = imported; it != buf_end(imported); it++) {
+        print_decl(*it);
+        print_char('\n');
+    }
+    char *actual = print_release();
+    assert(strcmp(expected, actual) == 0);
+
+    // Every truncation must be rejected rather than read out of bounds.
+    for (size_t size = 0; size < bin_size; size++) {
+        char *copy = xmalloc(size + 1);
+        memcpy(copy, bin, size);
+        assert(!ast_import_binary(copy, size));
+        free(copy);
+    }
+    bin[sizeof(AST_EXPORT_MAGIC) + 1] = 100;
+    assert(!ast_import_binary(bin, bin_size));
+
+    buf_free(imported);
+    buf_free(actual);
+    buf_free(expected);
+    buf_free(bin);
+    buf_free(decls);
+}
@@ -0,0 +1,797 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "ast.h"
+
+int fmt_indent;
+
+typedef enum FmtPrec {
+    FMT_PREC_TERNARY,
+    FMT_PREC_OR,
+    FMT_PREC_AND,
+    FMT_PREC_CMP,
+    FMT_PREC_ADD,
+    FMT_PREC_MUL,
+    FMT_PREC_UNARY,
+    FMT_PREC_BASE,
+} FmtPrec;
+
+// Mirrors the precedence climbing in parse.c.
+FmtPrec fmt_binary_prec(TokenKind op) {
+    if (op == TOKEN_OR) {
+        return FMT_PREC_OR;
+    } else if (op == TOKEN_AND) {
+        return FMT_PREC_AND;
+    } else if (op == '<' || op == '>' || op == TOKEN_EQ || op == TOKEN_NOTEQ || op == TOKEN_GTEQ || op == TOKEN_LTEQ) {
+        return FMT_PREC_CMP;
+    } else if (op == '+' || op == '-' || op == '|' || op == '^') {
+        return FMT_PREC_ADD;
+    } else {
+        return FMT_PREC_MUL;
+    }
+}
+
+FmtPrec fmt_expr_prec(Expr *e) {
+    switch (e->kind) {
+    case EXPR_TERNARY:
+        return FMT_PREC_TERNARY;
+    case EXPR_BINARY:
+        return fmt_binary_prec(e->binary.op);
+    case EXPR_UNARY:
+    case EXPR_CAST:
+        return FMT_PREC_UNARY;
+    default:
+        return FMT_PREC_BASE;
+    }
+}
+
+void fmt_newline(void) {
+    char *dest = print_reserve(1 + 4 * fmt_indent);
+    *dest = '\n';
+    memset(dest + 1, ' ', 4 * fmt_indent);
+}
+
+void fmt_op(TokenKind op) {
+    print_str(temp_token_kind_str(op));
+}
+
+void fmt_typespec(Typespec *type);
+
+// Element types of pointers and arrays need parentheses around fn types,
+// whose return type would otherwise swallow the suffix.
+void fmt_typespec_elem(Typespec *elem) {
+    if (elem->kind == TYPESPEC_FN) {
+        print_char('(');
+        fmt_typespec(elem);
+        print_char(')');
+    } else {
+        fmt_typespec(elem);
+    }
+}
+
+void fmt_expr(Expr *expr);
+
+void fmt_typespec(Typespec *type) {
+    Typespec *t = type;
+    switch (t->kind) {
+    case TYPESPEC_IDENT:
+        print_str(t->name);
+        break;
+    case TYPESPEC_FN:
+        print_str("fn(");
+        for (Typespec **it = t->fn.args; it != t->fn.args + t->fn.num_args; it++) {
+            if (it != t->fn.args) {
+                print_str(", ");
+            }
+            fmt_typespec(*it);
+        }
+        print_char(')');
+        if (t->fn.ret) {
+            print_str(": ");
+            fmt_typespec(t->fn.ret);
+        }
+        break;
+    case TYPESPEC_ARRAY:
+        fmt_typespec_elem(t->array.elem);
+        print_char('[');
+        if (t->array.size) {
+            fmt_expr(t->array.size);
+        }
+        print_char(']');
+        break;
+    case TYPESPEC_PTR:
+        fmt_typespec_elem(t->ptr.elem);
+        print_char('*');
+        break;
+    case TYPESPEC_ERROR:
+        print_str("<error>");
+        break;
+    default:
+        assert(0);
+        break;
+    }
+}
+
+const char *fmt_escapes[256] = {
+    ['\n'] = "\\n",
+    ['\r'] = "\\r",
+    ['\t'] = "\\t",
+    ['\v'] = "\\v",
+    ['\b'] = "\\b",
+    ['\a'] = "\\a",
+    ['"'] = "\\\"",
+    ['\\'] = "\\\\",
+};
+
+void fmt_str(const char *str) {
+    print_char('"');
+    for (const char *it = str; *it; it++) {
+        const char *escape = fmt_escapes[(unsigned char)*it];
+        if (escape) {
+            print_str(escape);
+        } else {
+            print_char(*it);
+        }
+    }
+    print_char('"');
+}
+
+// Prints val in base with prefix, most significant digit first.
+void fmt_uint_base(uint64_t val, unsigned base, const char *prefix) {
+    char digits[64];
+    size_t len = 0;
+    do {
+        digits[len++] = "0123456789ABCDEF"[val % base];
+        val /= base;
+    } while (val);
+    print_str(prefix);
+    while (len) {
+        print_char(digits[--len]);
+    }
+}
+
+// Prints an int literal the way it was written. Values that no char
+// literal can spell, which folding could leave behind, print in decimal.
+void fmt_int(Expr *e) {
+    uint64_t val = e->int_val;
+    switch (e->int_mod) {
+    case TOKENMOD_HEX:
+        fmt_uint_base(val, 16, "0x");
+        break;
+    case TOKENMOD_BIN:
+        fmt_uint_base(val, 2, "0b");
+        break;
+    case TOKENMOD_OCT:
+        fmt_uint_base(val, 8, "0");
+        break;
+    case TOKENMOD_CHAR:
+        if (val == 0) {
+            print_str("'\\0'");
+        } else if (val < 128 && fmt_escapes[val] && val != '"' && val != '\\') {
+            print_char('\'');
+            print_str(fmt_escapes[val]);
+            print_char('\'');
+        } else if (val >= ' ' && val < 127 && val != '\'' && val != '\\') {
+            print_char('\'');
+            print_char((char)val);
+            print_char('\'');
+        } else {
+            print_uint(val);
+        }
+        break;
+    default:
+        print_uint(val);
+        break;
+    }
+}
+
+void fmt_expr_args(Expr **args, size_t num_args) {
+    for (Expr **it = args; it != args + num_args; it++) {
+        if (it != args) {
+            print_str(", ");
+        }
+        fmt_expr(*it);
+    }
+}
+
+// Prints e, parenthesized if it binds looser than prec.
+void fmt_expr_prec_min(Expr *e, FmtPrec prec) {
+    if (fmt_expr_prec(e) < prec) {
+        print_char('(');
+        fmt_expr(e);
+        print_char(')');
+    } else {
+        fmt_expr(e);
+    }
+}
+
+void fmt_expr(Expr *expr) {
+    Expr *e = expr;
+    switch (e->kind) {
+    case EXPR_INT:
+        fmt_int(e);
+        break;
+    case EXPR_FLOAT:
+        print_double(e->float_val);
+        break;
+    case EXPR_STR:
+        fmt_str(e->str_val);
+        break;
+    case EXPR_IDENT:
+        print_str(e->name);
+        break;
+    case EXPR_CAST:
+        // The parser has no cast syntax yet.
+        print_str("cast(");
+        fmt_typespec(e->cast.type);
+        print_str(", ");
+        fmt_expr(e->cast.expr);
+        print_char(')');
+        break;
+    case EXPR_CALL:
+        fmt_expr_prec_min(e->call.expr, FMT_PREC_BASE);
+        print_char('(');
+        fmt_expr_args(e->call.args, e->call.num_args);
+        print_char(')');
+        break;
+    case EXPR_INDEX:
+        fmt_expr_prec_min(e->index.expr, FMT_PREC_BASE);
+        print_char('[');
+        fmt_expr(e->index.index);
+        print_char(']');
+        break;
+    case EXPR_FIELD:
+        fmt_expr_prec_min(e->field.expr, FMT_PREC_BASE);
+        print_char('.');
+        print_str(e->field.name);
+        break;
+    case EXPR_COMPOUND:
+        if (e->compound.type && e->compound.type->kind == TYPESPEC_IDENT) {
+            print_str(e->compound.type->name);
+        } else if (e->compound.type) {
+            print_str("(:");
+            fmt_typespec(e->compound.type);
+            print_char(')');
+        }
+        print_char('{');
+        fmt_expr_args(e->compound.args, e->compound.num_args);
+        print_char('}');
+        break;
+    case EXPR_UNARY:
+        fmt_op(e->unary.op);
+        // Keep "- -x" from lexing as "--x" and "& &x" as "&&x".
+        if (e->unary.expr->kind == EXPR_UNARY && e->unary.expr->unary.op == e->unary.op && e->unary.op != '*') {
+            print_char('(');
+            fmt_expr(e->unary.expr);
+            print_char(')');
+        } else {
+            fmt_expr_prec_min(e->unary.expr, FMT_PREC_UNARY);
+        }
+        break;
+    case EXPR_BINARY: {
+        FmtPrec prec = fmt_binary_prec(e->binary.op);
+        fmt_expr_prec_min(e->binary.left, prec);
+        print_char(' ');
+        fmt_op(e->binary.op);
+        print_char(' ');
+        fmt_expr_prec_min(e->binary.right, prec + 1);
+        break;
+    }
+    case EXPR_TERNARY:
+        fmt_expr_prec_min(e->ternary.cond, FMT_PREC_OR);
+        print_str(" ? ");
+        fmt_expr(e->ternary.then_expr);
+        print_str(" : ");
+        fmt_expr(e->ternary.else_expr);
+        break;
+    case EXPR_ERROR:
+        print_str("<error>");
+        break;
+    default:
+        assert(0);
+        break;
+    }
+}
+
+void fmt_stmt(Stmt *stmt);
+
+void fmt_stmt_block(StmtBlock block) {
+    if (block.num_stmts == 0) {
+        print_str("{}");
+        return;
+    }
+    print_char('{');
+    fmt_indent++;
+    for (Stmt **it = block.stmts; it != block.stmts + block.num_stmts; it++) {
+        fmt_newline();
+        fmt_stmt(*it);
+    }
+    fmt_indent--;
+    fmt_newline();
+    print_char('}');
+}
+
+void fmt_paren_expr(Expr *expr) {
+    print_str(" (");
+    fmt_expr(expr);
+    print_str(") ");
+}
+
+// Statements allowed in for headers, without their ';'.
+void fmt_simple_stmt(Stmt *stmt) {
+    Stmt *s = stmt;
+    switch (s->kind) {
+    case STMT_ASSIGN:
+        fmt_expr(s->assign.left);
+        if (s->assign.right) {
+            print_char(' ');
+            fmt_op(s->assign.op);
+            print_char(' ');
+            fmt_expr(s->assign.right);
+        } else {
+            fmt_op(s->assign.op);
+        }
+        break;
+    case STMT_INIT:
+        print_str(s->init.name);
+        print_str(" := ");
+        fmt_expr(s->init.expr);
+        break;
+    case STMT_EXPR:
+        fmt_expr(s->expr);
+        break;
+    default:
+        print_str("<error>");
+        break;
+    }
+}
+
+void fmt_stmt(Stmt *stmt) {
+    Stmt *s = stmt;
+    switch (s->kind) {
+    case STMT_RETURN:
+        print_str("return ");
+        fmt_expr(s->return_stmt.expr);
+        print_char(';');
+        break;
+    case STMT_BREAK:
+        print_str("break;");
+        break;
+    case STMT_CONTINUE:
+        print_str("continue;");
+        break;
+    case STMT_BLOCK:
+        fmt_stmt_block(s->block);
+        break;
+    case STMT_IF:
+        print_str("if");
+        fmt_paren_expr(s->if_stmt.cond);
+        fmt_stmt_block(s->if_stmt.then_block);
+        for (ElseIf *it = s->if_stmt.elseifs; it != s->if_stmt.elseifs + s->if_stmt.num_elseifs; it++) {
+            print_str(" else if");
+            fmt_paren_expr(it->cond);
+            fmt_stmt_block(it->block);
+        }
+        if (s->if_stmt.else_block.num_stmts != 0) {
+            print_str(" else ");
+            fmt_stmt_block(s->if_stmt.else_block);
+        }
+        break;
+    case STMT_WHILE:
+        print_str("while");
+        fmt_paren_expr(s->while_stmt.cond);
+        fmt_stmt_block(s->while_stmt.block);
+        break;
+    case STMT_DO_WHILE:
+        print_str("do ");
+        fmt_stmt_block(s->while_stmt.block);
+        print_str(" while (");
+        fmt_expr(s->while_stmt.cond);
+        print_str(");");
+        break;
+    case STMT_FOR:
+        print_str("for (");
+        if (s->for_stmt.init) {
+            fmt_simple_stmt(s->for_stmt.init);
+        }
+        print_char(';');
+        if (s->for_stmt.cond) {
+            print_char(' ');
+            fmt_expr(s->for_stmt.cond);
+        }
+        print_char(';');
+        if (s->for_stmt.next) {
+            print_char(' ');
+            fmt_simple_stmt(s->for_stmt.next);
+        }
+        print_str(") ");
+        fmt_stmt_block(s->for_stmt.block);
+        break;
+    case STMT_SWITCH:
+        print_str("switch");
+        fmt_paren_expr(s->switch_stmt.expr);
+        print_char('{');
+        fmt_indent++;
+        for (SwitchCase *it = s->switch_stmt.cases; it != s->switch_stmt.cases + s->switch_stmt.num_cases; it++) {
+            fmt_newline();
+            for (Expr **expr = it->exprs; expr != it->exprs + it->num_exprs; expr++) {
+                print_str("case ");
+                fmt_expr(*expr);
+                print_str(": ");
+            }
+            if (it->is_default) {
+                print_str("default ");
+            }
+            fmt_stmt_block(it->block);
+        }
+        fmt_indent--;
+        fmt_newline();
+        print_char('}');
+        break;
+    case STMT_ASSIGN:
+    case STMT_INIT:
+    case STMT_EXPR:
+        fmt_simple_stmt(s);
+        print_char(';');
+        break;
+    case STMT_ERROR:
+        print_str("<error>;");
+        break;
+    default:
+        assert(0);
+        break;
+    }
+}
+
+void fmt_decl(Decl *decl) {
+    Decl *d = decl;
+    switch (d->kind) {
+    case DECL_ENUM:
+        print_str("enum ");
+        print_str(d->name);
+        print_str(" {");
+        fmt_indent++;
+        for (EnumItem *it = d->enum_decl.items; it != d->enum_decl.items + d->enum_decl.num_items; it++) {
+            fmt_newline();
+            print_str(it->name);
+            if (it->expr) {
+                print_str(" = ");
+                fmt_expr(it->expr);
+            }
+        }
+        fmt_indent--;
+        if (d->enum_decl.num_items) {
+            fmt_newline();
+        }
+        print_char('}');
+        break;
+    case DECL_STRUCT:
+    case DECL_UNION:
+        print_str(d->kind == DECL_STRUCT ? "struct " : "union ");
+        print_str(d->name);
+        print_str(" {");
+        fmt_indent++;
+        for (AggregateItem *it = d->aggregate.items; it != d->aggregate.items + d->aggregate.num_items; it++) {
+            fmt_newline();
+            for (const char **name = it->names; name != it->names + it->num_names; name++) {
+                if (name != it->names) {
+                    print_str(", ");
+                }
+                print_str(*name);
+            }
+            print_str(": ");
+            fmt_typespec(it->types);
+            print_char(';');
+        }
+        fmt_indent--;
+        if (d->aggregate.num_items) {
+            fmt_newline();
+        }
+        print_char('}');
+        break;
+    case DECL_LET:
+        print_str("let ");
+        print_str(d->name);
+        if (d->let.type) {
+            print_str(": ");
+            fmt_typespec(d->let.type);
+        }
+        if (d->let.expr) {
+            print_str(" = ");
+            fmt_expr(d->let.expr);
+        }
+        break;
+    case DECL_CONST:
+        print_str("const ");
+        print_str(d->name);
+        print_str(" = ");
+        fmt_expr(d->const_decl.expr);
+        break;
+    case DECL_TYPEDEF:
+        print_str("typedef ");
+        print_str(d->name);
+        print_str(" = ");
+        fmt_typespec(d->typedef_decl.type);
+        break;
+    case DECL_FN:
+        print_str("fn ");
+        print_str(d->name);
+        print_char('(');
+        for (FnParam *it = d->fn.params; it != d->fn.params + d->fn.num_params; it++) {
+            if (it != d->fn.params) {
+                print_str(", ");
+            }
+            print_str(it->name);
+            print_str(": ");
+            fmt_typespec(it->type);
+        }
+        print_char(')');
+        if (d->fn.ret_type) {
+            print_str(": ");
+            fmt_typespec(d->fn.ret_type);
+        }
+        print_char(' ');
+        fmt_stmt_block(d->fn.block);
+        break;
+    case DECL_ERROR:
+        print_str("<error>");
+        break;
+    default:
+        assert(0);
+        break;
+    }
+}
+
+bool fmt_is_block_decl(DeclKind kind) {
+    return kind == DECL_ENUM || kind == DECL_STRUCT || kind == DECL_UNION || kind == DECL_FN;
+}
+
+// Formats the source in init_stream one declaration at a time, so the
+// AST arena never holds more than about FMT_MAX_ARENA_BLOCKS at once and
+// the printer flushes as it goes. Output stops at the first syntax error,
+// but parsing continues so every error gets reported.
+bool fmt_stream(void) {
+    DeclKind prev_kind = DECL_NONE;
+    while (!is_token(TOKEN_EOF)) {
+        const char *start = token.lo;
+        Decl *decl = parse_decl();
+        if (panic_mode) {
+            synchronize(start, false);
+        }
+        if (num_syntax_errors == 0) {
+            if (prev_kind != DECL_NONE) {
+                print_char('\n');
+                if (fmt_is_block_decl(prev_kind) || fmt_is_block_decl(decl->kind)) {
+                    print_char('\n');
+                }
+            }
+            fmt_decl(decl);
+            prev_kind = decl->kind;
+        }
+        if (buf_len(ast_arena.blocks) > FMT_MAX_ARENA_BLOCKS) {
+            typespec_table_free();
+            arena_free(&ast_arena);
+        }
+    }
+    if (prev_kind != DECL_NONE) {
+        print_char('\n');
+    }
+    return num_syntax_errors == 0;
+}
+
+// Formats path to stdout, or in place when write is set. Files that are
+// already formatted are left untouched so their mtime doesn't change.
+int fmt_path(const char *path, bool write) {
+    char *src = read_file(path);
+    if (!src) {
+        printf("error: cannot read '%s'\n", path);
+        return 1;
+    }
+    char *tmp_path = NULL;
+    FILE *out = NULL;
+    if (write) {
+        // The rename replaces the file, so the new one takes its mode.
+        struct stat st;
+        buf_printf(tmp_path, "%s.fmt-%d", path, (int)getpid());
+        out = fopen(tmp_path, "wb");
+        if (out && (stat(path, &st) != 0 || fchmod(fileno(out), st.st_mode & 07777) != 0)) {
+            fclose(out);
+            unlink(tmp_path);
+            out = NULL;
+        }
+        if (!out) {
+            printf("error: cannot write '%s'\n", tmp_path);
+            buf_free(tmp_path);
+            free(src);
+            return 1;
+        }
+        printer.file = out;
+    }
+    init_keywords();
+    init_stream_name(path, src);
+    bool ok = fmt_stream();
+    print_flush();
+    int result = ok ? 0 : 1;
+    if (write) {
+        printer.file = NULL;
+        bool written = fclose(out) == 0;
+        char *formatted = ok && written ? read_file(tmp_path) : NULL;
+        if (formatted && strcmp(formatted, src) != 0) {
+            if (rename(tmp_path, path) != 0) {
+                printf("error: cannot replace '%s'\n", path);
+                result = 1;
+            }
+        } else if (ok && !formatted) {
+            printf("error: cannot write '%s'\n", tmp_path);
+            result = 1;
+        }
+        unlink(tmp_path);
+        free(formatted);
+        buf_free(tmp_path);
+    }
+    flush_syntax_errors();
+    free(src);
+    return result;
+}
+
+// Formats every path, handing files to up to num_jobs forked workers at a
+// time when writing in place. Workers never share an address space, so the
+// global lexer and parser state needs no locking.
+int fmt_paths(const char **paths, size_t num_paths, bool write, int num_jobs) {
+    int result = 0;
+    if (!write || num_jobs <= 1) {
+        for (size_t i = 0; i < num_paths; i++) {
+            result |= fmt_path(paths[i], write);
+        }
+        return result;
+    }
+    int running = 0;
+    for (size_t i = 0; i < num_paths || running > 0;) {
+        if (i < num_paths && running < num_jobs) {
+            fflush(stdout);
+            pid_t pid = fork();
+            if (pid == 0) {
+                int status = fmt_path(paths[i], write);
+                fflush(stdout);
+                _exit(status);
+            }
+            if (pid < 0) {
+                result |= fmt_path(paths[i], write);
+            } else {
+                running++;
+            }
+            i++;
+            continue;
+        }
+        int status;
+        if (wait(&status) < 0) {
+            break;
+        }
+        running--;
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            result = 1;
+        }
+    }
+    return result;
+}
+
+// Formats src into memory. Returns NULL on syntax errors.
+char *fmt_test_capture(const char *src) {
+    init_stream(src);
+    print_capture();
+    bool ok = fmt_stream();
+    char *output = print_release();
+    if (!ok) {
+        reset_syntax_errors();
+        buf_free(output);
+    }
+    return output;
+}
+
+char *fmt_test_sexpr(const char *src) {
+    init_stream(src);
+    Decl **decls = parse_file();
+    assert(num_syntax_errors == 0);
+    print_capture();
+    for (Decl **it = decls; it != buf_end(decls); it++) {
+        print_decl(*it);
+        print_char('\n');
+    }
+    buf_free(decls);
+    return print_release();
+}
+
+// Formatting must preserve the AST and be idempotent.
+void fmt_test_roundtrip(const char *src) {
+    char *formatted = fmt_test_capture(src);
+    assert(formatted);
+    char *reformatted = fmt_test_capture(formatted);
+    assert(reformatted && strcmp(formatted, reformatted) == 0);
+    char *expected = fmt_test_sexpr(src);
+    char *actual = fmt_test_sexpr(formatted);
+    assert(strcmp(expected, actual) == 0);
+    buf_free(formatted);
+    buf_free(reformatted);
+    buf_free(expected);
+    buf_free(actual);
+}
+
+void fmt_test(void) {
+    Arena old_arena = ast_arena;
+    TypespecTable old_table = typespec_table;
+    ast_arena = (Arena){0};
+    typespec_table = (TypespecTable){0};
+
+    char *output = fmt_test_capture("const   c=1 let x :int[ 4 ]={1,2} fn f( a:int ,b :(fn(int):int)* ):int{if(a){return b(a)*-(-a);}else{x[0]+=1;}"
+                                    "for(;;){break;} switch(a){case 1:case 2:{} default{a++;}} return 0;} struct S{x,y:float;}");
+    assert(output);
+    assert(strcmp(output, "const c = 1\n"
+                          "let x: int[4] = {1, 2}\n"
+                          "\n"
+                          "fn f(a: int, b: (fn(int): int)*): int {\n"
+                          "    if (a) {\n"
+                          "        return b(a) * -(-a);\n"
+                          "    } else {\n"
+                          "        x[0] += 1;\n"
+                          "    }\n"
+                          "    for (;;) {\n"
+                          "        break;\n"
+                          "    }\n"
+                          "    switch (a) {\n"
+                          "        case 1: case 2: {}\n"
+                          "        default {\n"
+                          "            a++;\n"
+                          "        }\n"
+                          "    }\n"
+                          "    return 0;\n"
+                          "}\n"
+                          "\n"
+                          "struct S {\n"
+                          "    x, y: float;\n"
+                          "}\n") == 0);
+    buf_free(output);
+    assert(!fmt_test_capture("fn f( {"));
+
+    // Int literals keep the base or char form they were written in.
+    const char *literals = "let m = {0xFF, 0b101, 017, 00, 0, 'a', '\\n', '\\0', ' ', '\"', 10}\n";
+    output = fmt_test_capture(literals);
+    assert(output && strcmp(output, literals) == 0);
+    buf_free(output);
+    fmt_test_roundtrip(literals);
+    output = fmt_test_capture("let a: int[0x10] let b: int[16]");
+    assert(output && strcmp(output, "let a: int[0x10]\nlet b: int[16]\n") == 0);
+    buf_free(output);
+
+    fmt_test_roundtrip("let a = (1 - (2 - 3)) * (4 + 5) / (6 % 7) - -8 ? (x ? y : z) : w ? v : u");
+    fmt_test_roundtrip("let b = (a || b) && (c || d) == (e < f) | g & h ^ i << 2 >> 1 >= - + * & x");
+    fmt_test_roundtrip("let c = &(&x) + *(*p) let d = (1 ? 2 : 3).f[0](4)");
+    fmt_test_roundtrip("let e = {0.1, 1e300, 2.5e-8, 100000000000000000000.0, 18446744073709551615, \"a\\tb\\n\"}");
+    fmt_test_roundtrip("let f = (:int[3]){1, 2} let g = V{} let h: fn(int[], fn()) typedef T = (fn(): int)[2]*");
+    fmt_test_roundtrip("enum E {} enum F { A B = 2 } union U {} fn g() { do { x *= 2; } while (x < 10); { y := 1; } }");
+    fmt_test_roundtrip("fn h(): int { if (a) { } else if (b) { c--; } else if (c) { } while (1) { continue; } return 1; }");
+    char *src = bench_source(50);
+    fmt_test_roundtrip(src);
+    buf_free(src);
+
+    // Rewriting a file in place keeps its mode.
+    char path[] = "/tmp/rionc-fmt-XXXXXX";
+    int fd = mkstemp(path);
+    assert(fd >= 0 && fchmod(fd, 0640) == 0);
+    assert(write(fd, "const c=1", 9) == 9);
+    close(fd);
+    assert(fmt_path(path, true) == 0);
+    struct stat st;
+    assert(stat(path, &st) == 0 && (st.st_mode & 07777) == 0640);
+    char *formatted = read_file(path);
+    assert(formatted && strcmp(formatted, "const c = 1\n") == 0);
+    free(formatted);
+    unlink(path);
+
+    typespec_table_free();
+    arena_free(&ast_arena);
+    ast_arena = old_arena;
+    typespec_table = old_table;
+}
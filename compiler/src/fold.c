@@ -0,0 +1,439 @@
+#include "ast.h"
+
+FoldStats fold_stats;
+
+/*
+ * Constants are literals, optionally under a unary sign, so negative
+ * results (which have no literal of their own) can fold again later.
+ */
+
+bool fold_const(Expr *expr, ConstVal *val) {
+    TokenKind sign = 0;
+    if (expr->kind == EXPR_UNARY && (expr->unary.op == '-' || expr->unary.op == '+')) {
+        sign = expr->unary.op;
+        expr = expr->unary.expr;
+    }
+    if (expr->kind == EXPR_INT && expr->int_val <= INT64_MAX) {
+        *val = (ConstVal){type_int, .i = (int64_t)expr->int_val};
+    } else if (expr->kind == EXPR_FLOAT) {
+        *val = (ConstVal){type_float, .f = expr->float_val};
+    } else {
+        return false;
+    }
+    return !sign || const_unary_op(sign, val);
+}
+
+// The literal node inside a constant, which can be reused for the result.
+Expr *fold_const_literal(Expr *expr) {
+    return expr->kind == EXPR_UNARY ? expr->unary.expr : expr;
+}
+
+// Overwrites expr with val. A negative value becomes a unary minus over
+// spare, a literal the fold is dropping anyway, so nothing is allocated.
+bool fold_literal(Expr *expr, ConstVal val, Expr *spare) {
+    bool negative;
+    uint64_t bits = 0;
+    if (val.type == type_float) {
+        if (!isfinite(val.f)) {
+            return false;
+        }
+        negative = signbit(val.f);
+    } else if (val.type == type_uint) {
+        return false;
+    } else {
+        if (val.i == INT64_MIN) {
+            return false;
+        }
+        negative = val.i < 0;
+        bits = negative ? (uint64_t)-val.i : (uint64_t)val.i;
+    }
+    Type *type = expr->type;
+    Expr *literal = expr;
+    if (negative) {
+        assert(spare && spare != expr);
+        literal = spare;
+        assert(expr_size(EXPR_UNARY) <= expr_size(expr->kind));
+        expr->kind = EXPR_UNARY;
+        expr->unary.op = '-';
+        expr->unary.expr = spare;
+    }
+    if (val.type == type_float) {
+        assert(expr_size(EXPR_FLOAT) <= expr_size(literal->kind));
+        literal->kind = EXPR_FLOAT;
+        literal->float_val = negative ? -val.f : val.f;
+    } else {
+        assert(expr_size(EXPR_INT) <= expr_size(literal->kind));
+        literal->kind = EXPR_INT;
+        literal->int_val = bits;
+        literal->int_mod = TOKENMOD_NONE;
+    }
+    literal->type = type;
+    return true;
+}
+
+bool fold_pure(Expr *expr) {
+    switch (expr->kind) {
+    case EXPR_CALL:
+        return false;
+    case EXPR_CAST:
+        return fold_pure(expr->cast.expr);
+    case EXPR_INDEX:
+        return fold_pure(expr->index.expr) && fold_pure(expr->index.index);
+    case EXPR_FIELD:
+        return fold_pure(expr->field.expr);
+    case EXPR_COMPOUND:
+        for (size_t i = 0; i < expr->compound.num_args; i++) {
+            if (!fold_pure(expr->compound.args[i])) {
+                return false;
+            }
+        }
+        return true;
+    case EXPR_UNARY:
+        return fold_pure(expr->unary.expr);
+    case EXPR_BINARY:
+        return fold_pure(expr->binary.left) && fold_pure(expr->binary.right);
+    case EXPR_TERNARY:
+        return fold_pure(expr->ternary.cond) && fold_pure(expr->ternary.then_expr) && fold_pure(expr->ternary.else_expr);
+    default:
+        return true;
+    }
+}
+
+int fold_log2(int64_t value) {
+    if (value <= 0 || (value & (value - 1))) {
+        return -1;
+    }
+    int log = 0;
+    while (value >>= 1) {
+        log++;
+    }
+    return log;
+}
+
+Expr *fold_unary(Expr *expr) {
+    TokenKind op = expr->unary.op;
+    Expr *operand = expr->unary.expr;
+    if (op != '-' && op != '+') {
+        return expr;
+    }
+    ConstVal val;
+    if (fold_const(operand, &val)) {
+        if (op == '-' && (operand->kind == EXPR_INT || operand->kind == EXPR_FLOAT)) {
+            return expr; // Already how negative constants are written
+        }
+        const_quiet = true;
+        bool ok = const_unary_op(op, &val);
+        const_quiet = false;
+        if (ok && fold_literal(expr, val, fold_const_literal(operand))) {
+            fold_stats.folded++;
+        }
+        return expr;
+    }
+    // -(-x) and +x, once types say nothing is promoted away.
+    if (expr->type && operand->type == expr->type && is_integer_type(expr->type)) {
+        if (op == '+') {
+            fold_stats.simplified++;
+            return operand;
+        }
+        if (operand->kind == EXPR_UNARY && operand->unary.op == '-' && operand->unary.expr->type == expr->type) {
+            fold_stats.simplified++;
+            return operand->unary.expr;
+        }
+    }
+    return expr;
+}
+
+// Identities and strength reduction for x op k, where k is the constant
+// operand. These need types: an identity may only drop an operation that
+// leaves the type alone, and shifts only stand in for integer arithmetic.
+Expr *fold_binary_identity(Expr *expr, Expr *x, Expr *k_expr, ConstVal k, bool k_right) {
+    if (!expr->type || !x->type || !is_arithmetic_type(x->type)) {
+        return expr;
+    }
+    bool same = x->type == expr->type;
+    bool integer = same && is_integer_type(x->type) && k.type == type_int;
+    bool one = k.type == type_float ? k.f == 1 : k.i == 1;
+    int log = integer ? fold_log2(k.i) : -1;
+    switch ((int)expr->binary.op) {
+    case '+':
+    case '|':
+    case '^':
+        if (integer && k.i == 0) {
+            fold_stats.simplified++;
+            return x;
+        }
+        break;
+    case '-':
+    case TOKEN_LSHIFT:
+    case TOKEN_RSHIFT:
+        if (integer && k_right && k.i == 0) {
+            fold_stats.simplified++;
+            return x;
+        }
+        break;
+    case '*':
+        if (same && one) {
+            fold_stats.simplified++;
+            return x;
+        }
+        if (integer && k.i == 0 && fold_pure(x)) {
+            fold_literal(expr, k, NULL);
+            fold_stats.simplified++;
+            return expr;
+        }
+        if (log > 0) {
+            expr->binary.op = TOKEN_LSHIFT;
+            expr->binary.left = x;
+            expr->binary.right = k_expr;
+            fold_literal(k_expr, (ConstVal){.type = type_int, .i = log}, NULL);
+            fold_stats.reduced++;
+        }
+        break;
+    case '&':
+        if (integer && k.i == 0 && fold_pure(x)) {
+            fold_literal(expr, k, NULL);
+            fold_stats.simplified++;
+            return expr;
+        }
+        break;
+    case '/':
+        if (k_right && same && one) {
+            fold_stats.simplified++;
+            return x;
+        }
+        // Signed division rounds toward zero and a shift does not, so only
+        // uints divide by shifting.
+        if (k_right && log > 0 && x->type == type_uint) {
+            expr->binary.op = TOKEN_RSHIFT;
+            fold_literal(k_expr, (ConstVal){.type = type_int, .i = log}, NULL);
+            fold_stats.reduced++;
+        }
+        break;
+    case '%':
+        if (k_right && log > 0 && x->type == type_uint) {
+            expr->binary.op = '&';
+            fold_literal(k_expr, (ConstVal){.type = type_int, .i = k.i - 1}, NULL);
+            fold_stats.reduced++;
+        }
+        break;
+    default:
+        break;
+    }
+    return expr;
+}
+
+Expr *fold_binary(Expr *expr) {
+    Expr *left = expr->binary.left;
+    Expr *right = expr->binary.right;
+    ConstVal left_val, right_val, val;
+    bool left_const = fold_const(left, &left_val);
+    bool right_const = fold_const(right, &right_val);
+    if (left_const && right_const) {
+        const_quiet = true;
+        bool ok = const_binary_op(expr->binary.op, left_val, right_val, &val);
+        const_quiet = false;
+        if (ok && fold_literal(expr, val, fold_const_literal(left))) {
+            fold_stats.folded++;
+        }
+        return expr;
+    }
+    if (right_const && right->kind != EXPR_UNARY) {
+        return fold_binary_identity(expr, left, right, right_val, true);
+    }
+    if (left_const && left->kind != EXPR_UNARY) {
+        return fold_binary_identity(expr, right, left, left_val, false);
+    }
+    return expr;
+}
+
+Expr *fold_ternary(Expr *expr) {
+    ConstVal cond;
+    if (!fold_const(expr->ternary.cond, &cond)) {
+        return expr;
+    }
+    Expr *branch = const_truth(cond) ? expr->ternary.then_expr : expr->ternary.else_expr;
+    if (expr->type && branch->type != expr->type) {
+        return expr;
+    }
+    fold_stats.simplified++;
+    return branch;
+}
+
+Expr *fold_expr(Expr *expr) {
+    if (!expr) {
+        return NULL;
+    }
+    switch (expr->kind) {
+    case EXPR_CAST:
+        expr->cast.expr = fold_expr(expr->cast.expr);
+        break;
+    case EXPR_CALL:
+        expr->call.expr = fold_expr(expr->call.expr);
+        for (size_t i = 0; i < expr->call.num_args; i++) {
+            expr->call.args[i] = fold_expr(expr->call.args[i]);
+        }
+        break;
+    case EXPR_INDEX:
+        expr->index.expr = fold_expr(expr->index.expr);
+        expr->index.index = fold_expr(expr->index.index);
+        break;
+    case EXPR_FIELD:
+        expr->field.expr = fold_expr(expr->field.expr);
+        break;
+    case EXPR_COMPOUND:
+        for (size_t i = 0; i < expr->compound.num_args; i++) {
+            expr->compound.args[i] = fold_expr(expr->compound.args[i]);
+        }
+        break;
+    case EXPR_UNARY:
+        expr->unary.expr = fold_expr(expr->unary.expr);
+        return fold_unary(expr);
+    case EXPR_BINARY:
+        expr->binary.left = fold_expr(expr->binary.left);
+        expr->binary.right = fold_expr(expr->binary.right);
+        return fold_binary(expr);
+    case EXPR_TERNARY:
+        expr->ternary.cond = fold_expr(expr->ternary.cond);
+        expr->ternary.then_expr = fold_expr(expr->ternary.then_expr);
+        expr->ternary.else_expr = fold_expr(expr->ternary.else_expr);
+        return fold_ternary(expr);
+    default:
+        break;
+    }
+    return expr;
+}
+
+void fold_stmt(Stmt *stmt);
+
+void fold_stmt_block(StmtBlock block) {
+    for (size_t i = 0; i < block.num_stmts; i++) {
+        fold_stmt(block.stmts[i]);
+    }
+}
+
+void fold_stmt(Stmt *stmt) {
+    if (!stmt) {
+        return;
+    }
+    switch (stmt->kind) {
+    case STMT_RETURN:
+        stmt->return_stmt.expr = fold_expr(stmt->return_stmt.expr);
+        break;
+    case STMT_BLOCK:
+        fold_stmt_block(stmt->block);
+        break;
+    case STMT_IF:
+        stmt->if_stmt.cond = fold_expr(stmt->if_stmt.cond);
+        fold_stmt_block(stmt->if_stmt.then_block);
+        for (size_t i = 0; i < stmt->if_stmt.num_elseifs; i++) {
+            stmt->if_stmt.elseifs[i].cond = fold_expr(stmt->if_stmt.elseifs[i].cond);
+            fold_stmt_block(stmt->if_stmt.elseifs[i].block);
+        }
+        fold_stmt_block(stmt->if_stmt.else_block);
+        break;
+    case STMT_WHILE:
+    case STMT_DO_WHILE:
+        stmt->while_stmt.cond = fold_expr(stmt->while_stmt.cond);
+        fold_stmt_block(stmt->while_stmt.block);
+        break;
+    case STMT_FOR:
+        fold_stmt(stmt->for_stmt.init);
+        stmt->for_stmt.cond = fold_expr(stmt->for_stmt.cond);
+        fold_stmt(stmt->for_stmt.next);
+        fold_stmt_block(stmt->for_stmt.block);
+        break;
+    case STMT_SWITCH:
+        stmt->switch_stmt.expr = fold_expr(stmt->switch_stmt.expr);
+        for (size_t i = 0; i < stmt->switch_stmt.num_cases; i++) {
+            SwitchCase *c = &stmt->switch_stmt.cases[i];
+            for (size_t j = 0; j < c->num_exprs; j++) {
+                c->exprs[j] = fold_expr(c->exprs[j]);
+            }
+            fold_stmt_block(c->block);
+        }
+        break;
+    case STMT_ASSIGN:
+        stmt->assign.left = fold_expr(stmt->assign.left);
+        stmt->assign.right = fold_expr(stmt->assign.right);
+        break;
+    case STMT_INIT:
+        stmt->init.expr = fold_expr(stmt->init.expr);
+        break;
+    case STMT_EXPR:
+        stmt->expr = fold_expr(stmt->expr);
+        break;
+    default:
+        break;
+    }
+}
+
+// Folds the exprs of decls in place. Typespecs are left alone, since
+// they are interned and shared between decls.
+void fold_decls(Decl **decls, size_t num_decls) {
+    for (size_t i = 0; i < num_decls; i++) {
+        Decl *decl = decls[i];
+        switch (decl->kind) {
+        case DECL_ENUM:
+            for (size_t j = 0; j < decl->enum_decl.num_items; j++) {
+                decl->enum_decl.items[j].expr = fold_expr(decl->enum_decl.items[j].expr);
+            }
+            break;
+        case DECL_CONST:
+            decl->const_decl.expr = fold_expr(decl->const_decl.expr);
+            break;
+        case DECL_LET:
+            decl->let.expr = fold_expr(decl->let.expr);
+            break;
+        case DECL_FN:
+            fold_stmt_block(decl->fn.block);
+            break;
+        default:
+            break;
+        }
+    }
+}
+
+void fold_test(void) {
+    // Without types only constants fold.
+    pass_test_case(fold_decls, PASS_TEST_ALL, "let x = b == 1 ? 1+2 : 3-4", "(let x nil (? (== b 1) 3 (- 1)))\n");
+    pass_test_case(fold_decls, PASS_TEST_ALL, "let x = 1 < 2 ? (1 + 2.5) * -2 : 0", "(let x nil (- 7.0))\n");
+    pass_test_case(fold_decls, PASS_TEST_ALL, "let x = -(-(1 << 3)) + x * 1", "(let x nil (+ 8 (* x 1)))\n");
+    pass_test_case(fold_decls, PASS_TEST_ALL, "let x = 9223372036854775807 + 1 + 1 / 0",
+                   "(let x nil (+ (+ 9223372036854775807 1) (/ 1 0)))\n");
+
+    pass_test_case(fold_decls, PASS_TEST_TYPED | PASS_TEST_CHECK | PASS_TEST_ALL,
+                   "fn f(x: int, u: uint, y: float): int {\n"
+                   "    a := x * 8 + 0; b := u / 16 + u % 8 * (:uint){1}; c := y * 1 / 1.0;\n"
+                   "    d := (x + 1) * 0; e := f(x, u, y) * 0; g := 4 * -(-x); h := x / 4;\n"
+                   "    return 0 | a ^ 0 - 0;\n"
+                   "}",
+                   "(fn f ( x int u uint y float ) int\n"
+                   "  (block\n"
+                   "    (:= a (<< x 3))\n"
+                   "    (:= b (+ (>> u 4) (* (& u 7) (compound uint 1))))\n"
+                   "    (:= c y)\n"
+                   "    (:= d 0)\n"
+                   "    (:= e (* (f x u y) 0))\n"
+                   "    (:= g (<< x 2))\n"
+                   "    (:= h (/ x 4))\n"
+                   "    (return a)))\n");
+    // A rewritten constant is written plainly, however the source wrote it.
+    init_stream("fn f(u: uint): uint { return u / 0x10 + u % 0b100; }");
+    Decl **decls = parse_file();
+    assert(check_decls(decls, buf_len(decls)));
+    fold_decls(decls, buf_len(decls));
+    print_capture();
+    fmt_decl(decls[0]);
+    char *output = print_release();
+    assert(strstr(output, "return u >> 4 + u & 3;"));
+    buf_free(output);
+    buf_free(decls);
+    // An identity that would change the type is left alone.
+    pass_test_case(fold_decls, PASS_TEST_TYPED | PASS_TEST_CHECK | PASS_TEST_ALL,
+                   "fn f(c: char, y: float): float { return c + 0 + y * 1; }",
+                   "(fn f ( c char y float ) float\n  (block\n    (return (+ (+ c 0) y))))\n");
+    assert(fold_stats.folded && fold_stats.simplified && fold_stats.reduced);
+    fold_stats = (FoldStats){0};
+    check_reset();
+    resolve_reset();
+}
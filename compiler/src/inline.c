@@ -0,0 +1,666 @@
+#include "ast.h"
+
+InlineStats inline_stats;
+size_t inline_budget = INLINE_BUDGET;
+
+typedef enum InlineShape {
+    INLINE_NONE,
+    INLINE_EXPR, // A lone return, substituted into the call's expression
+    INLINE_STMTS, // One return at the end or none, spliced in at statements
+} InlineShape;
+
+// The fn whose calls are being inlined.
+typedef struct InlineCaller {
+    Decl *decl;
+    bool scanned;
+    Map names; // Every name in the fn, so new locals cannot clash with one
+    Map locals; // Names of its params and locals, which hide globals
+    size_t num_locals; // Next local slot
+    bool takes_addrs;
+} InlineCaller;
+
+// The fn being measured or copied in.
+typedef struct InlineCallee {
+    Decl *decl;
+    size_t cost; // Nodes in its body, counted up to the budget
+    size_t returns;
+    bool takes_addrs;
+    size_t *uses; // Of each param
+    bool *assigned; // Params the body assigns to
+    Expr **args;
+    bool *args_used;
+    Sym **params; // Locals standing in for the params at a splice
+    Expr **literals; // Or literal args written straight over their uses
+    Stmt **inits; // Its own init stmts, in visit order
+    size_t next_init;
+    Map locals; // Its init stmts to the locals standing in for them
+    const char **globals; // Names its body refers to globals by
+} InlineCallee;
+
+// What measuring a callee found, kept until the callee's own calls are
+// inlined and its body changes.
+typedef struct InlineMeasure {
+    InlineShape shape;
+    size_t cost;
+    size_t *uses;
+    bool *assigned;
+    bool takes_addrs;
+    const char **globals;
+    size_t num_globals;
+} InlineMeasure;
+
+Arena inline_arena;
+Map inline_measures;
+InlineCaller inline_caller;
+InlineCallee inline_callee;
+AstVisitor inline_scan_visitor;
+AstVisitor inline_measure_visitor;
+AstVisitor inline_collect_visitor;
+AstVisitor inline_rename_visitor;
+
+VisitResult inline_scan_pre(AstNode node, void *ctx) {
+    (void)ctx;
+    if (node.kind == AST_TYPESPEC) {
+        return VISIT_SKIP;
+    }
+    if (node.kind == AST_EXPR && node.expr->kind == EXPR_IDENT) {
+        map_put(&inline_caller.names, node.expr->name, (void *)node.expr->name);
+    } else if (node.kind == AST_STMT && node.stmt->kind == STMT_INIT) {
+        map_put(&inline_caller.names, node.stmt->init.name, (void *)node.stmt->init.name);
+        map_put(&inline_caller.locals, node.stmt->init.name, (void *)node.stmt->init.name);
+        inline_caller.num_locals++;
+    } else if (node.kind == AST_EXPR && node.expr->kind == EXPR_UNARY && node.expr->unary.op == '&') {
+        inline_caller.takes_addrs = true;
+    }
+    return VISIT_CONTINUE;
+}
+
+// Gathers the caller's names, locals and whether it takes addresses the
+// first time any of them is needed. Most callers only splice empty fns or
+// substitute pure exprs and never need them.
+void inline_caller_scan(void) {
+    if (inline_caller.scanned) {
+        return;
+    }
+    inline_caller.scanned = true;
+    Decl *decl = inline_caller.decl;
+    for (size_t i = 0; i < decl->fn.num_params; i++) {
+        map_put(&inline_caller.names, decl->fn.params[i].name, (void *)decl->fn.params[i].name);
+        map_put(&inline_caller.locals, decl->fn.params[i].name, (void *)decl->fn.params[i].name);
+    }
+    for (size_t i = 0; i < decl->fn.block.num_stmts; i++) {
+        ast_visit(&inline_scan_visitor, ast_stmt(decl->fn.block.stmts[i]));
+    }
+}
+
+// Returns a name like callee_name that nothing in the caller uses. Spliced
+// code keeps that true by adding its own names as it goes in.
+const char *inline_fresh(const char *name) {
+    inline_caller_scan();
+    char buf[256];
+    snprintf(buf, sizeof(buf), "%s_%s", inline_callee.decl->name, name);
+    const char *fresh = str_intern(buf);
+    size_t len = strlen(buf);
+    for (int i = 1; map_get(&inline_caller.names, fresh); i++) {
+        snprintf(buf + len, sizeof(buf) - len, "%d", i);
+        fresh = str_intern(buf);
+    }
+    map_put(&inline_caller.names, fresh, (void *)fresh);
+    map_put(&inline_caller.locals, fresh, (void *)fresh);
+    return fresh;
+}
+
+Sym *inline_local(const char *name, Stmt *init) {
+    inline_caller_scan();
+    Sym *sym = arena_alloc(&sym_arena, sizeof(Sym));
+    *sym = (Sym){.name = name, .kind = SYM_LOCAL, .state = SYM_RESOLVED, .decl = inline_caller.decl,
+                 .id = inline_caller.num_locals++, .init = init};
+    return sym;
+}
+
+bool inline_callee_param(Sym *sym) {
+    return sym && sym->kind == SYM_PARAM && sym->decl == inline_callee.decl;
+}
+
+VisitResult inline_measure_pre(AstNode node, void *ctx) {
+    (void)ctx;
+    if (node.kind == AST_TYPESPEC) {
+        return VISIT_SKIP;
+    }
+    if (++inline_callee.cost > inline_budget) {
+        return VISIT_STOP;
+    }
+    if (node.kind == AST_EXPR) {
+        Expr *expr = node.expr;
+        if (expr->kind == EXPR_IDENT && inline_callee_param(expr->sym)) {
+            inline_callee.uses[expr->sym->id]++;
+        } else if (expr->kind == EXPR_IDENT && expr->sym && expr->sym->kind == SYM_FN && expr->sym->decl == inline_callee.decl) {
+            return VISIT_STOP;
+        } else if (expr->kind == EXPR_IDENT && expr->sym && expr->sym->kind != SYM_PARAM && expr->sym->kind != SYM_LOCAL) {
+            buf_push(inline_callee.globals, expr->name);
+        } else if (expr->kind == EXPR_UNARY && expr->unary.op == '&') {
+            inline_callee.takes_addrs = true;
+        }
+    } else if (node.kind == AST_STMT && node.stmt->kind == STMT_RETURN) {
+        inline_callee.returns++;
+    } else if (node.kind == AST_STMT && node.stmt->kind == STMT_ASSIGN && node.stmt->assign.left->kind == EXPR_IDENT &&
+               inline_callee_param(node.stmt->assign.left->sym)) {
+        inline_callee.assigned[node.stmt->assign.left->sym->id] = true;
+    }
+    return VISIT_CONTINUE;
+}
+
+InlineShape inline_measure(Decl *callee) {
+    inline_callee.cost = 0;
+    inline_callee.returns = 0;
+    inline_callee.takes_addrs = false;
+    buf_clear(inline_callee.uses);
+    buf_clear(inline_callee.assigned);
+    buf_clear(inline_callee.globals);
+    for (size_t i = 0; i < callee->fn.num_params; i++) {
+        buf_push(inline_callee.uses, 0);
+        buf_push(inline_callee.assigned, false);
+    }
+    StmtBlock body = callee->fn.block;
+    for (size_t i = 0; i < body.num_stmts; i++) {
+        if (!ast_visit(&inline_measure_visitor, ast_stmt(body.stmts[i]))) {
+            return INLINE_NONE;
+        }
+    }
+    if (!callee->fn.ret_type) {
+        return inline_callee.returns ? INLINE_NONE : INLINE_STMTS;
+    }
+    if (inline_callee.returns != 1 || !body.num_stmts || body.stmts[body.num_stmts - 1]->kind != STMT_RETURN) {
+        return INLINE_NONE;
+    }
+    return body.num_stmts == 1 && !inline_callee.takes_addrs ? INLINE_EXPR : INLINE_STMTS;
+}
+
+void *inline_dup(const void *src, size_t size) {
+    if (size == 0) {
+        return NULL;
+    }
+    void *ptr = arena_alloc(&inline_arena, size);
+    memcpy(ptr, src, size);
+    return ptr;
+}
+
+// Whether a name the callee refers to a global by belongs to a param or
+// local of the caller, which would capture it once the body moved there.
+bool inline_hides_globals(InlineMeasure *measure) {
+    if (!measure->num_globals) {
+        return false;
+    }
+    inline_caller_scan();
+    for (size_t i = 0; i < measure->num_globals; i++) {
+        if (map_get(&inline_caller.locals, measure->globals[i])) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Sizes up callee for inlining into the current caller. Fns over budget,
+// that refer to themselves or to globals the caller hides are never
+// inlined. Each callee is measured once for all its call sites.
+InlineShape inline_shape(Decl *callee) {
+    if (callee == inline_caller.decl) {
+        return INLINE_NONE;
+    }
+    inline_callee.decl = callee;
+    size_t num_params = callee->fn.num_params;
+    InlineMeasure *measure = map_get(&inline_measures, callee);
+    if (!measure) {
+        InlineShape shape = inline_measure(callee);
+        measure = arena_alloc(&inline_arena, sizeof(InlineMeasure));
+        *measure = (InlineMeasure){.shape = shape, .cost = inline_callee.cost, .takes_addrs = inline_callee.takes_addrs};
+        if (shape != INLINE_NONE) {
+            measure->uses = inline_dup(inline_callee.uses, num_params * sizeof(size_t));
+            measure->assigned = inline_dup(inline_callee.assigned, num_params * sizeof(bool));
+            measure->num_globals = buf_len(inline_callee.globals);
+            measure->globals = inline_dup(inline_callee.globals, measure->num_globals * sizeof(const char *));
+        }
+        map_put(&inline_measures, callee, measure);
+    } else if (measure->shape != INLINE_NONE) {
+        inline_callee.cost = measure->cost;
+        inline_callee.takes_addrs = measure->takes_addrs;
+        buf_clear(inline_callee.uses);
+        buf_clear(inline_callee.assigned);
+        for (size_t i = 0; i < num_params; i++) {
+            buf_push(inline_callee.uses, measure->uses[i]);
+            buf_push(inline_callee.assigned, measure->assigned[i]);
+        }
+    }
+    if (measure->shape == INLINE_NONE || inline_hides_globals(measure)) {
+        return INLINE_NONE;
+    }
+    return measure->shape;
+}
+
+// Converts expr as passing or returning it as to would have.
+Expr *inline_convert(Expr *expr, Type *to, Typespec *typespec) {
+    if (expr->type == to) {
+        return expr;
+    }
+    Expr *cast = expr_cast(typespec, expr);
+    cast->type = to;
+    return cast;
+}
+
+// Calls visit on each expr slot under *slot, children first.
+void inline_walk_expr(Expr **slot, void (*visit)(Expr **slot)) {
+    Expr *expr = *slot;
+    switch (expr->kind) {
+    case EXPR_CAST:
+        inline_walk_expr(&expr->cast.expr, visit);
+        break;
+    case EXPR_CALL:
+        inline_walk_expr(&expr->call.expr, visit);
+        for (size_t i = 0; i < expr->call.num_args; i++) {
+            inline_walk_expr(&expr->call.args[i], visit);
+        }
+        break;
+    case EXPR_INDEX:
+        inline_walk_expr(&expr->index.expr, visit);
+        inline_walk_expr(&expr->index.index, visit);
+        break;
+    case EXPR_FIELD:
+        inline_walk_expr(&expr->field.expr, visit);
+        break;
+    case EXPR_COMPOUND:
+        for (size_t i = 0; i < expr->compound.num_args; i++) {
+            inline_walk_expr(&expr->compound.args[i], visit);
+        }
+        break;
+    case EXPR_UNARY:
+        inline_walk_expr(&expr->unary.expr, visit);
+        break;
+    case EXPR_BINARY:
+        inline_walk_expr(&expr->binary.left, visit);
+        inline_walk_expr(&expr->binary.right, visit);
+        break;
+    case EXPR_TERNARY:
+        inline_walk_expr(&expr->ternary.cond, visit);
+        inline_walk_expr(&expr->ternary.then_expr, visit);
+        inline_walk_expr(&expr->ternary.else_expr, visit);
+        break;
+    default:
+        break;
+    }
+    visit(slot);
+}
+
+// Puts an arg in place of each use of its param. The first use takes the
+// arg itself and any others a copy.
+void inline_subst(Expr **slot) {
+    Expr *expr = *slot;
+    if (expr->kind != EXPR_IDENT || !inline_callee_param(expr->sym)) {
+        return;
+    }
+    size_t i = expr->sym->id;
+    Expr *arg = inline_callee.args[i];
+    *slot = inline_callee.args_used[i] ? expr_copy(arg) : arg;
+    inline_callee.args_used[i] = true;
+}
+
+bool inline_literal(Expr *expr) {
+    return expr->kind == EXPR_INT || expr->kind == EXPR_FLOAT || expr->kind == EXPR_STR;
+}
+
+// Replaces a call to a fn with a lone return by that return's expr, with
+// the args substituted for the params. That takes no temporaries, so only
+// args that may be duplicated, dropped or evaluated later qualify: pure
+// ones, cheap ones where a param is used more than once, and ones nothing
+// the callee calls could change where it calls anything.
+void inline_call_expr(Expr **slot) {
+    Expr *call = *slot;
+    if (call->kind != EXPR_CALL || call->call.expr->kind != EXPR_IDENT) {
+        return;
+    }
+    Sym *sym = call->call.expr->sym;
+    if (!sym || sym->kind != SYM_FN || sym->decl->fn.num_params != call->call.num_args || inline_shape(sym->decl) != INLINE_EXPR) {
+        return;
+    }
+    Decl *callee = sym->decl;
+    Expr *body = callee->fn.block.stmts[0]->return_stmt.expr;
+    bool pure = fold_pure(body);
+    if (!pure) {
+        inline_caller_scan();
+    }
+    for (size_t i = 0; i < call->call.num_args; i++) {
+        Expr *arg = call->call.args[i];
+        bool local = arg->kind == EXPR_IDENT && arg->sym && (arg->sym->kind == SYM_LOCAL || arg->sym->kind == SYM_PARAM);
+        if (!fold_pure(arg) || (inline_callee.uses[i] > 1 && !inline_literal(arg) && arg->kind != EXPR_IDENT) ||
+            (!pure && !inline_literal(arg) && !(local && !inline_caller.takes_addrs))) {
+            return;
+        }
+    }
+    Type *type = sym->type;
+    Expr **args = NULL;
+    bool *args_used = NULL;
+    for (size_t i = 0; i < call->call.num_args; i++) {
+        buf_push(args, inline_convert(call->call.args[i], type->fn.params[i], callee->fn.params[i].type));
+        buf_push(args_used, false);
+    }
+    inline_callee.args = args;
+    inline_callee.args_used = args_used;
+    Expr *copy = expr_copy(body);
+    inline_walk_expr(&copy, inline_subst);
+    *slot = inline_convert(copy, type->fn.ret, callee->fn.ret_type);
+    buf_free(args);
+    buf_free(args_used);
+    inline_stats.calls++;
+    inline_stats.exprs++;
+    inline_stats.nodes += inline_callee.cost;
+}
+
+VisitResult inline_collect_pre(AstNode node, void *ctx) {
+    (void)ctx;
+    if (node.kind == AST_TYPESPEC) {
+        return VISIT_SKIP;
+    }
+    if (node.kind == AST_STMT && node.stmt->kind == STMT_INIT) {
+        buf_push(inline_callee.inits, node.stmt);
+        map_put(&inline_caller.names, node.stmt->init.name, (void *)node.stmt->init.name);
+    } else if (node.kind == AST_EXPR && node.expr->kind == EXPR_IDENT) {
+        map_put(&inline_caller.names, node.expr->name, (void *)node.expr->name);
+    }
+    return VISIT_CONTINUE;
+}
+
+// Points a copy of the callee's body at the caller's new locals, giving
+// each of its inits the next fresh local in the order collect saw them.
+VisitResult inline_rename_pre(AstNode node, void *ctx) {
+    (void)ctx;
+    if (node.kind == AST_TYPESPEC) {
+        return VISIT_SKIP;
+    }
+    if (node.kind == AST_STMT && node.stmt->kind == STMT_INIT) {
+        Stmt *orig = inline_callee.inits[inline_callee.next_init++];
+        node.stmt->init.name = inline_fresh(orig->init.name);
+        map_put(&inline_callee.locals, orig, inline_local(node.stmt->init.name, node.stmt));
+    } else if (node.kind == AST_EXPR && node.expr->kind == EXPR_IDENT) {
+        Expr *expr = node.expr;
+        Sym *sym = NULL;
+        if (inline_callee_param(expr->sym) && inline_callee.literals[expr->sym->id]) {
+            Expr *literal = inline_callee.literals[expr->sym->id];
+            assert(expr_size(literal->kind) <= expr_size(EXPR_IDENT));
+            expr->kind = literal->kind;
+            if (literal->kind == EXPR_INT) {
+                expr->int_val = literal->int_val;
+                expr->int_mod = literal->int_mod;
+            } else if (literal->kind == EXPR_FLOAT) {
+                expr->float_val = literal->float_val;
+            } else {
+                expr->str_val = literal->str_val;
+            }
+        } else if (inline_callee_param(expr->sym)) {
+            sym = inline_callee.params[expr->sym->id];
+        } else if (expr->sym && expr->sym->kind == SYM_LOCAL && expr->sym->decl == inline_callee.decl) {
+            sym = map_get(&inline_callee.locals, expr->sym->init);
+        }
+        if (sym) {
+            expr->name = sym->name;
+            expr->sym = sym;
+        }
+    }
+    return VISIT_CONTINUE;
+}
+
+// Splices the body of the fn called by stmt in ahead of it: an init of a
+// fresh local for each param that is used or whose arg has side effects,
+// unless the arg is a literal the body never changes, then the body with
+// its locals renamed, then stmt with the call replaced by the returned
+// expr. A call statement whose value is pure goes away.
+bool inline_splice(Stmt *stmt, Stmt ***out) {
+    Expr **site;
+    switch (stmt->kind) {
+    case STMT_EXPR:
+        site = &stmt->expr;
+        break;
+    case STMT_INIT:
+        site = &stmt->init.expr;
+        break;
+    case STMT_RETURN:
+        site = &stmt->return_stmt.expr;
+        break;
+    case STMT_ASSIGN:
+        // The target has to be the same place after the body as before it.
+        site = stmt->assign.right && fold_pure(stmt->assign.left) ? &stmt->assign.right : NULL;
+        break;
+    default:
+        site = NULL;
+        break;
+    }
+    Expr *call = site ? *site : NULL;
+    if (!call || call->kind != EXPR_CALL || call->call.expr->kind != EXPR_IDENT) {
+        return false;
+    }
+    Sym *sym = call->call.expr->sym;
+    if (!sym || sym->kind != SYM_FN || sym->decl->fn.num_params != call->call.num_args ||
+        inline_shape(sym->decl) == INLINE_NONE) {
+        return false;
+    }
+    Decl *callee = sym->decl;
+    StmtBlock body = callee->fn.block;
+    buf_clear(inline_callee.inits);
+    inline_callee.next_init = 0;
+    for (size_t i = 0; i < body.num_stmts; i++) {
+        ast_visit(&inline_collect_visitor, ast_stmt(body.stmts[i]));
+    }
+    Type *type = sym->type;
+    buf_clear(inline_callee.params);
+    buf_clear(inline_callee.literals);
+    for (size_t i = 0; i < callee->fn.num_params; i++) {
+        Expr *arg = call->call.args[i];
+        Type *param = type->fn.params[i];
+        buf_push(inline_callee.params, NULL);
+        buf_push(inline_callee.literals, NULL);
+        if (!inline_callee.uses[i] && fold_pure(arg)) {
+            continue;
+        }
+        if (inline_literal(arg) && arg->type == param && !inline_callee.assigned[i] && !inline_callee.takes_addrs) {
+            inline_callee.literals[i] = arg;
+            continue;
+        }
+        const char *name = inline_fresh(callee->fn.params[i].name);
+        Stmt *init = stmt_init(name, inline_convert(arg, param, callee->fn.params[i].type));
+        inline_callee.params[i] = inline_local(name, init);
+        buf_push(*out, init);
+    }
+    size_t num_stmts = callee->fn.ret_type ? body.num_stmts - 1 : body.num_stmts;
+    for (size_t i = 0; i < num_stmts; i++) {
+        Stmt *copy = stmt_copy(body.stmts[i]);
+        ast_visit(&inline_rename_visitor, ast_stmt(copy));
+        buf_push(*out, copy);
+    }
+    if (callee->fn.ret_type) {
+        Expr *result = expr_copy(body.stmts[num_stmts]->return_stmt.expr);
+        ast_visit(&inline_rename_visitor, ast_expr(result));
+        *site = inline_convert(result, type->fn.ret, callee->fn.ret_type);
+        if (stmt->kind != STMT_EXPR || !fold_pure(*site)) {
+            buf_push(*out, stmt);
+        }
+    }
+    map_free(&inline_callee.locals);
+    inline_stats.calls++;
+    inline_stats.splices++;
+    inline_stats.nodes += inline_callee.cost;
+    return true;
+}
+
+void inline_block(StmtBlock *block);
+
+void inline_stmt(Stmt *stmt) {
+    if (!stmt) {
+        return;
+    }
+    switch (stmt->kind) {
+    case STMT_RETURN:
+        if (stmt->return_stmt.expr) {
+            inline_walk_expr(&stmt->return_stmt.expr, inline_call_expr);
+        }
+        break;
+    case STMT_BLOCK:
+        inline_block(&stmt->block);
+        break;
+    case STMT_IF:
+        inline_walk_expr(&stmt->if_stmt.cond, inline_call_expr);
+        inline_block(&stmt->if_stmt.then_block);
+        for (size_t i = 0; i < stmt->if_stmt.num_elseifs; i++) {
+            inline_walk_expr(&stmt->if_stmt.elseifs[i].cond, inline_call_expr);
+            inline_block(&stmt->if_stmt.elseifs[i].block);
+        }
+        inline_block(&stmt->if_stmt.else_block);
+        break;
+    case STMT_WHILE:
+    case STMT_DO_WHILE:
+        inline_walk_expr(&stmt->while_stmt.cond, inline_call_expr);
+        inline_block(&stmt->while_stmt.block);
+        break;
+    case STMT_FOR:
+        inline_stmt(stmt->for_stmt.init);
+        if (stmt->for_stmt.cond) {
+            inline_walk_expr(&stmt->for_stmt.cond, inline_call_expr);
+        }
+        inline_stmt(stmt->for_stmt.next);
+        inline_block(&stmt->for_stmt.block);
+        break;
+    case STMT_SWITCH:
+        inline_walk_expr(&stmt->switch_stmt.expr, inline_call_expr);
+        for (size_t i = 0; i < stmt->switch_stmt.num_cases; i++) {
+            inline_block(&stmt->switch_stmt.cases[i].block);
+        }
+        break;
+    case STMT_ASSIGN:
+        inline_walk_expr(&stmt->assign.left, inline_call_expr);
+        if (stmt->assign.right) {
+            inline_walk_expr(&stmt->assign.right, inline_call_expr);
+        }
+        break;
+    case STMT_INIT:
+        inline_walk_expr(&stmt->init.expr, inline_call_expr);
+        break;
+    case STMT_EXPR:
+        inline_walk_expr(&stmt->expr, inline_call_expr);
+        break;
+    default:
+        break;
+    }
+}
+
+// Inlines within block and splices calls at its statements, moving it to a
+// new array only once a splice changes its length.
+void inline_block(StmtBlock *block) {
+    Stmt **stmts = NULL;
+    bool spliced = false;
+    for (size_t i = 0; i < block->num_stmts; i++) {
+        Stmt *stmt = block->stmts[i];
+        inline_stmt(stmt);
+        if (!spliced) {
+            Stmt **out = NULL;
+            if (!inline_splice(stmt, &out)) {
+                continue;
+            }
+            spliced = true;
+            for (size_t j = 0; j < i; j++) {
+                buf_push(stmts, block->stmts[j]);
+            }
+            for (size_t j = 0; j < buf_len(out); j++) {
+                buf_push(stmts, out[j]);
+            }
+            buf_free(out);
+        } else if (!inline_splice(stmt, &stmts)) {
+            buf_push(stmts, stmt);
+        }
+    }
+    if (spliced) {
+        block->stmts = ast_dup(stmts, buf_len(stmts) * sizeof(Stmt *));
+        block->num_stmts = buf_len(stmts);
+        buf_free(stmts);
+    }
+}
+
+void inline_decls(Decl **decls, size_t num_decls) {
+    inline_scan_visitor = (AstVisitor){.pre = inline_scan_pre};
+    inline_measure_visitor = (AstVisitor){.pre = inline_measure_pre};
+    inline_collect_visitor = (AstVisitor){.pre = inline_collect_pre};
+    inline_rename_visitor = (AstVisitor){.pre = inline_rename_pre};
+    for (size_t i = 0; i < num_decls; i++) {
+        Decl *decl = decls[i];
+        if (decl->kind != DECL_FN) {
+            continue;
+        }
+        map_free(&inline_caller.names);
+        map_free(&inline_caller.locals);
+        inline_caller = (InlineCaller){.decl = decl, .num_locals = decl->fn.num_params};
+        inline_block(&decl->fn.block);
+        // Calls to it from later fns see what it became.
+        if (map_get(&inline_measures, decl)) {
+            map_put(&inline_measures, decl, NULL);
+        }
+    }
+    map_free(&inline_measures);
+    arena_free(&inline_arena);
+    map_free(&inline_caller.names);
+    map_free(&inline_caller.locals);
+    inline_caller = (InlineCaller){0};
+    buf_free(inline_callee.uses);
+    buf_free(inline_callee.assigned);
+    buf_free(inline_callee.literals);
+    buf_free(inline_callee.params);
+    buf_free(inline_callee.inits);
+    buf_free(inline_callee.globals);
+    inline_callee = (InlineCallee){0};
+    visitor_free(&inline_scan_visitor);
+    visitor_free(&inline_measure_visitor);
+    visitor_free(&inline_collect_visitor);
+    visitor_free(&inline_rename_visitor);
+}
+
+void inline_test(void) {
+    // Lone returns go straight into the expression, converting at the call.
+    pass_test_case(inline_decls, PASS_TEST_TYPED | PASS_TEST_CHECK,
+                   "struct V { x, y: float; }\n"
+                   "fn dot(a: V, b: V): float { return a.x * b.x + a.y * b.y; }\n"
+                   "fn half(x: float): float { return x / 2; }\n"
+                   "fn f(v: V, w: V): float { return half(dot(v, w)) + half(1); }",
+                   "(fn f ( v V w V ) float\n  (block\n"
+                   "    (return (+ (/ (+ (* (field v x) (field w x)) (* (field v y) (field w y))) 2) (/ (cast float 1) 2)))))");
+    // Bodies with locals are spliced in under names the caller does not use.
+    pass_test_case(inline_decls, PASS_TEST_TYPED | PASS_TEST_CHECK,
+                   "fn clamp(x: int, lo: int, hi: int): int { y := x; if (y < lo) { y = lo; } if (y > hi) { y = hi; } return y; }\n"
+                   "fn f(a: int): int { clamp_y := a; b := clamp(a * 2, 0, 10); return clamp(b, a, clamp_y); }",
+                   "(fn f ( a int ) int\n  (block\n    (:= clamp_y a)\n    (:= clamp_x (* a 2))\n    (:= clamp_y1 clamp_x)\n"
+                   "    (if (< clamp_y1 0)\n      (block\n        (= clamp_y1 0)))\n"
+                   "    (if (> clamp_y1 10)\n      (block\n        (= clamp_y1 10)))\n    (:= b clamp_y1)\n"
+                   "    (:= clamp_x1 b)\n    (:= clamp_lo a)\n    (:= clamp_hi clamp_y)\n    (:= clamp_y2 clamp_x1)\n"
+                   "    (if (< clamp_y2 clamp_lo)\n      (block\n        (= clamp_y2 clamp_lo)))\n"
+                   "    (if (> clamp_y2 clamp_hi)\n      (block\n        (= clamp_y2 clamp_hi)))\n    (return clamp_y2)))");
+    // Args that cannot be duplicated or moved fall back to a local.
+    pass_test_case(inline_decls, PASS_TEST_TYPED | PASS_TEST_CHECK,
+                   "let n = 0 fn trace(s: char*) {} fn get(): int { return 1; } fn bump(): int { n++; return n; }\n"
+                   "fn twice(x: int): int { return x + x; }\n"
+                   "fn f(a: int): int { trace(\"f\"); b := twice(get()); b += twice(a + 1); b -= twice(bump()); return twice(a); }",
+                   "(fn f ( a int ) int\n  (block\n    (:= b (+ 1 1))\n    (:= twice_x (+ a 1))\n"
+                   "    (+= b (+ twice_x twice_x))\n    (:= twice_x1 (bump))\n    (-= b (+ twice_x1 twice_x1))\n"
+                   "    (return (+ a a))))");
+    pass_test_case(inline_decls, PASS_TEST_TYPED | PASS_TEST_CHECK,
+                   "fn fact(n: int): int { return n ? n * fact(n - 1) : 1; }\n"
+                   "fn f(): int { return fact(3); }",
+                   "(fn f ( ) int\n  (block\n    (return (fact 3))))");
+    // Nor can a global the callee refers to, where the caller hides it.
+    pass_test_case(inline_decls, PASS_TEST_TYPED | PASS_TEST_CHECK,
+                   "let N = 1 fn g(): int { return N; } fn f(): int { N := 2; return g(); }",
+                   "(fn f ( ) int\n  (block\n    (:= N 2)\n    (return (g))))");
+    pass_test_case(inline_decls, PASS_TEST_TYPED | PASS_TEST_CHECK,
+                   "let N = 1 fn g(): int { x := N; return x; } fn f(N: int): int { h := g(); return h + N; }",
+                   "(fn f ( N int ) int\n  (block\n    (:= h (g))\n    (return (+ h N))))");
+    inline_budget = 2;
+    pass_test_case(inline_decls, PASS_TEST_TYPED | PASS_TEST_CHECK,
+                   "fn half(x: float): float { return x / 2; } fn f(): float { return half(1.0); }",
+                   "(fn f ( ) float\n  (block\n    (return (half 1.0))))");
+    inline_budget = INLINE_BUDGET;
+    assert(inline_stats.calls == 11 && inline_stats.exprs == 6 && inline_stats.splices == 5);
+    inline_stats = (InlineStats){0};
+}
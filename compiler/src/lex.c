@@ -9,6 +9,10 @@ void init_keywords(void) {
     if (inited) {
         return;
     }
+    // is_keyword_str relies on all keywords sitting in one arena block.
+    if ((size_t)(str_arena.end - str_arena.ptr) < ARENA_BLOCK_SIZE / 2) {
+        arena_grow(&str_arena, ARENA_BLOCK_SIZE);
+    }
     char *arena_end = str_arena.end;
     KW(typedef);
     KW(enum);
@@ -56,6 +60,7 @@ bool match_keyword(const char *name) {
 
 const char *token_kind_names[] = {
     [TOKEN_EOF] = "EOF",
+    [TOKEN_KEYWORD] = "keyword",
     [TOKEN_INT] = "int",
     [TOKEN_FLOAT] = "float",
     [TOKEN_STR] = "string",
@@ -76,7 +81,7 @@ const char *token_kind_names[] = {
     [TOKEN_OR_ASSIGN] = "|=",
     [TOKEN_AND_ASSIGN] = "&=",
     [TOKEN_XOR_ASSIGN] = "^=",
-    [TOKEN_MUL_ASSIGN] = "+=",
+    [TOKEN_MUL_ASSIGN] = "*=",
     [TOKEN_DIV_ASSIGN] = "/=",
     [TOKEN_MOD_ASSIGN] = "%=",
     [TOKEN_LSHIFT_ASSIGN] = "<<=",
@@ -137,6 +142,7 @@ uint8_t char_to_digit[256] = {
 
 void scan_int(void) {
     uint64_t base = 10;
+    token.mod = TOKENMOD_NONE;
     // handle base
     if (*stream == '0') {
         stream++;
@@ -162,12 +168,12 @@ void scan_int(void) {
             break;
 
         if (digit >= base) {
-            syntax_error("digit '%c' out of range for base %ull", *stream, base);
+            syntax_error_here("digit '%c' out of range for base %ull", *stream, base);
             digit = 0;
         }
 
         if (value > (UINT64_MAX - digit) / base) {
-            syntax_error("Integar literal overflow");
+            syntax_error_here("Integar literal overflow");
             while (isdigit(*stream))
                 stream++;
             value = 0;
@@ -195,7 +201,7 @@ void scan_float(void) {
         if (*stream == '+' || *stream == '-')
             stream++;
         if (!isdigit(*stream))
-            syntax_error("expected digit after float loteral exponent, found '%c'.", *stream);
+            syntax_error_here("expected digit after float loteral exponent, found '%c'.", *stream);
 
         while (isdigit(*stream))
             stream++;
@@ -204,7 +210,7 @@ void scan_float(void) {
     // const char *end = stream;
     double value = strtod(start, NULL);
     if (value == HUGE_VAL || value == -HUGE_VAL)
-        syntax_error("float literal overflow");
+        syntax_error_here("float literal overflow");
 
     token.kind = TOKEN_FLOAT;
     token.f64 = value;
@@ -226,15 +232,15 @@ void scan_char(void) {
     char value = 0;
 
     if (*stream == '\'') {
-        syntax_error("char literal cannot be empty");
+        syntax_error_here("char literal cannot be empty");
         stream++;
     } else if (*stream == '\n') {
-        syntax_error("char literal cannot contain newlines");
+        syntax_error_here("char literal cannot contain newlines");
     } else if (*stream == '\\') {
         stream++;
         value = escape_to_char[(unsigned char)*stream];
         if (value == 0 && *stream != '0') {
-            syntax_error("invalid char literal escape '\\%c'", *stream);
+            syntax_error_here("invalid char literal escape '\\%c'", *stream);
         }
         stream++;
     } else {
@@ -242,7 +248,7 @@ void scan_char(void) {
         stream++;
     }
     if (*stream != '\'')
-        syntax_error("expected closing char quote, got '%c'", *stream);
+        syntax_error_here("expected closing char quote, got '%c'", *stream);
     else
         stream++;
 
@@ -259,12 +265,12 @@ void scan_str(void) {
     while (*stream && *stream != '"') {
         char value = *stream;
         if (value == '\n')
-            syntax_error("string literal cannot contain new lines");
+            syntax_error_here("string literal cannot contain new lines");
         else if (value == '\\') {
             stream++;
             value = escape_to_char[(unsigned char)*stream];
             if (value == 0 && *stream != '0')
-                syntax_error("invalid string literal escape '\\%c'", *stream);
+                syntax_error_here("invalid string literal escape '\\%c'", *stream);
         }
         buf_push(str, value);
         stream++;
@@ -273,7 +279,7 @@ void scan_str(void) {
         assert(*stream == '"');
         stream++;
     } else
-        syntax_error("unexpected eof within string litreal.");
+        syntax_error_here("unexpected eof within string litreal.");
 
     buf_push(str, 0);
     token.kind = TOKEN_STR;
@@ -304,14 +310,19 @@ void scan_str(void) {
 void next_token(void) {
 repeat:
     token.lo = stream;
+    token.pos.col = (int)(stream - line_start) + 1;
     switch (*stream) {
     case ' ':
     case '\t':
     case '\n':
     case '\r':
     case '\v':
-        while (isspace(*stream))
-            stream++;
+        while (isspace(*stream)) {
+            if (*stream++ == '\n') {
+                line_start = stream;
+                token.pos.line++;
+            }
+        }
 
         goto repeat;
         break;
@@ -325,7 +336,11 @@ repeat:
         break;
 
     case '.':
-        scan_float();
+        if (isdigit(stream[1])) {
+            scan_float();
+        } else {
+            token.kind = *stream++;
+        }
         break;
 
     case '0':
@@ -463,11 +478,28 @@ repeat:
 #undef CASE1
 #undef CASE2
 
-void init_stream(const char *str) {
+void init_stream_name(const char *name, const char *str) {
     stream = str;
+    line_start = str;
+    token.pos = (SrcPos){name, 1, 1};
+    panic_mode = false;
     next_token();
 }
 
+void init_stream(const char *str) {
+    init_stream_name(NULL, str);
+}
+
+LexState lex_save(void) {
+    return (LexState){token, stream, line_start};
+}
+
+void lex_restore(LexState state) {
+    token = state.token;
+    stream = state.stream;
+    line_start = state.line_start;
+}
+
 void print_token(Token token) {
     printf("TOKEN: %d", token.kind);
     switch (token.kind) {
@@ -501,14 +533,23 @@ inline bool match_token(TokenKind kind) {
     }
 }
 
+bool panic_mode;
+
 inline bool expect_token(TokenKind kind) {
     if (is_token(kind)) {
         next_token();
+        if (kind == ';') {
+            // A statement terminator is as good a sync point as any.
+            panic_mode = false;
+        }
         return true;
     } else {
-        char buf[256];
-        copy_token_kind_str(buf, sizeof(buf), kind);
-        fatal("expected token: %s, got %s\n", buf, temp_token_kind_str(token.kind));
+        if (!panic_mode) {
+            char buf[256];
+            copy_token_kind_str(buf, sizeof(buf), kind);
+            syntax_error_here("expected token %s, got %s", buf, temp_token_kind_str(token.kind));
+            panic_mode = true;
+        }
         return false;
     }
 }
@@ -578,6 +619,13 @@ void lex_test(void) {
     assert_token(TOKEN_LSHIFT_ASSIGN);
     assert_token_eof();
 
+    init_stream("a.b .5");
+    assert_token_name("a");
+    assert_token('.');
+    assert_token_name("b");
+    assert_token_float(.5);
+    assert_token_eof();
+
     init_stream("XY+(XY)1234-_jehllo!huhu_ui,994 aa12");
     assert_token_name("XY");
     assert_token('+');
@@ -593,6 +641,18 @@ void lex_test(void) {
     assert_token_int(994);
     assert_token_name("aa12");
     assert_token_eof();
+
+    init_stream("a\nb c");
+    assert_token_name("a");
+    LexState state = lex_save();
+    assert_token_name("b");
+    assert_token_name("c");
+    lex_restore(state);
+    assert(token.pos.line == 2 && token.pos.col == 1);
+    assert_token_name("b");
+    assert(token.pos.line == 2 && token.pos.col == 3);
+    assert_token_name("c");
+    assert_token_eof();
 }
 
 #undef assert_token
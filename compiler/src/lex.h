@@ -75,6 +75,7 @@ const char *temp_token_kind_str(TokenKind kind);
 typedef struct Token {
     TokenKind kind;
     TokenMod mod;
+    SrcPos pos;
     const char *lo;
     const char *hi;
     union {
@@ -87,6 +88,14 @@ typedef struct Token {
 
 Token token;
 const char *stream;
+const char *line_start;
+
+// Set by the first syntax error and cleared by the parser once it has
+// resynchronized, so one mistake does not produce a cascade of errors.
+extern bool panic_mode;
+
+#define syntax_error_here(...) syntax_error(token.pos, __VA_ARGS__)
+#define fatal_syntax_error_here(...) fatal_syntax_error(token.pos, __VA_ARGS__)
 
 const char *keyword_if;
 const char *keyword_for;
@@ -104,6 +113,17 @@ void scan_str(void);
 void next_token(void);
 
 void init_stream(const char *str);
+void init_stream_name(const char *name, const char *str);
+
+// Everything the lexer needs to resume from a token it has already read.
+typedef struct LexState {
+    Token token;
+    const char *stream;
+    const char *line_start;
+} LexState;
+
+LexState lex_save(void);
+void lex_restore(LexState state);
 
 void print_token(Token token);
 bool is_token(TokenKind kind);
@@ -1,3 +1,5 @@
+#define _XOPEN_SOURCE 700
+
 #include "ast.h"
 #include "common.h"
 #include "lex.h"
@@ -7,9 +9,219 @@ void run_tests(void) {
     lex_test();
     // print_test();
     parse_test();
+    print_sink_test();
+    fmt_test();
+    ast_test();
+    pool_test();
+    ast_file_test();
+    cache_test();
+    server_test();
+    export_test();
+    resolve_test();
+    type_test();
+    check_test();
+    const_test();
+    fold_test();
+    dce_test();
+    tco_test();
+    inline_test();
+    unroll_test();
+    switch_test();
+    purity_test();
+    cse_test();
+}
+
+int emit_ast(const char *path, const char *out_path) {
+    Decl **decls = parse_path(path);
+    if (!decls) {
+        return 1;
+    }
+    int result = 0;
+    if (!ast_file_write(out_path, decls, buf_len(decls))) {
+        printf("error: cannot write '%s'\n", out_path);
+        result = 1;
+    }
+    buf_free(decls);
+    return result;
+}
+
+int load_ast(const char *path) {
+    init_keywords();
+    size_t num_decls;
+    Decl **decls = ast_file_load(path, &num_decls);
+    if (!decls) {
+        printf("error: %s: %s\n", path, ast_file_error);
+        return 1;
+    }
+    print_decls(decls, num_decls);
+    return 0;
+}
+
+int client(const char *socket_path, const char *path) {
+    char *abs_path = realpath(path, NULL);
+    if (!abs_path) {
+        printf("error: cannot read '%s'\n", path);
+        return 1;
+    }
+    char *request = NULL;
+    buf_printf(request, "compile %s", abs_path);
+    int status = server_request(socket_path, request, stdout);
+    if (status < 0) {
+        printf("error: cannot reach server at '%s'\n", socket_path);
+        status = 1;
+    }
+    buf_free(request);
+    free(abs_path);
+    return status;
+}
+
+int usage(void) {
+    printf("usage: rionc [file | --cache dir file | --serve socket | --client socket file | --bench |\n"
+           "              --emit-ast file out | --load-ast file | --export json|bin file |\n"
+           "              --resolve file | --check file]\n"
+           "       rionc fmt [-w] [-j jobs] file...\n");
+    return 1;
 }
 
-int main(void) {
-    run_tests();
+// Streams the decls in path to stdout as JSON or binary.
+int export_ast(const char *format, const char *path) {
+    bool json = strcmp(format, "json") == 0;
+    if (!json && strcmp(format, "bin") != 0) {
+        return usage();
+    }
+    Decl **decls = parse_path(path);
+    if (!decls) {
+        return 1;
+    }
+    if (json) {
+        ast_export_json(decls, buf_len(decls));
+    } else {
+        ast_export_binary(decls, buf_len(decls));
+    }
+    print_flush();
+    buf_free(decls);
     return 0;
 }
+
+// Prints the decls in path in dependency order, one "kind name" per line.
+int resolve_path(const char *path) {
+    Decl **decls = parse_path(path);
+    if (!decls) {
+        return 1;
+    }
+    bool ok = resolve_decls(decls, buf_len(decls));
+    for (Sym **it = ordered_syms; it != buf_end(ordered_syms); it++) {
+        print_str(sym_kind_names[(*it)->kind]);
+        print_char(' ');
+        print_str((*it)->name);
+        print_char('\n');
+    }
+    print_flush();
+    for (char **it = resolve_errors; it != buf_end(resolve_errors); it++) {
+        printf("%s\n", *it);
+    }
+    resolve_reset();
+    buf_free(decls);
+    return ok ? 0 : 1;
+}
+
+// Type checks the decls in path and prints "name: type" for each global,
+// with the value of consts.
+int check_path(const char *path) {
+    Decl **decls = parse_path(path);
+    if (!decls) {
+        return 1;
+    }
+    bool ok = check_decls(decls, buf_len(decls));
+    char *str = NULL;
+    for (Sym **it = ordered_syms; it != buf_end(ordered_syms); it++) {
+        buf_clear(str);
+        type_to_str(&str, sym_type(*it));
+        print_str((*it)->name);
+        print_str(": ");
+        print_str(str);
+        if ((*it)->eval_state == SYM_RESOLVED && (*it)->val.type && (*it)->kind == SYM_CONST) {
+            print_str(" = ");
+            print_const_val((*it)->val);
+        }
+        print_char('\n');
+    }
+    print_flush();
+    buf_free(str);
+    for (char **it = resolve_errors; it != buf_end(resolve_errors); it++) {
+        printf("%s\n", *it);
+    }
+    for (char **it = check_errors; it != buf_end(check_errors); it++) {
+        printf("%s\n", *it);
+    }
+    check_reset();
+    resolve_reset();
+    buf_free(decls);
+    return ok ? 0 : 1;
+}
+
+// rionc fmt [-w] [-j jobs] file...
+int fmt_main(int argc, char **argv) {
+    bool write = false;
+    int num_jobs = 1;
+    int i = 2;
+    for (; i < argc && argv[i][0] == '-'; i++) {
+        if (strcmp(argv[i], "-w") == 0) {
+            write = true;
+        } else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+            num_jobs = atoi(argv[++i]);
+        } else {
+            return usage();
+        }
+    }
+    if (i == argc) {
+        return usage();
+    }
+    return fmt_paths((const char **)argv + i, argc - i, write, num_jobs);
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        run_tests();
+        return 0;
+    }
+    if (strcmp(argv[1], "fmt") == 0) {
+        return fmt_main(argc, argv);
+    }
+    if (strcmp(argv[1], "--bench") == 0) {
+        run_benchmarks();
+        return 0;
+    }
+    if (strcmp(argv[1], "--cache") == 0) {
+        if (argc != 4) {
+            return usage();
+        }
+        if (!decl_cache_init(argv[2])) {
+            printf("error: cannot create cache directory '%s'\n", argv[2]);
+            return 1;
+        }
+        return compile_file(argv[3]);
+    }
+    if (strcmp(argv[1], "--serve") == 0) {
+        return argc == 3 ? serve(argv[2]) : usage();
+    }
+    if (strcmp(argv[1], "--client") == 0) {
+        return argc == 4 ? client(argv[2], argv[3]) : usage();
+    }
+    if (strcmp(argv[1], "--emit-ast") == 0) {
+        return argc == 4 ? emit_ast(argv[2], argv[3]) : usage();
+    }
+    if (strcmp(argv[1], "--load-ast") == 0) {
+        return argc == 3 ? load_ast(argv[2]) : usage();
+    }
+    if (strcmp(argv[1], "--export") == 0) {
+        return argc == 4 ? export_ast(argv[2], argv[3]) : usage();
+    }
+    if (strcmp(argv[1], "--resolve") == 0) {
+        return argc == 3 ? resolve_path(argv[2]) : usage();
+    }
+    if (strcmp(argv[1], "--check") == 0) {
+        return argc == 3 ? check_path(argv[2]) : usage();
+    }
+    return compile_file(argv[1]);
+}
@@ -3,6 +3,60 @@
 #include "lex.h"
 #include <stdio.h>
 
+void parse_error(const char *fmt, ...) {
+    if (panic_mode) {
+        return;
+    }
+    va_list args;
+    va_start(args, fmt);
+    vsyntax_error(token.pos, fmt, args);
+    va_end(args);
+    panic_mode = true;
+}
+
+bool is_decl_keyword(void) {
+    return is_keyword(enum_keyword) || is_keyword(struct_keyword) || is_keyword(union_keyword) || is_keyword(let_keyword) ||
+           is_keyword(const_keyword) || is_keyword(typedef_keyword) || is_keyword(fn_keyword);
+}
+
+bool is_stmt_keyword(void) {
+    return is_keyword(return_keyword) || is_keyword(break_keyword) || is_keyword(continue_keyword) || is_keyword(if_keyword) ||
+           is_keyword(while_keyword) || is_keyword(do_keyword) || is_keyword(for_keyword) || is_keyword(switch_keyword);
+}
+
+// Panic-mode recovery: skip tokens until a likely construct boundary, which
+// is a ';' (consumed), the '}' closing the enclosing block, or a declaration
+// keyword (plus statement keywords and case/default when in_block is set).
+// Braces opened while skipping are balanced so a nested block's '}' does not
+// end the enclosing one. start is where the failed construct began; at least
+// one token is always consumed from there so callers looping on this cannot
+// get stuck.
+void synchronize(const char *start, bool in_block) {
+    if (token.lo == start && !is_token(TOKEN_EOF)) {
+        next_token();
+    }
+    int depth = 0;
+    while (!is_token(TOKEN_EOF)) {
+        if (is_token('{')) {
+            depth++;
+        } else if (is_token('}')) {
+            if (depth == 0 && in_block) {
+                break;
+            }
+            depth = MAX(depth - 1, 0);
+        } else if (depth == 0) {
+            if (is_token(';')) {
+                next_token();
+                break;
+            } else if (is_decl_keyword() || (in_block && (is_stmt_keyword() || is_keyword(case_keyword) || is_keyword(default_keyword)))) {
+                break;
+            }
+        }
+        next_token();
+    }
+    panic_mode = false;
+}
+
 Typespec *parse_type_fn(void) {
     Typespec **args = NULL;
     expect_token('(');
@@ -17,7 +71,9 @@ Typespec *parse_type_fn(void) {
     if (match_token(':')) {
         ret = parse_type();
     }
-    return typespec_fn(ast_dup(args, buf_sizeof(args)), buf_len(args), ret);
+    Typespec *type = typespec_fn(args, buf_len(args), ret);
+    buf_free(args);
+    return type;
 }
 
 Typespec *parse_type_base(void) {
@@ -28,10 +84,12 @@ Typespec *parse_type_base(void) {
     } else if (match_keyword(fn_keyword)) {
         return parse_type_fn();
     } else if (match_token('(')) {
-        return parse_type();
+        Typespec *type = parse_type();
+        expect_token(')');
+        return type;
     } else {
-        fatal_syntax_error("Unexpected token %s in type", temp_token_kind_str(token.kind));
-        return NULL;
+        parse_error("Unexpected token %s in type", temp_token_kind_str(token.kind));
+        return typespec_error();
     }
 }
 
@@ -64,14 +122,17 @@ Expr *parse_expr_compound(Typespec *type) {
         }
     }
     expect_token('}');
-    return expr_compound(type, ast_dup(args, buf_sizeof(args)), buf_len(args));
+    Expr *expr = expr_compound(type, args, buf_len(args));
+    buf_free(args);
+    return expr;
 }
 
 Expr *parse_expr_operand(void) {
     if (is_token(TOKEN_INT)) {
-        uint64_t value = token.u64;
+        Expr *expr = expr_int(token.u64);
+        expr->int_mod = token.mod;
         next_token();
-        return expr_int(value);
+        return expr;
     } else if (is_token(TOKEN_FLOAT)) {
         double value = token.f64;
         next_token();
@@ -90,8 +151,8 @@ Expr *parse_expr_operand(void) {
         }
     } else if (is_token('{')) {
         return parse_expr_compound(NULL);
-    } else if (is_token('(')) {
-        if (is_token(':')) {
+    } else if (match_token('(')) {
+        if (match_token(':')) {
             Typespec *type = parse_type();
             expect_token(')');
             return parse_expr_compound(type);
@@ -101,8 +162,8 @@ Expr *parse_expr_operand(void) {
             return expr;
         }
     } else {
-        fatal_syntax_error("Unexpected token %s in expression", temp_token_kind_str(token.kind));
-        return NULL;
+        parse_error("Unexpected token %s in expression", temp_token_kind_str(token.kind));
+        return expr_error();
     }
 }
 
@@ -118,7 +179,8 @@ Expr *parse_expr_base(void) {
                 }
             }
             expect_token(')');
-            expr = expr_call(expr, ast_dup(args, buf_sizeof(args)), buf_len(args));
+            expr = expr_call(expr, args, buf_len(args));
+            buf_free(args);
         } else if (match_token('[')) {
             Expr *index = parse_expr();
             expect_token(']');
@@ -126,9 +188,7 @@ Expr *parse_expr_base(void) {
         } else {
             assert(is_token('.'));
             next_token();
-            const char *field = token.name;
-            expect_token(TOKEN_IDENT);
-            expr = expr_field(expr, field);
+            expr = expr_field(expr, parse_ident());
         }
     }
     return expr;
@@ -151,7 +211,7 @@ bool is_cmp_op(void) {
 }
 
 bool is_assign_op(void) {
-    return TOKEN_FIRST_ASSIGN <= token.kind && token.kind <= TOKEN_LAST_ASSIGN;
+    return is_token('=') || (TOKEN_FIRST_ASSIGN <= token.kind && token.kind <= TOKEN_LAST_ASSIGN);
 }
 
 Expr *parse_expr_unary(void) {
@@ -236,10 +296,26 @@ StmtBlock parse_stmt_block(void) {
     expect_token('{');
     Stmt **stmts = NULL;
     while (!is_token(TOKEN_EOF) && !is_token('}')) {
+        const char *start = token.lo;
         buf_push(stmts, parse_stmt());
+        if (panic_mode) {
+            synchronize(start, true);
+            if (is_decl_keyword()) {
+                // Most likely a missing '}', so let the enclosing
+                // declaration end here instead of swallowing the next one.
+                panic_mode = true;
+                break;
+            }
+        }
     }
     expect_token('}');
-    return (StmtBlock){ast_dup(stmts, buf_sizeof(stmts)), buf_len(stmts)};
+    return (StmtBlock){stmts, buf_len(stmts)};
+}
+
+// Blocks from parse_stmt_block hold a temporary buffer that the builders
+// copy out of, so the caller frees it once the owning node is built.
+void free_stmt_block(StmtBlock block) {
+    buf_free(block.stmts);
 }
 
 Stmt *parse_stmt_if(void) {
@@ -256,22 +332,33 @@ Stmt *parse_stmt_if(void) {
         StmtBlock elseif_block = parse_stmt_block();
         buf_push(elseifs, (ElseIf){elseif_cond, elseif_block});
     }
-    return stmt_if(cond, then_block, ast_dup(elseifs, buf_sizeof(elseifs)), buf_len(elseifs), else_block);
+    Stmt *stmt = stmt_if(cond, then_block, elseifs, buf_len(elseifs), else_block);
+    free_stmt_block(then_block);
+    for (ElseIf *it = elseifs; it != buf_end(elseifs); it++) {
+        free_stmt_block(it->block);
+    }
+    buf_free(elseifs);
+    free_stmt_block(else_block);
+    return stmt;
 }
 
 Stmt *parse_stmt_while(void) {
     Expr *cond = parse_paren_expr();
-    return stmt_while(cond, parse_stmt_block());
+    StmtBlock block = parse_stmt_block();
+    Stmt *stmt = stmt_while(cond, block);
+    free_stmt_block(block);
+    return stmt;
 }
 
 Stmt *parse_stmt_do_while(void) {
     StmtBlock block = parse_stmt_block();
     if (!match_keyword(while_keyword)) {
-        fatal_syntax_error("Expected 'while' after 'do' block");
-        return NULL;
+        parse_error("Expected 'while' after 'do' block");
+        return stmt_error();
     }
     Expr *cond = parse_paren_expr();
     Stmt *stmt = stmt_do_while(cond, block);
+    free_stmt_block(block);
     expect_token(';');
     return stmt;
 }
@@ -281,7 +368,9 @@ Stmt *parse_simple_stmt(void) {
     Stmt *stmt;
     if (match_token(TOKEN_COLON_ASSIGN)) {
         if (expr->kind != EXPR_IDENT) {
-            fatal_syntax_error(":= must be preceded by a name");
+            parse_error(":= must be preceded by a name");
+            parse_expr();
+            return stmt_error();
         }
         stmt = stmt_init(expr->name, parse_expr());
     } else if (is_assign_op()) {
@@ -315,7 +404,10 @@ Stmt *parse_stmt_for(void) {
         next = parse_simple_stmt();
     }
     expect_token(')');
-    return stmt_for(init, cond, next, parse_stmt_block());
+    StmtBlock block = parse_stmt_block();
+    Stmt *stmt = stmt_for(init, cond, next, block);
+    free_stmt_block(block);
+    return stmt;
 }
 
 SwitchCase parse_stmt_switch_case(void) {
@@ -332,7 +424,7 @@ SwitchCase parse_stmt_switch_case(void) {
         }
     }
     StmtBlock block = parse_stmt_block();
-    return (SwitchCase){ast_dup(exprs, buf_sizeof(exprs)), buf_len(exprs), is_default, block};
+    return (SwitchCase){exprs, buf_len(exprs), is_default, block};
 }
 
 Stmt *parse_stmt_switch(void) {
@@ -340,15 +432,28 @@ Stmt *parse_stmt_switch(void) {
     SwitchCase *cases = NULL;
     expect_token('{');
     while (!is_token(TOKEN_EOF) && !is_token('}')) {
+        const char *start = token.lo;
         buf_push(cases, parse_stmt_switch_case());
+        if (panic_mode) {
+            synchronize(start, true);
+        }
     }
     expect_token('}');
-    return stmt_switch(expr, ast_dup(cases, buf_sizeof(cases)), buf_len(cases));
+    Stmt *stmt = stmt_switch(expr, cases, buf_len(cases));
+    for (SwitchCase *it = cases; it != buf_end(cases); it++) {
+        buf_free(it->exprs);
+        free_stmt_block(it->block);
+    }
+    buf_free(cases);
+    return stmt;
 }
 
 Stmt *parse_stmt(void) {
     if (is_token('{')) {
-        return stmt_block(parse_stmt_block());
+        StmtBlock block = parse_stmt_block();
+        Stmt *stmt = stmt_block(block);
+        free_stmt_block(block);
+        return stmt;
     } else if (match_keyword(return_keyword)) {
         Stmt *stmt = stmt_return(parse_expr());
         expect_token(';');
@@ -377,8 +482,12 @@ Stmt *parse_stmt(void) {
 }
 
 const char *parse_ident(void) {
+    if (!is_token(TOKEN_IDENT)) {
+        expect_token(TOKEN_IDENT);
+        return str_intern("<error>");
+    }
     const char *name = token.name;
-    expect_token(TOKEN_IDENT);
+    next_token();
     return name;
 }
 
@@ -387,15 +496,21 @@ Decl *parse_decl_enum(void) {
     expect_token('{');
     EnumItem *items = NULL;
     while (!is_token(TOKEN_EOF) && !is_token('}')) {
+        const char *start = token.lo;
         const char *item_name = parse_ident();
         Expr *expr = NULL;
         if (match_token('=')) {
             expr = parse_expr();
         }
         buf_push(items, (EnumItem){item_name, expr});
+        if (panic_mode) {
+            synchronize(start, true);
+        }
     }
     expect_token('}');
-    return decl_enum(name, ast_dup(items, buf_sizeof(items)), buf_len(items));
+    Decl *decl = decl_enum(name, items, buf_len(items));
+    buf_free(items);
+    return decl;
 }
 
 AggregateItem parse_decl_aggregate_item(void) {
@@ -407,7 +522,7 @@ AggregateItem parse_decl_aggregate_item(void) {
     expect_token(':');
     Typespec *type = parse_type();
     expect_token(';');
-    return (AggregateItem){ast_dup(names, buf_sizeof(names)), buf_len(names), type};
+    return (AggregateItem){names, buf_len(names), type};
 }
 
 Decl *parse_decl_aggregate(DeclKind kind) {
@@ -416,10 +531,19 @@ Decl *parse_decl_aggregate(DeclKind kind) {
     expect_token('{');
     AggregateItem *items = NULL;
     while (!is_token(TOKEN_EOF) && !is_token('}')) {
+        const char *start = token.lo;
         buf_push(items, parse_decl_aggregate_item());
+        if (panic_mode) {
+            synchronize(start, true);
+        }
     }
     expect_token('}');
-    return decl_aggregate(kind, name, ast_dup(items, buf_sizeof(items)), buf_len(items));
+    Decl *decl = decl_aggregate(kind, name, items, buf_len(items));
+    for (AggregateItem *it = items; it != buf_end(items); it++) {
+        buf_free(it->names);
+    }
+    buf_free(items);
+    return decl;
 }
 
 Decl *parse_decl_let(void) {
@@ -434,8 +558,8 @@ Decl *parse_decl_let(void) {
         }
         return decl_let(name, type, expr);
     } else {
-        fatal_syntax_error("Expected : or = after var, got %s", temp_token_kind_str(token.kind));
-        return NULL;
+        parse_error("Expected : or = after var, got %s", temp_token_kind_str(token.kind));
+        return decl_error();
     }
 }
 
@@ -474,7 +598,10 @@ Decl *parse_decl_fn(void) {
         ret_type = parse_type();
     }
     StmtBlock block = parse_stmt_block();
-    return decl_fn(name, ast_dup(params, buf_sizeof(params)), buf_len(params), ret_type, block);
+    Decl *decl = decl_fn(name, params, buf_len(params), ret_type, block);
+    buf_free(params);
+    free_stmt_block(block);
+    return decl;
 }
 
 Decl *parse_decl(void) {
@@ -493,19 +620,65 @@ Decl *parse_decl(void) {
     } else if (match_keyword(fn_keyword)) {
         return parse_decl_fn();
     } else {
-        fatal_syntax_error("Expected declaration keyword, got %s", temp_token_kind_str(token.kind));
-        return NULL;
+        parse_error("Expected declaration keyword, got %s", temp_token_kind_str(token.kind));
+        return decl_error();
+    }
+}
+
+Decl **parse_file(void) {
+    Decl **decls = NULL;
+    while (!is_token(TOKEN_EOF)) {
+        const char *start = token.lo;
+        buf_push(decls, parse_decl());
+        if (panic_mode) {
+            synchronize(start, false);
+        }
     }
+    return decls;
 }
 
 void parse_and_print_decl(const char *str) {
     init_stream(str);
     Decl *decl = parse_decl();
     print_decl(decl);
-    printf("\n");
+    print_char('\n');
+    print_flush();
+}
+
+void parse_recovery_test(void) {
+    init_stream("fn f() { x += ; y := 1; } let = 3 struct S { a: int; 1; b: float; } } fn g(): int { return 1 } const c = 2");
+    Decl **decls = parse_file();
+    assert(num_syntax_errors == 5);
+    assert(buf_len(decls) == 6);
+    assert(decls[0]->kind == DECL_FN && decls[0]->fn.block.num_stmts == 2);
+    assert(decls[0]->fn.block.stmts[0]->assign.right->kind == EXPR_ERROR);
+    assert(decls[1]->kind == DECL_LET);
+    assert(decls[2]->kind == DECL_STRUCT && decls[2]->aggregate.num_items == 3);
+    assert(decls[2]->aggregate.items[1].types->kind == TYPESPEC_ERROR);
+    assert(decls[2]->aggregate.items[2].names[0] == str_intern("b"));
+    assert(decls[3]->kind == DECL_ERROR);
+    assert(decls[4]->kind == DECL_FN && decls[4]->fn.block.num_stmts == 1);
+    assert(decls[5]->kind == DECL_CONST && decls[5]->name == str_intern("c"));
+    buf_free(decls);
+    reset_syntax_errors();
+
+    // Each unclosed block fails at EOF, but only the first says so.
+    init_stream("fn f() { if (x) { while (y) { x := 1;");
+    decls = parse_file();
+    assert(num_syntax_errors == 1 && strstr(syntax_errors[0], "got EOF"));
+    buf_free(decls);
+    reset_syntax_errors();
+
+    // Recovery must also terminate when nothing can be consumed.
+    init_stream("fn h() { let } ; ; } ) ]");
+    decls = parse_file();
+    assert(num_syntax_errors > 0 && !panic_mode);
+    buf_free(decls);
+    reset_syntax_errors();
 }
 
 void parse_test(void) {
+    parse_recovery_test();
     parse_and_print_decl("fn fact(n: int): int { trace(\"fact\"); if (n == 0) { return 1; } else { return n * fact(n-1); } }");
     parse_and_print_decl("fn fact(n: int): int { p := 1; for (i := 1; i <= n; i++) { p *= i; } return p; }");
     parse_and_print_decl("let x = b == 1 ? 1+2 : 3-4");
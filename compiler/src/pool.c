@@ -0,0 +1,511 @@
+#include "ast.h"
+
+AstPool ast_pool;
+
+uint32_t pool_push_ids(const uint32_t *ids, size_t num_ids) {
+    uint32_t start = (uint32_t)buf_len(ast_pool.ids);
+    for (size_t i = 0; i < num_ids; i++) {
+        buf_push(ast_pool.ids, ids[i]);
+    }
+    return start;
+}
+
+IdList pool_list(const uint32_t *ids, size_t num_ids) {
+    return (IdList){pool_push_ids(ids, num_ids), (uint32_t)num_ids};
+}
+
+#define POOL_PUSH(kind, b, ...) (buf_push((b), __VA_ARGS__), POOL_MAKE_ID((kind), buf_len(b) - 1))
+
+void pool_reset(void) {
+    buf_free(ast_pool.ints);
+    buf_free(ast_pool.floats);
+    buf_free(ast_pool.names);
+    buf_free(ast_pool.casts);
+    buf_free(ast_pool.calls);
+    buf_free(ast_pool.indexes);
+    buf_free(ast_pool.fields);
+    buf_free(ast_pool.compounds);
+    buf_free(ast_pool.unaries);
+    buf_free(ast_pool.binaries);
+    buf_free(ast_pool.ternaries);
+    buf_free(ast_pool.stmt_exprs);
+    buf_free(ast_pool.blocks);
+    buf_free(ast_pool.ifs);
+    buf_free(ast_pool.elseifs);
+    buf_free(ast_pool.whiles);
+    buf_free(ast_pool.fors);
+    buf_free(ast_pool.switches);
+    buf_free(ast_pool.cases);
+    buf_free(ast_pool.assigns);
+    buf_free(ast_pool.inits);
+    buf_free(ast_pool.decls);
+    buf_free(ast_pool.enum_items);
+    buf_free(ast_pool.aggregate_items);
+    buf_free(ast_pool.params);
+    buf_free(ast_pool.typespec_fns);
+    buf_free(ast_pool.typespec_arrays);
+    buf_free(ast_pool.ids);
+}
+
+size_t pool_bytes(void) {
+    return buf_sizeof(ast_pool.ints) + buf_sizeof(ast_pool.floats) + buf_sizeof(ast_pool.names) +
+           buf_sizeof(ast_pool.casts) + buf_sizeof(ast_pool.calls) + buf_sizeof(ast_pool.indexes) +
+           buf_sizeof(ast_pool.fields) + buf_sizeof(ast_pool.compounds) + buf_sizeof(ast_pool.unaries) + buf_sizeof(ast_pool.binaries) +
+           buf_sizeof(ast_pool.ternaries) + buf_sizeof(ast_pool.stmt_exprs) + buf_sizeof(ast_pool.blocks) +
+           buf_sizeof(ast_pool.ifs) + buf_sizeof(ast_pool.elseifs) + buf_sizeof(ast_pool.whiles) +
+           buf_sizeof(ast_pool.fors) + buf_sizeof(ast_pool.switches) + buf_sizeof(ast_pool.cases) +
+           buf_sizeof(ast_pool.assigns) + buf_sizeof(ast_pool.inits) + buf_sizeof(ast_pool.decls) +
+           buf_sizeof(ast_pool.enum_items) + buf_sizeof(ast_pool.aggregate_items) + buf_sizeof(ast_pool.params) +
+           buf_sizeof(ast_pool.typespec_fns) + buf_sizeof(ast_pool.typespec_arrays) + buf_sizeof(ast_pool.ids);
+}
+
+TypespecId pool_typespec_ident(const char *name) {
+    return POOL_PUSH(TYPESPEC_IDENT, ast_pool.names, name);
+}
+
+TypespecId pool_typespec_ptr(TypespecId elem) {
+    // A pointer's only payload is its element handle, kept in the shared
+    // id array so no separate pool is needed.
+    return POOL_MAKE_ID(TYPESPEC_PTR, pool_push_ids(&elem, 1));
+}
+
+TypespecId pool_typespec_array(TypespecId elem, ExprId size) {
+    return POOL_PUSH(TYPESPEC_ARRAY, ast_pool.typespec_arrays, (PoolArrayTypespec){elem, size});
+}
+
+TypespecId pool_typespec_fn(TypespecId *args, size_t num_args, TypespecId ret) {
+    return POOL_PUSH(TYPESPEC_FN, ast_pool.typespec_fns, (PoolFnTypespec){pool_list(args, num_args), ret});
+}
+
+TypespecId pool_typespec_error(void) {
+    return POOL_MAKE_ID(TYPESPEC_ERROR, 0);
+}
+
+DeclId pool_decl(DeclKind kind, const char *name, PoolDecl decl) {
+    decl.name = name;
+    return POOL_PUSH(kind, ast_pool.decls, decl);
+}
+
+DeclId pool_decl_enum(const char *name, PoolEnumItem *items, size_t num_items) {
+    uint32_t start = (uint32_t)buf_len(ast_pool.enum_items);
+    for (size_t i = 0; i < num_items; i++) {
+        buf_push(ast_pool.enum_items, items[i]);
+    }
+    return pool_decl(DECL_ENUM, name, (PoolDecl){.items = {start, (uint32_t)num_items}});
+}
+
+DeclId pool_decl_aggregate(DeclKind kind, const char *name, PoolAggregateItem *items, size_t num_items) {
+    assert(kind == DECL_STRUCT || kind == DECL_UNION);
+    uint32_t start = (uint32_t)buf_len(ast_pool.aggregate_items);
+    for (size_t i = 0; i < num_items; i++) {
+        buf_push(ast_pool.aggregate_items, items[i]);
+    }
+    return pool_decl(kind, name, (PoolDecl){.items = {start, (uint32_t)num_items}});
+}
+
+DeclId pool_decl_let(const char *name, TypespecId type, ExprId expr) {
+    return pool_decl(DECL_LET, name, (PoolDecl){.type = type, .expr = expr});
+}
+
+DeclId pool_decl_fn(const char *name, PoolFnParam *params, size_t num_params, TypespecId ret_type, IdList block) {
+    uint32_t start = (uint32_t)buf_len(ast_pool.params);
+    for (size_t i = 0; i < num_params; i++) {
+        buf_push(ast_pool.params, params[i]);
+    }
+    return pool_decl(DECL_FN, name, (PoolDecl){.type = ret_type, .items = {start, (uint32_t)num_params}, .block = block});
+}
+
+DeclId pool_decl_const(const char *name, ExprId expr) {
+    return pool_decl(DECL_CONST, name, (PoolDecl){.expr = expr});
+}
+
+DeclId pool_decl_typedef(const char *name, TypespecId type) {
+    return pool_decl(DECL_TYPEDEF, name, (PoolDecl){.type = type});
+}
+
+DeclId pool_decl_error(void) {
+    return POOL_MAKE_ID(DECL_ERROR, 0);
+}
+
+ExprId pool_expr_int(uint64_t value) {
+    return POOL_PUSH(EXPR_INT, ast_pool.ints, value);
+}
+
+ExprId pool_expr_float(double value) {
+    return POOL_PUSH(EXPR_FLOAT, ast_pool.floats, value);
+}
+
+ExprId pool_expr_str(const char *str) {
+    return POOL_PUSH(EXPR_STR, ast_pool.names, str);
+}
+
+ExprId pool_expr_ident(const char *name) {
+    return POOL_PUSH(EXPR_IDENT, ast_pool.names, name);
+}
+
+ExprId pool_expr_compound(TypespecId type, ExprId *args, size_t num_args) {
+    return POOL_PUSH(EXPR_COMPOUND, ast_pool.compounds, (PoolCompoundExpr){type, pool_list(args, num_args)});
+}
+
+ExprId pool_expr_cast(TypespecId type, ExprId expr) {
+    return POOL_PUSH(EXPR_CAST, ast_pool.casts, (PoolCastExpr){type, expr});
+}
+
+ExprId pool_expr_call(ExprId expr, ExprId *args, size_t num_args) {
+    return POOL_PUSH(EXPR_CALL, ast_pool.calls, (PoolCallExpr){expr, pool_list(args, num_args)});
+}
+
+ExprId pool_expr_index(ExprId expr, ExprId index) {
+    return POOL_PUSH(EXPR_INDEX, ast_pool.indexes, (PoolIndexExpr){expr, index});
+}
+
+ExprId pool_expr_field(ExprId expr, const char *name) {
+    return POOL_PUSH(EXPR_FIELD, ast_pool.fields, (PoolFieldExpr){name, expr});
+}
+
+ExprId pool_expr_unary(TokenKind op, ExprId expr) {
+    return POOL_PUSH(EXPR_UNARY, ast_pool.unaries, (PoolUnaryExpr){op, expr});
+}
+
+ExprId pool_expr_binary(TokenKind op, ExprId left, ExprId right) {
+    return POOL_PUSH(EXPR_BINARY, ast_pool.binaries, (PoolBinaryExpr){op, left, right});
+}
+
+ExprId pool_expr_ternary(ExprId cond, ExprId then_expr, ExprId else_expr) {
+    return POOL_PUSH(EXPR_TERNARY, ast_pool.ternaries, (PoolTernaryExpr){cond, then_expr, else_expr});
+}
+
+ExprId pool_expr_error(void) {
+    return POOL_MAKE_ID(EXPR_ERROR, 0);
+}
+
+IdList pool_stmt_list(StmtId *stmts, size_t num_stmts) {
+    return pool_list(stmts, num_stmts);
+}
+
+StmtId pool_stmt_return(ExprId expr) {
+    return POOL_PUSH(STMT_RETURN, ast_pool.stmt_exprs, expr);
+}
+
+StmtId pool_stmt_break(void) {
+    return POOL_MAKE_ID(STMT_BREAK, 0);
+}
+
+StmtId pool_stmt_continue(void) {
+    return POOL_MAKE_ID(STMT_CONTINUE, 0);
+}
+
+StmtId pool_stmt_block(IdList block) {
+    return POOL_PUSH(STMT_BLOCK, ast_pool.blocks, block);
+}
+
+StmtId pool_stmt_if(ExprId cond, IdList then_block, PoolElseIf *elseifs, size_t num_elseifs, IdList else_block) {
+    uint32_t start = (uint32_t)buf_len(ast_pool.elseifs);
+    for (size_t i = 0; i < num_elseifs; i++) {
+        buf_push(ast_pool.elseifs, elseifs[i]);
+    }
+    return POOL_PUSH(STMT_IF, ast_pool.ifs, (PoolIfStmt){cond, then_block, {start, (uint32_t)num_elseifs}, else_block});
+}
+
+StmtId pool_stmt_while(ExprId cond, IdList block) {
+    return POOL_PUSH(STMT_WHILE, ast_pool.whiles, (PoolWhileStmt){cond, block});
+}
+
+StmtId pool_stmt_do_while(ExprId cond, IdList block) {
+    return POOL_PUSH(STMT_DO_WHILE, ast_pool.whiles, (PoolWhileStmt){cond, block});
+}
+
+StmtId pool_stmt_for(StmtId init, ExprId cond, StmtId next, IdList block) {
+    return POOL_PUSH(STMT_FOR, ast_pool.fors, (PoolForStmt){init, cond, next, block});
+}
+
+StmtId pool_stmt_switch(ExprId expr, PoolSwitchCase *cases, size_t num_cases) {
+    uint32_t start = (uint32_t)buf_len(ast_pool.cases);
+    for (size_t i = 0; i < num_cases; i++) {
+        buf_push(ast_pool.cases, cases[i]);
+    }
+    return POOL_PUSH(STMT_SWITCH, ast_pool.switches, (PoolSwitchStmt){expr, {start, (uint32_t)num_cases}});
+}
+
+StmtId pool_stmt_assign(TokenKind op, ExprId left, ExprId right) {
+    return POOL_PUSH(STMT_ASSIGN, ast_pool.assigns, (PoolAssignStmt){op, left, right});
+}
+
+StmtId pool_stmt_init(const char *name, ExprId expr) {
+    return POOL_PUSH(STMT_INIT, ast_pool.inits, (PoolInitStmt){name, expr});
+}
+
+StmtId pool_stmt_expr(ExprId expr) {
+    return POOL_PUSH(STMT_EXPR, ast_pool.stmt_exprs, expr);
+}
+
+StmtId pool_stmt_error(void) {
+    return POOL_MAKE_ID(STMT_ERROR, 0);
+}
+
+/*
+ * Conversion from the pointer AST, built through the pool_* builders above.
+ */
+
+TypespecId pool_from_typespec(Typespec *type) {
+    if (!type) {
+        return POOL_NONE;
+    }
+    switch (type->kind) {
+    case TYPESPEC_IDENT:
+        return pool_typespec_ident(type->name);
+    case TYPESPEC_FN: {
+        TypespecId *args = NULL;
+        for (size_t i = 0; i < type->fn.num_args; i++) {
+            buf_push(args, pool_from_typespec(type->fn.args[i]));
+        }
+        TypespecId ret = pool_from_typespec(type->fn.ret);
+        TypespecId id = pool_typespec_fn(args, buf_len(args), ret);
+        buf_free(args);
+        return id;
+    }
+    case TYPESPEC_ARRAY: {
+        TypespecId elem = pool_from_typespec(type->array.elem);
+        return pool_typespec_array(elem, pool_from_expr(type->array.size));
+    }
+    case TYPESPEC_PTR:
+        return pool_typespec_ptr(pool_from_typespec(type->ptr.elem));
+    case TYPESPEC_ERROR:
+        return pool_typespec_error();
+    default:
+        assert(0);
+        return POOL_NONE;
+    }
+}
+
+ExprId *pool_from_exprs(Expr **exprs, size_t num_exprs) {
+    ExprId *ids = NULL;
+    for (size_t i = 0; i < num_exprs; i++) {
+        buf_push(ids, pool_from_expr(exprs[i]));
+    }
+    return ids;
+}
+
+ExprId pool_from_expr(Expr *expr) {
+    if (!expr) {
+        return POOL_NONE;
+    }
+    switch (expr->kind) {
+    case EXPR_INT:
+        return pool_expr_int(expr->int_val);
+    case EXPR_FLOAT:
+        return pool_expr_float(expr->float_val);
+    case EXPR_STR:
+        return pool_expr_str(expr->str_val);
+    case EXPR_IDENT:
+        return pool_expr_ident(expr->name);
+    case EXPR_CAST: {
+        TypespecId type = pool_from_typespec(expr->cast.type);
+        return pool_expr_cast(type, pool_from_expr(expr->cast.expr));
+    }
+    case EXPR_CALL: {
+        ExprId callee = pool_from_expr(expr->call.expr);
+        ExprId *args = pool_from_exprs(expr->call.args, expr->call.num_args);
+        ExprId id = pool_expr_call(callee, args, buf_len(args));
+        buf_free(args);
+        return id;
+    }
+    case EXPR_COMPOUND: {
+        TypespecId type = pool_from_typespec(expr->compound.type);
+        ExprId *args = pool_from_exprs(expr->compound.args, expr->compound.num_args);
+        ExprId id = pool_expr_compound(type, args, buf_len(args));
+        buf_free(args);
+        return id;
+    }
+    case EXPR_INDEX: {
+        ExprId base = pool_from_expr(expr->index.expr);
+        return pool_expr_index(base, pool_from_expr(expr->index.index));
+    }
+    case EXPR_FIELD:
+        return pool_expr_field(pool_from_expr(expr->field.expr), expr->field.name);
+    case EXPR_UNARY:
+        return pool_expr_unary(expr->unary.op, pool_from_expr(expr->unary.expr));
+    case EXPR_BINARY: {
+        ExprId left = pool_from_expr(expr->binary.left);
+        return pool_expr_binary(expr->binary.op, left, pool_from_expr(expr->binary.right));
+    }
+    case EXPR_TERNARY: {
+        ExprId cond = pool_from_expr(expr->ternary.cond);
+        ExprId then_expr = pool_from_expr(expr->ternary.then_expr);
+        return pool_expr_ternary(cond, then_expr, pool_from_expr(expr->ternary.else_expr));
+    }
+    case EXPR_ERROR:
+        return pool_expr_error();
+    default:
+        assert(0);
+        return POOL_NONE;
+    }
+}
+
+IdList pool_from_stmt_block(StmtBlock block) {
+    StmtId *ids = NULL;
+    for (size_t i = 0; i < block.num_stmts; i++) {
+        buf_push(ids, pool_from_stmt(block.stmts[i]));
+    }
+    IdList list = pool_stmt_list(ids, buf_len(ids));
+    buf_free(ids);
+    return list;
+}
+
+StmtId pool_from_stmt(Stmt *stmt) {
+    if (!stmt) {
+        return POOL_NONE;
+    }
+    switch (stmt->kind) {
+    case STMT_RETURN:
+        return pool_stmt_return(pool_from_expr(stmt->return_stmt.expr));
+    case STMT_BREAK:
+        return pool_stmt_break();
+    case STMT_CONTINUE:
+        return pool_stmt_continue();
+    case STMT_BLOCK:
+        return pool_stmt_block(pool_from_stmt_block(stmt->block));
+    case STMT_IF: {
+        ExprId cond = pool_from_expr(stmt->if_stmt.cond);
+        IdList then_block = pool_from_stmt_block(stmt->if_stmt.then_block);
+        PoolElseIf *elseifs = NULL;
+        for (size_t i = 0; i < stmt->if_stmt.num_elseifs; i++) {
+            ElseIf *elseif = &stmt->if_stmt.elseifs[i];
+            ExprId elseif_cond = pool_from_expr(elseif->cond);
+            buf_push(elseifs, (PoolElseIf){elseif_cond, pool_from_stmt_block(elseif->block)});
+        }
+        IdList else_block = pool_from_stmt_block(stmt->if_stmt.else_block);
+        StmtId id = pool_stmt_if(cond, then_block, elseifs, buf_len(elseifs), else_block);
+        buf_free(elseifs);
+        return id;
+    }
+    case STMT_WHILE: {
+        ExprId cond = pool_from_expr(stmt->while_stmt.cond);
+        return pool_stmt_while(cond, pool_from_stmt_block(stmt->while_stmt.block));
+    }
+    case STMT_DO_WHILE: {
+        ExprId cond = pool_from_expr(stmt->while_stmt.cond);
+        return pool_stmt_do_while(cond, pool_from_stmt_block(stmt->while_stmt.block));
+    }
+    case STMT_FOR: {
+        StmtId init = pool_from_stmt(stmt->for_stmt.init);
+        ExprId cond = pool_from_expr(stmt->for_stmt.cond);
+        StmtId next = pool_from_stmt(stmt->for_stmt.next);
+        return pool_stmt_for(init, cond, next, pool_from_stmt_block(stmt->for_stmt.block));
+    }
+    case STMT_SWITCH: {
+        ExprId expr = pool_from_expr(stmt->switch_stmt.expr);
+        PoolSwitchCase *cases = NULL;
+        for (size_t i = 0; i < stmt->switch_stmt.num_cases; i++) {
+            SwitchCase *c = &stmt->switch_stmt.cases[i];
+            ExprId *exprs = pool_from_exprs(c->exprs, c->num_exprs);
+            IdList expr_list = pool_list(exprs, buf_len(exprs));
+            buf_free(exprs);
+            buf_push(cases, (PoolSwitchCase){expr_list, c->is_default, pool_from_stmt_block(c->block)});
+        }
+        StmtId id = pool_stmt_switch(expr, cases, buf_len(cases));
+        buf_free(cases);
+        return id;
+    }
+    case STMT_ASSIGN: {
+        ExprId left = pool_from_expr(stmt->assign.left);
+        return pool_stmt_assign(stmt->assign.op, left, pool_from_expr(stmt->assign.right));
+    }
+    case STMT_INIT:
+        return pool_stmt_init(stmt->init.name, pool_from_expr(stmt->init.expr));
+    case STMT_EXPR:
+        return pool_stmt_expr(pool_from_expr(stmt->expr));
+    case STMT_ERROR:
+        return pool_stmt_error();
+    default:
+        assert(0);
+        return POOL_NONE;
+    }
+}
+
+DeclId pool_from_decl(Decl *decl) {
+    switch (decl->kind) {
+    case DECL_ENUM: {
+        PoolEnumItem *items = NULL;
+        for (size_t i = 0; i < decl->enum_decl.num_items; i++) {
+            EnumItem *item = &decl->enum_decl.items[i];
+            buf_push(items, (PoolEnumItem){item->name, pool_from_expr(item->expr)});
+        }
+        DeclId id = pool_decl_enum(decl->name, items, buf_len(items));
+        buf_free(items);
+        return id;
+    }
+    case DECL_STRUCT:
+    case DECL_UNION: {
+        PoolAggregateItem *items = NULL;
+        for (size_t i = 0; i < decl->aggregate.num_items; i++) {
+            AggregateItem *item = &decl->aggregate.items[i];
+            uint32_t start = (uint32_t)buf_len(ast_pool.names);
+            for (size_t j = 0; j < item->num_names; j++) {
+                buf_push(ast_pool.names, item->names[j]);
+            }
+            TypespecId type = pool_from_typespec(item->types);
+            buf_push(items, (PoolAggregateItem){{start, (uint32_t)item->num_names}, type});
+        }
+        DeclId id = pool_decl_aggregate(decl->kind, decl->name, items, buf_len(items));
+        buf_free(items);
+        return id;
+    }
+    case DECL_LET: {
+        TypespecId type = pool_from_typespec(decl->let.type);
+        return pool_decl_let(decl->name, type, pool_from_expr(decl->let.expr));
+    }
+    case DECL_CONST:
+        return pool_decl_const(decl->name, pool_from_expr(decl->const_decl.expr));
+    case DECL_TYPEDEF:
+        return pool_decl_typedef(decl->name, pool_from_typespec(decl->typedef_decl.type));
+    case DECL_FN: {
+        PoolFnParam *params = NULL;
+        for (size_t i = 0; i < decl->fn.num_params; i++) {
+            FnParam *param = &decl->fn.params[i];
+            buf_push(params, (PoolFnParam){param->name, pool_from_typespec(param->type)});
+        }
+        TypespecId ret_type = pool_from_typespec(decl->fn.ret_type);
+        IdList block = pool_from_stmt_block(decl->fn.block);
+        DeclId id = pool_decl_fn(decl->name, params, buf_len(params), ret_type, block);
+        buf_free(params);
+        return id;
+    }
+    case DECL_ERROR:
+        return pool_decl_error();
+    default:
+        assert(0);
+        return POOL_NONE;
+    }
+}
+
+void pool_test(void) {
+    pool_reset();
+    ExprId sum = pool_expr_binary('+', pool_expr_int(1), pool_expr_ident(str_intern("x")));
+    assert(POOL_KIND(sum) == EXPR_BINARY);
+    PoolBinaryExpr *binary = &ast_pool.binaries[POOL_INDEX(sum)];
+    assert(binary->op == '+');
+    assert(POOL_KIND(binary->left) == EXPR_INT && ast_pool.ints[POOL_INDEX(binary->left)] == 1);
+    assert(POOL_KIND(binary->right) == EXPR_IDENT && ast_pool.names[POOL_INDEX(binary->right)] == str_intern("x"));
+
+    ExprId args[] = {sum, pool_expr_float(2.5)};
+    ExprId call = pool_expr_call(pool_expr_ident(str_intern("f")), args, 2);
+    PoolCallExpr *c = &ast_pool.calls[POOL_INDEX(call)];
+    assert(c->args.len == 2 && ast_pool.ids[c->args.start] == sum);
+    assert(POOL_KIND(ast_pool.ids[c->args.start + 1]) == EXPR_FLOAT);
+
+    init_stream("fn f(n: int*): int { for (i := 0; i < n; i++) { if (i) { g(i, 1); } else if (j) { break; } } return n; }");
+    DeclId fn = pool_from_decl(parse_decl());
+    assert(POOL_KIND(fn) == DECL_FN);
+    PoolDecl *d = &ast_pool.decls[POOL_INDEX(fn)];
+    assert(d->name == str_intern("f") && d->items.len == 1 && d->block.len == 2);
+    assert(POOL_KIND(ast_pool.params[d->items.start].type) == TYPESPEC_PTR);
+    StmtId loop = ast_pool.ids[d->block.start];
+    assert(POOL_KIND(loop) == STMT_FOR);
+    PoolForStmt *f = &ast_pool.fors[POOL_INDEX(loop)];
+    assert(POOL_KIND(f->init) == STMT_INIT && POOL_KIND(f->cond) == EXPR_BINARY && POOL_KIND(f->next) == STMT_ASSIGN);
+    PoolIfStmt *i = &ast_pool.ifs[POOL_INDEX(ast_pool.ids[f->block.start])];
+    assert(i->elseifs.len == 1 && i->else_block.len == 0);
+    assert(POOL_KIND(ast_pool.ids[ast_pool.elseifs[i->elseifs.start].block.start]) == STMT_BREAK);
+    pool_reset();
+}
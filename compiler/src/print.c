@@ -2,38 +2,122 @@
 #include "lex.h"
 
 int indent;
+Printer printer;
+
+void print_flush(void) {
+    if (printer.capture || buf_len(printer.buf) == 0) {
+        return;
+    }
+    fwrite(printer.buf, 1, buf_len(printer.buf), printer.file ? printer.file : stdout);
+    buf_clear(printer.buf);
+}
+
+void print_capture(void) {
+    print_flush();
+    printer.capture = true;
+}
+
+char *print_release(void) {
+    buf_push(printer.buf, 0);
+    char *output = printer.buf;
+    printer.buf = NULL;
+    printer.capture = false;
+    return output;
+}
+
+// Reserves len bytes at the end of the buffer and returns where they start.
+// Flushes first when the buffer is full so it stays around PRINT_FLUSH_SIZE.
+char *print_reserve(size_t len) {
+    size_t n = buf_len(printer.buf);
+    if (n + len > PRINT_FLUSH_SIZE && !printer.capture) {
+        print_flush();
+        n = 0;
+    }
+    buf_fit(printer.buf, n + len);
+    buf__hdr(printer.buf)->len = n + len;
+    return printer.buf + n;
+}
+
+void print_chars(const char *str, size_t len) {
+    memcpy(print_reserve(len), str, len);
+}
+
+void print_str(const char *str) {
+    print_chars(str, strlen(str));
+}
+
+void print_char(char c) {
+    *print_reserve(1) = c;
+}
+
+void print_uint(uint64_t val) {
+    char *dest = print_reserve(FORMAT_UINT64_SIZE);
+    buf__hdr(printer.buf)->len -= FORMAT_UINT64_SIZE - format_uint64(dest, val);
+}
+
+// Prints the buffered syntax errors and forgets them, like
+// flush_syntax_errors but through the printer.
+void print_syntax_errors(void) {
+    for (char **it = syntax_errors; it != buf_end(syntax_errors); it++) {
+        print_str(*it);
+        print_char('\n');
+    }
+    if (num_syntax_errors > buf_len(syntax_errors)) {
+        print_uint(num_syntax_errors - buf_len(syntax_errors));
+        print_str(" more syntax errors not shown\n");
+    }
+    reset_syntax_errors();
+}
+
+void print_double(double val) {
+    char *dest = print_reserve(FORMAT_DOUBLE_SIZE);
+    buf__hdr(printer.buf)->len -= FORMAT_DOUBLE_SIZE - format_double(dest, val);
+}
 
 void print_newline(void) {
-    printf("\n%.*s", 2 * indent, "                                                                      ");
+    char *dest = print_reserve(1 + 2 * indent);
+    *dest = '\n';
+    memset(dest + 1, ' ', 2 * indent);
 }
 
 void print_typespec(Typespec *type) {
     Typespec *t = type;
     switch (t->kind) {
     case TYPESPEC_IDENT:
-        printf("%s", t->name);
+        print_str(t->name);
         break;
     case TYPESPEC_FN:
-        printf("(fn (");
+        print_str("(fn (");
         for (Typespec **it = t->fn.args; it != t->fn.args + t->fn.num_args; it++) {
-            printf(" ");
+            print_char(' ');
             print_typespec(*it);
         }
-        printf(") ");
-        print_typespec(t->fn.ret);
-        printf(")");
+        print_str(") ");
+        if (t->fn.ret) {
+            print_typespec(t->fn.ret);
+        } else {
+            print_str("nil");
+        }
+        print_char(')');
         break;
     case TYPESPEC_ARRAY:
-        printf("(array ");
+        print_str("(array ");
         print_typespec(t->array.elem);
-        printf(" ");
-        print_expr(t->array.size);
-        printf(")");
+        print_char(' ');
+        if (t->array.size) {
+            print_expr(t->array.size);
+        } else {
+            print_str("nil");
+        }
+        print_char(')');
         break;
     case TYPESPEC_PTR:
-        printf("(ptr ");
+        print_str("(ptr ");
         print_typespec(t->ptr.elem);
-        printf(")");
+        print_char(')');
+        break;
+    case TYPESPEC_ERROR:
+        print_str("(error)");
         break;
     default:
         assert(0);
@@ -45,78 +129,89 @@ void print_expr(Expr *expr) {
     Expr *e = expr;
     switch (e->kind) {
     case EXPR_INT:
-        printf("%llu", e->int_val);
+        print_uint(e->int_val);
         break;
     case EXPR_FLOAT:
-        printf("%f", e->float_val);
+        print_double(e->float_val);
         break;
     case EXPR_STR:
-        printf("\"%s\"", e->str_val);
+        print_char('"');
+        print_str(e->str_val);
+        print_char('"');
         break;
     case EXPR_IDENT:
-        printf("%s", e->name);
+        print_str(e->name);
         break;
     case EXPR_CAST:
-        printf("(cast ");
+        print_str("(cast ");
         print_typespec(e->cast.type);
-        printf(" ");
+        print_char(' ');
         print_expr(e->cast.expr);
-        printf(")");
+        print_char(')');
         break;
     case EXPR_CALL:
-        printf("(");
+        print_char('(');
         print_expr(e->call.expr);
         for (Expr **it = e->call.args; it != e->call.args + e->call.num_args; it++) {
-            printf(" ");
+            print_char(' ');
             print_expr(*it);
         }
-        printf(")");
+        print_char(')');
         break;
     case EXPR_INDEX:
-        printf("(index ");
+        print_str("(index ");
         print_expr(e->index.expr);
-        printf(" ");
+        print_char(' ');
         print_expr(e->index.index);
-        printf(")");
+        print_char(')');
         break;
     case EXPR_FIELD:
-        printf("(field ");
+        print_str("(field ");
         print_expr(e->field.expr);
-        printf(" %s)", e->field.name);
+        print_char(' ');
+        print_str(e->field.name);
+        print_char(')');
         break;
     case EXPR_COMPOUND:
-        printf("(compound ");
+        print_str("(compound ");
         if (e->compound.type) {
             print_typespec(e->compound.type);
         } else {
-            printf("nil");
+            print_str("nil");
         }
         for (Expr **it = e->compound.args; it != e->compound.args + e->compound.num_args; it++) {
-            printf(" ");
+            print_char(' ');
             print_expr(*it);
         }
-        printf(")");
+        print_char(')');
         break;
     case EXPR_UNARY:
-        printf("(%s ", temp_token_kind_str(e->unary.op));
+        print_char('(');
+        print_str(temp_token_kind_str(e->unary.op));
+        print_char(' ');
         print_expr(e->unary.expr);
-        printf(")");
+        print_char(')');
         break;
     case EXPR_BINARY:
-        printf("(%s ", temp_token_kind_str(e->binary.op));
+        print_char('(');
+        print_str(temp_token_kind_str(e->binary.op));
+        print_char(' ');
         print_expr(e->binary.left);
-        printf(" ");
+        print_char(' ');
         print_expr(e->binary.right);
-        printf(")");
+        print_char(')');
         break;
     case EXPR_TERNARY:
-        printf("(? ");
+        print_str("(? ");
         print_expr(e->ternary.cond);
-        printf(" ");
+        print_char(' ');
         print_expr(e->ternary.then_expr);
-        printf(" ");
+        print_char(' ');
         print_expr(e->ternary.else_expr);
-        printf(")");
+        print_char(')');
+        break;
+    case EXPR_ERROR:
+        print_str("(error)");
         break;
     default:
         assert(0);
@@ -125,121 +220,141 @@ void print_expr(Expr *expr) {
 }
 
 void print_stmt_block(StmtBlock block) {
-    printf("(block");
+    print_str("(block");
     indent++;
     for (Stmt **it = block.stmts; it != block.stmts + block.num_stmts; it++) {
         print_newline();
         print_stmt(*it);
     }
     indent--;
-    printf(")");
+    print_char(')');
 }
 
 void print_stmt(Stmt *stmt) {
     Stmt *s = stmt;
     switch (s->kind) {
     case STMT_RETURN:
-        printf("(return ");
+        print_str("(return ");
         print_expr(s->return_stmt.expr);
-        printf(")");
+        print_char(')');
         break;
     case STMT_BREAK:
-        printf("(break)");
+        print_str("(break)");
         break;
     case STMT_CONTINUE:
-        printf("(continue)");
+        print_str("(continue)");
         break;
     case STMT_BLOCK:
         print_stmt_block(s->block);
         break;
     case STMT_IF:
-        printf("(if ");
+        print_str("(if ");
         print_expr(s->if_stmt.cond);
         indent++;
         print_newline();
         print_stmt_block(s->if_stmt.then_block);
         for (ElseIf *it = s->if_stmt.elseifs; it != s->if_stmt.elseifs + s->if_stmt.num_elseifs; it++) {
             print_newline();
-            printf("elseif ");
+            print_str("elseif ");
             print_expr(it->cond);
             print_newline();
             print_stmt_block(it->block);
         }
         if (s->if_stmt.else_block.num_stmts != 0) {
             print_newline();
-            printf("else ");
+            print_str("else ");
             print_newline();
             print_stmt_block(s->if_stmt.else_block);
         }
         indent--;
-        printf(")");
+        print_char(')');
         break;
     case STMT_WHILE:
-        printf("(while ");
+        print_str("(while ");
         print_expr(s->while_stmt.cond);
         indent++;
         print_newline();
         print_stmt_block(s->while_stmt.block);
         indent--;
-        printf(")");
+        print_char(')');
         break;
     case STMT_DO_WHILE:
-        printf("(do-while ");
+        print_str("(do-while ");
         print_expr(s->while_stmt.cond);
         indent++;
         print_newline();
         print_stmt_block(s->while_stmt.block);
         indent--;
-        printf(")");
+        print_char(')');
         break;
     case STMT_FOR:
-        printf("(for ");
-        print_stmt(s->for_stmt.init);
-        print_expr(s->for_stmt.cond);
-        print_stmt(s->for_stmt.next);
+        print_str("(for ");
+        if (s->for_stmt.init) {
+            print_stmt(s->for_stmt.init);
+        } else {
+            print_str("nil");
+        }
+        if (s->for_stmt.cond) {
+            print_expr(s->for_stmt.cond);
+        } else {
+            print_str("nil");
+        }
+        if (s->for_stmt.next) {
+            print_stmt(s->for_stmt.next);
+        } else {
+            print_str("nil");
+        }
         indent++;
         print_newline();
         print_stmt_block(s->for_stmt.block);
         indent--;
-        printf(")");
+        print_char(')');
         break;
     case STMT_SWITCH:
-        printf("(switch ");
+        print_str("(switch ");
         print_expr(s->switch_stmt.expr);
         indent++;
         for (SwitchCase *it = s->switch_stmt.cases; it != s->switch_stmt.cases + s->switch_stmt.num_cases; it++) {
             print_newline();
-            printf("(case (%s", it->is_default ? " default" : "");
+            print_str("(case (");
+            print_str(it->is_default ? " default" : "");
             for (Expr **expr = it->exprs; expr != it->exprs + it->num_exprs; expr++) {
-                printf(" ");
+                print_char(' ');
                 print_expr(*expr);
             }
-            printf(" ) ");
+            print_str(" ) ");
             indent++;
             print_newline();
             print_stmt_block(it->block);
             indent--;
         }
         indent--;
-        printf(")");
+        print_char(')');
         break;
     case STMT_ASSIGN:
-        printf("(%s ", token_kind_name(s->assign.op));
+        print_char('(');
+        print_str(temp_token_kind_str(s->assign.op));
+        print_char(' ');
         print_expr(s->assign.left);
         if (s->assign.right) {
-            printf(" ");
+            print_char(' ');
             print_expr(s->assign.right);
         }
-        printf(")");
+        print_char(')');
         break;
     case STMT_INIT:
-        printf("(:= %s ", s->init.name);
+        print_str("(:= ");
+        print_str(s->init.name);
+        print_char(' ');
         print_expr(s->init.expr);
-        printf(")");
+        print_char(')');
         break;
     case STMT_EXPR:
         print_expr(s->expr);
         break;
+    case STMT_ERROR:
+        print_str("(error)");
+        break;
     default:
         assert(0);
         break;
@@ -250,12 +365,22 @@ void print_aggregate_decl(Decl *decl) {
     Decl *d = decl;
     for (AggregateItem *it = d->aggregate.items; it != d->aggregate.items + d->aggregate.num_items; it++) {
         print_newline();
-        printf("(");
+        print_char('(');
         print_typespec(it->types);
         for (const char **name = it->names; name != it->names + it->num_names; name++) {
-            printf(" %s", *name);
+            print_char(' ');
+            print_str(*name);
         }
-        printf(")");
+        print_char(')');
+    }
+}
+
+// Shows the value of a const or enum item once it has been evaluated.
+void print_decl_const_val(Decl *decl, const char *name) {
+    ConstVal val;
+    if (decl_const_val(decl, name, &val)) {
+        print_str(" = ");
+        print_const_val(val);
     }
 }
 
@@ -263,74 +388,98 @@ void print_decl(Decl *decl) {
     Decl *d = decl;
     switch (d->kind) {
     case DECL_ENUM:
-        printf("(enum %s", d->name);
+        print_str("(enum ");
+        print_str(d->name);
         indent++;
         for (EnumItem *it = d->enum_decl.items; it != d->enum_decl.items + d->enum_decl.num_items; it++) {
             print_newline();
-            printf("(%s ", it->name);
+            print_char('(');
+            print_str(it->name);
+            print_char(' ');
             if (it->expr) {
                 print_expr(it->expr);
             } else {
-                printf("nil");
+                print_str("nil");
             }
-            printf(")");
+            print_decl_const_val(d, it->name);
+            print_char(')');
         }
         indent--;
-        printf(")");
+        print_char(')');
         break;
     case DECL_STRUCT:
-        printf("(struct %s", d->name);
+        print_str("(struct ");
+        print_str(d->name);
         indent++;
         print_aggregate_decl(d);
         indent--;
-        printf(")");
+        print_char(')');
         break;
     case DECL_UNION:
-        printf("(union %s", d->name);
+        print_str("(union ");
+        print_str(d->name);
         indent++;
         print_aggregate_decl(d);
         indent--;
-        printf(")");
+        print_char(')');
         break;
     case DECL_LET:
-        printf("(let %s ", d->name);
+        print_str("(let ");
+        print_str(d->name);
+        print_char(' ');
         if (d->let.type) {
             print_typespec(d->let.type);
         } else {
-            printf("nil");
+            print_str("nil");
+        }
+        print_char(' ');
+        if (d->let.expr) {
+            print_expr(d->let.expr);
+        } else {
+            print_str("nil");
         }
-        printf(" ");
-        print_expr(d->let.expr);
-        printf(")");
+        print_char(')');
         break;
     case DECL_CONST:
-        printf("(const %s ", d->name);
+        print_str("(const ");
+        print_str(d->name);
+        print_char(' ');
         print_expr(d->const_decl.expr);
-        printf(")");
+        print_decl_const_val(d, d->name);
+        print_char(')');
         break;
     case DECL_TYPEDEF:
-        printf("(typedef %s ", d->name);
+        print_str("(typedef ");
+        print_str(d->name);
+        print_char(' ');
         print_typespec(d->typedef_decl.type);
-        printf(")");
+        print_char(')');
         break;
     case DECL_FN:
-        printf("(fn %s ", d->name);
-        printf("(");
+        print_str("(fn ");
+        print_str(d->name);
+        print_char(' ');
+        print_char('(');
         for (FnParam *it = d->fn.params; it != d->fn.params + d->fn.num_params; it++) {
-            printf(" %s ", it->name);
+            print_char(' ');
+            print_str(it->name);
+            print_char(' ');
             print_typespec(it->type);
         }
-        printf(" ) ");
+        print_str(" ) ");
         if (d->fn.ret_type) {
             print_typespec(d->fn.ret_type);
         } else {
-            printf("nil");
+            print_str("nil");
         }
         indent++;
         print_newline();
         print_stmt_block(d->fn.block);
         indent--;
-        printf(")");
+        print_char(')');
+        break;
+    case DECL_ERROR:
+        print_str("(error)");
         break;
     default:
         assert(0);
@@ -338,6 +487,14 @@ void print_decl(Decl *decl) {
     }
 }
 
+void print_decls(Decl **decls, size_t num_decls) {
+    for (size_t i = 0; i < num_decls; i++) {
+        print_decl(decls[i]);
+        print_char('\n');
+    }
+    print_flush();
+}
+
 void print_test(void) {
     Expr *exprs[] = {
         expr_binary('+', expr_int(1), expr_int(2)),
@@ -351,7 +508,7 @@ void print_test(void) {
     };
     for (Expr **it = exprs; it != exprs + sizeof(exprs) / sizeof(*exprs); it++) {
         print_expr(*it);
-        printf("\n");
+        print_char('\n');
     }
 
     // Statements
@@ -423,6 +580,58 @@ void print_test(void) {
     };
     for (Stmt **it = stmts; it != stmts + sizeof(stmts) / sizeof(*stmts); it++) {
         print_stmt(*it);
-        printf("\n");
+        print_char('\n');
+    }
+    print_flush();
+}
+
+// Captures the printed form of decl, parsed from src.
+char *print_test_capture(const char *src) {
+    init_stream(src);
+    Decl *decl = parse_decl();
+    print_capture();
+    print_decl(decl);
+    return print_release();
+}
+
+void print_sink_test(void) {
+    char *output = print_test_capture("fn f(a: int): int { if (a) { return 18446744073709551615; } return 0; }");
+    assert(strcmp(output, "(fn f ( a int ) int\n"
+                          "  (block\n"
+                          "    (if a\n"
+                          "      (block\n"
+                          "        (return 18446744073709551615)))\n"
+                          "    (return 0)))") == 0);
+    buf_free(output);
+    output = print_test_capture("let x: float[4] = {1.5, \"s\", v.f}");
+    assert(strcmp(output, "(let x (array float 4) (compound nil 1.5 \"s\" (field v f)))") == 0);
+    buf_free(output);
+
+    // Deep nesting indents past any fixed-size padding string.
+    char *src = NULL;
+    buf_printf(src, "fn g() ");
+    for (int i = 0; i < 50; i++) {
+        buf_printf(src, "{ ");
+    }
+    for (int i = 0; i < 50; i++) {
+        buf_printf(src, "} ");
+    }
+    output = print_test_capture(src);
+    assert(strstr(output, "\n                                                                                                    (block))"));
+    buf_free(output);
+    buf_free(src);
+
+    // Writing through a file flushes in bulk once the buffer fills up.
+    FILE *file = tmpfile();
+    printer.file = file;
+    for (size_t i = 0; i < PRINT_FLUSH_SIZE; i++) {
+        print_char('0' + i % 10);
     }
+    assert(ftell(file) == 0);
+    print_char('x');
+    assert(ftell(file) == PRINT_FLUSH_SIZE && buf_len(printer.buf) == 1);
+    print_flush();
+    assert(ftell(file) == PRINT_FLUSH_SIZE + 1 && buf_len(printer.buf) == 0);
+    printer.file = NULL;
+    fclose(file);
 }
@@ -0,0 +1,343 @@
+#include "ast.h"
+
+PurityStats purity_stats;
+Arena purity_arena;
+Map purity_fns;
+size_t purity_next_index;
+PurityFn *purity_scanning;
+PurityFn **purity_stack; // Tarjan's stack of fns whose SCC is still open
+AstVisitor purity_visitor;
+
+PurityFn *purity_fn(Decl *decl) {
+    assert(decl->kind == DECL_FN);
+    PurityFn *fn = map_get(&purity_fns, decl);
+    if (!fn) {
+        fn = arena_alloc(&purity_arena, sizeof(PurityFn));
+        *fn = (PurityFn){.decl = decl};
+        map_put(&purity_fns, decl, fn);
+    }
+    return fn;
+}
+
+bool purity_through_pointer(Expr *base) {
+    return !base->type || base->type->kind == TYPE_PTR;
+}
+
+// What assigning to left writes. Fields and elements of a local aggregate
+// are the local's own; anything reached through a pointer is memory.
+unsigned purity_target(Expr *left) {
+    switch (left->kind) {
+    case EXPR_IDENT:
+        if (left->sym && (left->sym->kind == SYM_LOCAL || left->sym->kind == SYM_PARAM)) {
+            return 0;
+        }
+        return left->sym && left->sym->kind == SYM_LET ? PURITY_WRITES_GLOBALS : PURITY_WRITES_MEMORY;
+    case EXPR_FIELD:
+        if (purity_through_pointer(left->field.expr)) {
+            return PURITY_WRITES_MEMORY;
+        }
+        return purity_target(left->field.expr);
+    case EXPR_INDEX:
+        if (purity_through_pointer(left->index.expr)) {
+            return PURITY_WRITES_MEMORY;
+        }
+        return purity_target(left->index.expr);
+    default:
+        return PURITY_WRITES_MEMORY;
+    }
+}
+
+// Targets are visited as exprs too, so they count as read as well as
+// written.
+VisitResult purity_pre(AstNode node, void *ctx) {
+    (void)ctx;
+    PurityFn *fn = purity_scanning;
+    if (node.kind == AST_TYPESPEC) {
+        return VISIT_SKIP;
+    }
+    if (node.kind == AST_STMT) {
+        if (node.stmt->kind == STMT_ASSIGN) {
+            fn->own |= purity_target(node.stmt->assign.left);
+        }
+        return VISIT_CONTINUE;
+    }
+    if (node.kind != AST_EXPR) {
+        return VISIT_CONTINUE;
+    }
+    Expr *expr = node.expr;
+    switch (expr->kind) {
+    case EXPR_IDENT:
+        if (expr->sym && expr->sym->kind == SYM_LET) {
+            fn->own |= PURITY_READS_GLOBALS;
+        }
+        break;
+    case EXPR_FIELD:
+        if (purity_through_pointer(expr->field.expr)) {
+            fn->own |= PURITY_READS_MEMORY;
+        }
+        break;
+    case EXPR_INDEX:
+        if (purity_through_pointer(expr->index.expr)) {
+            fn->own |= PURITY_READS_MEMORY;
+        }
+        break;
+    case EXPR_UNARY:
+        if (expr->unary.op == '*') {
+            fn->own |= PURITY_READS_MEMORY;
+        }
+        break;
+    case EXPR_CALL: {
+        Expr *callee = expr->call.expr;
+        if (callee->kind != EXPR_IDENT || !callee->sym || callee->sym->kind != SYM_FN) {
+            fn->own |= PURITY_CALLS_UNKNOWN;
+            break;
+        }
+        Decl *decl = callee->sym->decl;
+        bool seen = false;
+        for (size_t i = 0; i < buf_len(fn->callees) && !seen; i++) {
+            seen = fn->callees[i] == decl;
+        }
+        if (!seen) {
+            buf_push(fn->callees, decl);
+        }
+        break;
+    }
+    default:
+        break;
+    }
+    return VISIT_CONTINUE;
+}
+
+// Drops fn from the callers of the fns it called when last scanned.
+void purity_unlink(PurityFn *fn) {
+    for (size_t i = 0; i < buf_len(fn->callees); i++) {
+        PurityFn *callee = purity_fn(fn->callees[i]);
+        size_t len = 0;
+        for (size_t j = 0; j < buf_len(callee->callers); j++) {
+            if (callee->callers[j] != fn) {
+                callee->callers[len++] = callee->callers[j];
+            }
+        }
+        buf_resize(callee->callers, len);
+    }
+    buf_clear(fn->callees);
+}
+
+// Finds what fn's own body does and which fns it calls, and adds fn to
+// their callers.
+void purity_scan(PurityFn *fn) {
+    if (fn->scanned) {
+        return;
+    }
+    if (!purity_visitor.pre) {
+        purity_visitor = (AstVisitor){.pre = purity_pre};
+    }
+    fn->scanned = true;
+    fn->own = 0;
+    purity_unlink(fn);
+    purity_scanning = fn;
+    StmtBlock block = fn->decl->fn.block;
+    for (size_t i = 0; i < block.num_stmts; i++) {
+        ast_visit(&purity_visitor, ast_stmt(block.stmts[i]));
+    }
+    purity_scanning = NULL;
+    for (size_t i = 0; i < buf_len(fn->callees); i++) {
+        buf_push(purity_fn(fn->callees[i])->callers, fn);
+    }
+    purity_stats.scans++;
+}
+
+void purity_visit(PurityFn *fn) {
+    purity_scan(fn);
+    fn->index = fn->lowlink = ++purity_next_index;
+    fn->next_callee = 0;
+    fn->on_stack = true;
+    buf_push(purity_stack, fn);
+}
+
+// Pops fn's SCC off the stack. Its fns call each other, so they share one
+// result: everything any of them does, plus what the SCCs they call do,
+// which are solved already.
+void purity_close(PurityFn *fn) {
+    size_t start = buf_len(purity_stack);
+    do {
+        start--;
+    } while (purity_stack[start] != fn);
+    size_t size = buf_len(purity_stack) - start;
+    unsigned effects = 0;
+    bool recursive = size > 1;
+    for (size_t i = start; i < buf_len(purity_stack); i++) {
+        PurityFn *member = purity_stack[i];
+        effects |= member->own;
+        for (size_t j = 0; j < buf_len(member->callees); j++) {
+            PurityFn *callee = purity_fn(member->callees[j]);
+            if (callee->solved) {
+                effects |= callee->effects;
+            }
+            recursive |= callee == member;
+        }
+    }
+    for (size_t i = start; i < buf_len(purity_stack); i++) {
+        PurityFn *member = purity_stack[i];
+        member->effects = effects;
+        member->recursive = recursive;
+        member->solved = true;
+        member->on_stack = false;
+        member->index = 0;
+    }
+    buf_truncate(purity_stack, start);
+    purity_stats.sccs++;
+}
+
+// Tarjan's algorithm over the unsolved part of the call graph reachable
+// from root, with an explicit stack so long call chains are safe. SCCs
+// close callees first, so each is solved in one pass.
+void purity_solve(PurityFn *root) {
+    if (root->solved) {
+        return;
+    }
+    PurityFn **path = NULL;
+    purity_visit(root);
+    buf_push(path, root);
+    while (buf_len(path)) {
+        PurityFn *fn = path[buf_len(path) - 1];
+        if (fn->next_callee < buf_len(fn->callees)) {
+            PurityFn *callee = purity_fn(fn->callees[fn->next_callee++]);
+            if (callee->solved) {
+                continue;
+            }
+            if (!callee->index) {
+                purity_visit(callee);
+                buf_push(path, callee);
+            } else if (callee->on_stack) {
+                fn->lowlink = MIN(fn->lowlink, callee->index);
+            }
+            continue;
+        }
+        buf_pop(path);
+        if (buf_len(path)) {
+            PurityFn *caller = path[buf_len(path) - 1];
+            caller->lowlink = MIN(caller->lowlink, fn->lowlink);
+        }
+        if (fn->lowlink == fn->index) {
+            purity_close(fn);
+        }
+    }
+    buf_free(path);
+}
+
+unsigned purity_of(Decl *decl) {
+    PurityFn *fn = purity_fn(decl);
+    purity_solve(fn);
+    return fn->effects;
+}
+
+bool purity_pure(Decl *decl) {
+    return purity_of(decl) == 0;
+}
+
+bool purity_side_effect_free(Decl *decl) {
+    return !(purity_of(decl) & PURITY_WRITES);
+}
+
+// Results are closed under calls: a solved fn's callees are all solved.
+// So when a fn is already unsolved, so is everything that calls it.
+void purity_invalidate(Decl *decl) {
+    PurityFn *fn = map_get(&purity_fns, decl);
+    if (!fn) {
+        return;
+    }
+    fn->scanned = false;
+    PurityFn **stack = NULL;
+    buf_push(stack, fn);
+    while (buf_len(stack)) {
+        PurityFn *it = buf_pop(stack);
+        if (!it->solved) {
+            continue;
+        }
+        it->solved = false;
+        purity_stats.invalidated++;
+        for (size_t i = 0; i < buf_len(it->callers); i++) {
+            buf_push(stack, it->callers[i]);
+        }
+    }
+    buf_free(stack);
+}
+
+void purity_reset(void) {
+    for (size_t i = 0; i < purity_fns.cap; i++) {
+        if (purity_fns.keys[i]) {
+            PurityFn *fn = (PurityFn *)(uintptr_t)purity_fns.vals[i];
+            buf_free(fn->callees);
+            buf_free(fn->callers);
+        }
+    }
+    map_free(&purity_fns);
+    arena_free(&purity_arena);
+    buf_free(purity_stack);
+    visitor_free(&purity_visitor);
+    purity_visitor = (AstVisitor){0};
+    purity_next_index = 0;
+}
+
+Decl *purity_test_decl(Decl **decls, const char *name) {
+    for (size_t i = 0; i < buf_len(decls); i++) {
+        if (strcmp(decls[i]->name, name) == 0) {
+            return decls[i];
+        }
+    }
+    assert(0);
+    return NULL;
+}
+
+void purity_test(void) {
+    init_stream("let g: int\n"
+                "struct S { a: int[2]; p: int*; }\n"
+                "fn sq(x: int): int { s := (:S){}; s.a[0] = x; return s.a[0] * x; }\n"
+                "fn get(p: int*): int { return p[0] + sq(2); }\n"
+                "fn set(p: int*) { s := (:S){}; s.p = p; s.p[1] = get(p); }\n"
+                "fn glob(): int { return g; }\n"
+                "fn bump() { g++; }\n"
+                "fn even(n: int): int { return n == 0 ? 1 : odd(n - 1); }\n"
+                "fn odd(n: int): int { return n == 0 ? 0 : even(n - 1); }\n"
+                "fn loop(n: int): int { if (n) { bump(); } return n ? loop(n - 1) + glob() : 0; }\n"
+                "fn top(p: int*): int { return sq(get(p)) + glob(); }\n");
+    Decl **decls = parse_file();
+    assert(num_syntax_errors == 0);
+    assert(check_decls(decls, buf_len(decls)));
+    Decl *sq = purity_test_decl(decls, "sq"), *get = purity_test_decl(decls, "get");
+    Decl *set = purity_test_decl(decls, "set"), *glob = purity_test_decl(decls, "glob");
+    Decl *bump = purity_test_decl(decls, "bump"), *even = purity_test_decl(decls, "even");
+    Decl *loop = purity_test_decl(decls, "loop"), *top = purity_test_decl(decls, "top");
+    // Writes to a local's fields and elements stay in the fn, and effects
+    // come through calls.
+    assert(purity_pure(sq));
+    assert(purity_of(get) == PURITY_READS_MEMORY);
+    assert(purity_of(set) == (PURITY_READS_MEMORY | PURITY_WRITES_MEMORY));
+    assert(purity_of(glob) == PURITY_READS_GLOBALS);
+    assert(purity_of(bump) == (PURITY_READS_GLOBALS | PURITY_WRITES_GLOBALS));
+    assert(purity_side_effect_free(top) && purity_of(top) == (PURITY_READS_MEMORY | PURITY_READS_GLOBALS));
+    // Mutual and self recursion are solved as one SCC each.
+    assert(purity_pure(even) && purity_fn(even)->recursive && !purity_fn(sq)->recursive);
+    assert(!purity_side_effect_free(loop) && purity_fn(loop)->recursive);
+    // Each fn is scanned once however often it is asked about.
+    assert(purity_stats.scans == 9 && purity_stats.sccs == 8);
+    // Changing get's body to set's makes top write memory. Only get and
+    // the fns that call it are looked at again.
+    get->fn.block = set->fn.block;
+    purity_invalidate(get);
+    assert(purity_stats.invalidated == 3);
+    assert(purity_of(top) == (PURITY_READS_MEMORY | PURITY_WRITES_MEMORY | PURITY_READS_GLOBALS));
+    assert(purity_of(set) == (PURITY_READS_MEMORY | PURITY_WRITES_MEMORY));
+    assert(purity_of(loop) == (PURITY_READS_GLOBALS | PURITY_WRITES_GLOBALS));
+    assert(purity_stats.scans == 10 && purity_stats.sccs == 11);
+    // get now calls itself, and set only calls it. sq is left with one
+    // caller, and get has each of its own once.
+    assert(purity_fn(get)->recursive && !purity_fn(set)->recursive);
+    assert(buf_len(purity_fn(sq)->callers) == 1 && purity_fn(sq)->callers[0] == purity_fn(top));
+    assert(buf_len(purity_fn(get)->callers) == 3);
+    purity_stats = (PurityStats){0};
+    buf_free(decls);
+    check_reset();
+    resolve_reset();
+}
@@ -0,0 +1,812 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <pthread.h>
+#include <unistd.h>
+
+#include "ast.h"
+
+Arena sym_arena;
+Map global_syms;
+Sym **syms;
+Sym **sym_deps;
+Sym **ordered_syms;
+char **resolve_errors;
+size_t resolve_threads;
+
+const char *sym_kind_names[] = {
+    [SYM_TYPE] = "type",
+    [SYM_CONST] = "const",
+    [SYM_ENUM_CONST] = "enum const",
+    [SYM_LET] = "let",
+    [SYM_FN] = "fn",
+    [SYM_PARAM] = "param",
+    [SYM_LOCAL] = "local",
+};
+
+const char *builtin_type_names[] = {"void", "bool", "char", "int", "uint", "float"};
+
+void vresolve_error(char ***errors, const char *fmt, va_list args) {
+    char buf[1024];
+    int n = snprintf(buf, sizeof(buf), "Resolve Error: ");
+    vsnprintf(buf + n, sizeof(buf) - n, fmt, args);
+    size_t len = strlen(buf) + 1;
+    buf_push(*errors, memcpy(xmalloc(len), buf, len));
+}
+
+void resolve_error(const char *fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    vresolve_error(&resolve_errors, fmt, args);
+    va_end(args);
+}
+
+void local_resolvers_free(void);
+
+void resolve_reset(void) {
+    local_resolvers_free();
+    arena_free(&sym_arena);
+    map_free(&global_syms);
+    buf_free(syms);
+    buf_free(sym_deps);
+    buf_free(ordered_syms);
+    for (char **it = resolve_errors; it != buf_end(resolve_errors); it++) {
+        free(*it);
+    }
+    buf_free(resolve_errors);
+}
+
+Sym *sym_get(const char *name) {
+    return map_get(&global_syms, name);
+}
+
+Sym *sym_new(const char *name, SymKind kind, Decl *decl) {
+    Sym *old = sym_get(name);
+    if (old) {
+        resolve_error("'%s' is already defined (%s)", name, sym_kind_names[old->kind]);
+        return NULL;
+    }
+    Sym *sym = arena_alloc(&sym_arena, sizeof(Sym));
+    *sym = (Sym){.name = name, .kind = kind, .decl = decl, .id = buf_len(syms)};
+    map_put(&global_syms, name, sym);
+    buf_push(syms, sym);
+    return sym;
+}
+
+void sym_builtins(void) {
+    for (size_t i = 0; i < sizeof(builtin_type_names) / sizeof(*builtin_type_names); i++) {
+        Sym *sym = sym_new(str_intern(builtin_type_names[i]), SYM_TYPE, NULL);
+        sym->state = SYM_RESOLVED;
+        sym->type = type_builtin(sym->name);
+        sym->check_state = SYM_RESOLVED;
+    }
+}
+
+void sym_global_decl(Decl *decl) {
+    switch (decl->kind) {
+    case DECL_ENUM: {
+        Sym *sym = sym_new(decl->name, SYM_TYPE, decl);
+        for (size_t i = 0; sym && i < decl->enum_decl.num_items; i++) {
+            Sym *item = sym_new(decl->enum_decl.items[i].name, SYM_ENUM_CONST, decl);
+            if (item) {
+                item->parent = sym;
+            }
+        }
+        break;
+    }
+    case DECL_STRUCT:
+    case DECL_UNION:
+    case DECL_TYPEDEF:
+        sym_new(decl->name, SYM_TYPE, decl);
+        break;
+    case DECL_CONST:
+        sym_new(decl->name, SYM_CONST, decl);
+        break;
+    case DECL_LET:
+        sym_new(decl->name, SYM_LET, decl);
+        break;
+    case DECL_FN:
+        sym_new(decl->name, SYM_FN, decl);
+        break;
+    case DECL_ERROR:
+        break;
+    default:
+        assert(0);
+        break;
+    }
+}
+
+/*
+ * Dependency collection. A decl depends on every global it needs complete
+ * before it can be laid out or evaluated. Names seen only behind a pointer
+ * or inside a fn type are weak: they must exist, but they add no edge, so
+ * `struct S { next: S*; }` is fine while `struct S { s: S; }` is a cycle.
+ */
+
+Sym *resolving_sym;
+
+Sym *deps_name(const char *name, bool weak) {
+    Sym *sym = sym_get(name);
+    if (!sym) {
+        resolve_error("unresolved name '%s' in '%s'", name, resolving_sym->name);
+        return NULL;
+    }
+    Sym *dep = sym->parent ? sym->parent : sym;
+    // Items of the enum being declared may refer to each other.
+    bool own_item = sym->parent && dep == resolving_sym;
+    if (!weak && dep->decl && !own_item) {
+        buf_push(sym_deps, dep);
+    }
+    return sym;
+}
+
+void deps_expr(Expr *expr);
+
+void deps_typespec(Typespec *type, bool weak) {
+    if (!type) {
+        return;
+    }
+    switch (type->kind) {
+    case TYPESPEC_IDENT:
+        deps_name(type->name, weak);
+        break;
+    case TYPESPEC_FN:
+        for (size_t i = 0; i < type->fn.num_args; i++) {
+            deps_typespec(type->fn.args[i], true);
+        }
+        deps_typespec(type->fn.ret, true);
+        break;
+    case TYPESPEC_ARRAY:
+        deps_typespec(type->array.elem, weak);
+        deps_expr(type->array.size);
+        break;
+    case TYPESPEC_PTR:
+        deps_typespec(type->ptr.elem, true);
+        break;
+    case TYPESPEC_ERROR:
+        break;
+    default:
+        assert(0);
+        break;
+    }
+}
+
+void deps_exprs(Expr **exprs, size_t num_exprs) {
+    for (size_t i = 0; i < num_exprs; i++) {
+        deps_expr(exprs[i]);
+    }
+}
+
+void deps_expr(Expr *expr) {
+    if (!expr) {
+        return;
+    }
+    switch (expr->kind) {
+    case EXPR_INT:
+    case EXPR_FLOAT:
+    case EXPR_STR:
+    case EXPR_ERROR:
+        break;
+    case EXPR_IDENT:
+        expr->sym = deps_name(expr->name, false);
+        break;
+    case EXPR_CAST:
+        deps_typespec(expr->cast.type, false);
+        deps_expr(expr->cast.expr);
+        break;
+    case EXPR_CALL:
+        deps_expr(expr->call.expr);
+        deps_exprs(expr->call.args, expr->call.num_args);
+        break;
+    case EXPR_INDEX:
+        deps_expr(expr->index.expr);
+        deps_expr(expr->index.index);
+        break;
+    case EXPR_FIELD:
+        deps_expr(expr->field.expr);
+        break;
+    case EXPR_COMPOUND:
+        deps_typespec(expr->compound.type, false);
+        deps_exprs(expr->compound.args, expr->compound.num_args);
+        break;
+    case EXPR_UNARY:
+        deps_expr(expr->unary.expr);
+        break;
+    case EXPR_BINARY:
+        deps_expr(expr->binary.left);
+        deps_expr(expr->binary.right);
+        break;
+    case EXPR_TERNARY:
+        deps_expr(expr->ternary.cond);
+        deps_expr(expr->ternary.then_expr);
+        deps_expr(expr->ternary.else_expr);
+        break;
+    default:
+        assert(0);
+        break;
+    }
+}
+
+// Function bodies are left to local resolution; only the signature is a
+// dependency here.
+void deps_decl(Decl *decl) {
+    switch (decl->kind) {
+    case DECL_ENUM:
+        for (size_t i = 0; i < decl->enum_decl.num_items; i++) {
+            deps_expr(decl->enum_decl.items[i].expr);
+        }
+        break;
+    case DECL_STRUCT:
+    case DECL_UNION:
+        for (size_t i = 0; i < decl->aggregate.num_items; i++) {
+            deps_typespec(decl->aggregate.items[i].types, false);
+        }
+        break;
+    case DECL_LET:
+        deps_typespec(decl->let.type, false);
+        deps_expr(decl->let.expr);
+        break;
+    case DECL_CONST:
+        deps_expr(decl->const_decl.expr);
+        break;
+    case DECL_TYPEDEF:
+        deps_typespec(decl->typedef_decl.type, false);
+        break;
+    case DECL_FN:
+        for (size_t i = 0; i < decl->fn.num_params; i++) {
+            deps_typespec(decl->fn.params[i].type, false);
+        }
+        deps_typespec(decl->fn.ret_type, false);
+        break;
+    default:
+        assert(0);
+        break;
+    }
+}
+
+/*
+ * Ordering. An iterative depth-first search emits each sym after all of its
+ * dependencies, so deep dependency chains cannot overflow the C stack. A
+ * dependency still being resolved closes a cycle, which is reported and the
+ * edge dropped so the rest of the order is still produced.
+ */
+
+typedef struct SymFrame {
+    Sym *sym;
+    size_t next_dep;
+} SymFrame;
+
+void resolve_cycle(SymFrame *stack, Sym *sym) {
+    SymFrame *start = buf_end(stack);
+    while (start[-1].sym != sym) {
+        start--;
+    }
+    char *path = NULL;
+    for (SymFrame *it = start - 1; it != buf_end(stack); it++) {
+        buf_printf(path, "%s -> ", it->sym->name);
+    }
+    buf_printf(path, "%s", sym->name);
+    resolve_error("cyclic dependency: %s", path);
+    buf_free(path);
+}
+
+void resolve_order(void) {
+    SymFrame *stack = NULL;
+    for (Sym **root = syms; root != buf_end(syms); root++) {
+        if ((*root)->state != SYM_UNRESOLVED || !(*root)->decl || (*root)->parent) {
+            continue;
+        }
+        (*root)->state = SYM_RESOLVING;
+        buf_push(stack, (SymFrame){*root, 0});
+        while (buf_len(stack)) {
+            SymFrame *frame = &stack[buf_len(stack) - 1];
+            Sym *sym = frame->sym;
+            if (frame->next_dep == sym->num_deps) {
+                sym->state = SYM_RESOLVED;
+                buf_push(ordered_syms, sym);
+                buf_pop(stack);
+                continue;
+            }
+            Sym *dep = sym_deps[sym->deps_start + frame->next_dep++];
+            if (dep->state == SYM_RESOLVING) {
+                resolve_cycle(stack, dep);
+            } else if (dep->state == SYM_UNRESOLVED) {
+                dep->state = SYM_RESOLVING;
+                buf_push(stack, (SymFrame){dep, 0});
+            }
+        }
+    }
+    buf_free(stack);
+}
+
+/*
+ * Local resolution. Each fn body is walked with a flat stack of the locals
+ * in scope and a map from each name to its innermost local, whose shadowed
+ * link is the binding it hides. Declaring a local pushes it and swaps it
+ * into the map; a scope is just the stack height on entry, and leaving it
+ * restores each popped name's shadowed binding. Names not in the map are
+ * globals. Bodies touch only their own locals and read the global table,
+ * so they are split across worker threads, each with its own resolver.
+ */
+
+typedef struct LocalResolver {
+    Arena arena; // Local syms, which idents point into until resolve_reset
+    Map bindings;
+    Sym **stack;
+    int depth;
+    Decl *fn;
+    size_t num_locals;
+    Decl **fns;
+    size_t num_fns;
+    char **errors;
+} LocalResolver;
+
+LocalResolver *local_resolvers;
+
+void local_error(LocalResolver *r, const char *fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    vresolve_error(&r->errors, fmt, args);
+    va_end(args);
+}
+
+void local_resolvers_free(void) {
+    for (LocalResolver *r = local_resolvers; r != buf_end(local_resolvers); r++) {
+        arena_free(&r->arena);
+        map_free(&r->bindings);
+        buf_free(r->stack);
+        for (char **it = r->errors; it != buf_end(r->errors); it++) {
+            free(*it);
+        }
+        buf_free(r->errors);
+    }
+    buf_free(local_resolvers);
+}
+
+void local_push(LocalResolver *r, const char *name, SymKind kind, Stmt *init) {
+    Sym *shadowed = map_get(&r->bindings, name);
+    if (shadowed && shadowed->depth == r->depth) {
+        local_error(r, "'%s' is already defined in this scope in '%s'", name, r->fn->name);
+    }
+    Sym *sym = arena_alloc(&r->arena, sizeof(Sym));
+    *sym = (Sym){.name = name, .kind = kind, .state = SYM_RESOLVED, .decl = r->fn, .id = r->num_locals++,
+                 .init = init, .shadowed = shadowed, .depth = r->depth};
+    map_put(&r->bindings, name, sym);
+    buf_push(r->stack, sym);
+}
+
+size_t local_enter(LocalResolver *r) {
+    r->depth++;
+    return buf_len(r->stack);
+}
+
+void local_leave(LocalResolver *r, size_t mark) {
+    while (buf_len(r->stack) > mark) {
+        Sym *sym = buf_pop(r->stack);
+        map_put(&r->bindings, sym->name, sym->shadowed);
+    }
+    r->depth--;
+}
+
+Sym *local_lookup(LocalResolver *r, const char *name) {
+    Sym *sym = map_get(&r->bindings, name);
+    return sym ? sym : sym_get(name);
+}
+
+void local_expr(LocalResolver *r, Expr *expr);
+
+void local_typespec(LocalResolver *r, Typespec *type) {
+    if (!type) {
+        return;
+    }
+    switch (type->kind) {
+    case TYPESPEC_IDENT:
+        if (!sym_get(type->name)) {
+            local_error(r, "unresolved type '%s' in '%s'", type->name, r->fn->name);
+        }
+        break;
+    case TYPESPEC_FN:
+        for (size_t i = 0; i < type->fn.num_args; i++) {
+            local_typespec(r, type->fn.args[i]);
+        }
+        local_typespec(r, type->fn.ret);
+        break;
+    case TYPESPEC_ARRAY:
+        // Sizes that use a name are never shared (see typespec_size_equal),
+        // so binding them here can't touch another fn's nodes.
+        local_typespec(r, type->array.elem);
+        local_expr(r, type->array.size);
+        break;
+    case TYPESPEC_PTR:
+        local_typespec(r, type->ptr.elem);
+        break;
+    case TYPESPEC_ERROR:
+        break;
+    default:
+        assert(0);
+        break;
+    }
+}
+
+void local_exprs(LocalResolver *r, Expr **exprs, size_t num_exprs) {
+    for (size_t i = 0; i < num_exprs; i++) {
+        local_expr(r, exprs[i]);
+    }
+}
+
+void local_expr(LocalResolver *r, Expr *expr) {
+    if (!expr) {
+        return;
+    }
+    switch (expr->kind) {
+    case EXPR_INT:
+    case EXPR_FLOAT:
+    case EXPR_STR:
+    case EXPR_ERROR:
+        break;
+    case EXPR_IDENT:
+        expr->sym = local_lookup(r, expr->name);
+        if (!expr->sym) {
+            local_error(r, "unresolved name '%s' in '%s'", expr->name, r->fn->name);
+        }
+        break;
+    case EXPR_CAST:
+        local_typespec(r, expr->cast.type);
+        local_expr(r, expr->cast.expr);
+        break;
+    case EXPR_CALL:
+        local_expr(r, expr->call.expr);
+        local_exprs(r, expr->call.args, expr->call.num_args);
+        break;
+    case EXPR_INDEX:
+        local_expr(r, expr->index.expr);
+        local_expr(r, expr->index.index);
+        break;
+    case EXPR_FIELD:
+        local_expr(r, expr->field.expr);
+        break;
+    case EXPR_COMPOUND:
+        local_typespec(r, expr->compound.type);
+        local_exprs(r, expr->compound.args, expr->compound.num_args);
+        break;
+    case EXPR_UNARY:
+        local_expr(r, expr->unary.expr);
+        break;
+    case EXPR_BINARY:
+        local_expr(r, expr->binary.left);
+        local_expr(r, expr->binary.right);
+        break;
+    case EXPR_TERNARY:
+        local_expr(r, expr->ternary.cond);
+        local_expr(r, expr->ternary.then_expr);
+        local_expr(r, expr->ternary.else_expr);
+        break;
+    default:
+        assert(0);
+        break;
+    }
+}
+
+void local_stmt(LocalResolver *r, Stmt *stmt);
+
+void local_stmt_block(LocalResolver *r, StmtBlock block) {
+    size_t mark = local_enter(r);
+    for (size_t i = 0; i < block.num_stmts; i++) {
+        local_stmt(r, block.stmts[i]);
+    }
+    local_leave(r, mark);
+}
+
+void local_stmt(LocalResolver *r, Stmt *stmt) {
+    if (!stmt) {
+        return;
+    }
+    switch (stmt->kind) {
+    case STMT_RETURN:
+        local_expr(r, stmt->return_stmt.expr);
+        break;
+    case STMT_BREAK:
+    case STMT_CONTINUE:
+    case STMT_ERROR:
+        break;
+    case STMT_BLOCK:
+        local_stmt_block(r, stmt->block);
+        break;
+    case STMT_IF:
+        local_expr(r, stmt->if_stmt.cond);
+        local_stmt_block(r, stmt->if_stmt.then_block);
+        for (size_t i = 0; i < stmt->if_stmt.num_elseifs; i++) {
+            local_expr(r, stmt->if_stmt.elseifs[i].cond);
+            local_stmt_block(r, stmt->if_stmt.elseifs[i].block);
+        }
+        local_stmt_block(r, stmt->if_stmt.else_block);
+        break;
+    case STMT_WHILE:
+    case STMT_DO_WHILE:
+        local_expr(r, stmt->while_stmt.cond);
+        local_stmt_block(r, stmt->while_stmt.block);
+        break;
+    case STMT_FOR: {
+        size_t mark = local_enter(r);
+        local_stmt(r, stmt->for_stmt.init);
+        local_expr(r, stmt->for_stmt.cond);
+        local_stmt(r, stmt->for_stmt.next);
+        local_stmt_block(r, stmt->for_stmt.block);
+        local_leave(r, mark);
+        break;
+    }
+    case STMT_SWITCH:
+        local_expr(r, stmt->switch_stmt.expr);
+        for (size_t i = 0; i < stmt->switch_stmt.num_cases; i++) {
+            local_exprs(r, stmt->switch_stmt.cases[i].exprs, stmt->switch_stmt.cases[i].num_exprs);
+            local_stmt_block(r, stmt->switch_stmt.cases[i].block);
+        }
+        break;
+    case STMT_ASSIGN:
+        local_expr(r, stmt->assign.left);
+        local_expr(r, stmt->assign.right);
+        break;
+    case STMT_INIT:
+        // The initializer still sees any binding the new local shadows.
+        local_expr(r, stmt->init.expr);
+        local_push(r, stmt->init.name, SYM_LOCAL, stmt);
+        break;
+    case STMT_EXPR:
+        local_expr(r, stmt->expr);
+        break;
+    default:
+        assert(0);
+        break;
+    }
+}
+
+void local_fn(LocalResolver *r, Decl *fn) {
+    r->fn = fn;
+    r->num_locals = 0;
+    size_t mark = local_enter(r);
+    for (size_t i = 0; i < fn->fn.num_params; i++) {
+        local_push(r, fn->fn.params[i].name, SYM_PARAM, NULL);
+    }
+    // Params share the body's outermost scope, so locals cannot redefine them.
+    for (size_t i = 0; i < fn->fn.block.num_stmts; i++) {
+        local_stmt(r, fn->fn.block.stmts[i]);
+    }
+    local_leave(r, mark);
+}
+
+void *local_worker(void *arg) {
+    LocalResolver *r = arg;
+    for (size_t i = 0; i < r->num_fns; i++) {
+        local_fn(r, r->fns[i]);
+    }
+    return NULL;
+}
+
+size_t resolve_num_threads(size_t num_fns) {
+    size_t num_threads = resolve_threads;
+    if (!num_threads) {
+        long num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        num_threads = num_cpus > 0 ? num_cpus : 1;
+    }
+    // Not worth a thread for fewer than RESOLVE_MIN_FNS_PER_THREAD bodies.
+    size_t max_threads = num_fns / RESOLVE_MIN_FNS_PER_THREAD;
+    num_threads = MIN(num_threads, max_threads);
+    return MAX(num_threads, 1);
+}
+
+// Hands each worker a contiguous run of fns and appends their errors in
+// worker order, so the output does not depend on scheduling.
+void resolve_locals(Decl **decls, size_t num_decls) {
+    Decl **fns = NULL;
+    for (size_t i = 0; i < num_decls; i++) {
+        if (decls[i]->kind == DECL_FN) {
+            buf_push(fns, decls[i]);
+        }
+    }
+    size_t num_fns = buf_len(fns);
+    size_t num_threads = resolve_num_threads(num_fns);
+    size_t first = buf_len(local_resolvers);
+    for (size_t i = 0; i < num_threads; i++) {
+        size_t start = num_fns * i / num_threads;
+        size_t end = num_fns * (i + 1) / num_threads;
+        buf_push(local_resolvers, (LocalResolver){.fns = fns + start, .num_fns = end - start});
+    }
+    LocalResolver *workers = local_resolvers + first;
+    if (num_threads == 1) {
+        local_worker(workers);
+    } else {
+        pthread_t *threads = xmalloc(num_threads * sizeof(pthread_t));
+        size_t num_started = 0;
+        for (; num_started < num_threads; num_started++) {
+            if (pthread_create(&threads[num_started], NULL, local_worker, &workers[num_started]) != 0) {
+                break;
+            }
+        }
+        // Whatever could not get a thread runs here.
+        for (size_t i = num_started; i < num_threads; i++) {
+            local_worker(&workers[i]);
+        }
+        for (size_t i = 0; i < num_started; i++) {
+            pthread_join(threads[i], NULL);
+        }
+        free(threads);
+    }
+    for (LocalResolver *r = workers; r != buf_end(local_resolvers); r++) {
+        for (char **it = r->errors; it != buf_end(r->errors); it++) {
+            buf_push(resolve_errors, *it);
+        }
+        buf_free(r->errors);
+        buf_free(r->stack);
+        map_free(&r->bindings);
+        r->fns = NULL;
+        r->num_fns = 0;
+    }
+    buf_free(fns);
+}
+
+void resolve_globals(Decl **decls, size_t num_decls) {
+    resolve_reset();
+    sym_builtins();
+    for (size_t i = 0; i < num_decls; i++) {
+        sym_global_decl(decls[i]);
+    }
+    // Dependencies go into one flat buffer, each sym owning a slice of it.
+    for (Sym **it = syms; it != buf_end(syms); it++) {
+        Sym *sym = *it;
+        if (!sym->decl || sym->parent) {
+            continue;
+        }
+        resolving_sym = sym;
+        sym->deps_start = buf_len(sym_deps);
+        deps_decl(sym->decl);
+        sym->num_deps = buf_len(sym_deps) - sym->deps_start;
+    }
+    resolving_sym = NULL;
+    resolve_order();
+}
+
+bool resolve_decls(Decl **decls, size_t num_decls) {
+    resolve_globals(decls, num_decls);
+    resolve_locals(decls, num_decls);
+    return buf_len(resolve_errors) == 0;
+}
+
+void resolve_order_str(char **out) {
+    for (Sym **it = ordered_syms; it != buf_end(ordered_syms); it++) {
+        buf_printf(*out, "%s%s", it == ordered_syms ? "" : " ", (*it)->name);
+    }
+}
+
+void resolve_test_case(const char *src, const char *order, const char *error) {
+    init_stream(src);
+    Decl **decls = parse_file();
+    assert(num_syntax_errors == 0);
+    bool ok = resolve_decls(decls, buf_len(decls));
+    assert(ok == !error);
+    if (error) {
+        assert(strstr(resolve_errors[0], error));
+    }
+    if (order) {
+        char *str = NULL;
+        resolve_order_str(&str);
+        assert(strcmp(str, order) == 0);
+        buf_free(str);
+    }
+    buf_free(decls);
+}
+
+VisitResult binding_trace_pre(AstNode node, void *ctx) {
+    if (node.kind == AST_EXPR && node.expr->kind == EXPR_IDENT) {
+        Sym *sym = node.expr->sym;
+        char **trace = ctx;
+        buf_printf(*trace, "%s:%s", node.expr->name, sym ? sym_kind_names[sym->kind] : "?");
+        if (sym && (sym->kind == SYM_PARAM || sym->kind == SYM_LOCAL)) {
+            buf_printf(*trace, "%zu", sym->id);
+        }
+        buf_printf(*trace, " ");
+    }
+    return VISIT_CONTINUE;
+}
+
+VisitResult binding_trace_post(AstNode node, void *ctx) {
+    (void)node;
+    (void)ctx;
+    return VISIT_CONTINUE;
+}
+
+// Resolves src and returns each ident with what it is bound to.
+char *binding_trace(const char *src, const char *error) {
+    init_stream(src);
+    Decl **decls = parse_file();
+    assert(num_syntax_errors == 0);
+    bool ok = resolve_decls(decls, buf_len(decls));
+    assert(ok == !error);
+    if (error) {
+        assert(strstr(resolve_errors[0], error));
+    }
+    char *trace = NULL;
+    AstVisitor visitor = {.pre = binding_trace_pre, .post = binding_trace_post, .ctx = &trace};
+    ast_visit_decls(&visitor, decls, buf_len(decls));
+    visitor_free(&visitor);
+    buf_free(decls);
+    return trace;
+}
+
+void local_test_case(const char *src, const char *expected, const char *error) {
+    char *trace = binding_trace(src, error);
+    assert(strcmp(trace ? trace : "", expected) == 0);
+    buf_free(trace);
+}
+
+void local_test(void) {
+    local_test_case("fn f(a: int): int { x := a; { x := x + 1; y := x; } return x + g; } let g: int",
+                    "a:param0 x:local1 x:local2 x:local1 g:let ", NULL);
+    local_test_case("fn f(n: int) { for (i := 0; i < n; i++) { i := i * 2; n += i; } while (n) { n--; } }",
+                    "i:local1 n:param0 i:local1 i:local1 n:param0 i:local2 n:param0 n:param0 ", NULL);
+    local_test_case("enum E { A } const k = A fn f(): E { switch (k) { case A: { return f(); } } }",
+                    "A:enum const k:const A:enum const f:fn ", NULL);
+    local_test_case("fn f() { { x := 1; } y := x; }", "x:? ", "unresolved name 'x' in 'f'");
+    local_test_case("fn f() { for (i := 0;;) {} i++; }", "i:? ", "unresolved name 'i' in 'f'");
+    local_test_case("fn f(a: int) { a := 1; }", "", "'a' is already defined in this scope in 'f'");
+    local_test_case("fn f(a: int, a: int) {}", "", "'a' is already defined in this scope in 'f'");
+    local_test_case("fn f() { x := 1; x := 2; }", "", "'x' is already defined in this scope in 'f'");
+    local_test_case("fn f() { p := (:Q){1}; }", "", "unresolved type 'Q' in 'f'");
+    // The same size name bound to a global in one fn and a param in another.
+    local_test_case("const n = 4 fn g() { y := (:int[n]){1}; } fn f(n: int) { x := (:int[n]){1}; }",
+                    "n:const n:param0 ", NULL);
+    local_test_case("const n = 4 fn f(n: int) { x := (:int[n]){1}; } fn g() { y := (:int[n]){1}; }",
+                    "n:param0 n:const ", NULL);
+
+    // Enough bodies for several workers; errors still come out in source order.
+    size_t saved_threads = resolve_threads;
+    resolve_threads = 4;
+    char *src = NULL;
+    enum { N = 4 * RESOLVE_MIN_FNS_PER_THREAD };
+    for (int i = 0; i < N; i++) {
+        buf_printf(src, "fn f%d(a: int): int { b := a + %s; return b; }\n", i, i % 100 == 0 ? "zz" : "1");
+    }
+    init_stream(src);
+    Decl **decls = parse_file();
+    assert(!resolve_decls(decls, buf_len(decls)));
+    assert(buf_len(resolve_errors) == 3);
+    assert(strstr(resolve_errors[0], "in 'f0'"));
+    assert(strstr(resolve_errors[1], "in 'f100'"));
+    assert(strstr(resolve_errors[2], "in 'f200'"));
+    Stmt *ret = decls[N - 1]->fn.block.stmts[1];
+    assert(ret->return_stmt.expr->sym->init == decls[N - 1]->fn.block.stmts[0]);
+    resolve_threads = saved_threads;
+    buf_free(decls);
+    buf_free(src);
+}
+
+void resolve_test(void) {
+    resolve_test_case("const a = b + c const b = c * 2 const c = 1", "c b a", NULL);
+    resolve_test_case("let x: T typedef T = S[N] struct S { next: S*; n: int; } const N = 4", "S N T x", NULL);
+    resolve_test_case("fn f(s: S): int { return g(); } fn g(): int {} struct S { f: fn(S): int; }", "S f g", NULL);
+    resolve_test_case("enum E { A = 1 B = A + 1 } const k = B", "E k", NULL);
+    resolve_test_case("const a = b const b = c const c = a", NULL, "cyclic dependency: a -> b -> c -> a");
+    resolve_test_case("struct S { t: T; } struct T { s: S; }", NULL, "cyclic dependency: S -> T -> S");
+    resolve_test_case("const a = a", NULL, "cyclic dependency: a -> a");
+    resolve_test_case("const a = 1 let a: int", NULL, "'a' is already defined (const)");
+    resolve_test_case("enum E { A } const A = 1", NULL, "'A' is already defined (enum const)");
+    resolve_test_case("let x: U", NULL, "unresolved name 'U' in 'x'");
+
+    local_test();
+
+    // Chains deeper than the C stack could recurse through.
+    char *src = NULL;
+    enum { N = 100000 };
+    for (int i = N - 1; i > 0; i--) {
+        buf_printf(src, "const k%d = k%d + 1\n", i, i - 1);
+    }
+    buf_printf(src, "const k0 = 0\n");
+    init_stream(src);
+    Decl **decls = parse_file();
+    assert(resolve_decls(decls, buf_len(decls)));
+    assert(buf_len(ordered_syms) == N);
+    for (int i = 0; i < N; i++) {
+        assert(ordered_syms[i]->decl == decls[N - 1 - i]);
+    }
+    buf_free(decls);
+    buf_free(src);
+    resolve_reset();
+}
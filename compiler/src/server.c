@@ -0,0 +1,299 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "ast.h"
+
+// Runs fn(arg) with what it prints captured into *output, a stretchy
+// buffer, so fn must print through the printer. A fatal error inside fn
+// makes the run fail with status 1 instead of exiting, and its message and
+// syntax errors become the output. Whatever fn allocated before failing is
+// leaked.
+int server_run(int (*fn)(const char *arg), const char *arg, char **output) {
+    print_capture();
+    jmp_buf env;
+    volatile int status = 1;
+    if (setjmp(env) == 0) {
+        fatal_jmp = &env;
+        status = fn(arg);
+    } else {
+        if (fatal_message[0]) {
+            print_str("FATAL: ");
+            print_str(fatal_message);
+            print_char('\n');
+            fatal_message[0] = 0;
+        }
+        print_syntax_errors();
+        panic_mode = false;
+    }
+    fatal_jmp = NULL;
+    char *captured = print_release();
+    size_t start = buf_len(*output);
+    size_t len = buf_len(captured) - 1;
+    buf_resize(*output, start + len);
+    memcpy(*output + start, captured, len);
+    buf_free(captured);
+    return status;
+}
+
+bool write_all(int fd, const char *buf, size_t size) {
+    while (size > 0) {
+        ssize_t n = write(fd, buf, size);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        buf += n;
+        size -= n;
+    }
+    return true;
+}
+
+// Reads one '\n'-terminated line without the newline. Returns false if the
+// connection closed or timed out first, or the line doesn't fit.
+bool read_line(int fd, char *line, size_t size) {
+    size_t len = 0;
+    while (len + 1 < size) {
+        ssize_t n = read(fd, line + len, 1);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        if (line[len] == '\n') {
+            line[len] = 0;
+            return true;
+        }
+        len++;
+    }
+    return false;
+}
+
+// Bounds a long-running server's memory: once the AST arena is this big,
+// drop every resident decl and start over.
+void server_trim(void) {
+    if (buf_len(ast_arena.blocks) > SERVER_MAX_ARENA_BLOCKS) {
+        decl_cache_free();
+        typespec_table_free();
+        arena_free(&ast_arena);
+    }
+}
+
+double server_timeout_secs = SERVER_TIMEOUT_SECS;
+
+// Serves one connection. Returns false once asked to shut down. Requests
+// are served one at a time, so a client that stalls past the timeout while
+// sending or receiving is dropped rather than holding up the rest.
+bool server_handle(int conn) {
+    struct timeval timeout = {(time_t)server_timeout_secs,
+                              (suseconds_t)((server_timeout_secs - (time_t)server_timeout_secs) * 1e6)};
+    setsockopt(conn, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(conn, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    char request[4096];
+    if (!read_line(conn, request, sizeof(request))) {
+        return true;
+    }
+    char *output = NULL;
+    int status = 0;
+    bool running = true;
+    if (strcmp(request, "shutdown") == 0) {
+        running = false;
+    } else if (strncmp(request, "compile ", 8) == 0) {
+        status = server_run(compile_file, request + 8, &output);
+    } else {
+        status = 1;
+        buf_printf(output, "error: unknown request '%s'\n", request);
+    }
+    char header[64];
+    int len = snprintf(header, sizeof(header), "%d %zu\n", status, buf_len(output));
+    if (write_all(conn, header, len)) {
+        write_all(conn, output, buf_len(output));
+    }
+    buf_free(output);
+    server_trim();
+    return running;
+}
+
+bool server_address(struct sockaddr_un *addr, const char *socket_path) {
+    *addr = (struct sockaddr_un){.sun_family = AF_UNIX};
+    if (strlen(socket_path) >= sizeof(addr->sun_path)) {
+        return false;
+    }
+    strcpy(addr->sun_path, socket_path);
+    return true;
+}
+
+// Listens on a socket only its owner can connect to. A socket left at the
+// path by an earlier server is replaced, but nothing else is.
+int server_listen(const struct sockaddr_un *addr) {
+    struct stat st;
+    if (lstat(addr->sun_path, &st) == 0 && S_ISSOCK(st.st_mode)) {
+        unlink(addr->sun_path);
+    }
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    mode_t mask = umask(0077);
+    bool bound = bind(fd, (const struct sockaddr *)addr, sizeof(*addr)) == 0;
+    umask(mask);
+    if (!bound || listen(fd, SOMAXCONN) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int serve(const char *socket_path) {
+    struct sockaddr_un addr;
+    if (!server_address(&addr, socket_path)) {
+        printf("error: socket path too long\n");
+        return 1;
+    }
+    int fd = server_listen(&addr);
+    if (fd < 0) {
+        printf("error: cannot listen on '%s'\n", socket_path);
+        return 1;
+    }
+    signal(SIGPIPE, SIG_IGN);
+    init_keywords();
+    decl_cache_init(NULL);
+    decl_cache.resident = true;
+    for (bool running = true; running;) {
+        int conn = accept(fd, NULL, NULL);
+        if (conn < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        running = server_handle(conn);
+        close(conn);
+    }
+    close(fd);
+    unlink(socket_path);
+    return 0;
+}
+
+// Sends one request and copies the reply's output to out. Returns the
+// request's status, or -1 if the server can't be reached.
+int server_request(const char *socket_path, const char *request, FILE *out) {
+    struct sockaddr_un addr;
+    if (!server_address(&addr, socket_path)) {
+        return -1;
+    }
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        if (fd >= 0) {
+            close(fd);
+        }
+        return -1;
+    }
+    char header[64];
+    int status = -1;
+    size_t size = 0;
+    if (write_all(fd, request, strlen(request)) && write_all(fd, "\n", 1) && read_line(fd, header, sizeof(header)) &&
+        sscanf(header, "%d %zu", &status, &size) == 2) {
+        char buf[65536];
+        while (size > 0) {
+            ssize_t n = read(fd, buf, MIN(size, sizeof(buf)));
+            if (n <= 0) {
+                status = -1;
+                break;
+            }
+            fwrite(buf, 1, n, out);
+            size -= n;
+        }
+    }
+    close(fd);
+    return status;
+}
+
+int server_test_fatal(const char *arg) {
+    print_str("before ");
+    fatal("boom %s", arg);
+    return 0;
+}
+
+int server_test_ok(const char *arg) {
+    print_str("ok ");
+    print_str(arg);
+    return 0;
+}
+
+// Sends request over a socket pair to server_handle and returns the reply.
+char *server_test_handle(const char *request, bool *running) {
+    int fds[2];
+    assert(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+    assert(write_all(fds[0], request, strlen(request)));
+    *running = server_handle(fds[1]);
+    close(fds[1]);
+    char *reply = NULL;
+    char buf[4096];
+    for (ssize_t n; (n = read(fds[0], buf, sizeof(buf))) > 0;) {
+        size_t len = buf_len(reply);
+        buf_resize(reply, len + n);
+        memcpy(reply + len, buf, n);
+    }
+    buf_push(reply, 0);
+    close(fds[0]);
+    return reply;
+}
+
+void server_test(void) {
+    char *output = NULL;
+    assert(server_run(server_test_fatal, "x", &output) == 1);
+    buf_push(output, 0);
+    assert(strcmp(output, "before FATAL: boom x\n") == 0 && !fatal_jmp);
+    buf_free(output);
+    assert(server_run(server_test_ok, "y", &output) == 0);
+    assert(buf_len(output) == 4 && memcmp(output, "ok y", 4) == 0);
+    buf_free(output);
+
+    char path[] = "/tmp/rionc-server-XXXXXX";
+    int fd = mkstemp(path);
+    const char *src = "const c = 1\nfn f(): int { return c; }\n";
+    assert(fd >= 0 && write_all(fd, src, strlen(src)));
+    close(fd);
+    char request[64];
+    snprintf(request, sizeof(request), "compile %s\n", path);
+    bool running;
+    DeclCache old_cache = decl_cache;
+    decl_cache_init(NULL);
+    decl_cache.resident = true;
+    char *reply = server_test_handle(request, &running);
+    assert(running && strncmp(reply, "0 ", 2) == 0 && strstr(reply, "(const c 1)"));
+    buf_free(reply);
+    reply = server_test_handle(request, &running);
+    assert(running && strncmp(reply, "0 ", 2) == 0 && decl_cache.hits == 2);
+    buf_free(reply);
+    decl_cache_free();
+    decl_cache = old_cache;
+    unlink(path);
+
+    reply = server_test_handle(request, &running);
+    assert(running && strncmp(reply, "1 ", 2) == 0 && strstr(reply, "error: cannot read"));
+    buf_free(reply);
+    reply = server_test_handle("hello\n", &running);
+    assert(running && strncmp(reply, "1 ", 2) == 0);
+    buf_free(reply);
+    // A client that stalls mid-request is dropped without a reply.
+    double old_timeout = server_timeout_secs;
+    server_timeout_secs = 0.05;
+    reply = server_test_handle("compile /tmp/x", &running);
+    assert(running && strcmp(reply, "") == 0);
+    buf_free(reply);
+    server_timeout_secs = old_timeout;
+    reply = server_test_handle("shutdown\n", &running);
+    assert(!running && strcmp(reply, "0 0\n") == 0);
+    buf_free(reply);
+}
@@ -0,0 +1,279 @@
+#include "ast.h"
+
+const char *switch_kind_names[] = {
+    [SWITCH_TABLE] = "table",
+    [SWITCH_RANGES] = "ranges",
+    [SWITCH_TREE] = "tree",
+};
+
+typedef struct SwitchValue {
+    uint64_t key;
+    size_t target;
+} SwitchValue;
+
+SwitchValue *switch_values;
+Map switch_seen; // Keys so far, except 0
+bool switch_seen_zero;
+
+// Flips the sign bit of signed values, so keys compare as unsigned in the
+// same order as the values they stand for.
+uint64_t switch_key(ConstVal val) {
+    return val.type->kind == TYPE_UINT ? val.u : (uint64_t)val.i ^ ((uint64_t)1 << 63);
+}
+
+int switch_value_cmp(const void *a, const void *b) {
+    uint64_t x = ((const SwitchValue *)a)->key;
+    uint64_t y = ((const SwitchValue *)b)->key;
+    return x < y ? -1 : x > y;
+}
+
+// Adds key to the set of case values, returning false if it was there.
+bool switch_add(uint64_t key) {
+    if (!key) {
+        bool seen = switch_seen_zero;
+        switch_seen_zero = true;
+        return !seen;
+    }
+    if (map_get_uint64(&switch_seen, key)) {
+        return false;
+    }
+    map_put_uint64(&switch_seen, key, 1);
+    return true;
+}
+
+// Gives range, which spans several runs, a table of the case each key in it
+// goes to from its values. Keys between the runs go to default_case.
+void switch_table(SwitchRange *range, SwitchValue *values, size_t num_values, size_t default_case) {
+    size_t len = range->hi - range->lo + 1;
+    range->table = arena_alloc(&ast_arena, len * sizeof(size_t));
+    for (size_t i = 0; i < len; i++) {
+        range->table[i] = default_case;
+    }
+    for (size_t i = 0; i < num_values; i++) {
+        range->table[values[i].key - range->lo] = values[i].target;
+    }
+}
+
+// Evaluates the cases of stmt, a switch on type, reports duplicates and
+// plans its dispatch.
+SwitchPlan *switch_plan(Stmt *stmt, Type *type) {
+    SwitchStmt *s = &stmt->switch_stmt;
+    size_t default_case = s->num_cases;
+    bool constant = true;
+    buf_clear(switch_values);
+    for (size_t i = 0; i < s->num_cases; i++) {
+        SwitchCase *c = &s->cases[i];
+        if (c->is_default) {
+            default_case = i;
+        }
+        for (size_t j = 0; j < c->num_exprs; j++) {
+            ConstVal val;
+            const_quiet = true;
+            bool known = const_eval(c->exprs[j], &val);
+            const_quiet = false;
+            // A value the switch's type cannot hold is reported, not dropped.
+            if (!known || !const_convert(&val, type, false)) {
+                constant = false;
+            } else if (!switch_add(switch_key(val))) {
+                if (type->kind == TYPE_UINT) {
+                    check_error("duplicate case %llu", (unsigned long long)val.u);
+                } else {
+                    check_error("duplicate case %lld", (long long)val.i);
+                }
+            } else {
+                buf_push(switch_values, ((SwitchValue){switch_key(val), i}));
+            }
+        }
+    }
+    map_free(&switch_seen);
+    switch_seen_zero = false;
+    if (!constant) {
+        return NULL;
+    }
+    size_t num_values = buf_len(switch_values);
+    if (num_values) {
+        qsort(switch_values, num_values, sizeof(*switch_values), switch_value_cmp);
+    }
+    // Runs of consecutive values that go to the same case, grown into a
+    // table while at least SWITCH_MIN_DENSITY percent of it is cases.
+    SwitchRange *ranges = NULL;
+    size_t first = 0; // Of the values in the last range
+    bool merged = false; // Whether the last range needs a table
+    for (size_t i = 0; i < num_values; i++) {
+        SwitchValue value = switch_values[i];
+        SwitchRange *last = buf_len(ranges) ? &ranges[buf_len(ranges) - 1] : NULL;
+        uint64_t span = last ? value.key - last->lo : 0;
+        if (last && last->hi + 1 == value.key && last->target == value.target) {
+            last->hi = value.key;
+        } else if (last && span < SWITCH_MAX_TABLE && (i - first + 1) * 100 >= (span + 1) * SWITCH_MIN_DENSITY) {
+            last->hi = value.key;
+            merged = true;
+        } else {
+            if (merged) {
+                switch_table(last, switch_values + first, i - first, default_case);
+            }
+            buf_push(ranges, ((SwitchRange){value.key, value.key, value.target, NULL}));
+            first = i;
+            merged = false;
+        }
+    }
+    if (merged) {
+        switch_table(&ranges[buf_len(ranges) - 1], switch_values + first, num_values - first, default_case);
+    }
+    size_t num_ranges = buf_len(ranges);
+    SwitchPlan *plan = arena_alloc(&ast_arena, sizeof(SwitchPlan));
+    *plan = (SwitchPlan){.kind = SWITCH_TREE, .default_case = default_case, .num_ranges = num_ranges};
+    plan->ranges = ast_dup(ranges, num_ranges * sizeof(*ranges));
+    buf_free(ranges);
+    if (num_ranges == 1 && plan->ranges[0].table) {
+        plan->kind = SWITCH_TABLE;
+    } else if (num_ranges <= SWITCH_MAX_RANGES) {
+        plan->kind = SWITCH_RANGES;
+    }
+    return plan;
+}
+
+// Returns the index of the case that the value with key goes to, or the
+// plan's default_case.
+size_t switch_dispatch(SwitchPlan *plan, uint64_t key) {
+    SwitchRange *range = plan->ranges;
+    size_t n = plan->num_ranges;
+    if (plan->kind == SWITCH_TREE) {
+        // Halves without branching on the comparison, which is as good as
+        // a coin toss for values spread over the cases.
+        while (n > 1) {
+            size_t half = n / 2;
+            range = range[half].lo <= key ? range + half : range;
+            n -= half;
+        }
+    } else {
+        while (n > 1 && key - range->lo > range->hi - range->lo) {
+            range++;
+            n--;
+        }
+    }
+    if (!n || key - range->lo > range->hi - range->lo) {
+        return plan->default_case;
+    }
+    return range->table ? range->table[key - range->lo] : range->target;
+}
+
+// Copies plan into the AST arena along with the switch it belongs to.
+SwitchPlan *switch_plan_copy(SwitchPlan *plan) {
+    if (!plan) {
+        return NULL;
+    }
+    SwitchPlan *copy = ast_dup(plan, sizeof(SwitchPlan));
+    copy->ranges = ast_dup(plan->ranges, plan->num_ranges * sizeof(*plan->ranges));
+    for (size_t i = 0; i < copy->num_ranges; i++) {
+        SwitchRange *range = &copy->ranges[i];
+        if (range->table) {
+            range->table = ast_dup(range->table, (range->hi - range->lo + 1) * sizeof(size_t));
+        }
+    }
+    return copy;
+}
+
+void switch_reset(void) {
+    buf_free(switch_values);
+}
+
+// The case a value goes to when each case is tried in order.
+size_t switch_linear(Stmt *stmt, uint64_t key) {
+    SwitchStmt *s = &stmt->switch_stmt;
+    size_t default_case = s->num_cases;
+    for (size_t i = 0; i < s->num_cases; i++) {
+        for (size_t j = 0; j < s->cases[i].num_exprs; j++) {
+            ConstVal val;
+            bool ok = const_eval(s->cases[i].exprs[j], &val) && const_convert(&val, s->expr->type, false);
+            assert(ok);
+            if (switch_key(val) == key) {
+                return i;
+            }
+        }
+        default_case = s->cases[i].is_default ? i : default_case;
+    }
+    return default_case;
+}
+
+// Checks src, whose last decl is a fn that starts with a switch, and that
+// the switch is planned as kind with num_ranges runs. Dispatch must agree
+// with trying the cases in order throughout tables and around the ends of
+// each range.
+void switch_test_case(const char *src, SwitchKind kind, size_t num_ranges) {
+    init_stream(src);
+    Decl **decls = parse_file();
+    assert(num_syntax_errors == 0);
+    assert(check_decls(decls, buf_len(decls)));
+    Stmt *stmt = decls[buf_len(decls) - 1]->fn.block.stmts[0];
+    SwitchPlan *plan = stmt->switch_stmt.plan;
+    assert(plan && plan->kind == kind && plan->num_ranges == num_ranges);
+    for (size_t i = 0; i < plan->num_ranges; i++) {
+        for (uint64_t key = plan->ranges[i].lo; plan->ranges[i].table && key <= plan->ranges[i].hi; key++) {
+            assert(switch_dispatch(plan, key) == switch_linear(stmt, key));
+        }
+        for (uint64_t d = 0; d < 5; d++) {
+            uint64_t lo = plan->ranges[i].lo - 2 + d;
+            uint64_t hi = plan->ranges[i].hi - 2 + d;
+            assert(switch_dispatch(plan, lo) == switch_linear(stmt, lo));
+            assert(switch_dispatch(plan, hi) == switch_linear(stmt, hi));
+        }
+    }
+    buf_free(decls);
+    check_reset();
+    resolve_reset();
+}
+
+void switch_test_error(const char *src, const char *error) {
+    init_stream(src);
+    Decl **decls = parse_file();
+    assert(num_syntax_errors == 0);
+    assert(!check_decls(decls, buf_len(decls)));
+    assert(buf_len(check_errors) == 1 && strcmp(check_errors[0], error) == 0);
+    buf_free(decls);
+    check_reset();
+    resolve_reset();
+}
+
+void switch_test(void) {
+    // Most values in a short span, with a hole and a run.
+    switch_test_case("enum E { A B C }\n"
+                     "fn f(x: int) { switch (x) { case A: {} case B: case C: {} case 4: {} case 5: {} case 6: {} case 8: {} default {} } }",
+                     SWITCH_TABLE, 1);
+    // Two clusters far apart, one a run and the other a table.
+    switch_test_case("fn f(x: int) { switch (x) { case 1: case 2: case 3: case 4: {} case 1000: {} case 1001: {} case 1003: {} } }",
+                     SWITCH_RANGES, 2);
+    // Negative values sort first, and uint ones from 0.
+    switch_test_case("const K = 1000 fn f(x: int) { switch (x) { case -5: {} case 1: {} case 10: {} case 100: {} case K: {} "
+                     "case K * 10: {} default {} } }",
+                     SWITCH_TREE, 6);
+    switch_test_case("fn f(x: uint) { switch (x) { case 0: {} case 100: {} case 200: {} case 300: {} case 400: {} "
+                     "case 0x7FFFFFFFFFFFFFFF: {} } }",
+                     SWITCH_TREE, 6);
+    // No cases but the default.
+    init_stream("fn f(x: int, y: int) { switch (x) { default {} } switch (x) { case 1: {} case y: {} } }");
+    Decl **decls = parse_file();
+    assert(check_decls(decls, buf_len(decls)));
+    SwitchPlan *plan = decls[0]->fn.block.stmts[0]->switch_stmt.plan;
+    assert(plan && plan->num_ranges == 0 && switch_dispatch(plan, 7) == 0);
+    // A case that is not constant leaves the switch as it is.
+    assert(!decls[0]->fn.block.stmts[1]->switch_stmt.plan);
+    buf_free(decls);
+    check_reset();
+    resolve_reset();
+    // Plans outlive the checker's state and move with a compacted AST.
+    init_stream("fn f(x: int) { switch (x) { case 1: {} case 2: case 3: {} default {} } }");
+    decls = parse_file();
+    assert(check_decls(decls, buf_len(decls)));
+    check_reset();
+    resolve_reset();
+    ast_compact(decls, buf_len(decls));
+    plan = decls[0]->fn.block.stmts[0]->switch_stmt.plan;
+    assert(plan && plan->kind == SWITCH_TABLE && switch_dispatch(plan, plan->ranges[0].hi) == 1);
+    buf_free(decls);
+    switch_test_error("enum E { A = 2 B } fn f(x: int) { switch (x) { case 1: {} case 3: {} case B: {} } }",
+                      "Type Error: duplicate case 3 in 'f'");
+    switch_test_error("fn f(x: char) { switch (x) { case 'a': {} case 97: {} } }", "Type Error: duplicate case 97 in 'f'");
+    switch_test_error("fn f(x: char) { switch (x) { case 'a': {} case 300: {} } }",
+                      "Const Error: 300 is out of range for 'char' in 'f'");
+}
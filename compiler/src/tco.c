@@ -0,0 +1,438 @@
+#include "ast.h"
+
+TcoStats tco_stats;
+
+// The fn being rewritten.
+typedef struct TcoFn {
+    Decl *decl;
+    Map names; // Every name the fn mentions, so new locals cannot capture one
+    bool has_names;
+    bool eligible;
+    bool rewrite; // Off for the first walk, which only looks for tail calls
+    size_t found;
+    TokenKind acc_op; // Operator folded into the accumulator, 0 if none
+    bool acc_mixed; // Tail calls under different operators, so no accumulator
+    const char *acc;
+    const char **temps; // Fresh name for each param's next value, made on demand
+    size_t calls;
+} TcoFn;
+
+TcoFn tco_fn;
+AstVisitor tco_scan_visitor;
+AstVisitor tco_mention_visitor;
+AstVisitor tco_names_visitor;
+const char *tco_int_names[3];
+
+VisitResult tco_names_pre(AstNode node, void *ctx) {
+    (void)ctx;
+    if (node.kind == AST_EXPR && node.expr->kind == EXPR_IDENT) {
+        map_put(&tco_fn.names, node.expr->name, (void *)node.expr->name);
+    } else if (node.kind == AST_STMT && node.stmt->kind == STMT_INIT) {
+        map_put(&tco_fn.names, node.stmt->init.name, (void *)node.stmt->init.name);
+    }
+    return VISIT_CONTINUE;
+}
+
+// Most fns never need a new name, so what the fn already uses is only
+// gathered the first time one is asked for.
+const char *tco_fresh(const char *base) {
+    if (!tco_fn.has_names) {
+        tco_fn.has_names = true;
+        Decl *decl = tco_fn.decl;
+        for (size_t i = 0; i < decl->fn.num_params; i++) {
+            map_put(&tco_fn.names, decl->fn.params[i].name, (void *)decl->fn.params[i].name);
+        }
+        for (size_t i = 0; i < decl->fn.block.num_stmts; i++) {
+            ast_visit(&tco_names_visitor, ast_stmt(decl->fn.block.stmts[i]));
+        }
+    }
+    const char *name = str_intern(base);
+    char buf[256];
+    for (int i = 1; map_get(&tco_fn.names, name); i++) {
+        snprintf(buf, sizeof(buf), "%s%d", base, i);
+        name = str_intern(buf);
+    }
+    map_put(&tco_fn.names, name, (void *)name);
+    return name;
+}
+
+bool tco_self_call(Expr *expr) {
+    return expr->kind == EXPR_CALL && expr->call.expr->kind == EXPR_IDENT && expr->call.expr->name == tco_fn.decl->name &&
+           expr->call.num_args == tco_fn.decl->fn.num_params;
+}
+
+bool tco_int_ret(void) {
+    Typespec *ret = tco_fn.decl->fn.ret_type;
+    return ret && ret->kind == TYPESPEC_IDENT &&
+           (ret->name == tco_int_names[0] || ret->name == tco_int_names[1] || ret->name == tco_int_names[2]);
+}
+
+// Matches e op f(...) or f(...) op e for an associative op on integers, where
+// e has no side effects, and returns op with the call and e. When the call
+// comes first its args must be pure too, since e moves ahead of them.
+TokenKind tco_acc_call(Expr *expr, Expr **call, Expr **operand) {
+    if (expr->kind != EXPR_BINARY || !tco_int_ret()) {
+        return 0;
+    }
+    TokenKind op = expr->binary.op;
+    if (op != '+' && op != '*' && op != '|' && op != '^') {
+        return 0;
+    }
+    Expr *left = expr->binary.left;
+    Expr *right = expr->binary.right;
+    if (tco_self_call(right) && fold_pure(left)) {
+        *call = right;
+        *operand = left;
+        return op;
+    }
+    if (tco_self_call(left) && fold_pure(right)) {
+        for (size_t i = 0; i < left->call.num_args; i++) {
+            if (!fold_pure(left->call.args[i])) {
+                return 0;
+            }
+        }
+        *call = left;
+        *operand = right;
+        return op;
+    }
+    return 0;
+}
+
+VisitResult tco_scan_pre(AstNode node, void *ctx) {
+    (void)ctx;
+    if (node.kind == AST_EXPR) {
+        Expr *expr = node.expr;
+        if (expr->kind == EXPR_UNARY && expr->unary.op == '&') {
+            // A pointer into one call's frame would see later iterations.
+            tco_fn.eligible = false;
+            return VISIT_STOP;
+        }
+    } else if (node.kind == AST_STMT) {
+        Stmt *stmt = node.stmt;
+        if (stmt->kind == STMT_INIT) {
+            // Locals shadowing a param or the fn itself would change what
+            // the rewritten assignments and calls refer to.
+            bool shadows = stmt->init.name == tco_fn.decl->name;
+            for (size_t i = 0; i < tco_fn.decl->fn.num_params; i++) {
+                shadows |= tco_fn.decl->fn.params[i].name == stmt->init.name;
+            }
+            if (shadows) {
+                tco_fn.eligible = false;
+                return VISIT_STOP;
+            }
+        }
+    }
+    return VISIT_CONTINUE;
+}
+
+VisitResult tco_mention_pre(AstNode node, void *ctx) {
+    if (node.kind == AST_EXPR && node.expr->kind == EXPR_IDENT && node.expr->name == ctx) {
+        return VISIT_STOP;
+    }
+    return VISIT_CONTINUE;
+}
+
+bool tco_mentions(Expr *expr, const char *name) {
+    tco_mention_visitor.ctx = (void *)name;
+    return !ast_visit(&tco_mention_visitor, ast_expr(expr));
+}
+
+TokenKind tco_assign_op(TokenKind op) {
+    switch ((int)op) {
+    case '+':
+        return TOKEN_ADD_ASSIGN;
+    case '*':
+        return TOKEN_MUL_ASSIGN;
+    case '|':
+        return TOKEN_OR_ASSIGN;
+    default:
+        assert(op == '^');
+        return TOKEN_XOR_ASSIGN;
+    }
+}
+
+// Replaces a tail call with the block that takes the loop round again:
+// fold operand into the accumulator, move the args into the params as if
+// assigned all at once, and continue. An arg goes through a temp when it
+// reads a param already reassigned above it, and all do when any has side
+// effects, so that they are still evaluated in order.
+Stmt *tco_jump(Expr *call, Expr *operand) {
+    FnParam *params = tco_fn.decl->fn.params;
+    Expr **args = call->call.args;
+    size_t num_params = tco_fn.decl->fn.num_params;
+    Stmt **stmts = NULL;
+    if (operand) {
+        buf_push(stmts, stmt_assign(tco_assign_op(tco_fn.acc_op), expr_ident(tco_fn.acc), operand));
+    }
+    bool pure = true;
+    for (size_t i = 0; i < num_params; i++) {
+        pure &= fold_pure(args[i]);
+    }
+    Stmt **assigns = NULL;
+    for (size_t i = 0; i < num_params; i++) {
+        if (args[i]->kind == EXPR_IDENT && args[i]->name == params[i].name) {
+            continue;
+        }
+        bool temp = !pure;
+        for (size_t j = 0; j < i && !temp; j++) {
+            temp = !(args[j]->kind == EXPR_IDENT && args[j]->name == params[j].name) && tco_mentions(args[i], params[j].name);
+        }
+        Expr *value = args[i];
+        if (temp) {
+            if (!tco_fn.temps[i]) {
+                char buf[256];
+                snprintf(buf, sizeof(buf), "%s_next", params[i].name);
+                tco_fn.temps[i] = tco_fresh(buf);
+            }
+            buf_push(stmts, stmt_init(tco_fn.temps[i], args[i]));
+            value = expr_ident(tco_fn.temps[i]);
+        }
+        buf_push(assigns, stmt_assign('=', expr_ident(params[i].name), value));
+    }
+    for (size_t i = 0; i < buf_len(assigns); i++) {
+        buf_push(stmts, assigns[i]);
+    }
+    buf_push(stmts, stmt_continue());
+    Stmt *block = stmt_block((StmtBlock){stmts, buf_len(stmts)});
+    buf_free(assigns);
+    buf_free(stmts);
+    tco_fn.calls++;
+    tco_stats.calls++;
+    return block;
+}
+
+void tco_block(StmtBlock block, bool tail, bool in_loop);
+
+// Returns what should stand in place of stmt, or when not yet rewriting
+// only counts the tail calls. tail says whether control leaves the fn when
+// stmt finishes, and in_loop whether a continue would belong to a loop of
+// the fn's own.
+Stmt *tco_stmt(Stmt *stmt, bool tail, bool in_loop) {
+    switch (stmt->kind) {
+    case STMT_RETURN: {
+        Expr *expr = stmt->return_stmt.expr;
+        if (!expr) {
+            return stmt;
+        }
+        if (!in_loop && tco_self_call(expr)) {
+            tco_fn.found++;
+            return tco_fn.rewrite ? tco_jump(expr, NULL) : stmt;
+        }
+        Expr *call, *operand;
+        TokenKind op = in_loop ? 0 : tco_acc_call(expr, &call, &operand);
+        if (!tco_fn.rewrite) {
+            if (op && tco_fn.acc_op && op != tco_fn.acc_op) {
+                tco_fn.acc_mixed = true;
+            } else if (op) {
+                tco_fn.acc_op = op;
+                tco_fn.found++;
+            }
+            return stmt;
+        }
+        if (!tco_fn.acc) {
+            return stmt;
+        }
+        if (op == tco_fn.acc_op) {
+            tco_stats.accumulated++;
+            return tco_jump(call, operand);
+        }
+        // What is left to return still has everything folded so far applied.
+        stmt->return_stmt.expr = expr_binary(tco_fn.acc_op, expr_ident(tco_fn.acc), expr);
+        return stmt;
+    }
+    case STMT_EXPR:
+        if (tail && !in_loop && !tco_fn.decl->fn.ret_type && tco_self_call(stmt->expr)) {
+            tco_fn.found++;
+            return tco_fn.rewrite ? tco_jump(stmt->expr, NULL) : stmt;
+        }
+        return stmt;
+    case STMT_BLOCK:
+        tco_block(stmt->block, tail, in_loop);
+        return stmt;
+    case STMT_IF:
+        tco_block(stmt->if_stmt.then_block, tail, in_loop);
+        for (size_t i = 0; i < stmt->if_stmt.num_elseifs; i++) {
+            tco_block(stmt->if_stmt.elseifs[i].block, tail, in_loop);
+        }
+        tco_block(stmt->if_stmt.else_block, tail, in_loop);
+        return stmt;
+    case STMT_SWITCH:
+        for (size_t i = 0; i < stmt->switch_stmt.num_cases; i++) {
+            tco_block(stmt->switch_stmt.cases[i].block, tail, in_loop);
+        }
+        return stmt;
+    case STMT_WHILE:
+    case STMT_DO_WHILE:
+        tco_block(stmt->while_stmt.block, false, true);
+        return stmt;
+    case STMT_FOR:
+        tco_block(stmt->for_stmt.block, false, true);
+        return stmt;
+    default:
+        return stmt;
+    }
+}
+
+void tco_block(StmtBlock block, bool tail, bool in_loop) {
+    for (size_t i = 0; i < block.num_stmts; i++) {
+        block.stmts[i] = tco_stmt(block.stmts[i], tail && i + 1 == block.num_stmts, in_loop);
+    }
+}
+
+// Whether control can fall off the end of block, judged by its last
+// statement alone.
+bool tco_falls_through(StmtBlock block) {
+    if (!block.num_stmts) {
+        return true;
+    }
+    Stmt *last = block.stmts[block.num_stmts - 1];
+    switch (last->kind) {
+    case STMT_RETURN:
+    case STMT_CONTINUE:
+        return false;
+    case STMT_BLOCK:
+        return tco_falls_through(last->block);
+    case STMT_IF:
+        if (!last->if_stmt.else_block.num_stmts || tco_falls_through(last->if_stmt.then_block) ||
+            tco_falls_through(last->if_stmt.else_block)) {
+            return true;
+        }
+        for (size_t i = 0; i < last->if_stmt.num_elseifs; i++) {
+            if (tco_falls_through(last->if_stmt.elseifs[i].block)) {
+                return true;
+            }
+        }
+        return false;
+    default:
+        return true;
+    }
+}
+
+// Rewrites a fn whose self calls in tail position can become jumps:
+//
+//     acc := (:T){identity}     (only with an accumulator)
+//     while (1) {
+//         ...body, each tail call now { acc op= e; params = args; continue; }
+//         break;                (only when the body can fall off its end)
+//     }
+void tco_decl(Decl *decl) {
+    map_free(&tco_fn.names);
+    buf_clear(tco_fn.temps);
+    tco_fn = (TcoFn){.decl = decl, .eligible = true, .temps = tco_fn.temps};
+    for (size_t i = 0; i < decl->fn.num_params; i++) {
+        if (decl->fn.params[i].name == decl->name) {
+            return;
+        }
+    }
+    tco_block(decl->fn.block, true, false);
+    if (!tco_fn.found) {
+        return;
+    }
+    for (size_t i = 0; i < decl->fn.block.num_stmts && tco_fn.eligible; i++) {
+        ast_visit(&tco_scan_visitor, ast_stmt(decl->fn.block.stmts[i]));
+    }
+    if (!tco_fn.eligible) {
+        return;
+    }
+    buf_fit(tco_fn.temps, decl->fn.num_params);
+    for (size_t i = 0; i < decl->fn.num_params; i++) {
+        buf_push(tco_fn.temps, NULL);
+    }
+    Stmt *acc_init = NULL;
+    if (tco_fn.acc_op && !tco_fn.acc_mixed) {
+        tco_fn.acc = tco_fresh("acc");
+        Expr *identity = expr_int(tco_fn.acc_op == '*');
+        acc_init = stmt_init(tco_fn.acc, expr_compound(decl->fn.ret_type, &identity, 1));
+    }
+    tco_fn.rewrite = true;
+    tco_block(decl->fn.block, true, false);
+    if (!tco_fn.calls) {
+        return;
+    }
+    Stmt **body = NULL;
+    for (size_t i = 0; i < decl->fn.block.num_stmts; i++) {
+        buf_push(body, decl->fn.block.stmts[i]);
+    }
+    if (tco_falls_through(decl->fn.block)) {
+        buf_push(body, stmt_break());
+    }
+    Stmt *stmts[2];
+    size_t num_stmts = 0;
+    if (acc_init) {
+        stmts[num_stmts++] = acc_init;
+        tco_stats.accumulators++;
+    }
+    stmts[num_stmts++] = stmt_while(expr_int(1), (StmtBlock){body, buf_len(body)});
+    decl->fn.block = (StmtBlock){ast_dup(stmts, num_stmts * sizeof(Stmt *)), num_stmts};
+    buf_free(body);
+    tco_stats.fns++;
+}
+
+void tco_decls(Decl **decls, size_t num_decls) {
+    tco_scan_visitor = (AstVisitor){.pre = tco_scan_pre};
+    tco_mention_visitor = (AstVisitor){.pre = tco_mention_pre};
+    tco_names_visitor = (AstVisitor){.pre = tco_names_pre};
+    tco_int_names[0] = str_intern("int");
+    tco_int_names[1] = str_intern("uint");
+    tco_int_names[2] = str_intern("char");
+    for (size_t i = 0; i < num_decls; i++) {
+        if (decls[i]->kind == DECL_FN) {
+            tco_decl(decls[i]);
+        }
+    }
+    map_free(&tco_fn.names);
+    buf_free(tco_fn.temps);
+    tco_fn = (TcoFn){0};
+    visitor_free(&tco_scan_visitor);
+    visitor_free(&tco_mention_visitor);
+    visitor_free(&tco_names_visitor);
+}
+
+void tco_test(void) {
+    // The parser's own fact, with its product moved into an accumulator.
+    pass_test_case(tco_decls, PASS_TEST_CHECK | PASS_TEST_ALL,
+                   "fn trace(s: char*) {}\n"
+                   "fn fact(n: int): int { trace(\"fact\"); if (n == 0) { return 1; } else { return n * fact(n-1); } }",
+                   "(fn trace ( s (ptr char) ) nil\n  (block))\n"
+                   "(fn fact ( n int ) int\n  (block\n    (:= acc (compound int 1))\n    (while 1\n      (block\n"
+                   "        (trace \"fact\")\n        (if (== n 0)\n          (block\n            (return (* acc 1)))\n"
+                   "          else \n          (block\n            (block\n              (*= acc n)\n"
+                   "              (= n (- n 1))\n              (continue))))))))\n");
+    pass_test_case(tco_decls, PASS_TEST_CHECK | PASS_TEST_ALL,
+                   "fn sum(n: int, acc: int): int { if (n == 0) { return acc; } return n + sum(n - 1, acc); }",
+                   "(fn sum ( n int acc int ) int\n  (block\n    (:= acc1 (compound int 0))\n    (while 1\n      (block\n"
+                   "        (if (== n 0)\n          (block\n            (return (+ acc1 acc))))\n        (block\n"
+                   "          (+= acc1 n)\n          (= n (- n 1))\n          (continue))))))\n");
+    // Args that read params reassigned before them go through temps.
+    pass_test_case(tco_decls, PASS_TEST_CHECK | PASS_TEST_ALL,
+                   "fn gcd(a: int, b: int): int { if (b == 0) { return a; } return gcd(b, a % b); }",
+                   "(fn gcd ( a int b int ) int\n  (block\n    (while 1\n      (block\n        (if (== b 0)\n"
+                   "          (block\n            (return a)))\n        (block\n          (:= b_next (% a b))\n"
+                   "          (= a b)\n          (= b b_next)\n          (continue))))))\n");
+    pass_test_case(tco_decls, PASS_TEST_CHECK | PASS_TEST_ALL,
+                   "fn put(c: int) {} fn count(n: int, acc: int) { if (n > 0) { put(n); count(n - 1, acc + n); } }",
+                   "(fn put ( c int ) nil\n  (block))\n"
+                   "(fn count ( n int acc int ) nil\n  (block\n    (while 1\n      (block\n        (if (> n 0)\n"
+                   "          (block\n            (put n)\n            (block\n              (:= acc_next (+ acc n))\n"
+                   "              (= n (- n 1))\n              (= acc acc_next)\n              (continue))))\n"
+                   "        (break)))))\n");
+    // Args with side effects are all evaluated, in order, before any param changes.
+    pass_test_case(tco_decls, PASS_TEST_CHECK | PASS_TEST_ALL,
+                   "fn g(): int { return 1; } fn f(a: int, b: int): int { if (a) { return b; } return f(a - 1, g()); }",
+                   "(fn g ( ) int\n  (block\n    (return 1)))\n"
+                   "(fn f ( a int b int ) int\n  (block\n    (while 1\n      (block\n        (if a\n          (block\n"
+                   "            (return b)))\n        (block\n          (:= a_next (- a 1))\n          (:= b_next (g))\n"
+                   "          (= a a_next)\n          (= b b_next)\n          (continue))))))\n");
+    // Non-linear recursion, addresses and calls inside loops stay as they are.
+    pass_test_case(tco_decls, PASS_TEST_CHECK | PASS_TEST_ALL,
+                   "fn fib(n: int): int { if (n < 2) { return n; } return fib(n - 1) + fib(n - 2); }\n"
+                   "fn h(n: int): int { p := &n; return h(n - 1); }\n"
+                   "fn k(n: int): int { while (n) { return k(n - 1); } return 0; }",
+                   "(fn fib ( n int ) int\n  (block\n    (if (< n 2)\n      (block\n        (return n)))\n"
+                   "    (return (+ (fib (- n 1)) (fib (- n 2))))))\n"
+                   "(fn h ( n int ) int\n  (block\n    (:= p (& n))\n    (return (h (- n 1)))))\n"
+                   "(fn k ( n int ) int\n  (block\n    (while n\n      (block\n        (return (k (- n 1)))))\n"
+                   "    (return 0)))\n");
+    assert(tco_stats.fns == 5 && tco_stats.calls == 5 && tco_stats.accumulated == 2 && tco_stats.accumulators == 2);
+    tco_stats = (TcoStats){0};
+}
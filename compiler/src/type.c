@@ -0,0 +1,332 @@
+#include "ast.h"
+
+Type *type_void = &(Type){TYPE_VOID, .size = 0, .align = 1};
+Type *type_bool = &(Type){TYPE_BOOL, .size = 1, .align = 1, .complete = true};
+Type *type_char = &(Type){TYPE_CHAR, .size = 1, .align = 1, .complete = true};
+Type *type_int = &(Type){TYPE_INT, .size = 8, .align = 8, .complete = true};
+Type *type_uint = &(Type){TYPE_UINT, .size = 8, .align = 8, .complete = true};
+Type *type_float = &(Type){TYPE_FLOAT, .size = 8, .align = 8, .complete = true};
+Type *type_error = &(Type){TYPE_ERROR, .size = 0, .align = 1, .complete = true};
+
+#define PTR_SIZE 8
+
+Arena type_arena;
+TypeTable type_table;
+
+const char *type_names[] = {
+    [TYPE_VOID] = "void", [TYPE_BOOL] = "bool", [TYPE_CHAR] = "char",
+    [TYPE_INT] = "int",   [TYPE_UINT] = "uint", [TYPE_FLOAT] = "float",
+};
+
+Type *type_builtin(const char *name) {
+    Type *types[] = {type_void, type_bool, type_char, type_int, type_uint, type_float};
+    for (size_t i = 0; i < sizeof(types) / sizeof(*types); i++) {
+        if (strcmp(name, type_names[types[i]->kind]) == 0) {
+            return types[i];
+        }
+    }
+    return NULL;
+}
+
+bool is_integer_type(Type *type) {
+    return TYPE_BOOL <= type->kind && type->kind <= TYPE_ENUM && type->kind != TYPE_FLOAT;
+}
+
+bool is_arithmetic_type(Type *type) {
+    return TYPE_BOOL <= type->kind && type->kind <= TYPE_ENUM;
+}
+
+bool is_scalar_type(Type *type) {
+    return is_arithmetic_type(type) || type->kind == TYPE_PTR;
+}
+
+bool is_aggregate_type(Type *type) {
+    return type->kind == TYPE_STRUCT || type->kind == TYPE_UNION;
+}
+
+/*
+ * Canonical derived types. As with typespecs, the table holds one node per
+ * structure and children are canonical by construction, so hashing and
+ * comparison look one level deep and equal types are the same pointer.
+ * Named types (structs, unions and enums) are nominal and never interned.
+ */
+
+uint64_t type_hash(Type *type) {
+    uint64_t hash = hash_uint64(type->kind);
+    switch (type->kind) {
+    case TYPE_PTR:
+        return hash_mix(hash, hash_ptr(type->ptr.elem));
+    case TYPE_ARRAY:
+        return hash_mix(hash_mix(hash, hash_ptr(type->array.elem)), hash_uint64(type->array.len));
+    case TYPE_FN:
+        for (size_t i = 0; i < type->fn.num_params; i++) {
+            hash = hash_mix(hash, hash_ptr(type->fn.params[i]));
+        }
+        return hash_mix(hash_mix(hash, type->fn.num_params), hash_ptr(type->fn.ret));
+    default:
+        assert(0);
+        return 0;
+    }
+}
+
+bool type_equal(Type *a, Type *b) {
+    if (a->kind != b->kind) {
+        return false;
+    }
+    switch (a->kind) {
+    case TYPE_PTR:
+        return a->ptr.elem == b->ptr.elem;
+    case TYPE_ARRAY:
+        return a->array.elem == b->array.elem && a->array.len == b->array.len;
+    case TYPE_FN:
+        return a->fn.num_params == b->fn.num_params && a->fn.ret == b->fn.ret &&
+               (a->fn.num_params == 0 || memcmp(a->fn.params, b->fn.params, a->fn.num_params * sizeof(Type *)) == 0);
+    default:
+        assert(0);
+        return false;
+    }
+}
+
+Type *type_alloc(TypeKind kind, size_t extra) {
+    size_t size = sizeof(Type) + extra;
+    Type *type = arena_alloc(&type_arena, size);
+    memset(type, 0, size);
+    type->kind = kind;
+    type_table.bytes += ALIGN_UP(size, ARENA_ALIGNMENT);
+    return type;
+}
+
+// Allocates the canonical node for key, whose fn params may live anywhere.
+Type *type_build(Type *key) {
+    size_t params_size = key->kind == TYPE_FN ? key->fn.num_params * sizeof(Type *) : 0;
+    Type *type = type_alloc(key->kind, params_size);
+    *type = *key;
+    if (key->kind == TYPE_FN) {
+        type->fn.params = params_size ? memcpy(type + 1, key->fn.params, params_size) : NULL;
+    }
+    return type;
+}
+
+void type_table_grow(void) {
+    size_t new_cap = type_table.cap ? 2 * type_table.cap : 64;
+    Type **new_slots = xcalloc(new_cap, sizeof(Type *));
+    for (size_t i = 0; i < type_table.cap; i++) {
+        Type *type = type_table.slots[i];
+        if (type) {
+            size_t j = type_hash(type) & (new_cap - 1);
+            while (new_slots[j]) {
+                j = (j + 1) & (new_cap - 1);
+            }
+            new_slots[j] = type;
+        }
+    }
+    free(type_table.slots);
+    type_table.slots = new_slots;
+    type_table.cap = new_cap;
+}
+
+Type *type_intern(Type *key) {
+    type_table.uses++;
+    if (2 * type_table.len >= type_table.cap) {
+        type_table_grow();
+    }
+    size_t mask = type_table.cap - 1;
+    for (size_t i = type_hash(key) & mask;; i = (i + 1) & mask) {
+        Type *type = type_table.slots[i];
+        if (!type) {
+            type = type_table.slots[i] = type_build(key);
+            type_table.len++;
+            return type;
+        }
+        if (type_equal(type, key)) {
+            return type;
+        }
+    }
+}
+
+void type_table_free(void) {
+    free(type_table.slots);
+    type_table = (TypeTable){0};
+    arena_free(&type_arena);
+}
+
+Type *type_ptr(Type *elem) {
+    Type key = {TYPE_PTR, .size = PTR_SIZE, .align = PTR_SIZE, .complete = true, .ptr = {elem}};
+    return type_intern(&key);
+}
+
+// Whether len elems stay within TYPE_MAX_SIZE.
+bool type_array_fits(Type *elem, size_t len) {
+    return elem->size == 0 || len <= TYPE_MAX_SIZE / elem->size;
+}
+
+// len 0 is an array of unknown size, which is incomplete. Callers check
+// that the array fits first.
+Type *type_array(Type *elem, size_t len) {
+    assert(type_array_fits(elem, len));
+    Type key = {TYPE_ARRAY, .size = elem->size * len, .align = elem->align, .complete = len != 0, .array = {elem, len}};
+    return type_intern(&key);
+}
+
+Type *type_fn(Type **params, size_t num_params, Type *ret) {
+    Type key = {TYPE_FN, .size = PTR_SIZE, .align = PTR_SIZE, .complete = true, .fn = {params, num_params, ret}};
+    return type_intern(&key);
+}
+
+// Named types start out incomplete; aggregates get their fields later.
+Type *type_named(TypeKind kind, Sym *sym) {
+    Type *type = type_alloc(kind, 0);
+    type_table.named++;
+    type->sym = sym;
+    type->align = 1;
+    if (kind == TYPE_ENUM) {
+        type->size = type_int->size;
+        type->align = type_int->align;
+        type->complete = true;
+    }
+    return type;
+}
+
+// Returns false if the fields add up to more than TYPE_MAX_SIZE. Field
+// sizes are within it, so the running size can't wrap before that shows.
+bool type_complete_aggregate(Type *type, TypeField *fields, size_t num_fields) {
+    assert(is_aggregate_type(type) && !type->complete);
+    size_t size = 0;
+    size_t align = 1;
+    bool fits = true;
+    for (size_t i = 0; i < num_fields; i++) {
+        Type *field = fields[i].type;
+        align = MAX(align, field->align);
+        if (type->kind == TYPE_STRUCT) {
+            fields[i].offset = ALIGN_UP(size, field->align);
+            size = fields[i].offset + field->size;
+            if (size > TYPE_MAX_SIZE) {
+                fits = false;
+                size = 0;
+            }
+        } else {
+            fields[i].offset = 0;
+            size = MAX(size, field->size);
+        }
+    }
+    size_t fields_size = MAX(num_fields, 1) * sizeof(TypeField);
+    type->aggregate.fields = arena_alloc(&type_arena, fields_size);
+    type_table.bytes += ALIGN_UP(fields_size, ARENA_ALIGNMENT);
+    memcpy(type->aggregate.fields, fields, num_fields * sizeof(TypeField));
+    type->aggregate.num_fields = num_fields;
+    type->size = ALIGN_UP(size, align);
+    type->align = align;
+    type->complete = true;
+    return fits && type->size <= TYPE_MAX_SIZE;
+}
+
+TypeField *type_field(Type *type, const char *name) {
+    for (size_t i = 0; i < type->aggregate.num_fields; i++) {
+        if (type->aggregate.fields[i].name == name) {
+            return &type->aggregate.fields[i];
+        }
+    }
+    return NULL;
+}
+
+// Appends type in source syntax, e.g. "fn(int, S*): float[4]".
+void type_to_str(char **buf, Type *type) {
+    switch (type->kind) {
+    case TYPE_VOID:
+    case TYPE_BOOL:
+    case TYPE_CHAR:
+    case TYPE_INT:
+    case TYPE_UINT:
+    case TYPE_FLOAT:
+        buf_printf(*buf, "%s", type_names[type->kind]);
+        break;
+    case TYPE_ENUM:
+    case TYPE_STRUCT:
+    case TYPE_UNION:
+        buf_printf(*buf, "%s", type->sym->name);
+        break;
+    case TYPE_PTR:
+        type_to_str(buf, type->ptr.elem);
+        buf_printf(*buf, "*");
+        break;
+    case TYPE_ARRAY:
+        type_to_str(buf, type->array.elem);
+        if (type->array.len) {
+            buf_printf(*buf, "[%zu]", type->array.len);
+        } else {
+            buf_printf(*buf, "[]");
+        }
+        break;
+    case TYPE_FN:
+        buf_printf(*buf, "fn(");
+        for (size_t i = 0; i < type->fn.num_params; i++) {
+            if (i) {
+                buf_printf(*buf, ", ");
+            }
+            type_to_str(buf, type->fn.params[i]);
+        }
+        buf_printf(*buf, ")");
+        if (type->fn.ret != type_void) {
+            buf_printf(*buf, ": ");
+            type_to_str(buf, type->fn.ret);
+        }
+        break;
+    case TYPE_ERROR:
+        buf_printf(*buf, "<error>");
+        break;
+    default:
+        assert(0);
+        break;
+    }
+}
+
+const char *temp_type_str(Type *type) {
+    static char *bufs[4];
+    static size_t next;
+    char **buf = &bufs[next++ % 4];
+    buf_clear(*buf);
+    type_to_str(buf, type);
+    return *buf;
+}
+
+void type_test(void) {
+    TypeTable saved_table = type_table;
+    Arena saved_arena = type_arena;
+    type_table = (TypeTable){0};
+    type_arena = (Arena){0};
+
+    Type *int_ptr = type_ptr(type_int);
+    assert(type_ptr(type_int) == int_ptr);
+    assert(type_ptr(int_ptr) != int_ptr);
+    assert(int_ptr->size == 8 && int_ptr->complete);
+    assert(type_array(type_char, 4) == type_array(type_char, 4));
+    assert(type_array(type_char, 4) != type_array(type_char, 5));
+    assert(type_array(type_char, 4)->size == 4 && !type_array(type_char, 0)->complete);
+    assert(type_array_fits(type_int, TYPE_MAX_SIZE / 8) && !type_array_fits(type_int, TYPE_MAX_SIZE / 8 + 1));
+    assert(!type_array_fits(type_int, (size_t)1 << 61) && type_array_fits(type_void, SIZE_MAX));
+
+    Type *params[] = {type_int, int_ptr};
+    Type *other[] = {type_int, type_ptr(type_int)};
+    Type *fn = type_fn(params, 2, type_float);
+    assert(type_fn(other, 2, type_float) == fn);
+    assert(type_fn(other, 1, type_float) != fn);
+    assert(type_fn(NULL, 0, type_void) == type_fn(NULL, 0, type_void));
+    assert(type_table.len == 8);
+
+    Sym sym = {.name = str_intern("S")};
+    Type *s = type_named(TYPE_STRUCT, &sym);
+    TypeField fields[] = {{str_intern("c"), type_char, 0}, {str_intern("p"), type_ptr(s), 0}, {str_intern("d"), type_char, 0}};
+    type_complete_aggregate(s, fields, 3);
+    assert(s->size == 24 && s->align == 8);
+    assert(type_field(s, str_intern("p"))->offset == 8 && type_field(s, str_intern("d"))->offset == 16);
+    assert(!type_field(s, str_intern("q")));
+
+    char *str = NULL;
+    type_to_str(&str, type_fn(params, 2, type_array(type_ptr(s), 3)));
+    assert(strcmp(str, "fn(int, int*): S*[3]") == 0);
+    buf_free(str);
+
+    type_table_free();
+    type_table = saved_table;
+    type_arena = saved_arena;
+}
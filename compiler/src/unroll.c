@@ -0,0 +1,461 @@
+#include "ast.h"
+
+UnrollStats unroll_stats;
+size_t unroll_budget = UNROLL_BUDGET;
+size_t unroll_factor = UNROLL_FACTOR;
+
+// The fn whose loops are being unrolled.
+typedef struct UnrollFn {
+    Decl *decl;
+    bool scanned;
+    size_t num_locals; // Next local slot
+} UnrollFn;
+
+// The loop being sized up or copied.
+typedef struct UnrollLoop {
+    Stmt *init; // Of the induction variable
+    int64_t start;
+    int64_t step;
+    size_t trips;
+    size_t cost; // Nodes in its body, counted up to the budget
+    size_t loops; // Loops and switches around the node being scanned
+    size_t switches;
+    Stmt **inits; // The body's init stmts, in visit order
+    size_t next_init;
+    Map locals; // Those inits to the locals standing in for them in a copy
+    bool literal; // Whether copies get the variable's value written in
+    int64_t value;
+} UnrollLoop;
+
+UnrollFn unroll_fn;
+UnrollLoop unroll_loop;
+AstVisitor unroll_count_visitor;
+AstVisitor unroll_scan_visitor;
+AstVisitor unroll_rename_visitor;
+
+VisitResult unroll_count_pre(AstNode node, void *ctx) {
+    (void)ctx;
+    if (node.kind == AST_TYPESPEC) {
+        return VISIT_SKIP;
+    }
+    if (node.kind == AST_STMT && node.stmt->kind == STMT_INIT) {
+        unroll_fn.num_locals++;
+    }
+    return VISIT_CONTINUE;
+}
+
+// Counts the fn's locals the first time a copy needs a new one.
+Sym *unroll_local(const char *name, Stmt *init) {
+    if (!unroll_fn.scanned) {
+        unroll_fn.scanned = true;
+        Decl *decl = unroll_fn.decl;
+        for (size_t i = 0; i < decl->fn.block.num_stmts; i++) {
+            ast_visit(&unroll_count_visitor, ast_stmt(decl->fn.block.stmts[i]));
+        }
+    }
+    Sym *sym = arena_alloc(&sym_arena, sizeof(Sym));
+    *sym = (Sym){.name = name, .kind = SYM_LOCAL, .state = SYM_RESOLVED, .decl = unroll_fn.decl,
+                 .id = unroll_fn.num_locals++, .init = init};
+    return sym;
+}
+
+// Whether expr is an int constant, and if so its value.
+bool unroll_const(Expr *expr, int64_t *value) {
+    ConstVal val;
+    const_quiet = true;
+    bool known = (fold_const(expr, &val) || const_eval(expr, &val)) && is_integer_type(val.type) &&
+                 const_convert(&val, type_int, false);
+    const_quiet = false;
+    if (known) {
+        *value = val.i;
+    }
+    return known;
+}
+
+bool unroll_var(Expr *expr) {
+    return expr->kind == EXPR_IDENT && expr->sym && expr->sym->kind == SYM_LOCAL && expr->sym->init == unroll_loop.init;
+}
+
+// Works out how many times stmt runs its body, for loops of the form
+// for (i := a; i < b; i += k) with a, b and k constant and i an int. The
+// comparison may be any of <, <=, > and >= that moves towards b, and the
+// step ++, --, += k or -= k. Bounds stay well inside int, so neither the
+// count nor any value of i can overflow.
+bool unroll_trips(Stmt *stmt) {
+    Stmt *init = stmt->for_stmt.init;
+    Expr *cond = stmt->for_stmt.cond;
+    Stmt *next = stmt->for_stmt.next;
+    if (!init || init->kind != STMT_INIT || init->init.expr->type != type_int || !cond || cond->kind != EXPR_BINARY ||
+        !next || next->kind != STMT_ASSIGN) {
+        return false;
+    }
+    unroll_loop.init = init;
+    int64_t start, bound, step;
+    if (!unroll_var(cond->binary.left) || !unroll_var(next->assign.left) || !unroll_const(init->init.expr, &start) ||
+        !unroll_const(cond->binary.right, &bound)) {
+        return false;
+    }
+    switch (next->assign.op) {
+    case TOKEN_INC:
+        step = 1;
+        break;
+    case TOKEN_DEC:
+        step = -1;
+        break;
+    case TOKEN_ADD_ASSIGN:
+    case TOKEN_SUB_ASSIGN:
+        if (!unroll_const(next->assign.right, &step) || step < -INT32_MAX || step > INT32_MAX) {
+            return false;
+        }
+        step = next->assign.op == TOKEN_SUB_ASSIGN ? -step : step;
+        break;
+    default:
+        return false;
+    }
+    if (start < -INT32_MAX || start > INT32_MAX || bound < -INT32_MAX || bound > INT32_MAX) {
+        return false;
+    }
+    int64_t span;
+    switch ((int)cond->binary.op) {
+    case '<':
+    case TOKEN_LTEQ:
+        if (step <= 0) {
+            return false;
+        }
+        span = bound - start;
+        break;
+    case '>':
+    case TOKEN_GTEQ:
+        if (step >= 0) {
+            return false;
+        }
+        span = start - bound;
+        break;
+    default:
+        return false;
+    }
+    int64_t stride = step < 0 ? -step : step;
+    bool inclusive = cond->binary.op == TOKEN_LTEQ || cond->binary.op == TOKEN_GTEQ;
+    if (span < 0 || (span == 0 && !inclusive)) {
+        unroll_loop.trips = 0;
+    } else {
+        unroll_loop.trips = inclusive ? (size_t)(span / stride + 1) : (size_t)((span + stride - 1) / stride);
+    }
+    unroll_loop.start = start;
+    unroll_loop.step = step;
+    return true;
+}
+
+VisitResult unroll_scan_pre(AstNode node, void *ctx) {
+    (void)ctx;
+    if (node.kind == AST_TYPESPEC) {
+        return VISIT_SKIP;
+    }
+    if (++unroll_loop.cost > unroll_budget) {
+        return VISIT_STOP;
+    }
+    if (node.kind == AST_EXPR) {
+        Expr *expr = node.expr;
+        if (expr->kind == EXPR_UNARY && expr->unary.op == '&' && unroll_var(expr->unary.expr)) {
+            return VISIT_STOP;
+        }
+        return VISIT_CONTINUE;
+    }
+    if (node.kind != AST_STMT) {
+        return VISIT_CONTINUE;
+    }
+    Stmt *stmt = node.stmt;
+    switch (stmt->kind) {
+    case STMT_WHILE:
+    case STMT_DO_WHILE:
+    case STMT_FOR:
+        unroll_loop.loops++;
+        break;
+    case STMT_SWITCH:
+        unroll_loop.switches++;
+        break;
+    case STMT_BREAK:
+        if (!unroll_loop.loops && !unroll_loop.switches) {
+            return VISIT_STOP;
+        }
+        break;
+    case STMT_CONTINUE:
+        if (!unroll_loop.loops) {
+            return VISIT_STOP;
+        }
+        break;
+    case STMT_ASSIGN:
+        if (unroll_var(stmt->assign.left)) {
+            return VISIT_STOP;
+        }
+        break;
+    case STMT_INIT:
+        buf_push(unroll_loop.inits, stmt);
+        break;
+    default:
+        break;
+    }
+    return VISIT_CONTINUE;
+}
+
+VisitResult unroll_scan_post(AstNode node, void *ctx) {
+    (void)ctx;
+    if (node.kind == AST_STMT) {
+        StmtKind kind = node.stmt->kind;
+        if (kind == STMT_WHILE || kind == STMT_DO_WHILE || kind == STMT_FOR) {
+            unroll_loop.loops--;
+        } else if (kind == STMT_SWITCH) {
+            unroll_loop.switches--;
+        }
+    }
+    return VISIT_CONTINUE;
+}
+
+// Sizes up the body of stmt, which must neither leave nor restart the loop
+// itself, change the variable or take its address.
+bool unroll_scan(Stmt *stmt) {
+    unroll_loop.cost = 0;
+    unroll_loop.loops = 0;
+    unroll_loop.switches = 0;
+    buf_clear(unroll_loop.inits);
+    StmtBlock body = stmt->for_stmt.block;
+    for (size_t i = 0; i < body.num_stmts; i++) {
+        if (!ast_visit(&unroll_scan_visitor, ast_stmt(body.stmts[i]))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Points a copy of the body at new locals of its own and, for a full
+// unroll, overwrites uses of the variable with its value in that copy.
+VisitResult unroll_rename_pre(AstNode node, void *ctx) {
+    (void)ctx;
+    if (node.kind == AST_TYPESPEC) {
+        return VISIT_SKIP;
+    }
+    if (node.kind == AST_STMT && node.stmt->kind == STMT_INIT) {
+        Stmt *orig = unroll_loop.inits[unroll_loop.next_init++];
+        map_put(&unroll_loop.locals, orig, unroll_local(node.stmt->init.name, node.stmt));
+    } else if (node.kind == AST_EXPR && node.expr->kind == EXPR_IDENT) {
+        Expr *expr = node.expr;
+        if (unroll_loop.literal && unroll_var(expr)) {
+            assert(expr_size(EXPR_INT) <= expr_size(EXPR_IDENT));
+            expr->kind = EXPR_INT;
+            expr->int_val = (uint64_t)unroll_loop.value;
+            expr->int_mod = TOKENMOD_NONE;
+        } else if (expr->sym && expr->sym->kind == SYM_LOCAL && expr->sym->decl == unroll_fn.decl) {
+            Sym *sym = map_get(&unroll_loop.locals, expr->sym->init);
+            expr->sym = sym ? sym : expr->sym;
+        }
+    }
+    return VISIT_CONTINUE;
+}
+
+Stmt *unroll_copy(StmtBlock body) {
+    Stmt *copy = stmt_block(stmt_block_copy(body));
+    if (unroll_loop.literal || buf_len(unroll_loop.inits)) {
+        unroll_loop.next_init = 0;
+        ast_visit(&unroll_rename_visitor, ast_stmt(copy));
+        map_free(&unroll_loop.locals);
+    }
+    return copy;
+}
+
+Expr *unroll_int(int64_t value) {
+    Expr *expr = expr_int(value < 0 ? (uint64_t)-value : (uint64_t)value);
+    expr->type = type_int;
+    if (value < 0) {
+        expr = expr_unary('-', expr);
+        expr->type = type_int;
+    }
+    return expr;
+}
+
+// Replaces the loop by a block of one copy of the body per trip, each with
+// the variable's value for that trip written in.
+Stmt *unroll_full(Stmt *stmt) {
+    StmtBlock body = stmt->for_stmt.block;
+    Stmt **stmts = NULL;
+    unroll_loop.literal = true;
+    for (size_t i = 0; i < unroll_loop.trips; i++) {
+        unroll_loop.value = unroll_loop.start + (int64_t)i * unroll_loop.step;
+        buf_push(stmts, unroll_copy(body));
+    }
+    unroll_loop.literal = false;
+    Stmt *block = stmt_block((StmtBlock){ast_dup(stmts, buf_len(stmts) * sizeof(Stmt *)), buf_len(stmts)});
+    buf_free(stmts);
+    unroll_stats.full++;
+    unroll_stats.copies += unroll_loop.trips;
+    return block;
+}
+
+// Hoists the variable's init into a new block, then runs unroll_factor
+// copies of the body per trip of a loop that stops where fewer than that
+// many trips are left, and the original loop, without its init, for the
+// rest.
+Stmt *unroll_partial(Stmt *stmt) {
+    StmtBlock body = stmt->for_stmt.block;
+    size_t factor = unroll_factor;
+    size_t rounds = unroll_loop.trips / factor;
+    Stmt **stmts = NULL;
+    for (size_t i = 0; i < factor; i++) {
+        if (i) {
+            buf_push(stmts, stmt_copy(stmt->for_stmt.next));
+        }
+        buf_push(stmts, unroll_copy(body));
+    }
+    StmtBlock block = {ast_dup(stmts, buf_len(stmts) * sizeof(Stmt *)), buf_len(stmts)};
+    buf_free(stmts);
+    Expr *cond = expr_copy(stmt->for_stmt.cond);
+    cond->binary.op = unroll_loop.step > 0 ? '<' : '>';
+    cond->binary.right = unroll_int(unroll_loop.start + (int64_t)(rounds * factor) * unroll_loop.step);
+    Stmt *init = stmt->for_stmt.init;
+    stmt->for_stmt.init = NULL;
+    buf_push(stmts, init);
+    buf_push(stmts, stmt_for(NULL, cond, stmt_copy(stmt->for_stmt.next), block));
+    if (unroll_loop.trips % factor) {
+        buf_push(stmts, stmt);
+    }
+    Stmt *outer = stmt_block((StmtBlock){ast_dup(stmts, buf_len(stmts) * sizeof(Stmt *)), buf_len(stmts)});
+    buf_free(stmts);
+    unroll_stats.partial++;
+    unroll_stats.copies += factor;
+    return outer;
+}
+
+Stmt *unroll_for(Stmt *stmt) {
+    if (!unroll_trips(stmt) || !unroll_scan(stmt)) {
+        return stmt;
+    }
+    // Literals are never negative, so neither may the values written in be.
+    size_t cost = MAX(unroll_loop.cost, 1);
+    int64_t last = unroll_loop.start + ((int64_t)unroll_loop.trips - 1) * unroll_loop.step;
+    bool literal = !unroll_loop.trips || (unroll_loop.start >= 0 && last >= 0);
+    if (literal && unroll_loop.trips <= unroll_budget / cost) {
+        return unroll_full(stmt);
+    }
+    if (unroll_factor > 1 && unroll_loop.trips >= unroll_factor && cost <= unroll_budget / unroll_factor) {
+        return unroll_partial(stmt);
+    }
+    return stmt;
+}
+
+void unroll_block(StmtBlock block);
+
+// Unrolls inner loops first, so an outer loop is sized with its inner ones
+// already expanded.
+Stmt *unroll_stmt(Stmt *stmt) {
+    switch (stmt->kind) {
+    case STMT_BLOCK:
+        unroll_block(stmt->block);
+        break;
+    case STMT_IF:
+        unroll_block(stmt->if_stmt.then_block);
+        for (size_t i = 0; i < stmt->if_stmt.num_elseifs; i++) {
+            unroll_block(stmt->if_stmt.elseifs[i].block);
+        }
+        unroll_block(stmt->if_stmt.else_block);
+        break;
+    case STMT_WHILE:
+    case STMT_DO_WHILE:
+        unroll_block(stmt->while_stmt.block);
+        break;
+    case STMT_FOR:
+        unroll_block(stmt->for_stmt.block);
+        return unroll_for(stmt);
+    case STMT_SWITCH:
+        for (size_t i = 0; i < stmt->switch_stmt.num_cases; i++) {
+            unroll_block(stmt->switch_stmt.cases[i].block);
+        }
+        break;
+    default:
+        break;
+    }
+    return stmt;
+}
+
+void unroll_block(StmtBlock block) {
+    for (size_t i = 0; i < block.num_stmts; i++) {
+        block.stmts[i] = unroll_stmt(block.stmts[i]);
+    }
+}
+
+void unroll_decls(Decl **decls, size_t num_decls) {
+    unroll_count_visitor = (AstVisitor){.pre = unroll_count_pre};
+    unroll_scan_visitor = (AstVisitor){.pre = unroll_scan_pre, .post = unroll_scan_post};
+    unroll_rename_visitor = (AstVisitor){.pre = unroll_rename_pre};
+    for (size_t i = 0; i < num_decls; i++) {
+        Decl *decl = decls[i];
+        if (decl->kind == DECL_FN) {
+            unroll_fn = (UnrollFn){.decl = decl, .num_locals = decl->fn.num_params};
+            unroll_block(decl->fn.block);
+        }
+    }
+    unroll_fn = (UnrollFn){0};
+    buf_free(unroll_loop.inits);
+    unroll_loop = (UnrollLoop){0};
+    visitor_free(&unroll_count_visitor);
+    visitor_free(&unroll_scan_visitor);
+    visitor_free(&unroll_rename_visitor);
+}
+
+void unroll_test(void) {
+    // Small loops become straight-line code, counting up or down.
+    pass_test_case(unroll_decls, PASS_TEST_TYPED | PASS_TEST_CHECK,
+                   "fn f(p: int*): int { s := 0; for (i := 0; i < 4; i++) { s += p[i]; } return s; }",
+                   "(fn f ( p (ptr int) ) int\n  (block\n    (:= s 0)\n    (block\n      (block\n"
+                   "        (+= s (index p 0)))\n      (block\n        (+= s (index p 1)))\n      (block\n"
+                   "        (+= s (index p 2)))\n      (block\n        (+= s (index p 3))))\n    (return s)))");
+    pass_test_case(unroll_decls, PASS_TEST_TYPED | PASS_TEST_CHECK,
+                   "const N = 3 fn f(p: int*): int { s := 0; for (i := N; i >= 1; i -= 1) { t := p[i] * 2; s += t; } return s; }",
+                   "(fn f ( p (ptr int) ) int\n  (block\n    (:= s 0)\n    (block\n      (block\n"
+                   "        (:= t (* (index p 3) 2))\n        (+= s t))\n      (block\n"
+                   "        (:= t (* (index p 2) 2))\n        (+= s t))\n      (block\n"
+                   "        (:= t (* (index p 1) 2))\n        (+= s t)))\n    (return s)))");
+    // Longer ones run four copies per trip and the original loop for the rest.
+    pass_test_case(unroll_decls, PASS_TEST_TYPED | PASS_TEST_CHECK,
+                   "fn f(p: int*): int { s := 0; for (i := 0; i < 102; i++) { t := p[i]; s += t; } return s; }",
+                   "(fn f ( p (ptr int) ) int\n  (block\n    (:= s 0)\n    (block\n      (:= i 0)\n"
+                   "      (for nil(< i 100)(++ i)\n        (block\n          (block\n"
+                   "            (:= t (index p i))\n            (+= s t))\n          (++ i)\n          (block\n"
+                   "            (:= t (index p i))\n            (+= s t))\n          (++ i)\n          (block\n"
+                   "            (:= t (index p i))\n            (+= s t))\n          (++ i)\n          (block\n"
+                   "            (:= t (index p i))\n            (+= s t))))\n      (for nil(< i 102)(++ i)\n"
+                   "        (block\n          (:= t (index p i))\n          (+= s t))))\n    (return s)))");
+    // Negative values cannot be written in, so this one is only partial.
+    pass_test_case(unroll_decls, PASS_TEST_TYPED | PASS_TEST_CHECK,
+                   "fn f(p: int*): int { s := 0; for (i := 20; i > -20; i -= 3) { s += p[i + 20]; } return s; }",
+                   "(fn f ( p (ptr int) ) int\n  (block\n    (:= s 0)\n    (block\n      (:= i 20)\n"
+                   "      (for nil(> i (- 16))(-= i 3)\n        (block\n          (block\n"
+                   "            (+= s (index p (+ i 20))))\n          (-= i 3)\n          (block\n"
+                   "            (+= s (index p (+ i 20))))\n          (-= i 3)\n          (block\n"
+                   "            (+= s (index p (+ i 20))))\n          (-= i 3)\n          (block\n"
+                   "            (+= s (index p (+ i 20))))))\n      (for nil(> i (- 20))(-= i 3)\n        (block\n"
+                   "          (+= s (index p (+ i 20))))))\n    (return s)))");
+    // Loops that leave early, step themselves or have no constant bound stay,
+    // but breaks of a switch and continues of an inner loop are fine.
+    pass_test_case(unroll_decls, PASS_TEST_TYPED | PASS_TEST_CHECK,
+                   "fn f(p: int*, n: int): int { s := 0;\n"
+                   "for (i := 0; i < 4; i++) { if (p[i]) { break; } s++; }\n"
+                   "for (i := 0; i < 4; i++) { if (p[i]) { continue; } s++; }\n"
+                   "for (i := 0; i < 4; i++) { i += p[i]; }\n"
+                   "for (i := 0; i < n; i++) { s++; }\n"
+                   "for (i := 0; i < 2; i++) { switch (p[i]) { case 1: { break; } } for (j := 0; j < 2; j++) { if (p[j]) { continue; } s += j; } }\n"
+                   "return s; }",
+                   "(fn f ( p (ptr int) n int ) int\n  (block\n    (:= s 0)\n    (for (:= i 0)(< i 4)(++ i)\n"
+                   "      (block\n        (if (index p i)\n          (block\n            (break)))\n"
+                   "        (++ s)))\n    (for (:= i 0)(< i 4)(++ i)\n      (block\n        (if (index p i)\n"
+                   "          (block\n            (continue)))\n        (++ s)))\n    (for (:= i 0)(< i 4)(++ i)\n"
+                   "      (block\n        (+= i (index p i))))\n    (for (:= i 0)(< i n)(++ i)\n      (block\n"
+                   "        (++ s)))\n    (block\n      (block\n        (switch (index p 0)\n"
+                   "          (case ( 1 ) \n            (block\n              (break)))\n"
+                   "        (for (:= j 0)(< j 2)(++ j)\n          (block\n            (if (index p j)\n"
+                   "              (block\n                (continue)))\n            (+= s j))))\n      (block\n"
+                   "        (switch (index p 1)\n          (case ( 1 ) \n            (block\n"
+                   "              (break)))\n        (for (:= j 0)(< j 2)(++ j)\n          (block\n"
+                   "            (if (index p j)\n              (block\n                (continue)))\n"
+                   "            (+= s j)))))\n    (return s)))");
+    assert(unroll_stats.full == 3 && unroll_stats.partial == 2 && unroll_stats.copies == 17);
+    unroll_stats = (UnrollStats){0};
+}